@@ -29,6 +29,8 @@ This code is licensed under the MIT license (MIT) (http://opensource.org/license
 #include "VulkanDeferredRenderer.h"
 #include "VulkanRaytracer.h"
 #include "VulkanHybridRenderer.h"
+#include "BVHBenchmark.h"
+#include "CpuRaytracer.h"
 
 
 //------------------------------
@@ -90,12 +92,25 @@ CApplication::~CApplication()
 	glfwTerminate();
 }
 
-void CApplication::LaunchApplication(int argc, char **argv, int width, int height)
+int CApplication::LaunchApplication(int argc, char **argv, int width, int height)
 {
+	// Headless run of the BVH benchmark: --bvh-benchmark [model files...]
+	if (argc > 1 && std::string(argv[1]) == "--bvh-benchmark")
+	{
+		return BVHBenchmark::run(std::vector<std::string>(argv + 2, argv + argc)) ? 0 : 1;
+	}
+
+	// Headless CPU render of the hybrid raytracing pass: --cpu-raytrace [model file] [image file]
+	if (argc > 1 && std::string(argv[1]) == "--cpu-raytrace")
+	{
+		return CpuRaytracer::renderModel((argc > 2) ? argv[2] : "models/box/boxes.dae", (argc > 3) ? argv[3] : "cpu_raytrace.ppm") ? 0 : 1;
+	}
+
 	// Extra filename
 	//std::string inputFilename(argv[1]);
 	CSceneRenderApp renderApp(width, height);
 	renderApp.Run();
+	return 0;
 }
 
 
@@ -218,6 +233,12 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
 			pScene->m_context.m_enableReflection = !pScene->m_context.m_enableReflection;
 		if (key == GLFW_KEY_C)
 			pScene->m_context.m_enableColorByRayBounces = !pScene->m_context.m_enableColorByRayBounces;
+		if (key == GLFW_KEY_Q)
+			pScene->m_context.m_enableQuantizedBVH = !pScene->m_context.m_enableQuantizedBVH;
+		if (key == GLFW_KEY_V)
+			pScene->m_context.m_enableWavefront = !pScene->m_context.m_enableWavefront;
+		if (key == GLFW_KEY_P)
+			pScene->m_context.m_despawnMeshes = !pScene->m_context.m_despawnMeshes;
 		if (key == GLFW_KEY_L)
 			// Toggle adding light for now
 			pScene->m_context.m_addLight = pScene->m_context.m_addLight == 0 ? 1 : 0;
@@ -27,7 +27,8 @@ public:
 	CApplication(int width, int height);
 	~CApplication();
 
-	static void LaunchApplication(int argc, char **argv, int width = 1280, int height = 720);
+	// Returns the exit code of the process, non-zero when a headless run (benchmark, CPU render) failed.
+	static int LaunchApplication(int argc, char **argv, int width = 1280, int height = 720);
 
 	/**
 	* \brief This is the main loop of Application
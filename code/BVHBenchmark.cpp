@@ -0,0 +1,655 @@
+/******************************************************************************/
+/*!
+\file	BVHBenchmark.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "BVHBenchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "VulkanMeshLoader.h"
+#include "BVHTraversal.h"
+#include "BVHPacketTraversal.h"
+#include "BVHTriangleGroups.h"
+
+namespace
+{
+	// Same as VulkanRenderer::getAssetPath().
+	const char* BENCHMARK_ASSET_PATH = "../data/";
+
+	const int BENCHMARK_IMAGE_SIZE = 512;
+
+	// One ray out of this many is tested against every triangle to measure the triangle tests alone.
+	const size_t BENCHMARK_THROUGHPUT_RAY_STRIDE = 256;
+
+	struct SBenchmarkResult
+	{
+		double				m_timeInMs;
+		SBVHTraversalStats	m_stats;
+		size_t				m_numMismatches;
+	};
+
+	void printResult(const char* name, size_t numNodes, size_t nodesSize, const SBenchmarkResult& result, size_t numRays)
+	{
+		const double invNumRays = 1.0 / double(numRays);
+		printf("  %-14s %7zu nodes %8.1f KB %9.2f ms %8.2f Mrays/s %7.2f nodes/ray %7.2f aabbs/ray %7.2f tris/ray %7.2f lines/ray %5zu mismatches\n",
+			name, numNodes, nodesSize / 1024.0, result.m_timeInMs, double(numRays) / (result.m_timeInMs * 1000.0),
+			result.m_stats.m_numNodesVisited * invNumRays, result.m_stats.m_numAabbTests * invNumRays, result.m_stats.m_numTriTests * invNumRays,
+			result.m_stats.m_numCacheLinesTouched * invNumRays, result.m_numMismatches);
+	}
+
+	void printPacketResult(const char* name, const SBenchmarkResult& result, const SBVHPacketStats& packetStats, size_t numRays)
+	{
+		const double invNumPackets = 1.0 / double(std::max(packetStats.m_numPackets, size_t(1)));
+		printf("  %-14s %9.2f ms %8.2f Mrays/s %7.2f nodes/packet %7.2f aabbs/packet %5.1f%% interval culls %7.2f tris/packet %5.1f%% incoherent %7.2f fallbacks/packet %5zu mismatches\n",
+			name, result.m_timeInMs, double(numRays) / (result.m_timeInMs * 1000.0), packetStats.m_numNodesVisited * invNumPackets,
+			packetStats.m_numAabbTests * invNumPackets, 100.0 * packetStats.m_numIntervalCulls / double(std::max(packetStats.m_numAabbTests, size_t(1))),
+			packetStats.m_numTriTests * invNumPackets, 100.0 * packetStats.m_numIncoherentPackets * invNumPackets,
+			packetStats.m_numSubtreeFallbacks * invNumPackets, result.m_numMismatches);
+	}
+
+	bool isSameHit(const SBVHHit& hit, const SBVHHit& refHit)
+	{
+		if (hit.m_triIdx == refHit.m_triIdx)
+			return true;
+
+		// Another triangle at the same distance, e.g. on a shared edge.
+		return hit.isValid() && refHit.isValid() && std::fabs(hit.m_t - refHit.m_t) <= 1e-5f * refHit.m_t;
+	}
+
+	template <typename IntersectFunc>
+	SBenchmarkResult trace(const std::vector<SBVHRay>& rays, const std::vector<SBVHHit>& refHits, const IntersectFunc& intersect)
+	{
+		SBenchmarkResult result;
+		result.m_numMismatches = 0;
+
+		std::vector<SBVHHit> hits(rays.size());
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx++)
+		{
+			intersect(rays[rayIdx], hits[rayIdx], &result.m_stats);
+		}
+		result.m_timeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx++)
+		{
+			if (!isSameHit(hits[rayIdx], refHits[rayIdx]))
+				result.m_numMismatches++;
+		}
+		return result;
+	}
+
+	// Occlusion tests of the rays, which only have to agree with the closest hits on whether something was hit. Empty rays
+	// (m_tMax <= 0) are skipped.
+	template <typename OccludedFunc>
+	SBenchmarkResult traceOcclusion(const std::vector<SBVHRay>& rays, const std::vector<SBVHHit>& refHits, const OccludedFunc& occluded)
+	{
+		SBenchmarkResult result;
+		result.m_numMismatches = 0;
+
+		std::vector<char> isOccluded(rays.size(), 0);
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx++)
+		{
+			if (rays[rayIdx].m_tMax > 0.0f)
+				isOccluded[rayIdx] = occluded(rays[rayIdx], &result.m_stats) ? 1 : 0;
+		}
+		result.m_timeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx++)
+		{
+			if ((isOccluded[rayIdx] != 0) != refHits[rayIdx].isValid())
+				result.m_numMismatches++;
+		}
+		return result;
+	}
+
+	// Traces the rays through the N-wide collapse of the tree, then through its 16 and 8-bit quantized versions.
+	// Returns the number of mismatches with the hits of the binary tree.
+	template <int N>
+	size_t traceWide(const BVHTree& tree, const BVHTraversal& traversal, const std::vector<SBVHRay>& rays, const std::vector<SBVHHit>& refHits)
+	{
+		std::vector< BVHTree::WideBVHNode<N> > wideNodes;
+		tree.collapseToWideBVH<N>(wideNodes);
+		const SBenchmarkResult wideResult = trace(rays, refHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+			traversal.intersectWide<N>(wideNodes, ray, hit, stats);
+		});
+
+		std::vector< BVHTree::QuantizedWideBVHNode<N, uint16_t> > quantized16Nodes;
+		BVHTree::quantizeWideBVH<N, uint16_t>(wideNodes, quantized16Nodes);
+		const SBenchmarkResult quantized16Result = trace(rays, refHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+			traversal.intersectQuantizedWide<N, uint16_t>(quantized16Nodes, ray, hit, stats);
+		});
+
+		std::vector< BVHTree::QuantizedWideBVHNode<N, uint8_t> > quantized8Nodes;
+		BVHTree::quantizeWideBVH<N, uint8_t>(wideNodes, quantized8Nodes);
+		const SBenchmarkResult quantized8Result = trace(rays, refHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+			traversal.intersectQuantizedWide<N, uint8_t>(quantized8Nodes, ray, hit, stats);
+		});
+
+		char name[32];
+		sprintf(name, "wide %d", N);
+		printResult(name, wideNodes.size(), wideNodes.size() * sizeof(BVHTree::WideBVHNode<N>), wideResult, rays.size());
+		sprintf(name, "wide %d 16-bit", N);
+		printResult(name, quantized16Nodes.size(), quantized16Nodes.size() * sizeof(BVHTree::QuantizedWideBVHNode<N, uint16_t>), quantized16Result, rays.size());
+		sprintf(name, "wide %d 8-bit", N);
+		printResult(name, quantized8Nodes.size(), quantized8Nodes.size() * sizeof(BVHTree::QuantizedWideBVHNode<N, uint8_t>), quantized8Result, rays.size());
+
+		return wideResult.m_numMismatches + quantized16Result.m_numMismatches + quantized8Result.m_numMismatches;
+	}
+
+	// Traces the rays through the binary and 4-wide trees with their leaves packed in groups of 4 and 8 triangles (when the
+	// CPU supports AVX2), then measures the triangle tests alone: a subset of the rays is tested against every triangle of
+	// the scene, one at a time from the triangle soup and a group at a time. Returns the number of mismatches.
+	size_t traceTriangleGroups(const BVHTree& tree, const std::vector<glm::vec4>& positions, const std::vector<SBVHRay>& rays,
+		const std::vector<SBVHHit>& refHits, const std::vector< BVHTree::WideBVHNode<4> >& wideNodes,
+		const std::vector<BVHTree::PrecomputedTriangle>& triangleSoup)
+	{
+		size_t numMismatches = 0;
+
+		std::vector<SBVHRay> throughputRays;
+		for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx += BENCHMARK_THROUGHPUT_RAY_STRIDE)
+		{
+			throughputRays.push_back(rays[rayIdx]);
+		}
+
+		std::vector<SBVHHit> soupHits(throughputRays.size());
+		const auto soupStart = std::chrono::high_resolution_clock::now();
+		for (size_t rayIdx = 0; rayIdx < throughputRays.size(); rayIdx++)
+		{
+			const SBVHRay& ray = throughputRays[rayIdx];
+			SBVHHit& hit = soupHits[rayIdx];
+			for (size_t triIdx = 0; triIdx < triangleSoup.size(); triIdx++)
+			{
+				const BVHTree::PrecomputedTriangle& tri = triangleSoup[triIdx];
+				float u, v;
+				const float t = BVHTraversal::intersectTriangleEdges(ray, glm::vec3(tri.m_v0), glm::vec3(tri.m_edge1), glm::vec3(tri.m_edge2), u, v);
+				if (t > ray.m_tMin && t < hit.m_t)
+				{
+					hit.m_t = t;
+					hit.m_triIdx = int(triIdx);
+				}
+			}
+		}
+		const double soupTimeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - soupStart).count();
+		const double numTriTests = double(throughputRays.size()) * double(triangleSoup.size());
+		printf("  triangle tests: %.1f Mtris/s per core one at a time", numTriTests / (soupTimeInMs * 1000.0));
+
+		const int maxGroupSize = BVHTriangleGroups::getSupportedGroupSize();
+		for (int groupSize = 4; groupSize <= maxGroupSize; groupSize *= 2)
+		{
+			BVHTriangleGroups triangleGroups(groupSize);
+			triangleGroups.build(tree, positions);
+
+			std::vector<SBVHHit> groupHits(throughputRays.size());
+			const auto groupStart = std::chrono::high_resolution_clock::now();
+			for (size_t rayIdx = 0; rayIdx < throughputRays.size(); rayIdx++)
+			{
+				triangleGroups.intersectAll(throughputRays[rayIdx], groupHits[rayIdx]);
+			}
+			const double groupTimeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - groupStart).count();
+			size_t numGroupMismatches = 0;
+			for (size_t rayIdx = 0; rayIdx < throughputRays.size(); rayIdx++)
+			{
+				if (!isSameHit(groupHits[rayIdx], soupHits[rayIdx]))
+					numGroupMismatches++;
+			}
+			numMismatches += numGroupMismatches;
+			printf(", %.1f Mtris/s in groups of %d (%s, %.0f%% of the slots used, %zu mismatches)", numTriTests / (groupTimeInMs * 1000.0), groupSize,
+				triangleGroups.getKernelName(), 100.0 * triangleGroups.getNumTriangles() / double(triangleGroups.getNumGroups() * groupSize), numGroupMismatches);
+		}
+		printf("\n");
+
+		for (int groupSize = 4; groupSize <= maxGroupSize; groupSize *= 2)
+		{
+			BVHTriangleGroups triangleGroups(groupSize);
+			triangleGroups.build(tree, positions);
+			const BVHTraversal groupTraversal(tree, positions, nullptr, &triangleGroups);
+
+			const SBenchmarkResult groupResult = trace(rays, refHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+				groupTraversal.intersect(ray, hit, stats);
+			});
+			const SBenchmarkResult wideGroupResult = trace(rays, refHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+				groupTraversal.intersectWide<4>(wideNodes, ray, hit, stats);
+			});
+
+			char name[32];
+			sprintf(name, "binary groups %d", groupSize);
+			printResult(name, tree.m_aabbNodes.size(), tree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode), groupResult, rays.size());
+			sprintf(name, "wide 4 groups %d", groupSize);
+			printResult(name, wideNodes.size(), wideNodes.size() * sizeof(BVHTree::WideBVHNode<4>), wideGroupResult, rays.size());
+			printf("  groups of %d: %zu groups, %.1f KB\n", groupSize, triangleGroups.getNumGroups(), triangleGroups.getMemorySize() / 1024.0);
+			numMismatches += groupResult.m_numMismatches + wideGroupResult.m_numMismatches;
+		}
+		return numMismatches;
+	}
+
+	// Removes every other mesh from a tree with BVHTree::removeMesh and traces the rays against a fresh build of the
+	// remaining meshes, then inserts them back with BVHTree::insertMesh and traces the rays against the hits of the whole
+	// scene (refHits). Returns the number of mismatches.
+	size_t traceRespawnedMeshes(const BVHTree::SBuildParams& buildParams, const std::vector<vkMeshLoader::MeshEntry>& meshEntries,
+		const std::vector<glm::vec4>& positions, const std::vector<SBVHRay>& rays, const std::vector<SBVHHit>& refHits)
+	{
+		BVHTree tree;
+		tree.m_buildParams = buildParams;
+		tree.buildBVHTree(meshEntries);
+
+		std::vector<vkMeshLoader::MeshEntry> remainingMeshEntries(meshEntries);
+		std::vector<size_t> removedMeshIdxs;
+		std::vector<BVHTree::SRange> dirtyNodeRanges;
+		std::vector<BVHTree::SRange> dirtyTriRanges;
+		for (size_t meshIdx = 1; meshIdx < meshEntries.size(); meshIdx += 2)
+		{
+			tree.removeMesh(meshIdx, dirtyNodeRanges);
+			remainingMeshEntries[meshIdx].Indices.clear();
+			remainingMeshEntries[meshIdx].NumIndices = 0;
+			removedMeshIdxs.push_back(meshIdx);
+		}
+
+		BVHTree remainingTree;
+		remainingTree.m_buildParams = buildParams;
+		remainingTree.buildBVHTree(remainingMeshEntries);
+		std::vector<SBVHHit> remainingHits(rays.size());
+		const BVHTraversal remainingTraversal(remainingTree, positions);
+		for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx++)
+		{
+			remainingTraversal.intersect(rays[rayIdx], remainingHits[rayIdx]);
+		}
+
+		const BVHTraversal traversal(tree, positions);
+		const SBenchmarkResult removedResult = trace(rays, remainingHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+			traversal.intersect(ray, hit, stats);
+		});
+		printResult("despawned", tree.m_aabbNodes.size(), tree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode), removedResult, rays.size());
+
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < removedMeshIdxs.size(); i++)
+		{
+			const vkMeshLoader::MeshEntry& meshEntry = meshEntries[removedMeshIdxs[i]];
+			std::vector<glm::ivec3> triIndices;
+			for (size_t iCount = 0; iCount + 2 < meshEntry.Indices.size(); iCount += 3)
+			{
+				triIndices.push_back(glm::ivec3(meshEntry.Indices[iCount], meshEntry.Indices[iCount + 1], meshEntry.Indices[iCount + 2]) +
+					int(meshEntry.vertexBase));
+			}
+			tree.insertMesh(removedMeshIdxs[i], positions, triIndices, dirtyNodeRanges, dirtyTriRanges);
+		}
+		const double insertTimeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		const SBenchmarkResult insertedResult = trace(rays, refHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+			traversal.intersect(ray, hit, stats);
+		});
+		printResult("respawned", tree.m_aabbNodes.size(), tree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode), insertedResult, rays.size());
+		printf("  respawned %zu of %zu meshes in %.2f ms, %zu dirty node ranges, %zu dirty triangle ranges\n", removedMeshIdxs.size(),
+			meshEntries.size(), insertTimeInMs, dirtyNodeRanges.size(), dirtyTriRanges.size());
+
+		return removedResult.m_numMismatches + insertedResult.m_numMismatches;
+	}
+
+	size_t countElementsOutsideRanges(const void* elements, const void* refElements, size_t elementSize, size_t numElements,
+		const std::vector<BVHTree::SRange>& ranges)
+	{
+		std::vector<char> isInRange(numElements, 0);
+		for (size_t rangeIdx = 0; rangeIdx < ranges.size(); rangeIdx++)
+		{
+			for (size_t elementIdx = ranges[rangeIdx].m_first; elementIdx < ranges[rangeIdx].m_first + ranges[rangeIdx].m_count; elementIdx++)
+				isInRange[elementIdx] = 1;
+		}
+
+		size_t numOutside = 0;
+		for (size_t elementIdx = 0; elementIdx < numElements; elementIdx++)
+		{
+			const size_t offset = elementIdx * elementSize;
+			if (isInRange[elementIdx] == 0 && memcmp(static_cast<const char*>(elements) + offset, static_cast<const char*>(refElements) + offset, elementSize) != 0)
+				numOutside++;
+		}
+		return numOutside;
+	}
+
+	// Moves every other mesh (scaled about its center and shifted by a tenth of its extent), refits the tree with
+	// BVHTree::refit and the triangle soup with refitTriangleSoup, as VulkanHybridRenderer::updateModelMeshPositions does.
+	// The rays are traced against a fresh build over the moved positions, and the nodes and triangles modified outside of the
+	// dirty ranges which would be uploaded count as mismatches too. Returns the number of mismatches.
+	size_t traceRefittedMeshes(const BVHTree::SBuildParams& buildParams, const std::vector<vkMeshLoader::MeshEntry>& meshEntries,
+		const std::vector<glm::vec4>& positions, const std::vector<SBVHRay>& rays)
+	{
+		BVHTree tree;
+		tree.m_buildParams = buildParams;
+		tree.buildBVHTree(meshEntries);
+		std::vector<BVHTree::PrecomputedTriangle> triangleSoup;
+		tree.buildTriangleSoup(positions, triangleSoup);
+
+		std::vector<glm::vec4> movedPositions(positions);
+		std::vector<vkMeshLoader::MeshEntry> movedMeshEntries(meshEntries);
+		std::vector<size_t> movedMeshIdxs;
+		for (size_t meshIdx = 0; meshIdx < meshEntries.size(); meshIdx += 2)
+		{
+			const BVHTree::SRange& vertexRange = tree.getMeshVertexRange(meshIdx);
+			glm::vec3 meshMin(FLT_MAX), meshMax(-FLT_MAX);
+			for (size_t vertexIdx = vertexRange.m_first; vertexIdx < vertexRange.m_first + vertexRange.m_count; vertexIdx++)
+			{
+				meshMin = glm::min(meshMin, glm::vec3(positions[vertexIdx]));
+				meshMax = glm::max(meshMax, glm::vec3(positions[vertexIdx]));
+			}
+
+			const glm::vec3 meshCenter = 0.5f * (meshMin + meshMax);
+			const glm::vec3 offset = 0.1f * (meshMax - meshMin);
+			for (size_t vertexIdx = vertexRange.m_first; vertexIdx < vertexRange.m_first + vertexRange.m_count; vertexIdx++)
+			{
+				const glm::vec3 movedPos = meshCenter + 1.05f * (glm::vec3(positions[vertexIdx]) - meshCenter) + offset;
+				movedPositions[vertexIdx] = glm::vec4(movedPos, 1.0f);
+				movedMeshEntries[meshIdx].Vertices[vertexIdx - vertexRange.m_first].m_pos = movedPos;
+			}
+			movedMeshIdxs.push_back(meshIdx);
+		}
+
+		const std::vector<BVHTree::BVHNode> prevNodes(tree.m_aabbNodes);
+		const std::vector<BVHTree::PrecomputedTriangle> prevTriangleSoup(triangleSoup);
+		std::vector<BVHTree::SRange> dirtyNodeRanges;
+		std::vector<BVHTree::SRange> dirtyTriRanges;
+		const auto start = std::chrono::high_resolution_clock::now();
+		const bool isRebuildAdvised = tree.refit(movedPositions, movedMeshIdxs, dirtyNodeRanges);
+		tree.refitTriangleSoup(movedPositions, movedMeshIdxs, triangleSoup, dirtyTriRanges);
+		const double refitTimeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		size_t numMismatches = countElementsOutsideRanges(tree.m_aabbNodes.data(), prevNodes.data(), sizeof(BVHTree::BVHNode),
+			tree.m_aabbNodes.size(), dirtyNodeRanges);
+		numMismatches += countElementsOutsideRanges(triangleSoup.data(), prevTriangleSoup.data(), sizeof(BVHTree::PrecomputedTriangle),
+			triangleSoup.size(), dirtyTriRanges);
+
+		BVHTree movedTree;
+		movedTree.m_buildParams = buildParams;
+		movedTree.buildBVHTree(movedMeshEntries);
+		const BVHTraversal movedTraversal(movedTree, movedPositions);
+		std::vector<SBVHHit> movedHits(rays.size());
+		for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx++)
+		{
+			movedTraversal.intersect(rays[rayIdx], movedHits[rayIdx]);
+		}
+
+		const BVHTraversal traversal(tree, movedPositions, &triangleSoup);
+		SBenchmarkResult result = trace(rays, movedHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+			traversal.intersect(ray, hit, stats);
+		});
+		result.m_numMismatches += numMismatches;
+		printResult("refitted", tree.m_aabbNodes.size(), tree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode), result, rays.size());
+
+		size_t numDirtyNodes = 0;
+		for (size_t rangeIdx = 0; rangeIdx < dirtyNodeRanges.size(); rangeIdx++)
+		{
+			numDirtyNodes += dirtyNodeRanges[rangeIdx].m_count;
+		}
+		printf("  refitted %zu of %zu meshes in %.2f ms, %zu dirty node ranges (%zu of %zu nodes), %zu dirty triangle ranges%s\n",
+			movedMeshIdxs.size(), meshEntries.size(), refitTimeInMs, dirtyNodeRanges.size(), numDirtyNodes, tree.m_aabbNodes.size(),
+			dirtyTriRanges.size(), isRebuildAdvised ? ", rebuild advised" : "");
+
+		return result.m_numMismatches;
+	}
+
+	// Indices of the pixels of the image ordered by tiles of packetSize pixels (2x2, 4x2 or 4x4), so that the rays of a
+	// packet are neighbours.
+	std::vector<size_t> getTiledPixelOrder(int packetSize)
+	{
+		const int tileWidth = (packetSize >= 8) ? 4 : ((packetSize >= 4) ? 2 : 1);
+		const int tileHeight = packetSize / tileWidth;
+
+		std::vector<size_t> pixelIdxs;
+		pixelIdxs.reserve(BENCHMARK_IMAGE_SIZE * BENCHMARK_IMAGE_SIZE);
+		for (int tileY = 0; tileY < BENCHMARK_IMAGE_SIZE; tileY += tileHeight)
+		{
+			for (int tileX = 0; tileX < BENCHMARK_IMAGE_SIZE; tileX += tileWidth)
+			{
+				for (int y = tileY; y < tileY + tileHeight; y++)
+				{
+					for (int x = tileX; x < tileX + tileWidth; x++)
+						pixelIdxs.push_back(size_t(y) * BENCHMARK_IMAGE_SIZE + x);
+				}
+			}
+		}
+		return pixelIdxs;
+	}
+
+	// Traces the rays of the pixels which have one (rays[pixelIdx].m_tMax > 0) in packets, ordered by tiles of the packet size.
+	// Returns the number of mismatches with the hits of the binary tree.
+	size_t tracePackets(const BVHPacketTraversal& traversal, const char* name, const std::vector<SBVHRay>& rays, const std::vector<SBVHHit>& refHits)
+	{
+		const std::vector<size_t> pixelIdxs = getTiledPixelOrder(traversal.getPacketSize());
+		std::vector<SBVHRay> tiledRays;
+		std::vector<size_t> tiledPixelIdxs;
+		tiledRays.reserve(rays.size());
+		for (size_t orderIdx = 0; orderIdx < pixelIdxs.size(); orderIdx++)
+		{
+			if (rays[pixelIdxs[orderIdx]].m_tMax <= 0.0f)
+				continue;
+			tiledRays.push_back(rays[pixelIdxs[orderIdx]]);
+			tiledPixelIdxs.push_back(pixelIdxs[orderIdx]);
+		}
+
+		SBenchmarkResult result;
+		result.m_numMismatches = 0;
+		SBVHPacketStats packetStats;
+
+		std::vector<SBVHHit> hits(tiledRays.size());
+		const auto start = std::chrono::high_resolution_clock::now();
+		traversal.intersect(tiledRays.data(), tiledRays.size(), hits.data(), &packetStats);
+		result.m_timeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		for (size_t rayIdx = 0; rayIdx < tiledRays.size(); rayIdx++)
+		{
+			if (!isSameHit(hits[rayIdx], refHits[tiledPixelIdxs[rayIdx]]))
+				result.m_numMismatches++;
+		}
+
+		char fullName[32];
+		sprintf(fullName, "%s %s", name, BVHPacketTraversal::getSimdLevelName(traversal.getSimdLevel()));
+		printPacketResult(fullName, result, packetStats, tiledRays.size());
+		return result.m_numMismatches;
+	}
+}
+
+bool BVHBenchmark::run(const std::vector<std::string>& modelFilenames)
+{
+	std::vector<std::string> filenames = modelFilenames;
+	if (filenames.empty())
+	{
+		filenames.push_back("models/armor/armor.dae");
+		filenames.push_back("models/knot/knot.dae");
+		filenames.push_back("models/box/boxes.dae");
+		filenames.push_back("models/cornell_knot/cornell_knot.dae");
+		filenames.push_back("models/bear/bear.dae");
+	}
+
+	bool isSuccess = true;
+	for (size_t fileIdx = 0; fileIdx < filenames.size(); fileIdx++)
+	{
+		isSuccess &= _runModel(filenames[fileIdx]);
+	}
+	return isSuccess;
+}
+
+bool BVHBenchmark::_runModel(const std::string& modelFilename)
+{
+	VulkanMeshLoader mesh;
+	if (!mesh.LoadMesh(BENCHMARK_ASSET_PATH + modelFilename))
+	{
+		printf("%s: failed to load the model.\n", modelFilename.c_str());
+		return false;
+	}
+
+	// Same build parameters as VulkanHybridRenderer.
+	BVHTree tree;
+	tree.m_buildParams.m_strategy = BVHTree::BUILD_SBVH;
+	tree.m_buildParams.m_maxDepth = 32;
+	tree.buildBVHTree(mesh.m_Entries);
+	tree.optimizeBVHTree();
+
+	std::vector<glm::vec4> positions;
+	glm::vec3 sceneMin(FLT_MAX), sceneMax(-FLT_MAX);
+	for (size_t meshIdx = 0; meshIdx < mesh.m_Entries.size(); meshIdx++)
+	{
+		const vkMeshLoader::MeshEntry& meshEntry = mesh.m_Entries[meshIdx];
+		positions.resize(std::max(positions.size(), size_t(meshEntry.vertexBase + meshEntry.Vertices.size())));
+		for (size_t vertexIdx = 0; vertexIdx < meshEntry.Vertices.size(); vertexIdx++)
+		{
+			const glm::vec3& pos = meshEntry.Vertices[vertexIdx].m_pos;
+			positions[meshEntry.vertexBase + vertexIdx] = glm::vec4(pos, 1.0f);
+			sceneMin = glm::min(sceneMin, pos);
+			sceneMax = glm::max(sceneMax, pos);
+		}
+	}
+
+	// Pinhole camera slightly above the scene, far enough to see all of it with a 60 degrees field of view.
+	const glm::vec3 sceneCenter = 0.5f * (sceneMin + sceneMax);
+	const float sceneRadius = 0.5f * glm::length(sceneMax - sceneMin);
+	const glm::vec3 eye = sceneCenter + glm::normalize(glm::vec3(0.3f, 0.4f, 1.0f)) * (1.5f * sceneRadius);
+	const glm::vec3 forward = glm::normalize(sceneCenter - eye);
+	const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+	const glm::vec3 up = glm::cross(right, forward);
+	const float tanHalfFov = std::tan(glm::radians(30.0f));
+
+	std::vector<SBVHRay> rays;
+	rays.reserve(BENCHMARK_IMAGE_SIZE * BENCHMARK_IMAGE_SIZE);
+	for (int y = 0; y < BENCHMARK_IMAGE_SIZE; y++)
+	{
+		for (int x = 0; x < BENCHMARK_IMAGE_SIZE; x++)
+		{
+			const float ndcX = (2.0f * (x + 0.5f) / BENCHMARK_IMAGE_SIZE - 1.0f) * tanHalfFov;
+			const float ndcY = (1.0f - 2.0f * (y + 0.5f) / BENCHMARK_IMAGE_SIZE) * tanHalfFov;
+			rays.push_back(SBVHRay(eye, glm::normalize(forward + ndcX * right + ndcY * up)));
+		}
+	}
+
+	const BVHTraversal traversal(tree, positions);
+
+	SBenchmarkResult binaryResult;
+	binaryResult.m_numMismatches = 0;
+
+	std::vector<SBVHHit> refHits(rays.size());
+	size_t numHits = 0;
+	const auto start = std::chrono::high_resolution_clock::now();
+	for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx++)
+	{
+		numHits += traversal.intersect(rays[rayIdx], refHits[rayIdx], &binaryResult.m_stats) ? 1 : 0;
+	}
+	binaryResult.m_timeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	printf("%s: %zu triangles, %zu rays, %.1f%% hit\n", modelFilename.c_str(), tree.m_triIndices.size(), rays.size(),
+		100.0 * double(numHits) / double(rays.size()));
+	printResult("binary", tree.m_aabbNodes.size(), tree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode), binaryResult, rays.size());
+
+	size_t numMismatches = traceWide<2>(tree, traversal, rays, refHits);
+	numMismatches += traceWide<4>(tree, traversal, rays, refHits);
+	numMismatches += traceWide<8>(tree, traversal, rays, refHits);
+
+	// Same rays once every other mesh was removed from the tree, and once inserted back.
+	numMismatches += traceRespawnedMeshes(tree.m_buildParams, mesh.m_Entries, positions, rays, refHits);
+
+	// Same rays once every other mesh was moved and the tree refitted.
+	numMismatches += traceRefittedMeshes(tree.m_buildParams, mesh.m_Entries, positions, rays);
+
+	// Same binary and 4-wide traversals, with the leaves tested against the precomputed triangles instead of going through
+	// the vertex indices.
+	std::vector<BVHTree::PrecomputedTriangle> triangleSoup;
+	tree.buildTriangleSoup(positions, triangleSoup);
+	const BVHTraversal soupTraversal(tree, positions, &triangleSoup);
+
+	const SBenchmarkResult soupResult = trace(rays, refHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+		soupTraversal.intersect(ray, hit, stats);
+	});
+	std::vector< BVHTree::WideBVHNode<4> > wideNodes;
+	tree.collapseToWideBVH<4>(wideNodes);
+	const SBenchmarkResult wideSoupResult = trace(rays, refHits, [&](const SBVHRay& ray, SBVHHit& hit, SBVHTraversalStats* stats) {
+		soupTraversal.intersectWide<4>(wideNodes, ray, hit, stats);
+	});
+
+	printResult("binary soup", tree.m_aabbNodes.size(), tree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode), soupResult, rays.size());
+	printResult("wide 4 soup", wideNodes.size(), wideNodes.size() * sizeof(BVHTree::WideBVHNode<4>), wideSoupResult, rays.size());
+	printf("  triangles: %.1f KB indexed (indices + positions), %.1f KB soup\n",
+		(tree.m_triIndices.size() * sizeof(glm::ivec3) + positions.size() * sizeof(glm::vec4)) / 1024.0,
+		triangleSoup.size() * sizeof(BVHTree::PrecomputedTriangle) / 1024.0);
+
+	numMismatches += soupResult.m_numMismatches + wideSoupResult.m_numMismatches;
+
+	// Same again with the leaves tested a group of 4 or 8 triangles at a time, then the triangle tests alone.
+	numMismatches += traceTriangleGroups(tree, positions, rays, refHits, wideNodes, triangleSoup);
+
+	// Shadow feelers from the visible points toward a light above the scene, pixels without a hit have an empty ray.
+	const glm::vec3 lightPosition = sceneCenter + glm::vec3(0.3f, 2.0f, 0.2f) * sceneRadius;
+	std::vector<SBVHRay> shadowRays(rays.size(), SBVHRay(eye, forward, 0.0f, 0.0f));
+	size_t numShadowRays = 0;
+	for (size_t rayIdx = 0; rayIdx < rays.size(); rayIdx++)
+	{
+		if (!refHits[rayIdx].isValid())
+			continue;
+
+		const glm::vec3 hitPoint = rays[rayIdx].m_origin + refHits[rayIdx].m_t * rays[rayIdx].m_direction;
+		const glm::vec3 toLight = lightPosition - hitPoint;
+		const float lightDistance = glm::length(toLight);
+		shadowRays[rayIdx] = SBVHRay(hitPoint, toLight / lightDistance, 0.0001f * sceneRadius, lightDistance);
+		numShadowRays++;
+	}
+
+	SBenchmarkResult shadowResult;
+	shadowResult.m_numMismatches = 0;
+	std::vector<SBVHHit> shadowRefHits(rays.size());
+	const auto shadowStart = std::chrono::high_resolution_clock::now();
+	for (size_t rayIdx = 0; rayIdx < shadowRays.size(); rayIdx++)
+	{
+		if (shadowRays[rayIdx].m_tMax > 0.0f)
+			soupTraversal.intersect(shadowRays[rayIdx], shadowRefHits[rayIdx], &shadowResult.m_stats);
+	}
+	shadowResult.m_timeInMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - shadowStart).count();
+
+	// Same primary and shadow rays in packets of coherent rays, at each SIMD level supported by the CPU.
+	BVHPacketTraversal packetTraversal(tree, positions, &triangleSoup);
+	printf("  packets (%s supported):\n", BVHPacketTraversal::getSimdLevelName(BVHPacketTraversal::getSupportedSimdLevel()));
+	for (int simdLevel = BVH_SIMD_SSE; simdLevel <= int(BVHPacketTraversal::getSupportedSimdLevel()); simdLevel++)
+	{
+		packetTraversal.setSimdLevel(EBVHSimdLevel(simdLevel));
+		numMismatches += tracePackets(packetTraversal, "primary", rays, refHits);
+	}
+	printResult("shadow binary", tree.m_aabbNodes.size(), tree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode), shadowResult, numShadowRays);
+	for (int simdLevel = BVH_SIMD_SSE; simdLevel <= int(BVHPacketTraversal::getSupportedSimdLevel()); simdLevel++)
+	{
+		packetTraversal.setSimdLevel(EBVHSimdLevel(simdLevel));
+		numMismatches += tracePackets(packetTraversal, "shadow", shadowRays, shadowRefHits);
+	}
+
+	// Same shadow feelers through the occlusion tests, which stop at the first blocker.
+	const SBenchmarkResult anyHitResult = traceOcclusion(shadowRays, shadowRefHits, [&](const SBVHRay& ray, SBVHTraversalStats* stats) {
+		return soupTraversal.occluded(ray, stats);
+	});
+	const SBenchmarkResult wideAnyHitResult = traceOcclusion(shadowRays, shadowRefHits, [&](const SBVHRay& ray, SBVHTraversalStats* stats) {
+		return soupTraversal.occludedWide<4>(wideNodes, ray, stats);
+	});
+	BVHTriangleGroups triangleGroups;
+	triangleGroups.build(tree, positions);
+	const BVHTraversal groupTraversal(tree, positions, nullptr, &triangleGroups);
+	const SBenchmarkResult wideGroupAnyHitResult = traceOcclusion(shadowRays, shadowRefHits, [&](const SBVHRay& ray, SBVHTraversalStats* stats) {
+		return groupTraversal.occludedWide<4>(wideNodes, ray, stats);
+	});
+	printResult("shadow any", tree.m_aabbNodes.size(), tree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode), anyHitResult, numShadowRays);
+	printResult("shadow any 4", wideNodes.size(), wideNodes.size() * sizeof(BVHTree::WideBVHNode<4>), wideAnyHitResult, numShadowRays);
+	char name[32];
+	sprintf(name, "shadow any 4g%d", triangleGroups.getGroupSize());
+	printResult(name, wideNodes.size(), wideNodes.size() * sizeof(BVHTree::WideBVHNode<4>), wideGroupAnyHitResult, numShadowRays);
+	numMismatches += anyHitResult.m_numMismatches + wideAnyHitResult.m_numMismatches + wideGroupAnyHitResult.m_numMismatches;
+
+	return numMismatches == 0;
+}
@@ -0,0 +1,45 @@
+/******************************************************************************/
+/*!
+\file	BVHBenchmark.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_BENCHMARK_H_
+#define _BVH_BENCHMARK_H_
+
+#include <string>
+#include <vector>
+
+// Headless benchmark of the CPU BVH traversals, run with "--bvh-benchmark [model files...]" on the command line.
+// Each model is traced from a camera looking at it through its binary trees and through their 2, 4 and 8-wide collapses,
+// with full precision and quantized (16 and 8-bit) child bounds, then once every other mesh was removed and inserted back
+// (BVHTree::removeMesh and insertMesh) and once every other mesh was moved and refitted (BVHTree::refit), against fresh
+// builds, then with the leaves tested against the precomputed triangle soup.
+// The leaves are then tested a group of 4 (and 8 with AVX2) triangles at a time, and the triangle tests are timed alone.
+// The same rays, and shadow feelers from their hits toward a light, are then traced in packets at each supported SIMD level,
+// and the shadow feelers go through the occlusion tests, which stop at the first blocker.
+class BVHBenchmark
+{
+public:
+
+	// Models are relative to the asset path (e.g. "models/box/boxes.dae"); the bundled ones are used if none is given.
+	// Returns false if a model couldn't be loaded or if the traversals disagreed on a hit.
+	static bool run(const std::vector<std::string>& modelFilenames);
+
+private:
+
+	static bool _runModel(const std::string& modelFilename);
+};
+
+#endif // _BVH_BENCHMARK_H_
@@ -0,0 +1,421 @@
+/******************************************************************************/
+/*!
+\file	BVHPacketKernelImpl.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_PACKET_KERNEL_IMPL_H_
+#define _BVH_PACKET_KERNEL_IMPL_H_
+
+// Packet traversal shared by the kernels, only included by BVHPacketTraversalSSE/AVX2/AVX512.cpp. TSimd is one of the
+// wrappers of BVHSimd.h. See BVHPacketKernels.h for why nothing but plain data and intrinsics is used here.
+
+#include "BVHPacketKernels.h"
+
+namespace
+{
+	// Same as BVHTraversal, see BVH_STACK_SIZE: deep enough for BVH_MAX_DEPTH, the pushes are guarded all the same.
+	const int BVH_PACKET_STACK_SIZE = 64;
+
+	inline float packetMin(float a, float b) { return (b < a) ? b : a; }
+	inline float packetMax(float a, float b) { return (a < b) ? b : a; }
+	inline bool packetIsFinite(float value) { return value - value == 0.0f; }
+
+	inline int countBits(int bits)
+	{
+		int numBits = 0;
+		for (; bits != 0; bits &= bits - 1)
+			numBits++;
+		return numBits;
+	}
+
+	inline int lowestBit(int bits)
+	{
+		int bitIdx = 0;
+		while ((bits & (1 << bitIdx)) == 0)
+			bitIdx++;
+		return bitIdx;
+	}
+
+	template <typename TSimd>
+	class PacketTraversal
+	{
+	public:
+
+		typedef typename TSimd::Float Float;
+		typedef typename TSimd::Mask Mask;
+		enum { WIDTH = TSimd::WIDTH };
+
+		PacketTraversal(const SBVHPacketContext& context, const SBVHPacketRays& rays, SBVHPacketHits& ioHits, SBVHPacketKernelStats& ioStats)
+		: m_context(context)
+		, m_rays(rays)
+		, m_numRays(rays.m_numRays)
+		, m_hits(ioHits)
+		, m_stats(ioStats)
+		{
+		}
+
+		void intersect()
+		{
+			_loadRays();
+			_traverse();
+		}
+
+	private:
+
+		struct SStackEntry
+		{
+			int		m_nodeIdx;
+			float	m_tEntry;	// Nearest entry distance of the rays of the packet which hit the node.
+			int		m_meshIdx;
+		};
+
+		void _loadRays()
+		{
+			for (int dim = 0; dim < 3; dim++)
+			{
+				const float* origins = m_rays.m_origins[dim];
+				const float* invDirections = m_rays.m_invDirections[dim];
+				m_isNegative[dim] = invDirections[0] < 0.0f;
+				m_originMin[dim] = m_originMax[dim] = origins[0];
+				m_invDirectionMin[dim] = m_invDirectionMax[dim] = invDirections[0];
+				for (int laneIdx = 1; laneIdx < m_numRays; laneIdx++)
+				{
+					m_originMin[dim] = packetMin(m_originMin[dim], origins[laneIdx]);
+					m_originMax[dim] = packetMax(m_originMax[dim], origins[laneIdx]);
+					m_invDirectionMin[dim] = packetMin(m_invDirectionMin[dim], invDirections[laneIdx]);
+					m_invDirectionMax[dim] = packetMax(m_invDirectionMax[dim], invDirections[laneIdx]);
+				}
+				// Axis-aligned rays have infinite inverse directions, whose products don't bound anything.
+				m_isIntervalAxis[dim] = packetIsFinite(m_invDirectionMin[dim]) && packetIsFinite(m_invDirectionMax[dim]);
+
+				m_origins[dim] = TSimd::loadu(origins);
+				m_directions[dim] = TSimd::loadu(m_rays.m_directions[dim]);
+				m_invDirections[dim] = TSimd::loadu(invDirections);
+			}
+			m_tMins = TSimd::loadu(m_rays.m_tMins);
+
+			m_tMinMin = m_rays.m_tMins[0];
+			for (int laneIdx = 1; laneIdx < m_numRays; laneIdx++)
+				m_tMinMin = packetMin(m_tMinMin, m_rays.m_tMins[laneIdx]);
+		}
+
+		float _getFarthestHit() const
+		{
+			float tFarthest = m_hits.m_ts[0];
+			for (int laneIdx = 1; laneIdx < m_numRays; laneIdx++)
+				tFarthest = packetMax(tFarthest, m_hits.m_ts[laneIdx]);
+			return tFarthest;
+		}
+
+		// Interval arithmetic test of the box against every ray the packet may hold: false if no ray of the packet can hit it.
+		// Rounding is monotonic, so the bounds computed from the extreme origins and inverse directions bound the distances
+		// computed by each ray.
+		bool _intersectAabbInterval(const float* nearPlanes, const float* farPlanes, float tFarthest) const
+		{
+			float tNear = m_tMinMin;
+			float tFar = tFarthest;
+			for (int dim = 0; dim < 3; dim++)
+			{
+				if (!m_isIntervalAxis[dim])
+					continue;
+
+				const float nearPlane = nearPlanes[dim];
+				const float farPlane = farPlanes[dim];
+
+				// [nearPlane - originMax, nearPlane - originMin] * [invDirectionMin, invDirectionMax], lower bound.
+				const float nearLow = nearPlane - m_originMax[dim];
+				const float nearHigh = nearPlane - m_originMin[dim];
+				const float tDimNear = packetMin(packetMin(nearLow * m_invDirectionMin[dim], nearLow * m_invDirectionMax[dim]),
+					packetMin(nearHigh * m_invDirectionMin[dim], nearHigh * m_invDirectionMax[dim]));
+
+				// Same with the far plane, upper bound.
+				const float farLow = farPlane - m_originMax[dim];
+				const float farHigh = farPlane - m_originMin[dim];
+				const float tDimFar = packetMax(packetMax(farLow * m_invDirectionMin[dim], farLow * m_invDirectionMax[dim]),
+					packetMax(farHigh * m_invDirectionMin[dim], farHigh * m_invDirectionMax[dim]));
+
+				tNear = packetMax(tNear, tDimNear);
+				tFar = packetMin(tFar, tDimFar);
+			}
+			return tNear <= tFar;
+		}
+
+		// Same slab test as BVHTraversal::intersectAabb for every lane, returns the lanes which hit the box.
+		int _intersectAabb(const float* nearPlanes, const float* farPlanes, float* outTEntries) const
+		{
+			Float tNear = m_tMins;
+			Float tFar = TSimd::loadu(m_hits.m_ts);
+			for (int dim = 0; dim < 3; dim++)
+			{
+				const Float nearPlane = TSimd::set1(nearPlanes[dim]);
+				const Float farPlane = TSimd::set1(farPlanes[dim]);
+				const Float tDimNear = TSimd::mul(TSimd::sub(nearPlane, m_origins[dim]), m_invDirections[dim]);
+				const Float tDimFar = TSimd::mul(TSimd::sub(farPlane, m_origins[dim]), m_invDirections[dim]);
+				tNear = TSimd::max(tDimNear, tNear);
+				tFar = TSimd::min(tDimFar, tFar);
+			}
+			TSimd::storeu(outTEntries, tNear);
+			return TSimd::toBits(TSimd::cmpLe(tNear, tFar));
+		}
+
+		// Tests the box against the packet, the returned lanes are the ones which hit it and outTEntry their nearest entry.
+		int _intersectNode(int nodeIdx, float tFarthest, float& outTEntry)
+		{
+			const SBVHPacketNode& node = m_context.m_nodes[nodeIdx];
+			m_stats.m_numAabbTests++;
+
+			// Near and far planes of the box along each axis, picked from the signs of the directions like the slab test.
+			float nearPlanes[3], farPlanes[3];
+			for (int dim = 0; dim < 3; dim++)
+			{
+				nearPlanes[dim] = m_isNegative[dim] ? node.m_maxAABB[dim] : node.m_minAABB[dim];
+				farPlanes[dim] = m_isNegative[dim] ? node.m_minAABB[dim] : node.m_maxAABB[dim];
+			}
+
+			if (!_intersectAabbInterval(nearPlanes, farPlanes, tFarthest))
+			{
+				m_stats.m_numIntervalCulls++;
+				return 0;
+			}
+
+			float tEntries[WIDTH];
+			const int hitLanes = _intersectAabb(nearPlanes, farPlanes, tEntries);
+			if (hitLanes != 0)
+			{
+				outTEntry = tEntries[lowestBit(hitLanes)];
+				for (int laneIdx = 0; laneIdx < m_numRays; laneIdx++)
+				{
+					if ((hitLanes & (1 << laneIdx)) != 0)
+						outTEntry = packetMin(outTEntry, tEntries[laneIdx]);
+				}
+			}
+			return hitLanes;
+		}
+
+		// The lanes which hit the node finish its subtree alone.
+		void _intersectSubtreeSingleRays(int nodeIdx, int meshIdx, int lanes)
+		{
+			for (int laneIdx = 0; laneIdx < m_numRays; laneIdx++)
+			{
+				if ((lanes & (1 << laneIdx)) == 0)
+					continue;
+
+				m_stats.m_numSubtreeFallbacks++;
+
+				m_context.m_intersectSubtree(m_context, m_rays, laneIdx, nodeIdx, meshIdx, m_hits, m_stats.m_singleRayStats);
+			}
+		}
+
+		// Same Möller-Trumbore test as BVHTraversal::intersectTriangleEdges (with the operations of glm's cross and dot in the
+		// same order, so that both find the same distances), one triangle against every lane.
+		void _intersectTriangle(const float* v0, const float* edge1, const float* edge2, int triIdx, int meshIdx)
+		{
+			const Float e1x = TSimd::set1(edge1[0]), e1y = TSimd::set1(edge1[1]), e1z = TSimd::set1(edge1[2]);
+			const Float e2x = TSimd::set1(edge2[0]), e2y = TSimd::set1(edge2[1]), e2z = TSimd::set1(edge2[2]);
+			const Float& dx = m_directions[0];
+			const Float& dy = m_directions[1];
+			const Float& dz = m_directions[2];
+
+			// pvec = cross(direction, edge2), det = dot(pvec, edge1).
+			const Float px = TSimd::sub(TSimd::mul(dy, e2z), TSimd::mul(e2y, dz));
+			const Float py = TSimd::sub(TSimd::mul(dz, e2x), TSimd::mul(e2z, dx));
+			const Float pz = TSimd::sub(TSimd::mul(dx, e2y), TSimd::mul(e2x, dy));
+			const Float det = TSimd::add(TSimd::add(TSimd::mul(px, e1x), TSimd::mul(py, e1y)), TSimd::mul(pz, e1z));
+			Mask isHit = TSimd::cmpGe(TSimd::abs(det), TSimd::set1(1e-12f));
+			const Float invDet = TSimd::div(TSimd::set1(1.0f), det);
+
+			const Float tx = TSimd::sub(m_origins[0], TSimd::set1(v0[0]));
+			const Float ty = TSimd::sub(m_origins[1], TSimd::set1(v0[1]));
+			const Float tz = TSimd::sub(m_origins[2], TSimd::set1(v0[2]));
+
+			const Float u = TSimd::mul(TSimd::add(TSimd::add(TSimd::mul(px, tx), TSimd::mul(py, ty)), TSimd::mul(pz, tz)), invDet);
+			isHit = TSimd::andMask(isHit, TSimd::andMask(TSimd::cmpGe(u, TSimd::set1(0.0f)), TSimd::cmpLe(u, TSimd::set1(1.0f))));
+
+			// qvec = cross(tvec, edge1).
+			const Float qx = TSimd::sub(TSimd::mul(ty, e1z), TSimd::mul(e1y, tz));
+			const Float qy = TSimd::sub(TSimd::mul(tz, e1x), TSimd::mul(e1z, tx));
+			const Float qz = TSimd::sub(TSimd::mul(tx, e1y), TSimd::mul(e1x, ty));
+
+			const Float v = TSimd::mul(TSimd::add(TSimd::add(TSimd::mul(dx, qx), TSimd::mul(dy, qy)), TSimd::mul(dz, qz)), invDet);
+			isHit = TSimd::andMask(isHit, TSimd::andMask(TSimd::cmpGe(v, TSimd::set1(0.0f)), TSimd::cmpLe(TSimd::add(u, v), TSimd::set1(1.0f))));
+
+			const Float t = TSimd::mul(TSimd::add(TSimd::add(TSimd::mul(e2x, qx), TSimd::mul(e2y, qy)), TSimd::mul(e2z, qz)), invDet);
+			isHit = TSimd::andMask(isHit, TSimd::andMask(TSimd::cmpGt(t, m_tMins), TSimd::cmpLt(t, TSimd::loadu(m_hits.m_ts))));
+
+			int hitLanes = TSimd::toBits(isHit);
+			if (hitLanes == 0)
+				return;
+
+			float ts[WIDTH], us[WIDTH], vs[WIDTH];
+			TSimd::storeu(ts, t);
+			TSimd::storeu(us, u);
+			TSimd::storeu(vs, v);
+			for (; hitLanes != 0; hitLanes &= hitLanes - 1)
+			{
+				const int laneIdx = lowestBit(hitLanes);
+				m_hits.m_ts[laneIdx] = ts[laneIdx];
+				m_hits.m_us[laneIdx] = us[laneIdx];
+				m_hits.m_vs[laneIdx] = vs[laneIdx];
+				m_hits.m_triIdxs[laneIdx] = triIdx;
+				m_hits.m_meshIdxs[laneIdx] = meshIdx;
+			}
+		}
+
+		void _intersectLeaf(const SBVHPacketNode& node, int meshIdx)
+		{
+			const int firstTriIdx = node.m_left;
+			const int numTris = -node.m_right;
+			for (int triIdx = firstTriIdx; triIdx < firstTriIdx + numTris; triIdx++)
+			{
+				float v0[3], edge1[3], edge2[3];
+				if (m_context.m_triangleSoup != nullptr)
+				{
+					const float* tri = m_context.m_triangleSoup + 12 * triIdx;
+					for (int dim = 0; dim < 3; dim++)
+					{
+						v0[dim] = tri[dim];
+						edge1[dim] = tri[4 + dim];
+						edge2[dim] = tri[8 + dim];
+					}
+				}
+				else
+				{
+					const int32_t* triIndices = m_context.m_triIndices + 3 * triIdx;
+					const float* p0 = m_context.m_positions + 4 * triIndices[0];
+					const float* p1 = m_context.m_positions + 4 * triIndices[1];
+					const float* p2 = m_context.m_positions + 4 * triIndices[2];
+					for (int dim = 0; dim < 3; dim++)
+					{
+						v0[dim] = p0[dim];
+						edge1[dim] = p1[dim] - p0[dim];
+						edge2[dim] = p2[dim] - p0[dim];
+					}
+				}
+				_intersectTriangle(v0, edge1, edge2, triIdx, meshIdx);
+			}
+
+			m_stats.m_numTriTests += size_t(numTris);
+		}
+
+		void _traverse()
+		{
+			const int rootIdx = m_context.m_topLevelRootIdx;
+			float tRoot = 0.0f;
+			const int rootLanes = _intersectNode(rootIdx, _getFarthestHit(), tRoot);
+			if (rootLanes == 0)
+				return;
+			if (countBits(rootLanes) <= m_context.m_minActiveRays)
+			{
+				_intersectSubtreeSingleRays(rootIdx, -1, rootLanes);
+				return;
+			}
+
+			SStackEntry stack[BVH_PACKET_STACK_SIZE];
+			int stackSize = 0;
+			const SStackEntry rootEntry = { rootIdx, tRoot, -1 };
+			stack[stackSize++] = rootEntry;
+
+			while (stackSize > 0)
+			{
+				const SStackEntry entry = stack[--stackSize];
+				const float tFarthest = _getFarthestHit();
+				if (entry.m_tEntry >= tFarthest)
+					continue;
+
+				// Mesh entry: its bounds are the bounds of the mesh tree, which were already tested.
+				int nodeIdx = entry.m_nodeIdx;
+				int meshIdx = entry.m_meshIdx;
+				if (nodeIdx <= m_context.m_numMeshes)
+				{
+					meshIdx = nodeIdx - 1;
+					nodeIdx = m_context.m_nodes[nodeIdx].m_left;
+				}
+
+				const SBVHPacketNode& node = m_context.m_nodes[nodeIdx];
+				if (node.m_right < 0)
+				{
+					_intersectLeaf(node, meshIdx);
+					continue;
+				}
+
+				m_stats.m_numNodesVisited++;
+
+				SStackEntry childEntries[2] = {
+					{ node.m_left, 0.0f, meshIdx },
+					{ node.m_right, 0.0f, meshIdx }
+				};
+				int childLanes[2];
+				for (int childIdx = 0; childIdx < 2; childIdx++)
+				{
+					childLanes[childIdx] = _intersectNode(childEntries[childIdx].m_nodeIdx, tFarthest, childEntries[childIdx].m_tEntry);
+
+					// Too few rays left for the packet to pay off.
+					if (childLanes[childIdx] != 0 && countBits(childLanes[childIdx]) <= m_context.m_minActiveRays)
+					{
+						_intersectSubtreeSingleRays(childEntries[childIdx].m_nodeIdx, meshIdx, childLanes[childIdx]);
+						childLanes[childIdx] = 0;
+					}
+				}
+
+				// Push the farthest child first so that the nearest one is visited next.
+				if (childLanes[0] != 0 && childLanes[1] != 0 && childEntries[0].m_tEntry < childEntries[1].m_tEntry)
+				{
+					const SStackEntry nearEntry = childEntries[0];
+					childEntries[0] = childEntries[1];
+					childEntries[1] = nearEntry;
+					const int nearLanes = childLanes[0];
+					childLanes[0] = childLanes[1];
+					childLanes[1] = nearLanes;
+				}
+				for (int childIdx = 0; childIdx < 2; childIdx++)
+				{
+					if (childLanes[childIdx] != 0 && stackSize < BVH_PACKET_STACK_SIZE)
+						stack[stackSize++] = childEntries[childIdx];
+				}
+			}
+		}
+
+		const SBVHPacketContext&	m_context;
+		const SBVHPacketRays&		m_rays;
+		int							m_numRays;
+		SBVHPacketHits&				m_hits;
+		SBVHPacketKernelStats&		m_stats;
+
+		// Rays, one per lane.
+		Float	m_origins[3];
+		Float	m_directions[3];
+		Float	m_invDirections[3];
+		Float	m_tMins;
+
+		// Bounds of the rays of the packet, for the interval test.
+		bool	m_isNegative[3];
+		bool	m_isIntervalAxis[3];
+		float	m_originMin[3];
+		float	m_originMax[3];
+		float	m_invDirectionMin[3];
+		float	m_invDirectionMax[3];
+		float	m_tMinMin;
+
+	};
+
+	template <typename TSimd>
+	void intersectPacket(const SBVHPacketContext& context, const SBVHPacketRays& rays, SBVHPacketHits& ioHits, SBVHPacketKernelStats& ioStats)
+	{
+		PacketTraversal<TSimd> traversal(context, rays, ioHits, ioStats);
+		traversal.intersect();
+	}
+}
+
+#endif // _BVH_PACKET_KERNEL_IMPL_H_
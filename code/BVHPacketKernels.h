@@ -0,0 +1,118 @@
+/******************************************************************************/
+/*!
+\file	BVHPacketKernels.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_PACKET_KERNELS_H_
+#define _BVH_PACKET_KERNELS_H_
+
+// Interface between BVHPacketTraversal and its kernels. The kernels are compiled with their own instruction set, so this
+// header (the only one they include besides the intrinsics) only declares plain data: any inline function they would share
+// with the other files (e.g. from glm, std::vector or vulkanMeshLoader.h) could be emitted with that instruction set and
+// be the copy picked by the linker for the whole program, as it may do in builds without inlining.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BVH_PACKET_X86 1
+#else
+#define BVH_PACKET_X86 0
+#endif
+
+// Packet size of the widest kernel (AVX-512).
+#define BVH_PACKET_MAX_SIZE 16
+
+class BVHTraversal;
+struct SBVHRay;
+struct SBVHTraversalStats;
+
+// Same layout as BVHTree::BVHNode, see BVHPacketTraversal.cpp.
+struct SBVHPacketNode
+{
+	float	m_minAABB[3];
+	int32_t	m_left;
+	float	m_maxAABB[3];
+	int32_t	m_right;
+};
+
+// Rays of a packet, one per lane. The directions of all the rays share their signs.
+struct SBVHPacketRays
+{
+	int				m_numRays;	// The other lanes copy the first ray.
+	float			m_origins[3][BVH_PACKET_MAX_SIZE];
+	float			m_directions[3][BVH_PACKET_MAX_SIZE];
+	float			m_invDirections[3][BVH_PACKET_MAX_SIZE];
+	float			m_tMins[BVH_PACKET_MAX_SIZE];
+	const SBVHRay*	m_rays;		// The same rays, for the single ray traversals.
+};
+
+// Closest hits of the rays of a packet, m_ts being the far end of their intervals. The unused lanes start behind their
+// rays (m_ts < 0) so that they can't hit anything.
+struct SBVHPacketHits
+{
+	float	m_ts[BVH_PACKET_MAX_SIZE];
+	float	m_us[BVH_PACKET_MAX_SIZE];
+	float	m_vs[BVH_PACKET_MAX_SIZE];
+	int		m_triIdxs[BVH_PACKET_MAX_SIZE];	// < 0 := nothing was hit.
+	int		m_meshIdxs[BVH_PACKET_MAX_SIZE];
+};
+
+// Counters of SBVHPacketStats filled by the kernels.
+struct SBVHPacketKernelStats
+{
+	size_t				m_numNodesVisited;
+	size_t				m_numAabbTests;
+	size_t				m_numTriTests;
+	size_t				m_numIntervalCulls;
+	size_t				m_numSubtreeFallbacks;
+	SBVHTraversalStats*	m_singleRayStats;
+};
+
+struct SBVHPacketContext;
+
+// Finishes the subtree of the node with the given ray alone (see BVHTraversal::intersectSubtree), compiled without the
+// instruction sets of the kernels in BVHPacketTraversal.cpp.
+typedef void (*BVHPacketIntersectSubtreeFunc)(const SBVHPacketContext& context, const SBVHPacketRays& rays, int laneIdx, int nodeIdx,
+	int meshIdx, SBVHPacketHits& ioHits, SBVHTraversalStats* stats);
+
+struct SBVHPacketContext
+{
+	const SBVHPacketNode*			m_nodes;
+	int								m_numMeshes;
+	int								m_topLevelRootIdx;
+	const int32_t*					m_triIndices;	// 3 vertex indices per triangle.
+	const float*					m_positions;	// 4 floats per vertex.
+	const float*					m_triangleSoup;	// 12 floats per triangle (see BVHTree::PrecomputedTriangle), nullptr := the vertices are fetched through m_triIndices.
+	const BVHTraversal*				m_singleRayTraversal;
+	BVHPacketIntersectSubtreeFunc	m_intersectSubtree;
+	int								m_minActiveRays;	// Subtrees hit by at most this number of rays are traced ray by ray.
+};
+
+// Traces the rays of a packet through the tree, updating ioHits with their closest hits.
+typedef void (*BVHPacketKernelFunc)(const SBVHPacketContext& context, const SBVHPacketRays& rays, SBVHPacketHits& ioHits,
+	SBVHPacketKernelStats& ioStats);
+
+struct SBVHPacketKernel
+{
+	int					m_packetSize;
+	BVHPacketKernelFunc	m_intersect;	// nullptr := the kernel wasn't compiled in, see BVHPacketTraversalAVX2.cpp.
+};
+
+SBVHPacketKernel getBVHPacketKernelSSE();
+SBVHPacketKernel getBVHPacketKernelAVX2();
+SBVHPacketKernel getBVHPacketKernelAVX512();
+
+#endif // _BVH_PACKET_KERNELS_H_
@@ -0,0 +1,267 @@
+/******************************************************************************/
+/*!
+\file	BVHPacketTraversal.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "BVHPacketTraversal.h"
+
+#include <algorithm>
+#include <stddef.h>
+
+#include "BVHPacketKernels.h"
+
+#if BVH_PACKET_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	struct SCpuFeatures
+	{
+		bool	m_hasAVX2;
+		bool	m_hasAVX512;
+	};
+
+	SCpuFeatures detectCpuFeatures()
+	{
+		SCpuFeatures features = { false, false };
+#if BVH_PACKET_X86 && defined(_MSC_VER)
+		int cpuInfo[4];
+		__cpuid(cpuInfo, 0);
+		if (cpuInfo[0] < 7)
+			return features;
+
+		// The OS must save the YMM (and ZMM) registers on context switches as well.
+		__cpuid(cpuInfo, 1);
+		const bool hasOSXSave = (cpuInfo[2] & (1 << 27)) != 0;
+		if (!hasOSXSave)
+			return features;
+		const unsigned long long xcr0 = _xgetbv(0);
+		const bool hasYmmState = (xcr0 & 0x6) == 0x6;
+		const bool hasZmmState = (xcr0 & 0xe6) == 0xe6;
+
+		__cpuidex(cpuInfo, 7, 0);
+		features.m_hasAVX2 = hasYmmState && (cpuInfo[1] & (1 << 5)) != 0;
+		features.m_hasAVX512 = hasZmmState && (cpuInfo[1] & (1 << 16)) != 0;
+#elif BVH_PACKET_X86 && defined(__GNUC__)
+		__builtin_cpu_init();
+		features.m_hasAVX2 = __builtin_cpu_supports("avx2") != 0;
+		features.m_hasAVX512 = __builtin_cpu_supports("avx512f") != 0;
+#endif
+		return features;
+	}
+
+	SBVHPacketKernel getKernel(EBVHSimdLevel simdLevel)
+	{
+		switch (simdLevel)
+		{
+		case BVH_SIMD_SSE:		return getBVHPacketKernelSSE();
+		case BVH_SIMD_AVX2:		return getBVHPacketKernelAVX2();
+		case BVH_SIMD_AVX512:	return getBVHPacketKernelAVX512();
+		default:
+		{
+			SBVHPacketKernel kernel = { 1, nullptr };
+			return kernel;
+		}
+		}
+	}
+
+	void intersectSubtree(const SBVHPacketContext& context, const SBVHPacketRays& rays, int laneIdx, int nodeIdx, int meshIdx,
+		SBVHPacketHits& ioHits, SBVHTraversalStats* stats)
+	{
+		SBVHHit hit;
+		hit.m_t = ioHits.m_ts[laneIdx];
+		hit.m_u = ioHits.m_us[laneIdx];
+		hit.m_v = ioHits.m_vs[laneIdx];
+		hit.m_triIdx = ioHits.m_triIdxs[laneIdx];
+		hit.m_meshIdx = ioHits.m_meshIdxs[laneIdx];
+		context.m_singleRayTraversal->intersectSubtree(rays.m_rays[laneIdx], size_t(nodeIdx), meshIdx, hit, stats);
+
+		ioHits.m_ts[laneIdx] = hit.m_t;
+		ioHits.m_us[laneIdx] = hit.m_u;
+		ioHits.m_vs[laneIdx] = hit.m_v;
+		ioHits.m_triIdxs[laneIdx] = hit.m_triIdx;
+		ioHits.m_meshIdxs[laneIdx] = hit.m_meshIdx;
+	}
+
+	// Returns false if the directions of the rays don't share their signs, in which case the packet isn't worth tracing.
+	bool loadPacket(const SBVHRay* rays, int numRays, SBVHPacketRays& outRays, SBVHPacketHits& outHits)
+	{
+		for (int rayIdx = 1; rayIdx < numRays; rayIdx++)
+		{
+			for (int dim = 0; dim < 3; dim++)
+			{
+				if ((rays[rayIdx].m_invDirection[dim] < 0.0f) != (rays[0].m_invDirection[dim] < 0.0f))
+					return false;
+			}
+		}
+
+		outRays.m_numRays = numRays;
+		outRays.m_rays = rays;
+		for (int laneIdx = 0; laneIdx < BVH_PACKET_MAX_SIZE; laneIdx++)
+		{
+			const bool isUsed = laneIdx < numRays;
+			const SBVHRay& ray = rays[isUsed ? laneIdx : 0];
+			for (int dim = 0; dim < 3; dim++)
+			{
+				outRays.m_origins[dim][laneIdx] = ray.m_origin[dim];
+				outRays.m_directions[dim][laneIdx] = ray.m_direction[dim];
+				outRays.m_invDirections[dim][laneIdx] = ray.m_invDirection[dim];
+			}
+			outRays.m_tMins[laneIdx] = isUsed ? ray.m_tMin : 0.0f;
+
+			outHits.m_ts[laneIdx] = isUsed ? ray.m_tMax : -1.0f;
+			outHits.m_us[laneIdx] = 0.0f;
+			outHits.m_vs[laneIdx] = 0.0f;
+			outHits.m_triIdxs[laneIdx] = -1;
+			outHits.m_meshIdxs[laneIdx] = -1;
+		}
+		return true;
+	}
+}
+
+BVHPacketTraversal::BVHPacketTraversal(const BVHTree& tree, const std::vector<glm::vec4>& positions,
+	const std::vector<BVHTree::PrecomputedTriangle>* triangleSoup)
+: m_minActiveRayFraction(0.25f)
+, m_tree(tree)
+, m_positions(positions)
+, m_triangleSoup(triangleSoup)
+, m_singleRayTraversal(tree, positions, triangleSoup)
+, m_simdLevel(getSupportedSimdLevel())
+{
+}
+
+EBVHSimdLevel BVHPacketTraversal::getSupportedSimdLevel()
+{
+	static const SCpuFeatures s_cpuFeatures = detectCpuFeatures();
+
+	if (s_cpuFeatures.m_hasAVX512 && getBVHPacketKernelAVX512().m_intersect != nullptr)
+		return BVH_SIMD_AVX512;
+	if (s_cpuFeatures.m_hasAVX2 && getBVHPacketKernelAVX2().m_intersect != nullptr)
+		return BVH_SIMD_AVX2;
+	if (getBVHPacketKernelSSE().m_intersect != nullptr)
+		return BVH_SIMD_SSE;
+	return BVH_SIMD_SCALAR;
+}
+
+const char* BVHPacketTraversal::getSimdLevelName(EBVHSimdLevel simdLevel)
+{
+	switch (simdLevel)
+	{
+	case BVH_SIMD_SCALAR:	return "scalar";
+	case BVH_SIMD_SSE:		return "SSE";
+	case BVH_SIMD_AVX2:		return "AVX2";
+	case BVH_SIMD_AVX512:	return "AVX-512";
+	default:				return "unknown";
+	}
+}
+
+void BVHPacketTraversal::setSimdLevel(EBVHSimdLevel simdLevel)
+{
+	m_simdLevel = std::min(simdLevel, getSupportedSimdLevel());
+}
+
+int BVHPacketTraversal::getPacketSize() const
+{
+	return getKernel(m_simdLevel).m_packetSize;
+}
+
+void BVHPacketTraversal::intersect(const SBVHRay* rays, size_t numRays, SBVHHit* outHits, SBVHPacketStats* stats) const
+{
+	const std::vector<BVHTree::BVHNode>& nodes = m_tree.m_aabbNodes;
+	if (nodes.empty() || nodes[0].getTopLevelRootNode() == 0)
+		return;
+
+	const SBVHPacketKernel kernel = getKernel(m_simdLevel);
+	if (kernel.m_intersect == nullptr)
+	{
+		for (size_t rayIdx = 0; rayIdx < numRays; rayIdx++)
+		{
+			SBVHHit hit;
+			if (m_singleRayTraversal.intersect(rays[rayIdx], hit, (stats != nullptr) ? &stats->m_singleRayStats : nullptr))
+				outHits[rayIdx] = hit;
+		}
+		return;
+	}
+
+	static_assert(sizeof(SBVHPacketNode) == sizeof(BVHTree::BVHNode) && offsetof(SBVHPacketNode, m_left) == offsetof(BVHTree::BVHNode, m_left) &&
+		offsetof(SBVHPacketNode, m_maxAABB) == offsetof(BVHTree::BVHNode, m_maxAABB) && offsetof(SBVHPacketNode, m_right) == offsetof(BVHTree::BVHNode, m_right),
+		"The packet kernels read the nodes through SBVHPacketNode.");
+	static_assert(sizeof(glm::ivec3) == 3 * sizeof(int32_t) && sizeof(glm::vec4) == 4 * sizeof(float) &&
+		sizeof(BVHTree::PrecomputedTriangle) == 12 * sizeof(float), "The packet kernels read the triangles as plain arrays.");
+
+	SBVHPacketContext context;
+	context.m_nodes = reinterpret_cast<const SBVHPacketNode*>(&nodes[0]);
+	context.m_numMeshes = int(nodes[0].getNumMeshes());
+	context.m_topLevelRootIdx = int(nodes[0].getTopLevelRootNode());
+	context.m_triIndices = m_tree.m_triIndices.empty() ? nullptr : &m_tree.m_triIndices[0].x;
+	context.m_positions = m_positions.empty() ? nullptr : &m_positions[0].x;
+	context.m_triangleSoup = (m_triangleSoup != nullptr && !m_triangleSoup->empty()) ? &(*m_triangleSoup)[0].m_v0.x : nullptr;
+	context.m_singleRayTraversal = &m_singleRayTraversal;
+	context.m_intersectSubtree = &intersectSubtree;
+	context.m_minActiveRays = std::max(1, int(float(kernel.m_packetSize) * m_minActiveRayFraction));
+
+	SBVHTraversalStats* singleRayStats = (stats != nullptr) ? &stats->m_singleRayStats : nullptr;
+	SBVHPacketKernelStats kernelStats = { 0, 0, 0, 0, 0, singleRayStats };
+
+	SBVHPacketRays packetRays;
+	SBVHPacketHits packetHits;
+	for (size_t firstRayIdx = 0; firstRayIdx < numRays; firstRayIdx += size_t(kernel.m_packetSize))
+	{
+		const SBVHRay* packetFirstRay = rays + firstRayIdx;
+		SBVHHit* packetFirstHit = outHits + firstRayIdx;
+		const int numPacketRays = int(std::min(numRays - firstRayIdx, size_t(kernel.m_packetSize)));
+		if (stats != nullptr)
+			stats->m_numPackets++;
+
+		if (!loadPacket(packetFirstRay, numPacketRays, packetRays, packetHits))
+		{
+			if (stats != nullptr)
+				stats->m_numIncoherentPackets++;
+			for (int rayIdx = 0; rayIdx < numPacketRays; rayIdx++)
+			{
+				SBVHHit hit;
+				if (m_singleRayTraversal.intersect(packetFirstRay[rayIdx], hit, singleRayStats))
+					packetFirstHit[rayIdx] = hit;
+			}
+			continue;
+		}
+
+		kernel.m_intersect(context, packetRays, packetHits, kernelStats);
+
+		for (int laneIdx = 0; laneIdx < numPacketRays; laneIdx++)
+		{
+			if (packetHits.m_triIdxs[laneIdx] < 0)
+				continue;
+
+			SBVHHit& hit = packetFirstHit[laneIdx];
+			hit.m_t = packetHits.m_ts[laneIdx];
+			hit.m_u = packetHits.m_us[laneIdx];
+			hit.m_v = packetHits.m_vs[laneIdx];
+			hit.m_triIdx = packetHits.m_triIdxs[laneIdx];
+			hit.m_meshIdx = packetHits.m_meshIdxs[laneIdx];
+		}
+	}
+
+	if (stats != nullptr)
+	{
+		stats->m_numNodesVisited += kernelStats.m_numNodesVisited;
+		stats->m_numAabbTests += kernelStats.m_numAabbTests;
+		stats->m_numTriTests += kernelStats.m_numTriTests;
+		stats->m_numIntervalCulls += kernelStats.m_numIntervalCulls;
+		stats->m_numSubtreeFallbacks += kernelStats.m_numSubtreeFallbacks;
+	}
+}
@@ -0,0 +1,88 @@
+/******************************************************************************/
+/*!
+\file	BVHPacketTraversal.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_PACKET_TRAVERSAL_H_
+#define _BVH_PACKET_TRAVERSAL_H_
+
+#include <vector>
+
+#include "BVHTraversal.h"
+
+enum EBVHSimdLevel
+{
+	BVH_SIMD_SCALAR,	// One ray at a time through BVHTraversal::intersect.
+	BVH_SIMD_SSE,		// Packets of 4 rays.
+	BVH_SIMD_AVX2,		// Packets of 8 rays.
+	BVH_SIMD_AVX512,	// Packets of 16 rays.
+	BVH_SIMD_COUNT
+};
+
+struct SBVHPacketStats
+{
+	SBVHPacketStats() : m_numPackets(0), m_numIncoherentPackets(0), m_numNodesVisited(0), m_numAabbTests(0), m_numTriTests(0),
+		m_numIntervalCulls(0), m_numSubtreeFallbacks(0) {}
+
+	size_t	m_numPackets;
+	size_t	m_numIncoherentPackets;	// Traced ray by ray from the root since the signs of their directions differed.
+	size_t	m_numNodesVisited;		// Interior nodes visited by a whole packet.
+	size_t	m_numAabbTests;			// Packet against box tests, each testing every ray of the packet.
+	size_t	m_numTriTests;			// Packet against triangle tests.
+	size_t	m_numIntervalCulls;		// Boxes rejected for the whole packet by the interval test alone.
+	size_t	m_numSubtreeFallbacks;	// Subtrees finished by a single ray, see m_minActiveRayFraction.
+	SBVHTraversalStats m_singleRayStats; // Of the single ray traversals of the incoherent packets and fallbacks.
+};
+
+// Closest hit traversal of the binary trees of a BVHTree by packets of coherent rays (e.g. neighbouring primary rays, or
+// the shadow feelers of neighbouring G-buffer pixels toward the same light), each lane of a SIMD register holding a ray.
+// A packet goes down a node as soon as one of its rays hits its box, the boxes being first tested against the interval of
+// origins and directions of the whole packet so that most of the missed boxes cost a single scalar test.
+// Packets whose directions don't share their signs are traced ray by ray, and once the rays of a packet scatter so that
+// only a few of them still hit a box, these finish its subtree alone through BVHTraversal::intersectSubtree.
+// The kernels are compiled once per instruction set (BVHPacketTraversalSSE/AVX2/AVX512.cpp) and picked at runtime.
+class BVHPacketTraversal
+{
+public:
+
+	BVHPacketTraversal(const BVHTree& tree, const std::vector<glm::vec4>& positions,
+		const std::vector<BVHTree::PrecomputedTriangle>* triangleSoup = nullptr);
+
+	// Best level supported by both the CPU and the compiler the kernels were built with.
+	static EBVHSimdLevel getSupportedSimdLevel();
+	static const char* getSimdLevelName(EBVHSimdLevel simdLevel);
+
+	// Clamped to getSupportedSimdLevel(), which is the default.
+	void setSimdLevel(EBVHSimdLevel simdLevel);
+	EBVHSimdLevel getSimdLevel() const { return m_simdLevel; }
+	int getPacketSize() const;
+
+	// Closest hits of the rays, traced getPacketSize() consecutive rays at a time: neighbouring rays should be stored next to
+	// each other (e.g. in small screen tiles). outHits[i] is left as is if rays[i] doesn't hit anything.
+	void intersect(const SBVHRay* rays, size_t numRays, SBVHHit* outHits, SBVHPacketStats* stats = nullptr) const;
+
+	// The subtree of a box hit by at most this fraction of the rays of a packet (or by a single ray) is traversed ray by ray.
+	float m_minActiveRayFraction;
+
+private:
+
+	const BVHTree&					m_tree;
+	const std::vector<glm::vec4>&	m_positions;
+	const std::vector<BVHTree::PrecomputedTriangle>* m_triangleSoup;
+	BVHTraversal					m_singleRayTraversal;
+	EBVHSimdLevel					m_simdLevel;
+};
+
+#endif // _BVH_PACKET_TRAVERSAL_H_
@@ -0,0 +1,41 @@
+/******************************************************************************/
+/*!
+\file	BVHPacketTraversalAVX512.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "BVHPacketKernels.h"
+
+// Only compiled with AVX-512 enabled by the build (see CMakeLists.txt), the kernel is then picked at runtime on the CPUs
+// which support it.
+#if BVH_PACKET_X86 && defined(__AVX512F__)
+
+#include "BVHSimd.h"
+#include "BVHPacketKernelImpl.h"
+
+SBVHPacketKernel getBVHPacketKernelAVX512()
+{
+	SBVHPacketKernel kernel = { SSimdAVX512::WIDTH, &intersectPacket<SSimdAVX512> };
+	return kernel;
+}
+
+#else
+
+SBVHPacketKernel getBVHPacketKernelAVX512()
+{
+	SBVHPacketKernel kernel = { 0, nullptr };
+	return kernel;
+}
+
+#endif
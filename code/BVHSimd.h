@@ -0,0 +1,117 @@
+/******************************************************************************/
+/*!
+\file	BVHSimd.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_SIMD_H_
+#define _BVH_SIMD_H_
+
+// Wrappers of the SIMD registers of each instruction set, for the kernels templated over them (see BVHPacketKernelImpl.h
+// and BVHTriangleGroupKernelImpl.h). Each one is only defined in the translation units compiled with its instruction set:
+//   WIDTH, Float and Mask types,
+//   set1, loadu, storeu, add, sub, mul, div, min, max, abs (the min and max return their second operand on NaNs),
+//   cmpLt, cmpLe, cmpGt, cmpGe (false on NaNs), andMask and toBits (one bit per lane).
+// They live in an anonymous namespace so that each translation unit keeps its own copy.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#include <emmintrin.h>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+	// SSE2 is part of every x64 CPU, so this one is available with the default flags.
+	struct SSimdSSE
+	{
+		enum { WIDTH = 4 };
+		typedef __m128 Float;
+		typedef __m128 Mask;
+
+		static Float set1(float value) { return _mm_set1_ps(value); }
+		static Float loadu(const float* values) { return _mm_loadu_ps(values); }
+		static void storeu(float* outValues, Float a) { _mm_storeu_ps(outValues, a); }
+		static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+		static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+		static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+		static Float div(Float a, Float b) { return _mm_div_ps(a, b); }
+		static Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+		static Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+		static Float abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+		static Mask cmpLt(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+		static Mask cmpLe(Float a, Float b) { return _mm_cmple_ps(a, b); }
+		static Mask cmpGt(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+		static Mask cmpGe(Float a, Float b) { return _mm_cmpge_ps(a, b); }
+		static Mask andMask(Mask a, Mask b) { return _mm_and_ps(a, b); }
+		static int toBits(Mask mask) { return _mm_movemask_ps(mask); }
+	};
+
+#if defined(__AVX2__)
+	struct SSimdAVX2
+	{
+		enum { WIDTH = 8 };
+		typedef __m256 Float;
+		typedef __m256 Mask;
+
+		static Float set1(float value) { return _mm256_set1_ps(value); }
+		static Float loadu(const float* values) { return _mm256_loadu_ps(values); }
+		static void storeu(float* outValues, Float a) { _mm256_storeu_ps(outValues, a); }
+		static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+		static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+		static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+		static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+		static Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+		static Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+		static Float abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+		static Mask cmpLt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		static Mask cmpLe(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+		static Mask cmpGt(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		static Mask cmpGe(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+		static Mask andMask(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+		static int toBits(Mask mask) { return _mm256_movemask_ps(mask); }
+	};
+#endif
+
+#if defined(__AVX512F__)
+	struct SSimdAVX512
+	{
+		enum { WIDTH = 16 };
+		typedef __m512 Float;
+		typedef __mmask16 Mask;
+
+		static Float set1(float value) { return _mm512_set1_ps(value); }
+		static Float loadu(const float* values) { return _mm512_loadu_ps(values); }
+		static void storeu(float* outValues, Float a) { _mm512_storeu_ps(outValues, a); }
+		static Float add(Float a, Float b) { return _mm512_add_ps(a, b); }
+		static Float sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+		static Float mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+		static Float div(Float a, Float b) { return _mm512_div_ps(a, b); }
+		static Float min(Float a, Float b) { return _mm512_min_ps(a, b); }
+		static Float max(Float a, Float b) { return _mm512_max_ps(a, b); }
+		static Float abs(Float a) { return _mm512_abs_ps(a); }
+		static Mask cmpLt(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+		static Mask cmpLe(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+		static Mask cmpGt(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+		static Mask cmpGe(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+		static Mask andMask(Mask a, Mask b) { return Mask(a & b); }
+		static int toBits(Mask mask) { return int(mask); }
+	};
+#endif
+}
+
+#endif
+
+#endif // _BVH_SIMD_H_
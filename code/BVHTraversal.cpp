@@ -0,0 +1,456 @@
+/******************************************************************************/
+/*!
+\file	BVHTraversal.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "BVHTraversal.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "BVHTriangleGroups.h"
+
+namespace
+{
+	// A binary traversal holds at most one entry per level of the deepest tree BVHTree builds (BVH_MAX_DEPTH) plus the root,
+	// the shaders use the same size with a sentinel entry on top. A wide traversal holds up to N - 1 entries per level.
+	// The pushes are still guarded, so that a deeper tree loses the subtrees which don't fit rather than corrupting the stack.
+	const int BVH_STACK_SIZE = 64;
+	static_assert(BVH_MAX_DEPTH + 2 <= BVH_STACK_SIZE, "BVH_STACK_SIZE doesn't fit the depth limits of BVHTree");
+
+	// Cache line size of the CPUs and GPUs we run on, for SBVHTraversalStats::m_numCacheLinesTouched.
+	const size_t BVH_CACHE_LINE_SIZE = 64;
+
+	// Number of cache lines spanned by numElements elements starting at elements[firstElementIdx]. The lines are counted
+	// from the start of the buffer, which is assumed to be aligned on a cache line like the GPU buffers.
+	template <typename T>
+	size_t countCacheLines(size_t firstElementIdx, size_t numElements)
+	{
+		const size_t firstByte = firstElementIdx * sizeof(T);
+		const size_t lastByte = firstByte + numElements * sizeof(T) - 1;
+		return lastByte / BVH_CACHE_LINE_SIZE - firstByte / BVH_CACHE_LINE_SIZE + 1;
+	}
+}
+
+SBVHRay::SBVHRay(const glm::vec3& origin, const glm::vec3& direction, float tMin, float tMax)
+: m_origin(origin)
+, m_direction(direction)
+, m_invDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z)
+, m_tMin(tMin)
+, m_tMax(tMax)
+{
+}
+
+BVHTraversal::BVHTraversal(const BVHTree& tree, const std::vector<glm::vec4>& positions,
+	const std::vector<BVHTree::PrecomputedTriangle>* triangleSoup, const BVHTriangleGroups* triangleGroups)
+: m_tree(tree)
+, m_positions(positions)
+, m_triangleSoup(triangleSoup)
+, m_triangleGroups(triangleGroups)
+{
+}
+
+float BVHTraversal::intersectTriangle(const SBVHRay& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& outU, float& outV)
+{
+	return intersectTriangleEdges(ray, v0, v1 - v0, v2 - v0, outU, outV);
+}
+
+float BVHTraversal::intersectTriangleEdges(const SBVHRay& ray, const glm::vec3& v0, const glm::vec3& edge1, const glm::vec3& edge2, float& outU, float& outV)
+{
+	const glm::vec3 pvec = glm::cross(ray.m_direction, edge2);
+	const float det = glm::dot(pvec, edge1);
+	if (std::fabs(det) < 1e-12f)
+		return -1.0f;
+
+	const float invDet = 1.0f / det;
+	const glm::vec3 tvec = ray.m_origin - v0;
+
+	outU = glm::dot(pvec, tvec) * invDet;
+	if (outU < 0.0f || outU > 1.0f)
+		return -1.0f;
+
+	const glm::vec3 qvec = glm::cross(tvec, edge1);
+	outV = glm::dot(ray.m_direction, qvec) * invDet;
+	if (outV < 0.0f || (outU + outV) > 1.0f)
+		return -1.0f;
+
+	return glm::dot(edge2, qvec) * invDet;
+}
+
+float BVHTraversal::intersectAabb(const SBVHRay& ray, const glm::vec3& aabbMin, const glm::vec3& aabbMax, float tMax)
+{
+	// Pick the near and far planes from the direction of the ray rather than sorting the distances, so that an empty
+	// (inverted) box is never hit.
+	float tNear = ray.m_tMin;
+	float tFar = tMax;
+	for (int dim = 0; dim < 3; dim++)
+	{
+		const bool isNegative = ray.m_invDirection[dim] < 0.0f;
+		const float tDimNear = ((isNegative ? aabbMax[dim] : aabbMin[dim]) - ray.m_origin[dim]) * ray.m_invDirection[dim];
+		const float tDimFar = ((isNegative ? aabbMin[dim] : aabbMax[dim]) - ray.m_origin[dim]) * ray.m_invDirection[dim];
+		tNear = std::max(tNear, tDimNear);
+		tFar = std::min(tFar, tDimFar);
+	}
+	return (tNear <= tFar) ? tNear : FLT_MAX;
+}
+
+bool BVHTraversal::_intersectLeaf(const SBVHRay& ray, size_t firstTriIdx, size_t numTris, int meshIdx, bool isAnyHit, SBVHHit& hit,
+	SBVHTraversalStats* stats) const
+{
+	if (m_triangleGroups != nullptr)
+	{
+		if (stats != nullptr)
+			stats->m_numTriTests += numTris;
+
+		const float prevT = hit.m_t;
+		m_triangleGroups->intersectLeaf(ray, firstTriIdx, numTris, meshIdx, hit);
+		return hit.m_t < prevT;
+	}
+
+	bool isHit = false;
+	for (size_t triIdx = firstTriIdx; triIdx < firstTriIdx + numTris; triIdx++)
+	{
+		if (stats != nullptr)
+			stats->m_numTriTests++;
+
+		float u, v;
+		float t;
+		if (m_triangleSoup != nullptr)
+		{
+			const BVHTree::PrecomputedTriangle& tri = (*m_triangleSoup)[triIdx];
+			t = intersectTriangleEdges(ray, glm::vec3(tri.m_v0), glm::vec3(tri.m_edge1), glm::vec3(tri.m_edge2), u, v);
+		}
+		else
+		{
+			const glm::ivec3& triIndices = m_tree.m_triIndices[triIdx];
+			t = intersectTriangle(ray,
+				glm::vec3(m_positions[triIndices.x]), glm::vec3(m_positions[triIndices.y]), glm::vec3(m_positions[triIndices.z]), u, v);
+		}
+		if (t > ray.m_tMin && t < hit.m_t)
+		{
+			hit.m_t = t;
+			hit.m_u = u;
+			hit.m_v = v;
+			hit.m_triIdx = int(triIdx);
+			hit.m_meshIdx = meshIdx;
+			isHit = true;
+			if (isAnyHit)
+				break;
+		}
+	}
+	return isHit;
+}
+
+bool BVHTraversal::intersect(const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const
+{
+	const std::vector<BVHTree::BVHNode>& nodes = m_tree.m_aabbNodes;
+	if (nodes.empty())
+		return false;
+
+	const size_t topLevelRootIdx = nodes[0].getTopLevelRootNode();
+	if (topLevelRootIdx == 0)
+		return false;
+
+	SBVHHit hit;
+	hit.m_t = ray.m_tMax;
+
+	const BVHTree::BVHNode& root = nodes[topLevelRootIdx];
+	if (stats != nullptr)
+		stats->m_numCacheLinesTouched += countCacheLines<BVHTree::BVHNode>(topLevelRootIdx, 1);
+	const float tRoot = intersectAabb(ray, root.m_minAABB, root.m_maxAABB, hit.m_t);
+	if (tRoot != FLT_MAX)
+		_intersectSubtree<false>(ray, topLevelRootIdx, -1, hit, stats);
+
+	if (!hit.isValid())
+		return false;
+
+	outHit = hit;
+	return true;
+}
+
+bool BVHTraversal::occluded(const SBVHRay& ray, SBVHTraversalStats* stats) const
+{
+	const std::vector<BVHTree::BVHNode>& nodes = m_tree.m_aabbNodes;
+	if (nodes.empty())
+		return false;
+
+	const size_t topLevelRootIdx = nodes[0].getTopLevelRootNode();
+	if (topLevelRootIdx == 0)
+		return false;
+
+	SBVHHit hit;
+	hit.m_t = ray.m_tMax;
+
+	const BVHTree::BVHNode& root = nodes[topLevelRootIdx];
+	if (stats != nullptr)
+		stats->m_numCacheLinesTouched += countCacheLines<BVHTree::BVHNode>(topLevelRootIdx, 1);
+	const float tRoot = intersectAabb(ray, root.m_minAABB, root.m_maxAABB, hit.m_t);
+	if (tRoot != FLT_MAX)
+		_intersectSubtree<true>(ray, topLevelRootIdx, -1, hit, stats);
+
+	return hit.isValid();
+}
+
+void BVHTraversal::intersectSubtree(const SBVHRay& ray, size_t firstNodeIdx, int firstMeshIdx, SBVHHit& ioHit, SBVHTraversalStats* stats) const
+{
+	_intersectSubtree<false>(ray, firstNodeIdx, firstMeshIdx, ioHit, stats);
+}
+
+template <bool IsAnyHit>
+void BVHTraversal::_intersectSubtree(const SBVHRay& ray, size_t firstNodeIdx, int firstMeshIdx, SBVHHit& ioHit, SBVHTraversalStats* stats) const
+{
+	const std::vector<BVHTree::BVHNode>& nodes = m_tree.m_aabbNodes;
+	const size_t numMeshes = nodes[0].getNumMeshes();
+
+	struct SStackEntry
+	{
+		size_t	m_nodeIdx;
+		float	m_tEntry;
+		int		m_meshIdx;
+	};
+	SStackEntry stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+
+	SStackEntry rootEntry = { firstNodeIdx, ray.m_tMin, firstMeshIdx };
+	stack[stackSize++] = rootEntry;
+
+	while (stackSize > 0)
+	{
+		const SStackEntry entry = stack[--stackSize];
+		if (entry.m_tEntry >= ioHit.m_t)
+			continue;
+
+		// Mesh entry: its bounds are the bounds of the mesh tree, which were already tested.
+		size_t nodeIdx = entry.m_nodeIdx;
+		int meshIdx = entry.m_meshIdx;
+		if (nodeIdx <= numMeshes)
+		{
+			meshIdx = int(nodeIdx) - 1;
+			nodeIdx = nodes[nodeIdx].getRootNode();
+			if (stats != nullptr)
+				stats->m_numCacheLinesTouched += countCacheLines<BVHTree::BVHNode>(nodeIdx, 1);
+		}
+
+		const BVHTree::BVHNode& node = nodes[nodeIdx];
+		if (node.isLeaf())
+		{
+			if (_intersectLeaf(ray, node.getFirstTri(), node.getNumTris(), meshIdx, IsAnyHit, ioHit, stats) && IsAnyHit)
+				return;
+			continue;
+		}
+
+		if (stats != nullptr)
+			stats->m_numNodesVisited++;
+
+		SStackEntry childEntries[2] = {
+			{ node.getLeftChild(), 0.0f, meshIdx },
+			{ node.getRightChild(), 0.0f, meshIdx }
+		};
+		for (int childIdx = 0; childIdx < 2; childIdx++)
+		{
+			const BVHTree::BVHNode& child = nodes[childEntries[childIdx].m_nodeIdx];
+			childEntries[childIdx].m_tEntry = intersectAabb(ray, child.m_minAABB, child.m_maxAABB, ioHit.m_t);
+		}
+		if (stats != nullptr)
+		{
+			stats->m_numAabbTests += 2;
+			if (childEntries[1].m_nodeIdx == childEntries[0].m_nodeIdx + 1)
+				stats->m_numCacheLinesTouched += countCacheLines<BVHTree::BVHNode>(childEntries[0].m_nodeIdx, 2);
+			else
+				stats->m_numCacheLinesTouched += countCacheLines<BVHTree::BVHNode>(childEntries[0].m_nodeIdx, 1) +
+					countCacheLines<BVHTree::BVHNode>(childEntries[1].m_nodeIdx, 1);
+		}
+
+		// Push the farthest child first so that the nearest one is visited next: for an occlusion test, the nearest child is also
+		// the one most likely to hold a blocker (e.g. the rest of the surface around the origin of a shadow feeler).
+		if (childEntries[0].m_tEntry < childEntries[1].m_tEntry)
+			std::swap(childEntries[0], childEntries[1]);
+		for (int childIdx = 0; childIdx < 2; childIdx++)
+		{
+			if (childEntries[childIdx].m_tEntry != FLT_MAX && stackSize < BVH_STACK_SIZE)
+				stack[stackSize++] = childEntries[childIdx];
+		}
+	}
+}
+
+template <int N>
+void BVHTraversal::_intersectChildren(const BVHTree::WideBVHNode<N>& node, const SBVHRay& ray, float tMax, float* outTEntries)
+{
+	// Same slab test as intersectAabb, over all the children at once.
+	const bool isNegativeX = ray.m_invDirection.x < 0.0f;
+	const bool isNegativeY = ray.m_invDirection.y < 0.0f;
+	const bool isNegativeZ = ray.m_invDirection.z < 0.0f;
+
+	const float* nearX = isNegativeX ? node.m_maxX : node.m_minX;
+	const float* farX = isNegativeX ? node.m_minX : node.m_maxX;
+	const float* nearY = isNegativeY ? node.m_maxY : node.m_minY;
+	const float* farY = isNegativeY ? node.m_minY : node.m_maxY;
+	const float* nearZ = isNegativeZ ? node.m_maxZ : node.m_minZ;
+	const float* farZ = isNegativeZ ? node.m_minZ : node.m_maxZ;
+
+	for (int childIdx = 0; childIdx < N; childIdx++)
+	{
+		const float tNear = std::max(std::max((nearX[childIdx] - ray.m_origin.x) * ray.m_invDirection.x, (nearY[childIdx] - ray.m_origin.y) * ray.m_invDirection.y),
+			std::max((nearZ[childIdx] - ray.m_origin.z) * ray.m_invDirection.z, ray.m_tMin));
+		const float tFar = std::min(std::min((farX[childIdx] - ray.m_origin.x) * ray.m_invDirection.x, (farY[childIdx] - ray.m_origin.y) * ray.m_invDirection.y),
+			std::min((farZ[childIdx] - ray.m_origin.z) * ray.m_invDirection.z, tMax));
+		outTEntries[childIdx] = (tNear <= tFar) ? tNear : FLT_MAX;
+	}
+}
+
+template <int N, typename T>
+void BVHTraversal::_intersectChildren(const BVHTree::QuantizedWideBVHNode<N, T>& node, const SBVHRay& ray, float tMax, float* outTEntries)
+{
+	// Decode the bounds (same formula as BVHTree::quantizeWideBVH) and fall back to the regular test.
+	BVHTree::WideBVHNode<N> decodedNode;
+	for (int childIdx = 0; childIdx < N; childIdx++)
+	{
+		decodedNode.m_minX[childIdx] = node.m_origin[0] + float(node.m_qMinX[childIdx]) * node.m_scale[0];
+		decodedNode.m_minY[childIdx] = node.m_origin[1] + float(node.m_qMinY[childIdx]) * node.m_scale[1];
+		decodedNode.m_minZ[childIdx] = node.m_origin[2] + float(node.m_qMinZ[childIdx]) * node.m_scale[2];
+		decodedNode.m_maxX[childIdx] = node.m_origin[0] + float(node.m_qMaxX[childIdx]) * node.m_scale[0];
+		decodedNode.m_maxY[childIdx] = node.m_origin[1] + float(node.m_qMaxY[childIdx]) * node.m_scale[1];
+		decodedNode.m_maxZ[childIdx] = node.m_origin[2] + float(node.m_qMaxZ[childIdx]) * node.m_scale[2];
+	}
+	_intersectChildren<N>(decodedNode, ray, tMax, outTEntries);
+
+	// The inverted box of an unused slot may still be hit once decoded, e.g. if the node is flat.
+	for (int childIdx = 0; childIdx < N; childIdx++)
+	{
+		if (node.m_children[childIdx] < 0)
+			outTEntries[childIdx] = FLT_MAX;
+	}
+}
+
+template <int N>
+bool BVHTraversal::intersectWide(const std::vector< BVHTree::WideBVHNode<N> >& wideNodes, const SBVHRay& ray, SBVHHit& outHit,
+	SBVHTraversalStats* stats) const
+{
+	return _intersectWide<N, false>(wideNodes, ray, outHit, stats);
+}
+
+template <int N>
+bool BVHTraversal::occludedWide(const std::vector< BVHTree::WideBVHNode<N> >& wideNodes, const SBVHRay& ray, SBVHTraversalStats* stats) const
+{
+	SBVHHit hit;
+	return _intersectWide<N, true>(wideNodes, ray, hit, stats);
+}
+
+template <int N, typename T>
+bool BVHTraversal::intersectQuantizedWide(const std::vector< BVHTree::QuantizedWideBVHNode<N, T> >& quantizedNodes, const SBVHRay& ray, SBVHHit& outHit,
+	SBVHTraversalStats* stats) const
+{
+	return _intersectWide<N, false>(quantizedNodes, ray, outHit, stats);
+}
+
+template <int N, bool IsAnyHit, typename TNode>
+bool BVHTraversal::_intersectWide(const std::vector<TNode>& nodes, const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const
+{
+	if (nodes.empty())
+		return false;
+
+	SBVHHit hit;
+	hit.m_t = ray.m_tMax;
+
+	// Leaves and mesh roots are pushed like the other children, so that they are also visited front to back.
+	struct SStackEntry
+	{
+		int32_t	m_link;
+		int32_t	m_count;
+		float	m_tEntry;
+		int		m_meshIdx;
+	};
+	const int maxStackSize = BVH_STACK_SIZE * (N - 1) + 1;
+	SStackEntry stack[maxStackSize];
+	int stackSize = 0;
+
+	SStackEntry rootEntry = { 0, 0, ray.m_tMin, -1 };
+	stack[stackSize++] = rootEntry;
+
+	while (stackSize > 0)
+	{
+		const SStackEntry entry = stack[--stackSize];
+		if (entry.m_tEntry >= hit.m_t)
+			continue;
+
+		if (entry.m_count > 0)
+		{
+			if (_intersectLeaf(ray, size_t(entry.m_link), size_t(entry.m_count), entry.m_meshIdx, IsAnyHit, hit, stats) && IsAnyHit)
+				break;
+			continue;
+		}
+
+		const int meshIdx = (entry.m_count < 0) ? -entry.m_count - 1 : entry.m_meshIdx;
+		const TNode& node = nodes[entry.m_link];
+		if (stats != nullptr)
+		{
+			stats->m_numNodesVisited++;
+			stats->m_numAabbTests += N;
+			stats->m_numCacheLinesTouched += countCacheLines<TNode>(size_t(entry.m_link), 1);
+		}
+
+		float tEntries[N];
+		_intersectChildren(node, ray, hit.m_t, tEntries);
+
+		// Push the children which were hit from the farthest to the nearest.
+		const int firstChildEntryIdx = stackSize;
+		for (int childIdx = 0; childIdx < N; childIdx++)
+		{
+			if (tEntries[childIdx] == FLT_MAX || stackSize == maxStackSize)
+				continue;
+
+			SStackEntry childEntry = { node.m_children[childIdx], node.m_counts[childIdx], tEntries[childIdx], meshIdx };
+			int childEntryIdx = stackSize++;
+			for (; childEntryIdx > firstChildEntryIdx && stack[childEntryIdx - 1].m_tEntry < childEntry.m_tEntry; childEntryIdx--)
+			{
+				stack[childEntryIdx] = stack[childEntryIdx - 1];
+			}
+			stack[childEntryIdx] = childEntry;
+		}
+	}
+
+	if (!hit.isValid())
+		return false;
+
+	outHit = hit;
+	return true;
+}
+
+template bool BVHTraversal::intersectWide<2>(const std::vector< BVHTree::WideBVHNode<2> >& wideNodes, const SBVHRay& ray, SBVHHit& outHit,
+	SBVHTraversalStats* stats) const;
+template bool BVHTraversal::intersectWide<4>(const std::vector< BVHTree::WideBVHNode<4> >& wideNodes, const SBVHRay& ray, SBVHHit& outHit,
+	SBVHTraversalStats* stats) const;
+template bool BVHTraversal::intersectWide<8>(const std::vector< BVHTree::WideBVHNode<8> >& wideNodes, const SBVHRay& ray, SBVHHit& outHit,
+	SBVHTraversalStats* stats) const;
+
+template bool BVHTraversal::occludedWide<2>(const std::vector< BVHTree::WideBVHNode<2> >& wideNodes, const SBVHRay& ray,
+	SBVHTraversalStats* stats) const;
+template bool BVHTraversal::occludedWide<4>(const std::vector< BVHTree::WideBVHNode<4> >& wideNodes, const SBVHRay& ray,
+	SBVHTraversalStats* stats) const;
+template bool BVHTraversal::occludedWide<8>(const std::vector< BVHTree::WideBVHNode<8> >& wideNodes, const SBVHRay& ray,
+	SBVHTraversalStats* stats) const;
+
+template bool BVHTraversal::intersectQuantizedWide<2, uint8_t>(const std::vector< BVHTree::QuantizedWideBVHNode<2, uint8_t> >& quantizedNodes,
+	const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const;
+template bool BVHTraversal::intersectQuantizedWide<4, uint8_t>(const std::vector< BVHTree::QuantizedWideBVHNode<4, uint8_t> >& quantizedNodes,
+	const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const;
+template bool BVHTraversal::intersectQuantizedWide<8, uint8_t>(const std::vector< BVHTree::QuantizedWideBVHNode<8, uint8_t> >& quantizedNodes,
+	const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const;
+template bool BVHTraversal::intersectQuantizedWide<2, uint16_t>(const std::vector< BVHTree::QuantizedWideBVHNode<2, uint16_t> >& quantizedNodes,
+	const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const;
+template bool BVHTraversal::intersectQuantizedWide<4, uint16_t>(const std::vector< BVHTree::QuantizedWideBVHNode<4, uint16_t> >& quantizedNodes,
+	const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const;
+template bool BVHTraversal::intersectQuantizedWide<8, uint16_t>(const std::vector< BVHTree::QuantizedWideBVHNode<8, uint16_t> >& quantizedNodes,
+	const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const;
@@ -0,0 +1,137 @@
+/******************************************************************************/
+/*!
+\file	BVHTraversal.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_TRAVERSAL_H_
+#define _BVH_TRAVERSAL_H_
+
+#include <vector>
+#include <float.h>
+
+#include <glm/glm.hpp>
+
+#include "VulkanMeshLoader.h"
+
+class BVHTriangleGroups;
+
+struct SBVHRay
+{
+	SBVHRay(const glm::vec3& origin, const glm::vec3& direction, float tMin = 0.0001f, float tMax = FLT_MAX);
+
+	glm::vec3	m_origin;
+	glm::vec3	m_direction;
+	glm::vec3	m_invDirection;
+	float		m_tMin;
+	float		m_tMax;
+};
+
+struct SBVHHit
+{
+	SBVHHit() : m_t(FLT_MAX), m_u(0.0f), m_v(0.0f), m_triIdx(-1), m_meshIdx(-1) {}
+
+	bool isValid() const { return m_triIdx >= 0; }
+
+	float	m_t;
+	float	m_u;		// Barycentric coordinates of the hit point, relative to the second and third vertices.
+	float	m_v;
+	int		m_triIdx;	// Index of the triangle in BVHTree::m_triIndices.
+	int		m_meshIdx;
+};
+
+// Counters filled by the traversal routines when given, to compare trees without relying on timings only.
+// Only interior nodes are counted as visited, leaves are accounted for by their triangle tests.
+// The cache lines are the 64 bytes lines of the node buffer read by each fetch (the two children of a binary node, which
+// share their lines when they are stored next to each other, or a whole wide node), counted again on every fetch since
+// there is no cache model behind it. Triangle data isn't counted.
+struct SBVHTraversalStats
+{
+	SBVHTraversalStats() : m_numNodesVisited(0), m_numAabbTests(0), m_numTriTests(0), m_numCacheLinesTouched(0) {}
+
+	size_t	m_numNodesVisited;
+	size_t	m_numAabbTests;
+	size_t	m_numTriTests;
+	size_t	m_numCacheLinesTouched;
+};
+
+// Single ray CPU traversal of a BVHTree, either through its binary trees (same algorithm as traverseBvh in
+// data/shaders/hybrid/raytrace.comp) or through a collapsed wide tree (same algorithm as traverseWideBvh).
+class BVHTraversal
+{
+public:
+
+	// The leaves are tested a group of triangles at a time against triangleGroups (see BVHTriangleGroups) when given, then
+	// one triangle at a time against triangleSoup (see BVHTree::buildTriangleSoup), otherwise their vertices are fetched
+	// through BVHTree::m_triIndices.
+	BVHTraversal(const BVHTree& tree, const std::vector<glm::vec4>& positions,
+		const std::vector<BVHTree::PrecomputedTriangle>* triangleSoup = nullptr, const BVHTriangleGroups* triangleGroups = nullptr);
+
+	// Closest hit along the ray within [ray.m_tMin, ray.m_tMax]. Returns false if nothing was hit.
+	bool intersect(const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats = nullptr) const;
+
+	// Any hit along the ray within [ray.m_tMin, ray.m_tMax], for shadow feelers: the traversal stops at the first triangle
+	// hit, still visiting the nearest children first, and doesn't report which one it was.
+	bool occluded(const SBVHRay& ray, SBVHTraversalStats* stats = nullptr) const;
+
+	// Same traversal from the given node (or mesh entry, meshIdx being -1 above the mesh trees), whose bounds are assumed
+	// to be hit. ioHit is only updated with closer hits than ioHit.m_t, so that a ray can carry on from a packet traversal.
+	void intersectSubtree(const SBVHRay& ray, size_t firstNodeIdx, int firstMeshIdx, SBVHHit& ioHit, SBVHTraversalStats* stats = nullptr) const;
+
+	template <int N>
+	bool intersectWide(const std::vector< BVHTree::WideBVHNode<N> >& wideNodes, const SBVHRay& ray, SBVHHit& outHit,
+		SBVHTraversalStats* stats = nullptr) const;
+
+	template <int N>
+	bool occludedWide(const std::vector< BVHTree::WideBVHNode<N> >& wideNodes, const SBVHRay& ray, SBVHTraversalStats* stats = nullptr) const;
+
+	// Same as intersectWide, with the child bounds decoded from their quantized values (see BVHTree::quantizeWideBVH).
+	template <int N, typename T>
+	bool intersectQuantizedWide(const std::vector< BVHTree::QuantizedWideBVHNode<N, T> >& quantizedNodes, const SBVHRay& ray, SBVHHit& outHit,
+		SBVHTraversalStats* stats = nullptr) const;
+
+	// Möller-Trumbore, returns the distance to the triangle (with its barycentric coordinates) or a negative value.
+	static float intersectTriangle(const SBVHRay& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& outU, float& outV);
+	// Same as intersectTriangle, with the edges leaving v0 precomputed.
+	static float intersectTriangleEdges(const SBVHRay& ray, const glm::vec3& v0, const glm::vec3& edge1, const glm::vec3& edge2, float& outU, float& outV);
+
+	// Slab test, returns the entry distance of the ray into the box or FLT_MAX if the box isn't hit within [ray.m_tMin, tMax].
+	static float intersectAabb(const SBVHRay& ray, const glm::vec3& aabbMin, const glm::vec3& aabbMax, float tMax);
+
+private:
+
+	// Closest hit, or any hit if IsAnyHit is set.
+	template <bool IsAnyHit>
+	void _intersectSubtree(const SBVHRay& ray, size_t firstNodeIdx, int firstMeshIdx, SBVHHit& ioHit, SBVHTraversalStats* stats) const;
+	template <int N, bool IsAnyHit, typename TNode>
+	bool _intersectWide(const std::vector<TNode>& nodes, const SBVHRay& ray, SBVHHit& outHit, SBVHTraversalStats* stats) const;
+
+	// Entry distance of the ray into each child box of the node, FLT_MAX for the children which aren't hit before tMax.
+	template <int N>
+	static void _intersectChildren(const BVHTree::WideBVHNode<N>& node, const SBVHRay& ray, float tMax, float* outTEntries);
+	template <int N, typename T>
+	static void _intersectChildren(const BVHTree::QuantizedWideBVHNode<N, T>& node, const SBVHRay& ray, float tMax, float* outTEntries);
+
+	// Returns true if a triangle was hit before hit.m_t, stopping at the first one if isAnyHit is set (the groups of
+	// triangles are tested whole though).
+	bool _intersectLeaf(const SBVHRay& ray, size_t firstTriIdx, size_t numTris, int meshIdx, bool isAnyHit, SBVHHit& hit,
+		SBVHTraversalStats* stats) const;
+
+	const BVHTree&					m_tree;
+	const std::vector<glm::vec4>&	m_positions;
+	const std::vector<BVHTree::PrecomputedTriangle>* m_triangleSoup;
+	const BVHTriangleGroups*		m_triangleGroups;
+};
+
+#endif // _BVH_TRAVERSAL_H_
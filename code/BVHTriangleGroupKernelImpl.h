@@ -0,0 +1,104 @@
+/******************************************************************************/
+/*!
+\file	BVHTriangleGroupKernelImpl.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_TRIANGLE_GROUP_KERNEL_IMPL_H_
+#define _BVH_TRIANGLE_GROUP_KERNEL_IMPL_H_
+
+// Ray against triangle group test shared by the kernels, only included by BVHTriangleGroupsSSE/AVX2.cpp. TSimd is one of
+// the wrappers of BVHSimd.h, whose width is the group size.
+
+#include "BVHTriangleGroupKernels.h"
+
+namespace
+{
+	template <typename TSimd>
+	int intersectTriangleGroups(const float* groups, size_t numGroups, const SBVHTriangleGroupRay& ray, float& ioT, float& outU, float& outV)
+	{
+		typedef typename TSimd::Float Float;
+		typedef typename TSimd::Mask Mask;
+		const int WIDTH = TSimd::WIDTH;
+
+		const Float ox = TSimd::set1(ray.m_origin[0]), oy = TSimd::set1(ray.m_origin[1]), oz = TSimd::set1(ray.m_origin[2]);
+		const Float dx = TSimd::set1(ray.m_direction[0]), dy = TSimd::set1(ray.m_direction[1]), dz = TSimd::set1(ray.m_direction[2]);
+		const Float tMin = TSimd::set1(ray.m_tMin);
+		const Float minDet = TSimd::set1(1e-12f);
+		const Float zero = TSimd::set1(0.0f);
+		const Float one = TSimd::set1(1.0f);
+
+		int closestSlotIdx = -1;
+		for (size_t groupIdx = 0; groupIdx < numGroups; groupIdx++)
+		{
+			const float* group = groups + groupIdx * BVH_TRIANGLE_GROUP_FLOATS(WIDTH);
+			const Float v0x = TSimd::loadu(group), v0y = TSimd::loadu(group + WIDTH), v0z = TSimd::loadu(group + 2 * WIDTH);
+			const Float e1x = TSimd::loadu(group + 3 * WIDTH), e1y = TSimd::loadu(group + 4 * WIDTH), e1z = TSimd::loadu(group + 5 * WIDTH);
+			const Float e2x = TSimd::loadu(group + 6 * WIDTH), e2y = TSimd::loadu(group + 7 * WIDTH), e2z = TSimd::loadu(group + 8 * WIDTH);
+
+			// Same operations in the same order as BVHTraversal::intersectTriangleEdges (glm's cross and dot), so that both
+			// find the same distances.
+			// pvec = cross(direction, edge2), det = dot(pvec, edge1).
+			const Float px = TSimd::sub(TSimd::mul(dy, e2z), TSimd::mul(e2y, dz));
+			const Float py = TSimd::sub(TSimd::mul(dz, e2x), TSimd::mul(e2z, dx));
+			const Float pz = TSimd::sub(TSimd::mul(dx, e2y), TSimd::mul(e2x, dy));
+			const Float det = TSimd::add(TSimd::add(TSimd::mul(px, e1x), TSimd::mul(py, e1y)), TSimd::mul(pz, e1z));
+			Mask isHit = TSimd::cmpGe(TSimd::abs(det), minDet);
+			if (TSimd::toBits(isHit) == 0)
+				continue;
+			const Float invDet = TSimd::div(one, det);
+
+			const Float tx = TSimd::sub(ox, v0x);
+			const Float ty = TSimd::sub(oy, v0y);
+			const Float tz = TSimd::sub(oz, v0z);
+
+			const Float u = TSimd::mul(TSimd::add(TSimd::add(TSimd::mul(px, tx), TSimd::mul(py, ty)), TSimd::mul(pz, tz)), invDet);
+			isHit = TSimd::andMask(isHit, TSimd::andMask(TSimd::cmpGe(u, zero), TSimd::cmpLe(u, one)));
+
+			// qvec = cross(tvec, edge1).
+			const Float qx = TSimd::sub(TSimd::mul(ty, e1z), TSimd::mul(e1y, tz));
+			const Float qy = TSimd::sub(TSimd::mul(tz, e1x), TSimd::mul(e1z, tx));
+			const Float qz = TSimd::sub(TSimd::mul(tx, e1y), TSimd::mul(e1x, ty));
+
+			const Float v = TSimd::mul(TSimd::add(TSimd::add(TSimd::mul(dx, qx), TSimd::mul(dy, qy)), TSimd::mul(dz, qz)), invDet);
+			isHit = TSimd::andMask(isHit, TSimd::andMask(TSimd::cmpGe(v, zero), TSimd::cmpLe(TSimd::add(u, v), one)));
+
+			const Float t = TSimd::mul(TSimd::add(TSimd::add(TSimd::mul(e2x, qx), TSimd::mul(e2y, qy)), TSimd::mul(e2z, qz)), invDet);
+			isHit = TSimd::andMask(isHit, TSimd::andMask(TSimd::cmpGt(t, tMin), TSimd::cmpLt(t, TSimd::set1(ioT))));
+
+			int hitSlots = TSimd::toBits(isHit);
+			if (hitSlots == 0)
+				continue;
+
+			// Nearest of the hit slots, the first one on ties like the scalar loop over the triangles.
+			float ts[WIDTH], us[WIDTH], vs[WIDTH];
+			TSimd::storeu(ts, t);
+			TSimd::storeu(us, u);
+			TSimd::storeu(vs, v);
+			for (int slotIdx = 0; hitSlots != 0; slotIdx++, hitSlots >>= 1)
+			{
+				if ((hitSlots & 1) == 0 || !(ts[slotIdx] < ioT))
+					continue;
+
+				ioT = ts[slotIdx];
+				outU = us[slotIdx];
+				outV = vs[slotIdx];
+				closestSlotIdx = int(groupIdx) * WIDTH + slotIdx;
+			}
+		}
+		return closestSlotIdx;
+	}
+}
+
+#endif // _BVH_TRIANGLE_GROUP_KERNEL_IMPL_H_
@@ -0,0 +1,57 @@
+/******************************************************************************/
+/*!
+\file	BVHTriangleGroupKernels.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_TRIANGLE_GROUP_KERNELS_H_
+#define _BVH_TRIANGLE_GROUP_KERNELS_H_
+
+// Interface between BVHTriangleGroups and its kernels, plain data only for the same reason as BVHPacketKernels.h.
+
+#include <stddef.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BVH_TRIANGLE_GROUP_X86 1
+#else
+#define BVH_TRIANGLE_GROUP_X86 0
+#endif
+
+// Number of floats of a group of groupSize triangles: the x, y and z of v0, edge1 (v1 - v0) and edge2 (v2 - v0), each
+// stored for the groupSize triangles in a row. The unused slots of a group are zeros, which no ray can hit.
+#define BVH_TRIANGLE_GROUP_FLOATS(groupSize) (9 * (groupSize))
+
+struct SBVHTriangleGroupRay
+{
+	float	m_origin[3];
+	float	m_direction[3];
+	float	m_tMin;
+};
+
+// Closest hit of the ray within (ray.m_tMin, ioT) among the triangles of the numGroups groups, with the same results as
+// BVHTraversal::intersectTriangleEdges. Returns the index of its slot (group index * group size + slot in the group), or -1
+// if none was hit, in which case ioT, outU and outV are left as is.
+typedef int (*BVHTriangleGroupKernelFunc)(const float* groups, size_t numGroups, const SBVHTriangleGroupRay& ray, float& ioT,
+	float& outU, float& outV);
+
+struct SBVHTriangleGroupKernel
+{
+	int							m_groupSize;
+	BVHTriangleGroupKernelFunc	m_intersect;	// nullptr := the kernel wasn't compiled in.
+};
+
+SBVHTriangleGroupKernel getBVHTriangleGroupKernelSSE();
+SBVHTriangleGroupKernel getBVHTriangleGroupKernelAVX2();
+
+#endif // _BVH_TRIANGLE_GROUP_KERNELS_H_
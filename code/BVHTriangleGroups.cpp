@@ -0,0 +1,193 @@
+/******************************************************************************/
+/*!
+\file	BVHTriangleGroups.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "BVHTriangleGroups.h"
+
+#include <algorithm>
+
+#include "BVHTraversal.h"
+#include "BVHPacketTraversal.h"
+#include "BVHTriangleGroupKernels.h"
+
+namespace
+{
+	SBVHTriangleGroupKernel getKernel(int groupSize)
+	{
+		return (groupSize == 8) ? getBVHTriangleGroupKernelAVX2() : getBVHTriangleGroupKernelSSE();
+	}
+
+	// Scalar version of the kernels, for the builds without any of them.
+	int intersectTriangleGroupsScalar(const float* groups, size_t numGroups, int groupSize, const SBVHRay& ray, float& ioT, float& outU, float& outV)
+	{
+		int closestSlotIdx = -1;
+		for (size_t groupIdx = 0; groupIdx < numGroups; groupIdx++)
+		{
+			const float* group = groups + groupIdx * BVH_TRIANGLE_GROUP_FLOATS(groupSize);
+			for (int slotIdx = 0; slotIdx < groupSize; slotIdx++)
+			{
+				const glm::vec3 v0(group[slotIdx], group[groupSize + slotIdx], group[2 * groupSize + slotIdx]);
+				const glm::vec3 edge1(group[3 * groupSize + slotIdx], group[4 * groupSize + slotIdx], group[5 * groupSize + slotIdx]);
+				const glm::vec3 edge2(group[6 * groupSize + slotIdx], group[7 * groupSize + slotIdx], group[8 * groupSize + slotIdx]);
+				float u, v;
+				const float t = BVHTraversal::intersectTriangleEdges(ray, v0, edge1, edge2, u, v);
+				if (t > ray.m_tMin && t < ioT)
+				{
+					ioT = t;
+					outU = u;
+					outV = v;
+					closestSlotIdx = int(groupIdx) * groupSize + slotIdx;
+				}
+			}
+		}
+		return closestSlotIdx;
+	}
+}
+
+int BVHTriangleGroups::getSupportedGroupSize()
+{
+	// Same CPU features as the packet kernels, which are compiled with the same flags.
+	const bool hasAVX2 = BVHPacketTraversal::getSupportedSimdLevel() >= BVH_SIMD_AVX2;
+	return (hasAVX2 && getBVHTriangleGroupKernelAVX2().m_intersect != nullptr) ? 8 : 4;
+}
+
+BVHTriangleGroups::BVHTriangleGroups(int groupSize)
+: m_groupSize((groupSize > 4) ? std::min(8, getSupportedGroupSize()) : 4)
+, m_numTris(0)
+{
+}
+
+const char* BVHTriangleGroups::getKernelName() const
+{
+	if (getKernel(m_groupSize).m_intersect == nullptr)
+		return "scalar";
+	return (m_groupSize == 8) ? "AVX2" : "SSE";
+}
+
+size_t BVHTriangleGroups::getMemorySize() const
+{
+	return m_groups.size() * sizeof(float) + (m_groupFirstTris.size() + m_leafFirstGroups.size()) * sizeof(int32_t);
+}
+
+void BVHTriangleGroups::build(const BVHTree& tree, const std::vector<glm::vec4>& positions)
+{
+	const std::vector<BVHTree::BVHNode>& nodes = tree.m_aabbNodes;
+	const size_t groupFloats = BVH_TRIANGLE_GROUP_FLOATS(m_groupSize);
+
+	m_groups.clear();
+	m_groupFirstTris.clear();
+	m_leafFirstGroups.assign(tree.m_triIndices.size(), -1);
+	m_numTris = 0;
+	if (nodes.empty())
+		return;
+
+	// Only the leaves reachable from the mesh entries, the free node ranges (see BVHTree::removeMesh) may hold stale ones.
+	std::vector<size_t> nodeStack;
+	const size_t numMeshes = nodes[0].getNumMeshes();
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		const BVHTree::BVHNode& meshEntry = nodes[meshIdx + 1];
+		if (meshEntry.getNumMeshNodes() == 0)
+			continue;
+
+		nodeStack.push_back(meshEntry.getRootNode());
+		while (!nodeStack.empty())
+		{
+			const BVHTree::BVHNode& node = nodes[nodeStack.back()];
+			nodeStack.pop_back();
+			if (!node.isLeaf())
+			{
+				nodeStack.push_back(node.getRightChild());
+				nodeStack.push_back(node.getLeftChild());
+				continue;
+			}
+
+			const size_t firstTriIdx = node.getFirstTri();
+			const size_t numTris = node.getNumTris();
+			if (numTris == 0)
+				continue;
+
+			m_leafFirstGroups[firstTriIdx] = int32_t(m_groupFirstTris.size());
+			m_numTris += numTris;
+			for (size_t groupFirstTriIdx = firstTriIdx; groupFirstTriIdx < firstTriIdx + numTris; groupFirstTriIdx += size_t(m_groupSize))
+			{
+				m_groupFirstTris.push_back(int32_t(groupFirstTriIdx));
+				m_groups.resize(m_groups.size() + groupFloats, 0.0f);
+				float* group = &m_groups[m_groups.size() - groupFloats];
+
+				const size_t numGroupTris = std::min(size_t(m_groupSize), firstTriIdx + numTris - groupFirstTriIdx);
+				for (size_t slotIdx = 0; slotIdx < numGroupTris; slotIdx++)
+				{
+					// Same values as BVHTree::buildTriangleSoup.
+					const glm::ivec3& triIndices = tree.m_triIndices[groupFirstTriIdx + slotIdx];
+					const glm::vec3 v0(positions[triIndices.x]);
+					const glm::vec3 edge1 = glm::vec3(positions[triIndices.y]) - v0;
+					const glm::vec3 edge2 = glm::vec3(positions[triIndices.z]) - v0;
+					for (int dim = 0; dim < 3; dim++)
+					{
+						group[dim * m_groupSize + slotIdx] = v0[dim];
+						group[(3 + dim) * m_groupSize + slotIdx] = edge1[dim];
+						group[(6 + dim) * m_groupSize + slotIdx] = edge2[dim];
+					}
+				}
+			}
+		}
+	}
+}
+
+void BVHTriangleGroups::_intersectGroups(const SBVHRay& ray, size_t firstGroupIdx, size_t numGroups, int meshIdx, SBVHHit& ioHit) const
+{
+	const float* groups = &m_groups[firstGroupIdx * BVH_TRIANGLE_GROUP_FLOATS(m_groupSize)];
+	float u = 0.0f, v = 0.0f;
+	int slotIdx;
+
+	const SBVHTriangleGroupKernel kernel = getKernel(m_groupSize);
+	if (kernel.m_intersect != nullptr)
+	{
+		SBVHTriangleGroupRay groupRay;
+		for (int dim = 0; dim < 3; dim++)
+		{
+			groupRay.m_origin[dim] = ray.m_origin[dim];
+			groupRay.m_direction[dim] = ray.m_direction[dim];
+		}
+		groupRay.m_tMin = ray.m_tMin;
+		slotIdx = kernel.m_intersect(groups, numGroups, groupRay, ioHit.m_t, u, v);
+	}
+	else
+	{
+		slotIdx = intersectTriangleGroupsScalar(groups, numGroups, m_groupSize, ray, ioHit.m_t, u, v);
+	}
+
+	if (slotIdx < 0)
+		return;
+
+	ioHit.m_u = u;
+	ioHit.m_v = v;
+	ioHit.m_triIdx = m_groupFirstTris[firstGroupIdx + slotIdx / m_groupSize] + slotIdx % m_groupSize;
+	ioHit.m_meshIdx = meshIdx;
+}
+
+void BVHTriangleGroups::intersectLeaf(const SBVHRay& ray, size_t firstTriIdx, size_t numTris, int meshIdx, SBVHHit& ioHit) const
+{
+	const size_t numGroups = (numTris + size_t(m_groupSize) - 1) / size_t(m_groupSize);
+	_intersectGroups(ray, size_t(m_leafFirstGroups[firstTriIdx]), numGroups, meshIdx, ioHit);
+}
+
+void BVHTriangleGroups::intersectAll(const SBVHRay& ray, SBVHHit& ioHit) const
+{
+	if (!m_groupFirstTris.empty())
+		_intersectGroups(ray, 0, m_groupFirstTris.size(), -1, ioHit);
+}
@@ -0,0 +1,73 @@
+/******************************************************************************/
+/*!
+\file	BVHTriangleGroups.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _BVH_TRIANGLE_GROUPS_H_
+#define _BVH_TRIANGLE_GROUPS_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "VulkanMeshLoader.h"
+
+struct SBVHRay;
+struct SBVHHit;
+
+// Leaf storage of a BVHTree which packs the triangles of each leaf as SoA groups of 4 or 8 (the width of the SSE or AVX2
+// registers), so that a ray is tested against a whole group at once instead of one triangle at a time. Each group holds
+// the precomputed triangles of BVHTree::buildTriangleSoup (v0 and the two edges leaving it), the groups of a leaf follow
+// each other and its last one is padded with triangles which can't be hit.
+// The kernels are compiled once per instruction set (BVHTriangleGroupsSSE/AVX2.cpp), the group size picking the kernel.
+class BVHTriangleGroups
+{
+public:
+
+	// 8 on the CPUs supporting AVX2 (when the AVX2 kernel was compiled in), 4 otherwise.
+	static int getSupportedGroupSize();
+
+	// The group size is rounded to 4 or 8 and clamped to getSupportedGroupSize().
+	explicit BVHTriangleGroups(int groupSize = getSupportedGroupSize());
+
+	// Packs the triangles of every leaf of the tree, to be redone whenever the tree or the positions change.
+	void build(const BVHTree& tree, const std::vector<glm::vec4>& positions);
+
+	// Closest hit of the ray among the numTris triangles of the leaf starting at firstTriIdx in BVHTree::m_triIndices, same
+	// as the scalar leaf test of BVHTraversal: ioHit is only updated with closer hits than ioHit.m_t.
+	void intersectLeaf(const SBVHRay& ray, size_t firstTriIdx, size_t numTris, int meshIdx, SBVHHit& ioHit) const;
+
+	// Same test against all the groups of the tree, for throughput measurements. The mesh of the hit isn't known (-1).
+	void intersectAll(const SBVHRay& ray, SBVHHit& ioHit) const;
+
+	int getGroupSize() const { return m_groupSize; }
+	const char* getKernelName() const;
+	size_t getNumGroups() const { return m_groupFirstTris.size(); }
+	size_t getNumTriangles() const { return m_numTris; }
+	size_t getMemorySize() const;
+
+private:
+
+	void _intersectGroups(const SBVHRay& ray, size_t firstGroupIdx, size_t numGroups, int meshIdx, SBVHHit& ioHit) const;
+
+	int						m_groupSize;
+	std::vector<float>		m_groups;			// BVH_TRIANGLE_GROUP_FLOATS(m_groupSize) floats per group, see BVHTriangleGroupKernels.h.
+	std::vector<int32_t>	m_groupFirstTris;	// Index in BVHTree::m_triIndices of the first triangle of each group.
+	std::vector<int32_t>	m_leafFirstGroups;	// First group of the leaf starting at each triangle, -1 for the other triangles.
+	size_t					m_numTris;
+};
+
+#endif // _BVH_TRIANGLE_GROUPS_H_
@@ -0,0 +1,40 @@
+/******************************************************************************/
+/*!
+\file	BVHTriangleGroupsAVX2.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "BVHTriangleGroupKernels.h"
+
+// Only compiled with AVX2 enabled by the build (see CMakeLists.txt), like BVHPacketTraversalAVX2.cpp.
+#if BVH_TRIANGLE_GROUP_X86 && defined(__AVX2__)
+
+#include "BVHSimd.h"
+#include "BVHTriangleGroupKernelImpl.h"
+
+SBVHTriangleGroupKernel getBVHTriangleGroupKernelAVX2()
+{
+	SBVHTriangleGroupKernel kernel = { SSimdAVX2::WIDTH, &intersectTriangleGroups<SSimdAVX2> };
+	return kernel;
+}
+
+#else
+
+SBVHTriangleGroupKernel getBVHTriangleGroupKernelAVX2()
+{
+	SBVHTriangleGroupKernel kernel = { 0, nullptr };
+	return kernel;
+}
+
+#endif
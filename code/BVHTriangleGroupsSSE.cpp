@@ -0,0 +1,39 @@
+/******************************************************************************/
+/*!
+\file	BVHTriangleGroupsSSE.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "BVHTriangleGroupKernels.h"
+
+#if BVH_TRIANGLE_GROUP_X86
+
+#include "BVHSimd.h"
+#include "BVHTriangleGroupKernelImpl.h"
+
+SBVHTriangleGroupKernel getBVHTriangleGroupKernelSSE()
+{
+	SBVHTriangleGroupKernel kernel = { SSimdSSE::WIDTH, &intersectTriangleGroups<SSimdSSE> };
+	return kernel;
+}
+
+#else
+
+SBVHTriangleGroupKernel getBVHTriangleGroupKernelSSE()
+{
+	SBVHTriangleGroupKernel kernel = { 0, nullptr };
+	return kernel;
+}
+
+#endif
@@ -0,0 +1,606 @@
+/******************************************************************************/
+/*!
+\file	CpuRaytracer.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "CpuRaytracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#include "ThreadPool.h"
+
+namespace
+{
+	// Same constants as raytrace.comp.
+	const float RAYTRACE_EPSILON = 0.0001f;
+	const float RAYTRACE_MAXLEN = 1000.0f;
+	const int RAYTRACE_TRACEDEPTH = 2;
+	const int RAYTRACE_GROUND_MESH_IDX = 2;
+	const int RAYTRACE_MAX_LIGHTS = 6;
+	const int RAYTRACE_TILE_SIZE = 16;
+	const size_t RAYTRACE_WAVEFRONT_POOL_SIZE = 1024 * 1024;
+
+	// Same as VulkanRenderer::getAssetPath().
+	const char* RAYTRACE_ASSET_PATH = "../data/";
+
+	const int RAYTRACE_IMAGE_SIZE = 800;
+
+	float lightDiffuse(const glm::vec3& normal, const glm::vec3& lightDir)
+	{
+		return glm::clamp(glm::dot(normal, lightDir), 0.1f, 1.0f);
+	}
+
+	// Like the shader, the half vector is built from the camera position itself rather than the direction to the camera.
+	float lightSpecular(const glm::vec3& cameraPosition, const glm::vec3& normal, const glm::vec3& lightDir, float specularFactor)
+	{
+		const glm::vec3 viewVec = glm::normalize(cameraPosition);
+		const glm::vec3 halfVec = glm::normalize(lightDir + viewVec);
+		return std::pow(glm::clamp(glm::dot(normal, halfVec), 0.0f, 1.0f), specularFactor);
+	}
+
+	float sintheta2(const glm::vec3& i, const glm::vec3& n)
+	{
+		return std::max(0.0f, 1.0f - glm::dot(i, n) * glm::dot(i, n));
+	}
+
+	glm::vec3 getPointOnRay(const glm::vec3& origin, const glm::vec3& direction, float t)
+	{
+		return origin + (t - RAYTRACE_EPSILON) * glm::normalize(direction);
+	}
+
+	bool isShadowReceiver(int materialId, const SCpuRaytraceSettings& settings)
+	{
+		// Only the ground receives shadows.
+		return settings.m_isShadows && materialId == RAYTRACE_GROUND_MESH_IDX;
+	}
+
+	// Storage of a queue of the wavefront mode, appended to by all the workers of a stage at once.
+	template <typename T>
+	struct SWavefrontQueue
+	{
+		explicit SWavefrontQueue(size_t capacity = 0) : m_entries(capacity), m_count(0) {}
+
+		void append(const T& entry) { m_entries[m_count.fetch_add(1)] = entry; }
+		void clear() { m_count = 0; }
+		size_t size() const { return m_count.load(); }
+
+		std::vector<T>		m_entries;
+		std::atomic<size_t>	m_count;
+	};
+
+	// Hit of an extension ray, as WavefrontHit.
+	struct SWavefrontHit
+	{
+		size_t		m_pathIdx;
+		int			m_materialId;
+		glm::vec3	m_hitPoint;
+		glm::vec3	m_hitNormal;
+	};
+}
+
+SCpuRaytraceSettings::SCpuRaytraceSettings()
+: m_cameraPosition(0.0f)
+, m_isBVH(true)
+, m_isShadows(true)
+, m_isTransparency(true)
+, m_isReflection(true)
+, m_isColorByRayBounces(false)
+, m_isWavefront(false)
+{
+}
+
+CpuRaytracer::CpuRaytracer(const SSceneAttributes& scene, const BVHTree& tree, unsigned int numThreads)
+: m_scene(scene)
+, m_tree(tree)
+, m_traversal(tree, scene.m_verticePositions, nullptr, &m_triangleGroups)
+, m_numThreads(numThreads)
+{
+	m_triangleGroups.build(tree, scene.m_verticePositions);
+	tree.collapseToWideBVH<4>(m_wideNodes);
+
+	tree.buildMeshMaterialIds(scene.m_indices, m_meshMaterialIds);
+}
+
+void CpuRaytracer::traceGBuffer(const glm::vec3& eye, const glm::vec3& target, float fovY, int width, int height, SCpuGBuffer& outGBuffer) const
+{
+	outGBuffer.m_width = width;
+	outGBuffer.m_height = height;
+	outGBuffer.m_positions.assign(size_t(width) * height, glm::vec4(0.0f));
+	outGBuffer.m_normals.assign(size_t(width) * height, glm::vec4(0.0f));
+
+	const glm::vec3 forward = glm::normalize(target - eye);
+	const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+	const glm::vec3 up = glm::cross(right, forward);
+	const float tanHalfFov = std::tan(0.5f * fovY);
+	const float aspectRatio = float(width) / float(height);
+	const float numMaterials = float(std::max<size_t>(m_scene.m_materials.size(), 1));
+
+	ThreadPool threadPool(m_numThreads);
+	threadPool.parallelFor(size_t(height), [&](size_t y) {
+		for (int x = 0; x < width; x++)
+		{
+			const float ndcX = (2.0f * (x + 0.5f) / width - 1.0f) * tanHalfFov * aspectRatio;
+			const float ndcY = (1.0f - 2.0f * (y + 0.5f) / height) * tanHalfFov;
+			const SBVHRay ray(eye, glm::normalize(forward + ndcX * right + ndcY * up));
+
+			SBVHHit hit;
+			if (!m_traversal.intersectWide<4>(m_wideNodes, ray, hit))
+				continue;
+
+			const glm::ivec3& triIndices = m_tree.m_triIndices[hit.m_triIdx];
+			const glm::vec3 normal = glm::normalize(
+				glm::vec3(m_scene.m_verticeNormals[triIndices.x]) * (1.0f - hit.m_u - hit.m_v) +
+				glm::vec3(m_scene.m_verticeNormals[triIndices.y]) * hit.m_u +
+				glm::vec3(m_scene.m_verticeNormals[triIndices.z]) * hit.m_v);
+
+			// Centered on the material index so that the truncation of the shader gives it back exactly.
+			const size_t pixelIdx = y * width + x;
+			const float materialIdNormalized = (float(m_meshMaterialIds[hit.m_meshIdx]) + 0.5f) / numMaterials;
+			outGBuffer.m_positions[pixelIdx] = glm::vec4(ray.m_origin + hit.m_t * ray.m_direction, materialIdNormalized);
+			outGBuffer.m_normals[pixelIdx] = glm::vec4(normal, 1.0f);
+		}
+	});
+}
+
+void CpuRaytracer::render(const SCpuGBuffer& gBuffer, const SCpuRaytraceSettings& settings, std::vector<glm::vec4>& outImage) const
+{
+	if (settings.m_isWavefront)
+	{
+		_renderWavefront(gBuffer, settings, outImage);
+		return;
+	}
+
+	outImage.assign(size_t(gBuffer.m_width) * gBuffer.m_height, glm::vec4(0.0f));
+
+	const int numTilesX = (gBuffer.m_width + RAYTRACE_TILE_SIZE - 1) / RAYTRACE_TILE_SIZE;
+	const int numTilesY = (gBuffer.m_height + RAYTRACE_TILE_SIZE - 1) / RAYTRACE_TILE_SIZE;
+
+	ThreadPool threadPool(m_numThreads);
+	threadPool.parallelFor(size_t(numTilesX) * numTilesY, [&](size_t tileIdx) {
+		const int firstX = int(tileIdx % numTilesX) * RAYTRACE_TILE_SIZE;
+		const int firstY = int(tileIdx / numTilesX) * RAYTRACE_TILE_SIZE;
+		const int lastX = std::min(firstX + RAYTRACE_TILE_SIZE, gBuffer.m_width);
+		const int lastY = std::min(firstY + RAYTRACE_TILE_SIZE, gBuffer.m_height);
+		for (int y = firstY; y < lastY; y++)
+		{
+			for (int x = firstX; x < lastX; x++)
+			{
+				outImage[size_t(y) * gBuffer.m_width + x] = _shadePixel(gBuffer, x, y, settings);
+			}
+		}
+	});
+}
+
+CpuRaytracer::SIntersection CpuRaytracer::_intersect(const glm::vec3& origin, const glm::vec3& direction) const
+{
+	SIntersection intersection;
+	intersection.m_t = -1.0f;
+
+	SBVHHit hit;
+	if (!m_traversal.intersectWide<4>(m_wideNodes, SBVHRay(origin, direction, RAYTRACE_EPSILON, RAYTRACE_MAXLEN), hit))
+		return intersection;
+
+	const glm::ivec3& triIndices = m_tree.m_triIndices[hit.m_triIdx];
+	intersection.m_t = hit.m_t;
+	intersection.m_materialId = m_meshMaterialIds[hit.m_meshIdx];
+	intersection.m_hitNormal = glm::normalize(
+		glm::vec3(m_scene.m_verticeNormals[triIndices.x]) * (1.0f - hit.m_u - hit.m_v) +
+		glm::vec3(m_scene.m_verticeNormals[triIndices.y]) * hit.m_u +
+		glm::vec3(m_scene.m_verticeNormals[triIndices.z]) * hit.m_v);
+	intersection.m_hitPoint = getPointOnRay(origin, direction, hit.m_t);
+	return intersection;
+}
+
+float CpuRaytracer::_calcShadow(const glm::vec3& origin, const glm::vec3& direction, int objectId, float dist, const SCpuRaytraceSettings& settings) const
+{
+	// Like occludedWideBvh in the shader, the traversal stops at the first blocker between the feeler and the light.
+	if (settings.m_isBVH)
+		return m_traversal.occludedWide<4>(m_wideNodes, SBVHRay(origin, direction, RAYTRACE_EPSILON, dist)) ? 0.5f : 1.0f;
+
+	const SBVHRay feeler(origin, direction);
+	const std::vector<glm::vec4>& positions = m_scene.m_verticePositions;
+	for (size_t triIdx = 0; triIdx < m_scene.m_indices.size(); triIdx++)
+	{
+		const glm::ivec4& indices = m_scene.m_indices[triIdx];
+		if (indices.w == objectId)
+			continue;
+
+		float u, v;
+		const float t = BVHTraversal::intersectTriangle(feeler,
+			glm::vec3(positions[indices.x]), glm::vec3(positions[indices.y]), glm::vec3(positions[indices.z]), u, v);
+		if (t > RAYTRACE_EPSILON && t < dist)
+			return 0.5f;
+	}
+	return 1.0f;
+}
+
+float CpuRaytracer::_calcShadowFeeler(const SIntersection& intersection, int lightIdx, const SCpuRaytraceSettings& settings) const
+{
+	const SSceneLight& light = settings.m_lights[lightIdx];
+	const glm::vec3 lightVec = glm::normalize(glm::vec3(light.position) - intersection.m_hitPoint);
+	const float dist = glm::length(glm::vec3(light.position) - intersection.m_hitPoint);
+	return _calcShadow(intersection.m_hitPoint + 0.001f * intersection.m_hitNormal, lightVec, intersection.m_materialId, dist, settings);
+}
+
+bool CpuRaytracer::_scatterMaterial(const SIntersection& intersection, const SCpuRaytraceSettings& settings, SPathSegment& ioPath) const
+{
+	if (intersection.m_t < 0.0f || intersection.m_materialId < 0 || size_t(intersection.m_materialId) >= m_scene.m_materials.size())
+	{
+		ioPath.m_remainingBounces = 0;
+		return false;
+	}
+
+	const SMaterial& material = m_scene.m_materials[intersection.m_materialId];
+
+	if (settings.m_isTransparency && material.m_refracti > 1.0f)
+	{
+		float ei = 1.0f;
+		float et = material.m_refracti + 1.1f;
+		const float cosi = glm::clamp(glm::dot(ioPath.m_direction, intersection.m_hitNormal), -1.0f, 1.0f);
+		if (cosi >= 0.0f)
+			std::swap(ei, et);
+		const float eta = ei / et;
+
+		// Total internal reflection ends the path.
+		const float sint = eta * std::sqrt(std::max(0.0f, 1.0f - cosi * cosi));
+		const float sint2 = eta * eta * sintheta2(ioPath.m_direction, intersection.m_hitNormal);
+		if (sint >= 1.0f || sint2 >= 1.0f)
+		{
+			ioPath.m_remainingBounces = 0;
+		}
+		else
+		{
+			// The shader mixes the color of the material in with a weight of 0, so the color is left as is.
+			ioPath.m_direction = glm::normalize(glm::refract(ioPath.m_direction, intersection.m_hitNormal, eta));
+			ioPath.m_origin = intersection.m_hitPoint + 0.1f * ioPath.m_direction;
+			ioPath.m_objectId = intersection.m_materialId;
+			ioPath.m_remainingBounces--;
+			ioPath.m_bounces++;
+		}
+	}
+	else if (settings.m_isReflection && intersection.m_materialId == RAYTRACE_GROUND_MESH_IDX)
+	{
+		ioPath.m_direction = glm::normalize(glm::reflect(ioPath.m_direction, intersection.m_hitNormal));
+		ioPath.m_origin = intersection.m_hitPoint + 0.1f * ioPath.m_direction;
+		ioPath.m_color += glm::clamp(std::fabs(glm::dot(ioPath.m_direction, intersection.m_hitNormal)), 0.0f, 1.0f) * glm::vec3(material.m_colorDiffuse);
+		ioPath.m_objectId = intersection.m_materialId;
+		ioPath.m_remainingBounces--;
+		ioPath.m_bounces++;
+	}
+	else
+	{
+		ioPath.m_remainingBounces = 0;
+		return true;
+	}
+	return false;
+}
+
+glm::vec3 CpuRaytracer::_shadeLights(const SIntersection& intersection, const SCpuRaytraceSettings& settings, const glm::vec3& color,
+	bool isFeelersTraced, uint32_t blockedLights) const
+{
+	const SMaterial& material = m_scene.m_materials[intersection.m_materialId];
+
+	glm::vec3 outColor = color;
+	const int numLights = std::min(int(settings.m_lights.size()), RAYTRACE_MAX_LIGHTS);
+	for (int lightIdx = 0; lightIdx < numLights; lightIdx++)
+	{
+		const SSceneLight& light = settings.m_lights[lightIdx];
+		const glm::vec3 lightVec = glm::normalize(glm::vec3(light.position) - intersection.m_hitPoint);
+		const float dist = glm::length(glm::vec3(light.position) - intersection.m_hitPoint);
+		if (dist >= light.radius)
+			continue;
+
+		float shadow = 1.0f;
+		if (isFeelersTraced)
+		{
+			if ((blockedLights & (1u << lightIdx)) != 0)
+				shadow = 0.5f;
+		}
+		else if (isShadowReceiver(intersection.m_materialId, settings))
+		{
+			shadow = _calcShadowFeeler(intersection, lightIdx, settings);
+		}
+
+		const float atten = light.radius - dist;
+		const glm::vec3 diffuseColor = lightDiffuse(intersection.m_hitNormal, lightVec) * glm::vec3(material.m_colorDiffuse);
+		const glm::vec3 specularColor = lightSpecular(settings.m_cameraPosition, intersection.m_hitNormal, lightVec, 5.0f) * glm::vec3(material.m_colorSpecular);
+
+		outColor += diffuseColor * light.color * atten + specularColor;
+		outColor *= shadow;
+	}
+	return outColor;
+}
+
+void CpuRaytracer::_shadeMaterial(const SIntersection& intersection, const SCpuRaytraceSettings& settings, SPathSegment& ioPath) const
+{
+	if (_scatterMaterial(intersection, settings, ioPath))
+		ioPath.m_color = _shadeLights(intersection, settings, ioPath.m_color, false, 0);
+}
+
+bool CpuRaytracer::_initPath(const SCpuGBuffer& gBuffer, size_t pixelIdx, const SCpuRaytraceSettings& settings, SPathSegment& outPath,
+	SIntersection& outIntersection) const
+{
+	const glm::vec3 position(gBuffer.m_positions[pixelIdx]);
+	const glm::vec3 normal(gBuffer.m_normals[pixelIdx]);
+	if (normal == glm::vec3(0.0f))
+		return false;
+
+	const int materialId = int(gBuffer.m_positions[pixelIdx].w * float(m_scene.m_materials.size()));
+
+	// The first segment starts from the G-buffer sample, looking back at the camera.
+	outPath.m_remainingBounces = RAYTRACE_TRACEDEPTH;
+	outPath.m_direction = glm::normalize(settings.m_cameraPosition - position);
+	outPath.m_origin = position + 0.01f * outPath.m_direction;
+	outPath.m_color = glm::vec3(0.0f);
+	outPath.m_objectId = materialId;
+	outPath.m_bounces = 0;
+
+	outIntersection.m_hitPoint = position;
+	outIntersection.m_hitNormal = normal;
+	outIntersection.m_materialId = materialId;
+	outIntersection.m_t = 1.0f;
+	return true;
+}
+
+glm::vec4 CpuRaytracer::_getPixelColor(const SPathSegment& path, const SCpuRaytraceSettings& settings) const
+{
+	if (settings.m_isColorByRayBounces)
+	{
+		// Integer division, as in the shader.
+		const float val = float(path.m_bounces / RAYTRACE_TRACEDEPTH);
+		return glm::vec4(val, val, val, 1.0f);
+	}
+	return glm::vec4(path.m_color, 1.0f);
+}
+
+glm::vec4 CpuRaytracer::_shadePixel(const SCpuGBuffer& gBuffer, int x, int y, const SCpuRaytraceSettings& settings) const
+{
+	SPathSegment path;
+	SIntersection intersection;
+	if (!_initPath(gBuffer, size_t(y) * gBuffer.m_width + x, settings, path, intersection))
+		return glm::vec4(0.0f);
+
+	_shadeMaterial(intersection, settings, path);
+
+	while (path.m_remainingBounces > 0)
+	{
+		intersection = _intersect(path.m_origin, path.m_direction);
+		_shadeMaterial(intersection, settings, path);
+	}
+
+	return _getPixelColor(path, settings);
+}
+
+void CpuRaytracer::_renderWavefront(const SCpuGBuffer& gBuffer, const SCpuRaytraceSettings& settings, std::vector<glm::vec4>& outImage) const
+{
+	const size_t numPixels = size_t(gBuffer.m_width) * gBuffer.m_height;
+	const size_t poolSize = std::min(numPixels, RAYTRACE_WAVEFRONT_POOL_SIZE);
+	const int numLights = std::min(int(settings.m_lights.size()), RAYTRACE_MAX_LIGHTS);
+
+	std::vector<SWavefrontPath> paths(poolSize);
+	std::vector< std::atomic<uint32_t> > blockedLights(poolSize);
+	SWavefrontQueue<size_t> extensionQueues[2];	// Used by every other bounce.
+	extensionQueues[0].m_entries.resize(poolSize);
+	extensionQueues[1].m_entries.resize(poolSize);
+	SWavefrontQueue<SWavefrontHit> hitQueue(poolSize);
+	SWavefrontQueue<size_t> shadowQueue(poolSize * RAYTRACE_MAX_LIGHTS);	// (path index << 3) | light index.
+
+	// Same as storeWavefrontPath: queues the extension ray of the next bounce or the shadow feelers of the diffuse hit.
+	auto storePath = [&](size_t pathIdx, const SPathSegment& path, const SIntersection& intersection, bool isDiffuse, int nextBounce) {
+		SWavefrontPath& state = paths[pathIdx];
+		state.m_path = path;
+		state.m_diffuseHit.m_t = -1.0f;
+		if (isDiffuse)
+		{
+			state.m_diffuseHit = intersection;
+			if (!isShadowReceiver(intersection.m_materialId, settings))
+				return;
+
+			for (int lightIdx = 0; lightIdx < numLights; lightIdx++)
+			{
+				const SSceneLight& light = settings.m_lights[lightIdx];
+				if (glm::length(glm::vec3(light.position) - intersection.m_hitPoint) < light.radius)
+					shadowQueue.append((pathIdx << 3) | size_t(lightIdx));
+			}
+		}
+		else if (path.m_remainingBounces > 0)
+		{
+			extensionQueues[nextBounce & 1].append(pathIdx);
+		}
+	};
+
+	ThreadPool threadPool(m_numThreads);
+	outImage.assign(numPixels, glm::vec4(0.0f));
+	for (size_t firstPixelIdx = 0; firstPixelIdx < numPixels; firstPixelIdx += poolSize)
+	{
+		const size_t numPaths = std::min(numPixels - firstPixelIdx, poolSize);
+		extensionQueues[0].clear();
+		extensionQueues[1].clear();
+		hitQueue.clear();
+		shadowQueue.clear();
+
+		// Primary stage
+		threadPool.parallelFor(numPaths, [&](size_t pathIdx) {
+			blockedLights[pathIdx] = 0;
+
+			SPathSegment path;
+			SIntersection intersection;
+			if (!_initPath(gBuffer, firstPixelIdx + pathIdx, settings, path, intersection))
+				return;
+
+			const bool isDiffuse = _scatterMaterial(intersection, settings, path);
+			storePath(pathIdx, path, intersection, isDiffuse, 0);
+		});
+
+		for (int bounce = 0; bounce < RAYTRACE_TRACEDEPTH; bounce++)
+		{
+			const SWavefrontQueue<size_t>& extensionQueue = extensionQueues[bounce & 1];
+			extensionQueues[(bounce + 1) & 1].clear();
+			hitQueue.clear();
+
+			// Extension stage, a miss ends the path as is
+			threadPool.parallelFor(extensionQueue.size(), [&](size_t entryIdx) {
+				const size_t pathIdx = extensionQueue.m_entries[entryIdx];
+				const SPathSegment& path = paths[pathIdx].m_path;
+				const SIntersection intersection = _intersect(path.m_origin, path.m_direction);
+				if (intersection.m_t < 0.0f)
+					return;
+
+				SWavefrontHit hit;
+				hit.m_pathIdx = pathIdx;
+				hit.m_materialId = intersection.m_materialId;
+				hit.m_hitPoint = intersection.m_hitPoint;
+				hit.m_hitNormal = intersection.m_hitNormal;
+				hitQueue.append(hit);
+			});
+
+			// Shade stage
+			threadPool.parallelFor(hitQueue.size(), [&](size_t entryIdx) {
+				const SWavefrontHit& hit = hitQueue.m_entries[entryIdx];
+				SIntersection intersection;
+				intersection.m_hitNormal = hit.m_hitNormal;
+				intersection.m_t = 1.0f;
+				intersection.m_hitPoint = hit.m_hitPoint;
+				intersection.m_materialId = hit.m_materialId;
+
+				SPathSegment path = paths[hit.m_pathIdx].m_path;
+				const bool isDiffuse = _scatterMaterial(intersection, settings, path);
+				storePath(hit.m_pathIdx, path, intersection, isDiffuse, bounce + 1);
+			});
+		}
+
+		// Shadow stage
+		threadPool.parallelFor(shadowQueue.size(), [&](size_t entryIdx) {
+			const size_t pathIdx = shadowQueue.m_entries[entryIdx] >> 3;
+			const int lightIdx = int(shadowQueue.m_entries[entryIdx] & 7);
+			if (_calcShadowFeeler(paths[pathIdx].m_diffuseHit, lightIdx, settings) < 1.0f)
+				blockedLights[pathIdx].fetch_or(1u << lightIdx);
+		});
+
+		// Resolve stage
+		threadPool.parallelFor(numPaths, [&](size_t pathIdx) {
+			// Nothing was drawn there, the pixel is left black.
+			if (glm::vec3(gBuffer.m_normals[firstPixelIdx + pathIdx]) == glm::vec3(0.0f))
+				return;
+
+			const SWavefrontPath& state = paths[pathIdx];
+			SPathSegment path = state.m_path;
+			if (state.m_diffuseHit.m_t >= 0.0f)
+				path.m_color = _shadeLights(state.m_diffuseHit, settings, path.m_color, true, blockedLights[pathIdx].load());
+			outImage[firstPixelIdx + pathIdx] = _getPixelColor(path, settings);
+		});
+	}
+}
+
+bool CpuRaytracer::writeImage(const std::string& filename, int width, int height, const std::vector<glm::vec4>& image)
+{
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	std::vector<unsigned char> row(size_t(width) * 3);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const glm::vec4& color = image[size_t(y) * width + x];
+			for (int channelIdx = 0; channelIdx < 3; channelIdx++)
+			{
+				row[x * 3 + channelIdx] = (unsigned char)(glm::clamp(color[channelIdx], 0.0f, 1.0f) * 255.0f + 0.5f);
+			}
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+
+	const bool isSuccess = (ferror(file) == 0);
+	fclose(file);
+	return isSuccess;
+}
+
+bool CpuRaytracer::renderModel(const std::string& modelFilename, const std::string& imageFilename)
+{
+	VulkanMeshLoader mesh;
+	if (!mesh.LoadMesh(RAYTRACE_ASSET_PATH + modelFilename))
+	{
+		printf("%s: failed to load the model.\n", modelFilename.c_str());
+		return false;
+	}
+
+	// Same build parameters as VulkanHybridRenderer.
+	BVHTree tree;
+	tree.m_buildParams.m_strategy = BVHTree::BUILD_SBVH;
+	tree.m_buildParams.m_maxDepth = 32;
+	tree.buildBVHTree(mesh.m_Entries);
+
+	const SSceneAttributes& scene = mesh.m_sceneAttributes;
+	const CpuRaytracer raytracer(scene, tree);
+
+	// Camera slightly above the scene and a single white light above it, both far enough to see (and light) all of it.
+	const glm::vec3 sceneMin = tree.m_aabbNodes[0].m_minAABB;
+	const glm::vec3 sceneMax = tree.m_aabbNodes[0].m_maxAABB;
+	const glm::vec3 sceneCenter = 0.5f * (sceneMin + sceneMax);
+	const float sceneRadius = 0.5f * glm::length(sceneMax - sceneMin);
+
+	SCpuRaytraceSettings settings;
+	settings.m_cameraPosition = sceneCenter + glm::normalize(glm::vec3(0.3f, 0.4f, 1.0f)) * (1.5f * sceneRadius);
+
+	SSceneLight light;
+	light.position = glm::vec4(sceneCenter + glm::vec3(0.5f, 2.0f, 0.5f) * sceneRadius, 1.0f);
+	light.color = glm::vec3(1.0f) / (4.0f * sceneRadius);
+	light.radius = 5.0f * sceneRadius;
+	settings.m_lights.push_back(light);
+
+	const auto start = std::chrono::high_resolution_clock::now();
+	SCpuGBuffer gBuffer;
+	raytracer.traceGBuffer(settings.m_cameraPosition, sceneCenter, glm::radians(60.0f), RAYTRACE_IMAGE_SIZE, RAYTRACE_IMAGE_SIZE, gBuffer);
+	const auto gBufferEnd = std::chrono::high_resolution_clock::now();
+
+	std::vector<glm::vec4> image;
+	raytracer.render(gBuffer, settings, image);
+	const auto renderEnd = std::chrono::high_resolution_clock::now();
+
+	printf("%s: %zu triangles, %dx%d, G-buffer %.2f ms, raytracing %.2f ms on %u threads\n", modelFilename.c_str(),
+		scene.m_indices.size(), RAYTRACE_IMAGE_SIZE, RAYTRACE_IMAGE_SIZE,
+		std::chrono::duration<double, std::milli>(gBufferEnd - start).count(),
+		std::chrono::duration<double, std::milli>(renderEnd - gBufferEnd).count(), ThreadPool::getDefaultNumThreads());
+
+	// Same pass through the stages of the wavefront mode, which must give the same image.
+	SCpuRaytraceSettings wavefrontSettings = settings;
+	wavefrontSettings.m_isWavefront = true;
+	std::vector<glm::vec4> wavefrontImage;
+	raytracer.render(gBuffer, wavefrontSettings, wavefrontImage);
+	const auto wavefrontEnd = std::chrono::high_resolution_clock::now();
+
+	size_t numDifferentPixels = 0;
+	for (size_t pixelIdx = 0; pixelIdx < image.size(); pixelIdx++)
+	{
+		if (wavefrontImage[pixelIdx] != image[pixelIdx])
+			numDifferentPixels++;
+	}
+	printf("%s: wavefront raytracing %.2f ms, %zu pixels differ from the megakernel\n", modelFilename.c_str(),
+		std::chrono::duration<double, std::milli>(wavefrontEnd - renderEnd).count(), numDifferentPixels);
+
+	if (!writeImage(imageFilename, RAYTRACE_IMAGE_SIZE, RAYTRACE_IMAGE_SIZE, image))
+	{
+		printf("%s: failed to write the image.\n", imageFilename.c_str());
+		return false;
+	}
+	return numDifferentPixels == 0;
+}
@@ -0,0 +1,139 @@
+/******************************************************************************/
+/*!
+\file	CpuRaytracer.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _CPU_RAYTRACER_H_
+#define _CPU_RAYTRACER_H_
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BVHTraversal.h"
+#include "BVHTriangleGroups.h"
+
+// Same content as the positionsImage and normalsImage attachments read by data/shaders/hybrid/raytrace.comp, in row order.
+struct SCpuGBuffer
+{
+	SCpuGBuffer() : m_width(0), m_height(0) {}
+
+	int						m_width;
+	int						m_height;
+	std::vector<glm::vec4>	m_positions;	// xyz := position, w := material index / number of materials (see mrt.frag).
+	std::vector<glm::vec4>	m_normals;		// xyz := normal, (0, 0, 0) where nothing was drawn.
+};
+
+// Same parameters as the uniform block of raytrace.comp.
+struct SCpuRaytraceSettings
+{
+	SCpuRaytraceSettings();
+
+	glm::vec3					m_cameraPosition;
+	std::vector<SSceneLight>	m_lights;	// At most 6 are used, like the lights of the uniform block.
+
+	bool	m_isBVH;	// The shadow feelers traverse the 4-wide tree instead of testing every triangle of the scene (the bounces always do).
+	bool	m_isShadows;
+	bool	m_isTransparency;
+	bool	m_isReflection;
+	bool	m_isColorByRayBounces;
+	bool	m_isWavefront;	// The paths go through the stages of the wavefront mode of the shader (see _renderWavefront) instead of one pixel at a time.
+};
+
+// CPU implementation of the hybrid raytracing pass (data/shaders/hybrid/raytrace.comp): shades a G-buffer with the same
+// lights, shadow feelers, reflections off the ground and refractions, so that the pass can be profiled and compared
+// against on machines without a GPU. The image is rendered in 16x16 tiles (the work group size of the shader) spread over
+// all the cores.
+// The bounces are traced through the 4-wide BVH, whose leaves are tested a group of triangles at a time; they find the
+// same closest hits as the shader (computeIntersectionsWithBvh, or its brute force loop), and the material of a hit is
+// the one of its mesh.
+// The wavefront mode runs the same stages as the wavefront kernels of the shader, each over a whole queue before the next
+// one starts, so that their queues and counters can be checked against the megakernel: both give the same image.
+class CpuRaytracer
+{
+public:
+
+	// The scene and the tree must outlive the raytracer, the tree must have been built over the scene.
+	CpuRaytracer(const SSceneAttributes& scene, const BVHTree& tree, unsigned int numThreads = 0);
+
+	// Fills the G-buffer with the closest hits of the rays of a pinhole camera, for runs without a rasterizer.
+	void traceGBuffer(const glm::vec3& eye, const glm::vec3& target, float fovY, int width, int height, SCpuGBuffer& outGBuffer) const;
+
+	// Shades every pixel of the G-buffer into outImage (RGBA, in row order), like one dispatch of raytrace.comp.
+	void render(const SCpuGBuffer& gBuffer, const SCpuRaytraceSettings& settings, std::vector<glm::vec4>& outImage) const;
+
+	// Writes the image as a binary PPM, the colors are clamped to [0, 1] like the rgba8 storage image of the shader.
+	static bool writeImage(const std::string& filename, int width, int height, const std::vector<glm::vec4>& image);
+
+	// Headless reference render of a model with every effect enabled, run with "--cpu-raytrace [model file] [image file]".
+	// Returns false if the model or the image couldn't be read or written, or if the wavefront mode gave a different image.
+	static bool renderModel(const std::string& modelFilename, const std::string& imageFilename);
+
+private:
+
+	struct SIntersection
+	{
+		glm::vec3	m_hitNormal;
+		float		m_t;	// < 0 := nothing was hit.
+		glm::vec3	m_hitPoint;
+		int			m_materialId;
+	};
+
+	struct SPathSegment
+	{
+		glm::vec3	m_origin;
+		glm::vec3	m_direction;
+		glm::vec3	m_color;
+		int			m_remainingBounces;
+		int			m_objectId;
+		int			m_bounces;
+	};
+
+	// State of a path between the wavefront stages, as WavefrontPath in raytrace.comp.
+	struct SWavefrontPath
+	{
+		SPathSegment	m_path;
+		SIntersection	m_diffuseHit;	// m_t < 0 := the path didn't end on a diffuse hit, which is left to be lit.
+	};
+
+	// Closest hit along the ray, as computeIntersections.
+	SIntersection _intersect(const glm::vec3& origin, const glm::vec3& direction) const;
+	float _calcShadow(const glm::vec3& origin, const glm::vec3& direction, int objectId, float dist, const SCpuRaytraceSettings& settings) const;
+	float _calcShadowFeeler(const SIntersection& intersection, int lightIdx, const SCpuRaytraceSettings& settings) const;
+	// Reflects or refracts the path off the hit, returns true if the hit is diffuse, which ends the path and is left to be lit.
+	bool _scatterMaterial(const SIntersection& intersection, const SCpuRaytraceSettings& settings, SPathSegment& ioPath) const;
+	// Adds the lights to the color of a diffuse hit, tracing their shadow feelers unless isFeelersTraced is set, in which
+	// case blockedLights flags the lights whose feelers were blocked.
+	glm::vec3 _shadeLights(const SIntersection& intersection, const SCpuRaytraceSettings& settings, const glm::vec3& color,
+		bool isFeelersTraced, uint32_t blockedLights) const;
+	void _shadeMaterial(const SIntersection& intersection, const SCpuRaytraceSettings& settings, SPathSegment& ioPath) const;
+	// First segment of the path of a pixel, returns false if nothing was drawn there.
+	bool _initPath(const SCpuGBuffer& gBuffer, size_t pixelIdx, const SCpuRaytraceSettings& settings, SPathSegment& outPath,
+		SIntersection& outIntersection) const;
+	glm::vec4 _getPixelColor(const SPathSegment& path, const SCpuRaytraceSettings& settings) const;
+	glm::vec4 _shadePixel(const SCpuGBuffer& gBuffer, int x, int y, const SCpuRaytraceSettings& settings) const;
+	void _renderWavefront(const SCpuGBuffer& gBuffer, const SCpuRaytraceSettings& settings, std::vector<glm::vec4>& outImage) const;
+
+	const SSceneAttributes&						m_scene;
+	const BVHTree&								m_tree;
+	BVHTriangleGroups							m_triangleGroups;
+	std::vector< BVHTree::WideBVHNode<4> >		m_wideNodes;
+	BVHTraversal								m_traversal;
+	std::vector<int32_t>						m_meshMaterialIds;	// Material of each mesh, see BVHTree::buildMeshMaterialIds.
+	unsigned int								m_numThreads;
+};
+
+#endif // _CPU_RAYTRACER_H_
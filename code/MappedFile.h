@@ -0,0 +1,54 @@
+/******************************************************************************/
+/*!
+\file	MappedFile.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <string>
+#include <stdint.h>
+
+// Read-only view of a whole file mapped into memory, which stays valid until the file is closed.
+class MappedFile
+{
+public:
+
+	MappedFile();
+	~MappedFile();
+
+	// Returns false if the file doesn't exist, is empty or can't be mapped.
+	bool open(const std::string& filename);
+	void close();
+
+	bool isOpen() const { return m_data != nullptr; }
+	const uint8_t* getData() const { return m_data; }
+	size_t getSize() const { return m_size; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+#ifdef _WIN32
+	void*			m_fileHandle;
+	void*			m_mappingHandle;
+#else
+	int				m_fileDesc;
+#endif
+	const uint8_t*	m_data;
+	size_t			m_size;
+};
+
+#endif // _MAPPED_FILE_H_
@@ -0,0 +1,241 @@
+/******************************************************************************/
+/*!
+\file	ThreadPool.cpp
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#include "ThreadPool.h"
+
+// VS2013 doesn't support thread_local, its (and GCC's) thread storage extension is enough for these plain values.
+#if defined(_MSC_VER)
+#define THREAD_POOL_TLS __declspec(thread)
+#else
+#define THREAD_POOL_TLS __thread
+#endif
+
+namespace
+{
+	// Identifies the pool (and the worker within that pool) the calling thread belongs to.
+	THREAD_POOL_TLS const ThreadPool* tl_pool = nullptr;
+	THREAD_POOL_TLS int tl_workerIdx = -1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+/////							TaskGroup									/////
+
+ThreadPool::TaskGroup::TaskGroup(ThreadPool& pool)
+: m_pool(pool)
+, m_numPendingTasks(0)
+{
+}
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+	wait();
+}
+
+void ThreadPool::TaskGroup::run(const Task& task)
+{
+	m_numPendingTasks++;
+	std::atomic<int>* numPendingTasks = &m_numPendingTasks;
+	m_pool.enqueue([numPendingTasks, task]() {
+		task();
+		(*numPendingTasks)--;
+	});
+}
+
+void ThreadPool::TaskGroup::wait()
+{
+	while (m_numPendingTasks > 0)
+	{
+		if (!m_pool.runPendingTask())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+/////							ThreadPool									/////
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+: m_numQueuedTasks(0)
+, m_numPendingTasks(0)
+, m_isStopping(false)
+{
+	if (numThreads == 0)
+		numThreads = getDefaultNumThreads();
+
+	m_workerQueues.resize(numThreads);
+	for (unsigned int i = 0; i < numThreads; i++)
+	{
+		m_workerQueues[i] = new SWorkerQueue();
+	}
+
+	m_workers.reserve(numThreads);
+	for (unsigned int i = 0; i < numThreads; i++)
+	{
+		m_workers.push_back(std::thread(&ThreadPool::workerLoop, this, int(i)));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	waitIdle();
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_isStopping = true;
+	}
+	m_taskAvailable.notify_all();
+
+	for (size_t i = 0; i < m_workers.size(); i++)
+	{
+		m_workers[i].join();
+		delete m_workerQueues[i];
+	}
+}
+
+unsigned int ThreadPool::getDefaultNumThreads()
+{
+	unsigned int numThreads = std::thread::hardware_concurrency();
+	return (numThreads > 0) ? numThreads : 1;
+}
+
+int ThreadPool::getCurrentWorkerIdx() const
+{
+	return (tl_pool == this) ? tl_workerIdx : -1;
+}
+
+void ThreadPool::enqueue(const Task& task)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_numPendingTasks++;
+	}
+
+	// Tasks spawned by a worker stay local to it until somebody steals them.
+	const int workerIdx = getCurrentWorkerIdx();
+	SWorkerQueue& queue = (workerIdx >= 0) ? *m_workerQueues[workerIdx] : m_injectionQueue;
+	{
+		std::unique_lock<std::mutex> lock(queue.m_mutex);
+		queue.m_tasks.push_back(task);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_numQueuedTasks++;
+	}
+	m_taskAvailable.notify_one();
+}
+
+void ThreadPool::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_tasksDone.wait(lock, [this]() { return m_numPendingTasks == 0; });
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& func)
+{
+	TaskGroup taskGroup(*this);
+	for (size_t i = 0; i < count; i++)
+	{
+		taskGroup.run([&func, i]() { func(i); });
+	}
+	taskGroup.wait();
+}
+
+bool ThreadPool::popTask(Task& task)
+{
+	const int workerIdx = getCurrentWorkerIdx();
+
+	// 1) Most recent task of our own queue.
+	if (workerIdx >= 0)
+	{
+		SWorkerQueue& queue = *m_workerQueues[workerIdx];
+		std::unique_lock<std::mutex> lock(queue.m_mutex);
+		if (!queue.m_tasks.empty())
+		{
+			task = queue.m_tasks.back();
+			queue.m_tasks.pop_back();
+			return true;
+		}
+	}
+
+	// 2) Tasks submitted from outside the pool.
+	{
+		std::unique_lock<std::mutex> lock(m_injectionQueue.m_mutex);
+		if (!m_injectionQueue.m_tasks.empty())
+		{
+			task = m_injectionQueue.m_tasks.front();
+			m_injectionQueue.m_tasks.pop_front();
+			return true;
+		}
+	}
+
+	// 3) Steal the oldest task of another worker.
+	const int numWorkers = int(m_workerQueues.size());
+	for (int i = 1; i <= numWorkers; i++)
+	{
+		const int victimIdx = (workerIdx + i + numWorkers) % numWorkers;
+		if (victimIdx == workerIdx)
+			continue;
+
+		SWorkerQueue& queue = *m_workerQueues[victimIdx];
+		std::unique_lock<std::mutex> lock(queue.m_mutex);
+		if (!queue.m_tasks.empty())
+		{
+			task = queue.m_tasks.front();
+			queue.m_tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool ThreadPool::runPendingTask()
+{
+	Task task;
+	if (!popTask(task))
+		return false;
+
+	m_numQueuedTasks--;
+	task();
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_numPendingTasks--;
+		if (m_numPendingTasks == 0)
+			m_tasksDone.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::workerLoop(int workerIdx)
+{
+	tl_pool = this;
+	tl_workerIdx = workerIdx;
+
+	while (true)
+	{
+		if (runPendingTask())
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_taskAvailable.wait(lock, [this]() { return m_isStopping || m_numQueuedTasks > 0; });
+		if (m_isStopping && m_numQueuedTasks <= 0)
+			return;
+	}
+}
@@ -0,0 +1,108 @@
+/******************************************************************************/
+/*!
+\file	ThreadPool.h
+\author David Grosman
+\par    email: ToDavidGrosman\@gmail.com
+\par    Project: CIS 565: GPU Programming and Architecture - Final Project.
+\date   10/16/2026
+\brief
+
+Compiled using Microsoft (R) C/C++ Optimizing Compiler Version 18.00.21005.1 for
+x86 which is my default VS2013 compiler.
+
+This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+
+*/
+/******************************************************************************/
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Work-stealing thread pool.
+// Each worker owns a deque of tasks: it pushes and pops its own tasks at the back (depth-first, cache friendly)
+// while idle workers steal from the front of the others' deques (the oldest, hence usually biggest, tasks).
+// Tasks enqueued from outside the pool go through a shared injection queue.
+class ThreadPool
+{
+public:
+
+	typedef std::function<void()> Task;
+
+	// Set of tasks which can be waited on. Waiting doesn't block the calling thread: it keeps running pending
+	// tasks of the pool until all the tasks of the group are completed, so task groups can be nested freely.
+	class TaskGroup
+	{
+	public:
+
+		explicit TaskGroup(ThreadPool& pool);
+		~TaskGroup();
+
+		void run(const Task& task);
+		void wait();
+
+	private:
+
+		TaskGroup(const TaskGroup&);
+		TaskGroup& operator=(const TaskGroup&);
+
+		ThreadPool&			m_pool;
+		std::atomic<int>	m_numPendingTasks;
+	};
+
+	// numThreads == 0 spawns one worker per hardware thread.
+	explicit ThreadPool(unsigned int numThreads = 0);
+	~ThreadPool();
+
+	void enqueue(const Task& task);
+
+	// Blocks until every enqueued task has completed.
+	void waitIdle();
+
+	// Runs func(i) for every i in [0, count) on the pool and waits for all of them to complete.
+	void parallelFor(size_t count, const std::function<void(size_t)>& func);
+
+	unsigned int getNumThreads() const { return static_cast<unsigned int>(m_workers.size()); }
+
+	// Index of the calling worker thread in [0, getNumThreads()), -1 if the caller isn't one of our workers.
+	int getCurrentWorkerIdx() const;
+
+	static unsigned int getDefaultNumThreads();
+
+private:
+
+	struct SWorkerQueue
+	{
+		std::mutex			m_mutex;
+		std::deque<Task>	m_tasks;
+	};
+
+	void workerLoop(int workerIdx);
+
+	// Pops a task from the calling worker's own queue, then from the injection queue, and finally tries to
+	// steal one from the other workers. Returns false if no task could be found.
+	bool runPendingTask();
+
+	bool popTask(Task& task);
+
+	std::vector<std::thread>		m_workers;
+	std::vector<SWorkerQueue*>		m_workerQueues;
+	SWorkerQueue					m_injectionQueue;
+
+	std::mutex						m_mutex;
+	std::condition_variable			m_taskAvailable;
+	std::condition_variable			m_tasksDone;
+
+	std::atomic<int>				m_numQueuedTasks;	// Waiting in any of the queues.
+	size_t							m_numPendingTasks;	// Enqueued or running.
+	bool							m_isStopping;
+};
+
+#endif // _THREAD_POOL_H_
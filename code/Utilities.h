@@ -92,7 +92,7 @@ private:
 
 struct SRendererContext
 {
-	SRendererContext() : m_window(NULL), m_debugDraw(false), m_debugBVH(false), m_enableBVH(false), m_enableShadows(false), m_enableTransparency(false), m_enableReflection(false), m_enableColorByRayBounces(false), m_addLight(0)
+	SRendererContext() : m_window(NULL), m_debugDraw(false), m_debugBVH(false), m_enableBVH(false), m_enableShadows(false), m_enableTransparency(false), m_enableReflection(false), m_enableColorByRayBounces(false), m_enableQuantizedBVH(false), m_enableWavefront(false), m_despawnMeshes(false), m_addLight(0)
 	{}
 	void getWindowSize(uint32_t& width, uint32_t& height);
 
@@ -106,6 +106,9 @@ struct SRendererContext
 	bool		m_enableTransparency;
 	bool        m_enableReflection;
 	bool		m_enableColorByRayBounces;
+	bool		m_enableQuantizedBVH;
+	bool		m_enableWavefront;
+	bool		m_despawnMeshes;
 	int 		m_addLight;
 };
 
@@ -1,6 +1,7 @@
 // Adapted from Sascha Willems Vulkan examples : https ://github.com/SaschaWillems/Vulkan
 
 #include "VulkanHybridRenderer.h"
+#include <vulkan/spirv.h>
 
 namespace
 {
@@ -15,6 +16,38 @@ namespace
 		vkMeshLoader::VERTEX_LAYOUT_TANGENT,
 		vkMeshLoader::VERTEX_LAYOUT_MATERIALID_NORMALIZED,
 	};
+
+	// Makes the queues and paths written by a wavefront stage (or reset by vkCmdUpdateBuffer) visible to the next one,
+	// including the work group counts it reads as its indirect dispatch.
+	void wavefrontBarrier(VkCommandBuffer commandBuffer)
+	{
+		VkMemoryBarrier memoryBarrier = vkUtils::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0,
+			1, &memoryBarrier,
+			0, nullptr,
+			0, nullptr);
+	}
+
+	// Empties the given queues, whose indirect dispatches are left with no work group until their first entry is appended.
+	void resetWavefrontQueues(VkCommandBuffer commandBuffer, VkBuffer queueCounters, uint32_t firstQueueIdx, uint32_t numQueues)
+	{
+		SWavefrontQueueCounter counters[WAVEFRONT_QUEUE_COUNT];
+		for (uint32_t queueIdx = 0; queueIdx < numQueues; queueIdx++)
+		{
+			counters[queueIdx].m_dispatch.x = 0;
+			counters[queueIdx].m_dispatch.y = 1;
+			counters[queueIdx].m_dispatch.z = 1;
+			counters[queueIdx].m_count = 0;
+		}
+		vkCmdUpdateBuffer(commandBuffer, queueCounters, firstQueueIdx * sizeof(SWavefrontQueueCounter), numQueues * sizeof(SWavefrontQueueCounter), counters);
+	}
 }
 
 
@@ -121,6 +154,8 @@ void VulkanHybridRenderer::shutdownVulkan()
 	vkDestroyPipeline(m_device, m_pipelines.m_offscreen, nullptr);
 	vkDestroyPipeline(m_device, m_pipelines.m_debug, nullptr);
 	vkDestroyPipeline(m_device, m_pipelines.m_raytrace, nullptr);
+	for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; stage++)
+		vkDestroyPipeline(m_device, m_pipelines.m_wavefront[stage], nullptr);
 	vkDestroyPipeline(m_device, m_pipelines.m_wireframe, nullptr);
 
 	vkDestroyPipelineLayout(m_device, m_pipelineLayouts.m_onscreen, nullptr);
@@ -154,11 +189,31 @@ void VulkanHybridRenderer::shutdownVulkan()
 	vkDestroyBuffer(m_device, m_compute.m_buffers.positions.buffer, nullptr);
 	vkDestroyBuffer(m_device, m_compute.m_buffers.normals.buffer, nullptr);
 	vkDestroyBuffer(m_device, m_compute.m_buffers.bvhAabbNodes.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.bvhTriIndices.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.bvhWideNodes.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.bvhQuantizedWideNodes.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.bvhTriangles.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.bvhMeshMaterialIds.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.wavefrontPaths.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.wavefrontQueueCounters.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.wavefrontExtensionQueues.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.wavefrontHitQueue.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.m_buffers.wavefrontShadowQueue.buffer, nullptr);
 
 	vkFreeMemory(m_device, m_compute.m_buffers.indicesAndMaterialIDs.memory, nullptr);
 	vkFreeMemory(m_device, m_compute.m_buffers.positions.memory, nullptr);
 	vkFreeMemory(m_device, m_compute.m_buffers.normals.memory, nullptr);
 	vkFreeMemory(m_device, m_compute.m_buffers.bvhAabbNodes.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.bvhTriIndices.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.bvhWideNodes.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.bvhQuantizedWideNodes.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.bvhTriangles.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.bvhMeshMaterialIds.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.wavefrontPaths.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.wavefrontQueueCounters.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.wavefrontExtensionQueues.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.wavefrontHitQueue.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.m_buffers.wavefrontShadowQueue.memory, nullptr);
 	vkFreeMemory(m_device, m_compute.m_storageRaytraceImage.deviceMemory, nullptr);
 
 	vkDestroyImage(m_device, m_compute.m_storageRaytraceImage.image, nullptr);
@@ -622,12 +677,36 @@ void VulkanHybridRenderer::setupRaytracingPipeline() {
 
 	VkPipelineShaderStageCreateInfo shader;
 
+	// The binary is compiled by the build (see CMakeLists.txt), but a stale one would still load and trace garbage: one older
+	// than the wavefront mode has neither its queues nor the RAYTRACE_STAGE constant, and reads the BVH node links as floats.
+	const std::string shaderFileName = getAssetPath() + "shaders/hybrid/raytrace.comp.spv";
+	std::vector<uint32_t> bindings;
+	std::vector<uint32_t> specIds;
+	if (!vkUtils::getShaderDecorations(shaderFileName.c_str(), SpvDecorationBinding, bindings) ||
+		!vkUtils::getShaderDecorations(shaderFileName.c_str(), SpvDecorationSpecId, specIds) ||
+		std::find(bindings.begin(), bindings.end(), RAYTRACE_LAST_BINDING) == bindings.end() ||
+		std::find(specIds.begin(), specIds.end(), 0) == specIds.end())
+	{
+		vkUtils::exitFatal(shaderFileName + " is missing or was compiled from an older raytrace.comp, rebuild the Shaders target.", "Fatal error");
+	}
+
 	// Create shader modules from bytecodes
-	shader = loadShader(getAssetPath() + "shaders/hybrid/raytrace.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+	shader = loadShader(shaderFileName, VK_SHADER_STAGE_COMPUTE_BIT);
 	computePipelineCreateInfo.stage = shader;
 
 	VK_CHECK_RESULT(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &m_pipelines.m_raytrace));
 
+	// Wavefront stages, the same shader specialized for each of them
+	VkSpecializationMapEntry specializationMapEntry = vkUtils::initializers::specializationMapEntry(0, 0, sizeof(int32_t));
+	for (int stage = 0; stage < WAVEFRONT_STAGE_COUNT; stage++)
+	{
+		const int32_t raytraceStage = stage + 1;
+		VkSpecializationInfo specializationInfo = vkUtils::initializers::specializationInfo(1, &specializationMapEntry, sizeof(raytraceStage), &raytraceStage);
+		computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+
+		VK_CHECK_RESULT(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &m_pipelines.m_wavefront[stage]));
+	}
+
 	VkFenceCreateInfo fenceCreateInfo = vkUtils::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
 	VK_CHECK_RESULT(vkCreateFence(m_device, &fenceCreateInfo, nullptr, &m_compute.fence));
 }
@@ -635,14 +714,15 @@ void VulkanHybridRenderer::setupRaytracingPipeline() {
 // Build command buffer for rendering the scene to the offscreen frame buffer attachments
 void VulkanHybridRenderer::buildDeferredCommandBuffer()
 {
+	// Re-recorded when meshes are spawned or despawned.
 	if (m_offScreenCmdBuffer == VK_NULL_HANDLE)
 	{
 		m_offScreenCmdBuffer = VulkanRenderer::createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, false);
-	}
 
-	// Create a semaphore used to synchronize offscreen rendering and usage
-	VkSemaphoreCreateInfo semaphoreCreateInfo = vkUtils::initializers::semaphoreCreateInfo();
-	VK_CHECK_RESULT(vkCreateSemaphore(m_device, &semaphoreCreateInfo, nullptr, &m_offscreenSemaphore));
+		// Create a semaphore used to synchronize offscreen rendering and usage
+		VkSemaphoreCreateInfo semaphoreCreateInfo = vkUtils::initializers::semaphoreCreateInfo();
+		VK_CHECK_RESULT(vkCreateSemaphore(m_device, &semaphoreCreateInfo, nullptr, &m_offscreenSemaphore));
+	}
 
 	VkCommandBufferBeginInfo cmdBufInfo = vkUtils::initializers::commandBufferBeginInfo();
 
@@ -679,7 +759,25 @@ void VulkanHybridRenderer::buildDeferredCommandBuffer()
 	vkCmdBindDescriptorSets(m_offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayouts.m_offscreen, 0, 1, &m_descriptorSets.m_model, 0, NULL);
 	vkCmdBindVertexBuffers(m_offScreenCmdBuffer, VERTEX_BUFFER_BIND_ID, 1, &m_sceneMeshes.m_model.meshBuffer.vertices.buf, offsets);
 	vkCmdBindIndexBuffer(m_offScreenCmdBuffer, m_sceneMeshes.m_model.meshBuffer.indices.buf, 0, VK_INDEX_TYPE_UINT32);
-	vkCmdDrawIndexed(m_offScreenCmdBuffer, m_sceneMeshes.m_model.meshBuffer.indexCount, 1, 0, 0, 0);
+
+	// One draw per run of spawned meshes, which is a single draw for the whole model unless some were despawned.
+	const std::vector<vkMeshLoader::MeshDescriptor>& meshDescriptors = m_sceneMeshes.m_model.meshBuffer.meshDescriptors;
+	for (size_t meshIdx = 0; meshIdx < meshDescriptors.size(); )
+	{
+		if (!m_isModelMeshSpawned[meshIdx])
+		{
+			meshIdx++;
+			continue;
+		}
+
+		const uint32_t firstIndex = meshDescriptors[meshIdx].indexBase;
+		uint32_t indexCount = 0;
+		for (; meshIdx < meshDescriptors.size() && m_isModelMeshSpawned[meshIdx]; meshIdx++)
+		{
+			indexCount += meshDescriptors[meshIdx].indexCount;
+		}
+		vkCmdDrawIndexed(m_offScreenCmdBuffer, indexCount, 1, firstIndex, 0, 0);
+	}
 
 	vkCmdEndRenderPass(m_offScreenCmdBuffer);
 
@@ -709,11 +807,69 @@ void VulkanHybridRenderer::buildRaytracingCommandBuffer() {
 	//vkCmdWriteTimestamp(m_compute.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, );
 	vkCmdBindDescriptorSets(m_compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayouts.m_raytrace, 0, 1, &m_descriptorSets.m_raytrace, 0, nullptr);
 
-	vkCmdDispatch(m_compute.commandBuffer, m_compute.m_storageRaytraceImage.width / 16, m_compute.m_storageRaytraceImage.height / 16, 1);
+	if (m_enableWavefront)
+	{
+		buildWavefrontCommands();
+	}
+	else
+	{
+		vkCmdDispatch(m_compute.commandBuffer, m_compute.m_storageRaytraceImage.width / 16, m_compute.m_storageRaytraceImage.height / 16, 1);
+	}
 
 	VK_CHECK_RESULT(vkEndCommandBuffer(m_compute.commandBuffer));
 }
 
+void VulkanHybridRenderer::buildWavefrontCommands() {
+	const VkCommandBuffer commandBuffer = m_compute.commandBuffer;
+	const VkBuffer queueCounters = m_compute.m_buffers.wavefrontQueueCounters.buffer;
+	const uint32_t numPixels = m_compute.m_storageRaytraceImage.width * m_compute.m_storageRaytraceImage.height;
+
+	SWavefrontPushConstants pushConstants;
+	for (pushConstants.m_firstPixel = 0; pushConstants.m_firstPixel < numPixels; pushConstants.m_firstPixel += WAVEFRONT_POOL_SIZE)
+	{
+		const uint32_t numPaths = std::min<uint32_t>(numPixels - pushConstants.m_firstPixel, WAVEFRONT_POOL_SIZE);
+		const uint32_t numPathGroups = (numPaths + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+		pushConstants.m_bounce = 0;
+
+		// Primary samples, which fill the first extension queue and the shadow queue
+		resetWavefrontQueues(commandBuffer, queueCounters, 0, WAVEFRONT_QUEUE_COUNT);
+		wavefrontBarrier(commandBuffer);
+
+		vkCmdPushConstants(commandBuffer, m_pipelineLayouts.m_raytrace, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_wavefront[WAVEFRONT_STAGE_PRIMARY]);
+		vkCmdDispatch(commandBuffer, numPathGroups, 1, 1);
+		wavefrontBarrier(commandBuffer);
+
+		// Bounces, each reading the extension queue filled by the previous one and filling the other one
+		for (pushConstants.m_bounce = 0; pushConstants.m_bounce < RAYTRACE_TRACE_DEPTH; pushConstants.m_bounce++)
+		{
+			const uint32_t extensionQueueIdx = WAVEFRONT_QUEUE_EXTENSION + (pushConstants.m_bounce & 1);
+			const uint32_t nextExtensionQueueIdx = WAVEFRONT_QUEUE_EXTENSION + ((pushConstants.m_bounce + 1) & 1);
+			resetWavefrontQueues(commandBuffer, queueCounters, nextExtensionQueueIdx, 1);
+			resetWavefrontQueues(commandBuffer, queueCounters, WAVEFRONT_QUEUE_HIT, 1);
+			wavefrontBarrier(commandBuffer);
+
+			vkCmdPushConstants(commandBuffer, m_pipelineLayouts.m_raytrace, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_wavefront[WAVEFRONT_STAGE_EXTEND]);
+			vkCmdDispatchIndirect(commandBuffer, queueCounters, extensionQueueIdx * sizeof(SWavefrontQueueCounter));
+			wavefrontBarrier(commandBuffer);
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_wavefront[WAVEFRONT_STAGE_SHADE]);
+			vkCmdDispatchIndirect(commandBuffer, queueCounters, WAVEFRONT_QUEUE_HIT * sizeof(SWavefrontQueueCounter));
+			wavefrontBarrier(commandBuffer);
+		}
+
+		// Shadow feelers of all the bounces, then the pixels of the pool
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_wavefront[WAVEFRONT_STAGE_SHADOW]);
+		vkCmdDispatchIndirect(commandBuffer, queueCounters, WAVEFRONT_QUEUE_SHADOW * sizeof(SWavefrontQueueCounter));
+		wavefrontBarrier(commandBuffer);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.m_wavefront[WAVEFRONT_STAGE_RESOLVE]);
+		vkCmdDispatch(commandBuffer, numPathGroups, 1, 1);
+		wavefrontBarrier(commandBuffer);
+	}
+}
+
 void VulkanHybridRenderer::loadTextures()
 {
 	m_textureLoader->loadTexture(getAssetPath() + "textures/pattern_35_bc3.ktx", VK_FORMAT_BC3_UNORM_BLOCK, &m_modelTex.m_colorMap);
@@ -920,7 +1076,19 @@ void VulkanHybridRenderer::loadMeshes()
 	{
 		vkMeshLoader::MeshCreateInfo meshCreateInfo;
 
+		m_bvhTree.m_buildParams.m_strategy = BVHTree::BUILD_SBVH;
+		m_bvhTree.m_buildParams.m_maxDepth = 32;
+		// The scene is static until meshes are moved, so it is worth spending some of the loading time on a better tree.
+		m_bvhTree.m_buildParams.m_optimizeAfterBuild = true;
+
 		loadMesh(getAssetPath() + m_fileName, &m_sceneMeshes.m_model.meshBuffer, &m_sceneMeshes.m_model.meshAttributes, vertexLayout, &meshCreateInfo, &m_bvhTree);
+		std::vector<BVHTree::SRange> wideNodeRanges;
+		m_bvhWideLayout = BVHTree::SWideBVHLayout();
+		m_bvhTree.updateWideBVH<BVH_WIDTH>(std::vector<size_t>(), m_bvhWideLayout, m_bvhWideNodes, wideNodeRanges);
+		BVHTree::quantizeWideBVH(m_bvhWideNodes, m_bvhQuantizedWideNodes);
+		m_bvhTree.buildTriangleSoup(m_sceneMeshes.m_model.meshAttributes.m_verticePositions, m_bvhTriangles);
+		m_bvhTree.buildMeshMaterialIds(m_sceneMeshes.m_model.meshAttributes.m_indices, m_bvhMeshMaterialIds);
+		m_isModelMeshSpawned.assign(m_sceneMeshes.m_model.meshBuffer.meshDescriptors.size(), true);
 		std::cout << "Number of vertices: " << m_sceneMeshes.m_model.meshAttributes.m_verticePositions.size() << std::endl;
 		std::cout << "Number of triangles: " << m_sceneMeshes.m_model.meshAttributes.m_indices.size() << std::endl;
 	}
@@ -1138,6 +1306,530 @@ void VulkanHybridRenderer::loadMeshes()
 
 	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
 	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+
+	// --  BVH triangle indices
+	bufferSize = m_bvhTree.m_triIndices.size() * sizeof(glm::ivec3);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhTree.m_triIndices.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.m_buffers.bvhTriIndices.buffer,
+		&m_compute.m_buffers.bvhTriIndices.memory,
+		&m_compute.m_buffers.bvhTriIndices.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyTriIndicesCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyTriIndicesCmd, stagingBuffer.buffer, m_compute.m_buffers.bvhTriIndices.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyTriIndicesCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+
+	// --  BVH wide nodes
+	bufferSize = m_bvhWideNodes.size() * sizeof(BVHTree::WideBVHNode<BVH_WIDTH>);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhWideNodes.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.m_buffers.bvhWideNodes.buffer,
+		&m_compute.m_buffers.bvhWideNodes.memory,
+		&m_compute.m_buffers.bvhWideNodes.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyWideNodesCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyWideNodesCmd, stagingBuffer.buffer, m_compute.m_buffers.bvhWideNodes.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyWideNodesCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+
+	// --  BVH quantized wide nodes
+	bufferSize = m_bvhQuantizedWideNodes.size() * sizeof(SQuantizedWideBVHNode);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhQuantizedWideNodes.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.m_buffers.bvhQuantizedWideNodes.buffer,
+		&m_compute.m_buffers.bvhQuantizedWideNodes.memory,
+		&m_compute.m_buffers.bvhQuantizedWideNodes.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyQuantizedWideNodesCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyQuantizedWideNodesCmd, stagingBuffer.buffer, m_compute.m_buffers.bvhQuantizedWideNodes.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyQuantizedWideNodesCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+
+	// --  BVH precomputed triangles
+	bufferSize = m_bvhTriangles.size() * sizeof(BVHTree::PrecomputedTriangle);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhTriangles.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.m_buffers.bvhTriangles.buffer,
+		&m_compute.m_buffers.bvhTriangles.memory,
+		&m_compute.m_buffers.bvhTriangles.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyTrianglesCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyTrianglesCmd, stagingBuffer.buffer, m_compute.m_buffers.bvhTriangles.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyTrianglesCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+
+	// --  BVH mesh materials
+	bufferSize = m_bvhMeshMaterialIds.size() * sizeof(int32_t);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhMeshMaterialIds.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.m_buffers.bvhMeshMaterialIds.buffer,
+		&m_compute.m_buffers.bvhMeshMaterialIds.memory,
+		&m_compute.m_buffers.bvhMeshMaterialIds.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyMeshMaterialIdsCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyMeshMaterialIdsCmd, stagingBuffer.buffer, m_compute.m_buffers.bvhMeshMaterialIds.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyMeshMaterialIdsCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+}
+
+void VulkanHybridRenderer::createWavefrontBuffers()
+{
+	// Same layouts as WavefrontPath and WavefrontHit in raytrace.comp.
+	const VkDeviceSize pathSize = 12 * sizeof(uint32_t);
+	const VkDeviceSize hitSize = 8 * sizeof(uint32_t);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		WAVEFRONT_POOL_SIZE * pathSize,
+		nullptr,
+		&m_compute.m_buffers.wavefrontPaths.buffer,
+		&m_compute.m_buffers.wavefrontPaths.memory,
+		&m_compute.m_buffers.wavefrontPaths.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		WAVEFRONT_QUEUE_COUNT * sizeof(SWavefrontQueueCounter),
+		nullptr,
+		&m_compute.m_buffers.wavefrontQueueCounters.buffer,
+		&m_compute.m_buffers.wavefrontQueueCounters.memory,
+		&m_compute.m_buffers.wavefrontQueueCounters.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		2 * WAVEFRONT_POOL_SIZE * sizeof(uint32_t),
+		nullptr,
+		&m_compute.m_buffers.wavefrontExtensionQueues.buffer,
+		&m_compute.m_buffers.wavefrontExtensionQueues.memory,
+		&m_compute.m_buffers.wavefrontExtensionQueues.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		WAVEFRONT_POOL_SIZE * hitSize,
+		nullptr,
+		&m_compute.m_buffers.wavefrontHitQueue.buffer,
+		&m_compute.m_buffers.wavefrontHitQueue.memory,
+		&m_compute.m_buffers.wavefrontHitQueue.descriptor);
+
+	// A path queues its shadow feelers once, at the end of its last bounce.
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		WAVEFRONT_POOL_SIZE * WAVEFRONT_MAX_LIGHTS * sizeof(uint32_t),
+		nullptr,
+		&m_compute.m_buffers.wavefrontShadowQueue.buffer,
+		&m_compute.m_buffers.wavefrontShadowQueue.memory,
+		&m_compute.m_buffers.wavefrontShadowQueue.descriptor);
+}
+
+void VulkanHybridRenderer::uploadBufferRanges(VkBuffer dstBuffer, const void* srcData, const std::vector<VkBufferCopy>& regions)
+{
+	if (regions.empty())
+		return;
+
+	VkDeviceSize bufferSize = 0;
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		bufferSize += regions[i].size;
+	}
+
+	vk::Buffer stagingBuffer;
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		nullptr,
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	// Pack the regions back to back in the staging buffer.
+	std::vector<VkBufferCopy> copyRegions(regions);
+	uint8_t *pData;
+	VK_CHECK_RESULT(vkMapMemory(m_device, stagingBuffer.memory, 0, bufferSize, 0, (void **)&pData));
+	VkDeviceSize stagingOffset = 0;
+	for (size_t i = 0; i < copyRegions.size(); i++)
+	{
+		memcpy(pData + stagingOffset, static_cast<const uint8_t*>(srcData) + copyRegions[i].srcOffset, copyRegions[i].size);
+		copyRegions[i].srcOffset = stagingOffset;
+		stagingOffset += copyRegions[i].size;
+	}
+	vkUnmapMemory(m_device, stagingBuffer.memory);
+
+	VkCommandBuffer copyCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, dstBuffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+	flushCommandBuffer(copyCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+}
+
+void VulkanHybridRenderer::uploadBufferRanges(VkBuffer dstBuffer, const void* srcData, size_t elementSize, const std::vector<BVHTree::SRange>& ranges)
+{
+	std::vector<VkBufferCopy> copyRegions;
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		if (ranges[i].m_count == 0)
+			continue;
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = ranges[i].m_first * elementSize;
+		copyRegion.dstOffset = copyRegion.srcOffset;
+		copyRegion.size = ranges[i].m_count * elementSize;
+		copyRegions.push_back(copyRegion);
+	}
+	uploadBufferRanges(dstBuffer, srcData, copyRegions);
+}
+
+void VulkanHybridRenderer::recreateRaytracingBuffer(vk::Buffer& buffer, VkBufferUsageFlags usageFlags, VkDeviceSize size, uint32_t binding)
+{
+	vkQueueWaitIdle(m_compute.queue);
+	vkDestroyBuffer(m_device, buffer.buffer, nullptr);
+	vkFreeMemory(m_device, buffer.memory, nullptr);
+
+	createBuffer(
+		usageFlags,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		size,
+		nullptr,
+		&buffer.buffer,
+		&buffer.memory,
+		&buffer.descriptor);
+
+	VkWriteDescriptorSet writeDescriptorSet = vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		binding,
+		&buffer.descriptor);
+	vkUpdateDescriptorSets(m_device, 1, &writeDescriptorSet, 0, NULL);
+}
+
+void VulkanHybridRenderer::updateModelMeshPositions(const std::vector<size_t>& meshIdxs)
+{
+	const std::vector<glm::vec4>& positions = m_sceneMeshes.m_model.meshAttributes.m_verticePositions;
+
+	// --  Positions buffer: only the vertices of the moved meshes.
+	std::vector<VkBufferCopy> copyRegions;
+	for (size_t i = 0; i < meshIdxs.size(); i++)
+	{
+		const BVHTree::SRange& vertexRange = m_bvhTree.getMeshVertexRange(meshIdxs[i]);
+		if (vertexRange.m_count == 0)
+			continue;
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = vertexRange.m_first * sizeof(glm::vec4);
+		copyRegion.dstOffset = copyRegion.srcOffset;
+		copyRegion.size = vertexRange.m_count * sizeof(glm::vec4);
+		copyRegions.push_back(copyRegion);
+	}
+	uploadBufferRanges(m_compute.m_buffers.positions.buffer, positions.data(), copyRegions);
+
+	// --  BVH AABBs
+	std::vector<BVHTree::SRange> dirtyNodeRanges;
+	const size_t prevNumNodes = m_bvhTree.m_aabbNodes.size();
+	if (!m_bvhTree.refit(positions, meshIdxs, dirtyNodeRanges))
+	{
+		uploadBufferRanges(m_compute.m_buffers.bvhAabbNodes.buffer, m_bvhTree.m_aabbNodes.data(), sizeof(BVHTree::BVHNode), dirtyNodeRanges);
+
+		// --  BVH precomputed triangles: only the triangles of the moved meshes.
+		std::vector<BVHTree::SRange> dirtyTriRanges;
+		m_bvhTree.refitTriangleSoup(positions, meshIdxs, m_bvhTriangles, dirtyTriRanges);
+		uploadBufferRanges(m_compute.m_buffers.bvhTriangles.buffer, m_bvhTriangles.data(), sizeof(BVHTree::PrecomputedTriangle), dirtyTriRanges);
+
+		updateBVHWideNodes(meshIdxs);
+		return;
+	}
+
+	// The refitted trees got too loose, rebuild them and upload the whole node buffer.
+	const size_t prevNumTris = m_bvhTree.m_triIndices.size();
+	m_bvhTree.rebuildBVHTree(positions);
+	m_bvhTree.buildTriangleSoup(positions, m_bvhTriangles);
+
+	const size_t numNodes = m_bvhTree.m_aabbNodes.size();
+	if (numNodes != prevNumNodes)
+	{
+		recreateRaytracingBuffer(m_compute.m_buffers.bvhAabbNodes,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			numNodes * sizeof(BVHTree::BVHNode), 8);
+		reBuildRaytracingCommandBuffers();
+	}
+
+	VkBufferCopy copyRegion = {};
+	copyRegion.size = numNodes * sizeof(BVHTree::BVHNode);
+	uploadBufferRanges(m_compute.m_buffers.bvhAabbNodes.buffer, m_bvhTree.m_aabbNodes.data(), std::vector<VkBufferCopy>(1, copyRegion));
+
+	// The triangles were redistributed among the new leaves, and split differently with BUILD_SBVH.
+	const size_t numTris = m_bvhTree.m_triIndices.size();
+	if (numTris != prevNumTris)
+	{
+		recreateRaytracingBuffer(m_compute.m_buffers.bvhTriIndices, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			numTris * sizeof(glm::ivec3), 9);
+		recreateRaytracingBuffer(m_compute.m_buffers.bvhTriangles, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			numTris * sizeof(BVHTree::PrecomputedTriangle), 12);
+		reBuildRaytracingCommandBuffers();
+	}
+
+	copyRegion.size = numTris * sizeof(glm::ivec3);
+	uploadBufferRanges(m_compute.m_buffers.bvhTriIndices.buffer, m_bvhTree.m_triIndices.data(), std::vector<VkBufferCopy>(1, copyRegion));
+
+	copyRegion.size = numTris * sizeof(BVHTree::PrecomputedTriangle);
+	uploadBufferRanges(m_compute.m_buffers.bvhTriangles.buffer, m_bvhTriangles.data(), std::vector<VkBufferCopy>(1, copyRegion));
+
+	// Every tree was rebuilt, so they are all collapsed again.
+	m_bvhWideLayout = BVHTree::SWideBVHLayout();
+	updateBVHWideNodes(std::vector<size_t>());
+}
+
+BVHTree::SRange VulkanHybridRenderer::getModelMeshTriRange(size_t meshIdx) const
+{
+	// The triangles of the meshes are stored back to back, in the order of their indices in the index buffer.
+	const vkMeshLoader::MeshDescriptor& meshDescriptor = m_sceneMeshes.m_model.meshBuffer.meshDescriptors[meshIdx];
+
+	BVHTree::SRange triRange;
+	triRange.m_first = meshDescriptor.indexBase / 3;
+	triRange.m_count = meshDescriptor.indexCount / 3;
+	return triRange;
+}
+
+void VulkanHybridRenderer::setModelMeshesSpawned(const std::vector<size_t>& meshIdxs, bool isSpawned)
+{
+	const std::vector<glm::vec4>& positions = m_sceneMeshes.m_model.meshAttributes.m_verticePositions;
+	const std::vector<glm::ivec4>& indices = m_sceneMeshes.m_model.meshAttributes.m_indices;
+
+	std::vector<size_t> changedMeshIdxs;
+	for (size_t i = 0; i < meshIdxs.size(); i++)
+	{
+		if (m_isModelMeshSpawned[meshIdxs[i]] != isSpawned)
+			changedMeshIdxs.push_back(meshIdxs[i]);
+	}
+	if (changedMeshIdxs.empty())
+		return;
+
+	std::vector<BVHTree::SRange> dirtyNodeRanges;
+	std::vector<BVHTree::SRange> dirtyTriRanges;
+	std::vector<BVHTree::SRange> meshTriRanges;
+	for (size_t i = 0; i < changedMeshIdxs.size(); i++)
+	{
+		const size_t meshIdx = changedMeshIdxs[i];
+		const BVHTree::SRange meshTriRange = getModelMeshTriRange(meshIdx);
+		m_isModelMeshSpawned[meshIdx] = isSpawned;
+		meshTriRanges.push_back(meshTriRange);
+		if (!isSpawned)
+		{
+			m_bvhTree.removeMesh(meshIdx, dirtyNodeRanges);
+			continue;
+		}
+
+		std::vector<glm::ivec3> meshTriIndices;
+		meshTriIndices.reserve(meshTriRange.m_count);
+		for (size_t triIdx = meshTriRange.m_first; triIdx < meshTriRange.m_first + meshTriRange.m_count; triIdx++)
+		{
+			meshTriIndices.push_back(glm::ivec3(indices[triIdx]));
+		}
+		m_bvhTree.insertMesh(meshIdx, positions, meshTriIndices, dirtyNodeRanges, dirtyTriRanges);
+	}
+
+	// --  Triangles looped over without the BVH: the despawned ones are made degenerate, which no ray can hit.
+	if (isSpawned)
+	{
+		uploadBufferRanges(m_compute.m_buffers.indicesAndMaterialIDs.buffer, indices.data(), sizeof(glm::ivec4), meshTriRanges);
+	}
+	else
+	{
+		std::vector<glm::ivec4> degenerateIndices;
+		std::vector<VkBufferCopy> copyRegions;
+		for (size_t i = 0; i < meshTriRanges.size(); i++)
+		{
+			VkBufferCopy copyRegion = {};
+			copyRegion.srcOffset = degenerateIndices.size() * sizeof(glm::ivec4);
+			copyRegion.dstOffset = meshTriRanges[i].m_first * sizeof(glm::ivec4);
+			copyRegion.size = meshTriRanges[i].m_count * sizeof(glm::ivec4);
+			copyRegions.push_back(copyRegion);
+
+			for (size_t triIdx = meshTriRanges[i].m_first; triIdx < meshTriRanges[i].m_first + meshTriRanges[i].m_count; triIdx++)
+			{
+				degenerateIndices.push_back(glm::ivec4(glm::ivec3(indices[triIdx].x), indices[triIdx].w));
+			}
+		}
+		uploadBufferRanges(m_compute.m_buffers.indicesAndMaterialIDs.buffer, degenerateIndices.data(), copyRegions);
+	}
+
+	// --  G-buffer: the render loop waits for the graphics queue at the end of each frame, so it is idle here.
+	buildDeferredCommandBuffer();
+
+	// --  BVH
+	std::vector<BVHTree::SRange> dirtySoupRanges;
+	m_bvhTriangles.resize(m_bvhTree.m_triIndices.size());
+	if (isSpawned)
+		m_bvhTree.refitTriangleSoup(positions, changedMeshIdxs, m_bvhTriangles, dirtySoupRanges);
+
+	// The node and triangle arrays only grow when the inserted trees didn't fit in the ranges freed by removed meshes. The
+	// buffers are then re-created twice as big, so that the next spawns are ranged uploads again.
+	bool isBufferRecreated = false;
+	const size_t numNodes = m_bvhTree.m_aabbNodes.size();
+	if (numNodes * sizeof(BVHTree::BVHNode) > m_compute.m_buffers.bvhAabbNodes.descriptor.range)
+	{
+		recreateRaytracingBuffer(m_compute.m_buffers.bvhAabbNodes,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			2 * numNodes * sizeof(BVHTree::BVHNode), 8);
+		isBufferRecreated = true;
+
+		BVHTree::SRange nodeRange;
+		nodeRange.m_first = 0;
+		nodeRange.m_count = numNodes;
+		dirtyNodeRanges.assign(1, nodeRange);
+	}
+
+	const size_t numTris = m_bvhTree.m_triIndices.size();
+	if (numTris * sizeof(glm::ivec3) > m_compute.m_buffers.bvhTriIndices.descriptor.range)
+	{
+		recreateRaytracingBuffer(m_compute.m_buffers.bvhTriIndices, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			2 * numTris * sizeof(glm::ivec3), 9);
+		recreateRaytracingBuffer(m_compute.m_buffers.bvhTriangles, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			2 * numTris * sizeof(BVHTree::PrecomputedTriangle), 12);
+		isBufferRecreated = true;
+
+		BVHTree::SRange triRange;
+		triRange.m_first = 0;
+		triRange.m_count = numTris;
+		dirtyTriRanges.assign(1, triRange);
+		dirtySoupRanges.assign(1, triRange);
+	}
+
+	if (isBufferRecreated)
+		reBuildRaytracingCommandBuffers();
+
+	uploadBufferRanges(m_compute.m_buffers.bvhAabbNodes.buffer, m_bvhTree.m_aabbNodes.data(), sizeof(BVHTree::BVHNode), dirtyNodeRanges);
+	uploadBufferRanges(m_compute.m_buffers.bvhTriIndices.buffer, m_bvhTree.m_triIndices.data(), sizeof(glm::ivec3), dirtyTriRanges);
+	uploadBufferRanges(m_compute.m_buffers.bvhTriangles.buffer, m_bvhTriangles.data(), sizeof(BVHTree::PrecomputedTriangle), dirtySoupRanges);
+
+	updateBVHWideNodes(changedMeshIdxs);
+}
+
+void VulkanHybridRenderer::updateBVHWideNodes(const std::vector<size_t>& meshIdxs)
+{
+	// Only the top-level tree and the trees of the given meshes are collapsed again, the others keep their nodes.
+	std::vector<BVHTree::SRange> dirtyNodeRanges;
+	m_bvhTree.updateWideBVH<BVH_WIDTH>(meshIdxs, m_bvhWideLayout, m_bvhWideNodes, dirtyNodeRanges);
+	BVHTree::quantizeWideBVH(m_bvhWideNodes, dirtyNodeRanges, m_bvhQuantizedWideNodes);
+
+	// Same as the binary nodes: the buffers are re-created twice as big once the collapsed trees outgrow them.
+	const size_t numWideNodes = m_bvhWideNodes.size();
+	if (numWideNodes * sizeof(BVHTree::WideBVHNode<BVH_WIDTH>) > m_compute.m_buffers.bvhWideNodes.descriptor.range)
+	{
+		recreateRaytracingBuffer(m_compute.m_buffers.bvhWideNodes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			2 * numWideNodes * sizeof(BVHTree::WideBVHNode<BVH_WIDTH>), 10);
+		recreateRaytracingBuffer(m_compute.m_buffers.bvhQuantizedWideNodes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			2 * numWideNodes * sizeof(SQuantizedWideBVHNode), 11);
+		reBuildRaytracingCommandBuffers();
+
+		BVHTree::SRange nodeRange;
+		nodeRange.m_first = 0;
+		nodeRange.m_count = numWideNodes;
+		dirtyNodeRanges.assign(1, nodeRange);
+	}
+
+	uploadBufferRanges(m_compute.m_buffers.bvhWideNodes.buffer, m_bvhWideNodes.data(), sizeof(BVHTree::WideBVHNode<BVH_WIDTH>), dirtyNodeRanges);
+	uploadBufferRanges(m_compute.m_buffers.bvhQuantizedWideNodes.buffer, m_bvhQuantizedWideNodes.data(), sizeof(SQuantizedWideBVHNode), dirtyNodeRanges);
 }
 
 glm::vec3 Centroid(
@@ -1157,17 +1849,18 @@ void VulkanHybridRenderer::generateWireframeBVHNodes() {
 	std::vector<glm::vec3> vertexBuffer;
 	std::vector<uint16_t> bbox_idx;
 
+	// Skip the header and the mesh entries, which duplicate the bounds of the scene and of the mesh roots.
+	const size_t numMeshes = m_bvhTree.m_aabbNodes.empty() ? 0 : m_bvhTree.m_aabbNodes[0].getNumMeshes();
+
 	size_t verticeCount = 0;
-	for (auto node : m_bvhTree.m_aabbNodes) {
+	for (size_t nodeIdx = numMeshes + 1; nodeIdx < m_bvhTree.m_aabbNodes.size(); nodeIdx++) {
 
-		if (node.m_minAABB.w == 0 || node.m_maxAABB.w == 0) {
-			continue;
-		}
+		const BVHTree::BVHNode& node = m_bvhTree.m_aabbNodes[nodeIdx];
 
 		// Setup vertices
-		glm::vec3 centroid = Centroid(glm::vec3(node.m_minAABB), glm::vec3(node.m_maxAABB));
+		glm::vec3 centroid = Centroid(node.m_minAABB, node.m_maxAABB);
 		glm::vec3 translation = centroid;
-		glm::vec3 scale = glm::vec3(glm::vec3(node.m_maxAABB) - glm::vec3(node.m_minAABB));
+		glm::vec3 scale = glm::vec3(node.m_maxAABB - node.m_minAABB);
 		glm::mat4 transform = glm::translate(translation) * glm::scale(scale);
 		
 		vertexBuffer.push_back(glm::vec3(transform * glm::vec4(.5f, .5f, .5f, 1)));
@@ -1294,7 +1987,7 @@ void VulkanHybridRenderer::setupDescriptorFramework()
 		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 12),
 		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 14),
 		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1),
-		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10),
+		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 15),
 	};
 
 	VkDescriptorPoolCreateInfo descriptorPoolInfo =
@@ -1486,6 +2179,56 @@ void VulkanHybridRenderer::setupDescriptorFramework()
 		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 		VK_SHADER_STAGE_COMPUTE_BIT,
 		8),
+		// Binding 9 : bvhTriIndices buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		9),
+		// Binding 10 : bvhWideNodes buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		10),
+		// Binding 11 : bvhQuantizedWideNodes buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		11),
+		// Binding 12 : bvhTriangles buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		12),
+		// Binding 13 : bvhMeshMaterialIds buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		13),
+		// Binding 14 : wavefrontPaths buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		14),
+		// Binding 15 : wavefrontQueueCounters buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		15),
+		// Binding 16 : wavefrontExtensionQueues buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		16),
+		// Binding 17 : wavefrontHitQueue buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		17),
+		// Binding 18 : wavefrontShadowQueue buffer
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		18),
 	};
 
 	descriptorLayout =
@@ -1500,6 +2243,11 @@ void VulkanHybridRenderer::setupDescriptorFramework()
 		&m_descriptorSetLayouts.m_raytrace,
 		1);
 
+	// Pool and bounce of the wavefront stages
+	VkPushConstantRange pushConstantRange = vkUtils::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(SWavefrontPushConstants), 0);
+	pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
 	VK_CHECK_RESULT(vkCreatePipelineLayout(m_device, &pPipelineLayoutCreateInfo, nullptr, &m_pipelineLayouts.m_raytrace));
 
 }
@@ -1718,6 +2466,76 @@ void VulkanHybridRenderer::setupDescriptors()
 		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 		8,
 		&m_compute.m_buffers.bvhAabbNodes.descriptor
+		),
+		// Binding 9 : bvhTriIndices buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		9,
+		&m_compute.m_buffers.bvhTriIndices.descriptor
+		),
+		// Binding 10 : bvhWideNodes buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		10,
+		&m_compute.m_buffers.bvhWideNodes.descriptor
+		),
+		// Binding 11 : bvhQuantizedWideNodes buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		11,
+		&m_compute.m_buffers.bvhQuantizedWideNodes.descriptor
+		),
+		// Binding 12 : bvhTriangles buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		12,
+		&m_compute.m_buffers.bvhTriangles.descriptor
+		),
+		// Binding 13 : bvhMeshMaterialIds buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		13,
+		&m_compute.m_buffers.bvhMeshMaterialIds.descriptor
+		),
+		// Binding 14 : wavefrontPaths buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		14,
+		&m_compute.m_buffers.wavefrontPaths.descriptor
+		),
+		// Binding 15 : wavefrontQueueCounters buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		15,
+		&m_compute.m_buffers.wavefrontQueueCounters.descriptor
+		),
+		// Binding 16 : wavefrontExtensionQueues buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		16,
+		&m_compute.m_buffers.wavefrontExtensionQueues.descriptor
+		),
+		// Binding 17 : wavefrontHitQueue buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		17,
+		&m_compute.m_buffers.wavefrontHitQueue.descriptor
+		),
+		// Binding 18 : wavefrontShadowQueue buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_raytrace,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		18,
+		&m_compute.m_buffers.wavefrontShadowQueue.descriptor
 		)
 	};
 
@@ -1739,6 +2557,7 @@ void VulkanHybridRenderer::setupUniformBuffers(SRendererContext& context)
 	// Setup target compute texture
 	prepareTextureTarget(&m_compute.m_storageRaytraceImage, TEX_DIM, TEX_DIM, VK_FORMAT_R8G8B8A8_UNORM);
 	loadMeshes();
+	createWavefrontBuffers();
 	generateQuads();
 	generateWireframeBVHNodes();
 
@@ -1924,6 +2743,7 @@ void VulkanHybridRenderer::updateUniformBufferRaytracing(SRendererContext& conte
 	m_compute.ubo.m_isTransparency = context.m_enableTransparency;
 	m_compute.ubo.m_isReflection = context.m_enableReflection;
 	m_compute.ubo.m_isColorByRayBounces = context.m_enableColorByRayBounces;
+	m_compute.ubo.m_isQuantizedBVH = context.m_enableQuantizedBVH;
 
 	uint8_t *pData;
 	VK_CHECK_RESULT(vkMapMemory(m_device, m_compute.m_buffers.ubo.memory, 0, sizeof(m_compute.ubo), 0, (void **)&pData));
@@ -2020,6 +2840,35 @@ void VulkanHybridRenderer::toggleColorByRayBounces() {
 	vkUnmapMemory(m_device, m_compute.m_buffers.ubo.memory);
 }
 
+void VulkanHybridRenderer::toggleQuantizedBVH() {
+	VulkanRenderer::toggleQuantizedBVH();
+	reBuildRaytracingCommandBuffers();
+
+	m_compute.ubo.m_isQuantizedBVH = m_enableQuantizedBVH;
+
+	uint8_t *pData;
+	VK_CHECK_RESULT(vkMapMemory(m_device, m_compute.m_buffers.ubo.memory, 0, sizeof(m_compute.ubo), 0, (void **)&pData));
+	memcpy(pData, &m_compute.ubo, sizeof(m_compute.ubo));
+	vkUnmapMemory(m_device, m_compute.m_buffers.ubo.memory);
+}
+
+void VulkanHybridRenderer::toggleWavefront() {
+	VulkanRenderer::toggleWavefront();
+	reBuildRaytracingCommandBuffers();
+}
+
+void VulkanHybridRenderer::toggleDespawnMeshes() {
+	VulkanRenderer::toggleDespawnMeshes();
+
+	// Every other mesh of the model, to show off the incremental BVH updates.
+	std::vector<size_t> meshIdxs;
+	for (size_t meshIdx = 1; meshIdx < m_isModelMeshSpawned.size(); meshIdx += 2)
+	{
+		meshIdxs.push_back(meshIdx);
+	}
+	setModelMeshesSpawned(meshIdxs, !m_despawnMeshes);
+}
+
 void VulkanHybridRenderer::addLight() {
 	VulkanRenderer::addLight();
 	reBuildRaytracingCommandBuffers();
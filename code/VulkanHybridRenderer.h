@@ -23,6 +23,68 @@
 // Offscreen frame buffer properties
 #define FB_DIM TEX_DIM
 
+// Number of children per node of the BVH traversed by the raytracing shader, must match BVH_WIDTH in data/shaders/hybrid/raytrace.comp.
+#define BVH_WIDTH 4
+// Precision of the child bounds of the quantized BVH nodes (8 or 16), must match BVH_QUANTIZATION_BITS in raytrace.comp.
+#define BVH_QUANTIZATION_BITS 8
+
+#if BVH_QUANTIZATION_BITS == 16
+typedef BVHTree::QuantizedWideBVHNode<BVH_WIDTH, uint16_t> SQuantizedWideBVHNode;
+#else
+typedef BVHTree::QuantizedWideBVHNode<BVH_WIDTH, uint8_t> SQuantizedWideBVHNode;
+#endif
+
+// Number of bounces of the raytraced paths, must match TRACEDEPTH in raytrace.comp.
+#define RAYTRACE_TRACE_DEPTH 2
+// Invocations of a work group of raytrace.comp (16x16), which the wavefront stages index as a 1D range.
+#define WAVEFRONT_GROUP_SIZE 256
+// Paths traced at a time by the wavefront mode, must match WAVEFRONT_POOL_SIZE in raytrace.comp. The image is traced
+// in as many passes as needed, so that the paths and queues don't grow with it.
+// A path takes 112 bytes (48 of state, 32 for its hit, 2 x 4 in the extension queues and 6 x 4 in the shadow queue), so
+// the pool takes 112 MiB.
+#define WAVEFRONT_POOL_SIZE (1024 * 1024)
+// Shadow feelers of a path at most, must match MAX_LIGHTS in raytrace.comp.
+#define WAVEFRONT_MAX_LIGHTS 6
+// Binding of the last buffer of raytrace.comp (the shadow queue of the wavefront mode), which a binary compiled from an
+// older version of the shader doesn't declare.
+#define RAYTRACE_LAST_BINDING 18
+
+// Kernels of the wavefront mode, each compiled from raytrace.comp with its RAYTRACE_STAGE specialization constant set to
+// the stage + 1 (0 being the megakernel).
+enum EWavefrontStage
+{
+	WAVEFRONT_STAGE_PRIMARY,	// Shades the G-buffer samples of the pool.
+	WAVEFRONT_STAGE_EXTEND,		// Traces the extension rays of a bounce.
+	WAVEFRONT_STAGE_SHADE,		// Shades the hits of a bounce.
+	WAVEFRONT_STAGE_SHADOW,		// Traces the shadow feelers of the diffuse hits.
+	WAVEFRONT_STAGE_RESOLVE,	// Lights the diffuse hits and writes the pixels of the pool.
+	WAVEFRONT_STAGE_COUNT
+};
+
+// Queues of the wavefront mode, must match WAVEFRONT_QUEUE_* in raytrace.comp.
+enum EWavefrontQueue
+{
+	WAVEFRONT_QUEUE_EXTENSION,	// And WAVEFRONT_QUEUE_EXTENSION + 1, used by every other bounce.
+	WAVEFRONT_QUEUE_HIT = WAVEFRONT_QUEUE_EXTENSION + 2,
+	WAVEFRONT_QUEUE_SHADOW,
+	WAVEFRONT_QUEUE_COUNT
+};
+
+// Same layout as WavefrontQueueCounter in raytrace.comp: the indirect dispatch of the stage reading a queue, kept up to
+// date by the stages appending to it, followed by its number of entries.
+struct SWavefrontQueueCounter
+{
+	VkDispatchIndirectCommand	m_dispatch;
+	uint32_t					m_count;
+};
+
+// Same layout as WavefrontPushConstants in raytrace.comp.
+struct SWavefrontPushConstants
+{
+	uint32_t	m_firstPixel;
+	int32_t		m_bounce;
+};
+
 class VulkanHybridRenderer : public VulkanRenderer
 {
 public:
@@ -62,6 +124,18 @@ public:
 
 	void updateUniformBufferRaytracing(SRendererContext& context);
 
+	// To be called once the positions of the given meshes of the model were modified in place in
+	// SSceneMeshes::m_model.meshAttributes.m_verticePositions. The BVH is refitted and only the modified ranges of
+	// the positions, bvhAabbNodes and bvhTriangles buffers are uploaded, unless the BVH degraded enough to be rebuilt.
+	void updateModelMeshPositions(const std::vector<size_t>& meshIdxs);
+
+	// Removes the given meshes of the model from the scene (isSpawned == false) or puts them back. Their trees are removed
+	// from the BVH or inserted back incrementally, their triangles are made degenerate in the indicesAndMaterialIDs buffer
+	// (for the shader loops that don't use the BVH) or restored, and the G-buffer pass stops or resumes drawing them.
+	// Only the modified ranges of the buffers are uploaded, the BVH buffers are only recreated (twice as big) when the
+	// inserted trees don't fit in them anymore.
+	void setModelMeshesSpawned(const std::vector<size_t>& meshIdxs, bool isSpawned);
+
 	/////////////////////////////////////////////////////////////////////////////////////////////////
 	////////					Event-Handler Functions  								     ////////
 
@@ -72,6 +146,9 @@ public:
 	void toggleTransparency() override;
 	void toggleReflection() override;
 	void toggleColorByRayBounces() override;
+	void toggleQuantizedBVH() override;
+	void toggleWavefront() override;
+	void toggleDespawnMeshes() override;
 	void addLight() override;
 
 	// Called when view change occurs
@@ -123,6 +200,7 @@ private:
 		VkPipeline m_offscreen;
 		VkPipeline m_debug;
 		VkPipeline m_raytrace;
+		VkPipeline m_wavefront[WAVEFRONT_STAGE_COUNT];
 		VkPipeline m_wireframe;
 	};
 
@@ -198,14 +276,29 @@ private:
 	// Build command buffer for rendering the scene to the offscreen frame buffer attachments
 	void buildDeferredCommandBuffer();
 	void buildRaytracingCommandBuffer();
+	// Records the stages of the wavefront mode into the raytracing command buffer, once per pool of paths.
+	void buildWavefrontCommands();
 	void reBuildCommandBuffers();
 	void reBuildRaytracingCommandBuffers();
 
 	void prepareTextureTarget(vkUtils::VulkanTexture *tex, uint32_t width, uint32_t height, VkFormat format);
 	void loadTextures();
 	void loadMeshes();
+	// Copies the given regions of srcData (VkBufferCopy::srcOffset is relative to srcData) into dstBuffer through a single staging buffer.
+	void uploadBufferRanges(VkBuffer dstBuffer, const void* srcData, const std::vector<VkBufferCopy>& regions);
+	// Same as uploadBufferRanges, with the regions given as ranges of elements of elementSize bytes.
+	void uploadBufferRanges(VkBuffer dstBuffer, const void* srcData, size_t elementSize, const std::vector<BVHTree::SRange>& ranges);
+	// Replaces a storage buffer of the raytracing descriptor set by a new one of the given size, whose content is undefined.
+	void recreateRaytracingBuffer(vk::Buffer& buffer, VkBufferUsageFlags usageFlags, VkDeviceSize size, uint32_t binding);
+	// Creates the paths and queues of the wavefront mode, sized for WAVEFRONT_POOL_SIZE paths.
+	void createWavefrontBuffers();
+	// Collapses the top-level tree and the trees of the given meshes of m_bvhTree again into m_bvhWideNodes (and
+	// m_bvhQuantizedWideNodes) and uploads the modified nodes, once the buffers were created.
+	void updateBVHWideNodes(const std::vector<size_t>& meshIdxs);
 	void generateQuads();
 	void generateWireframeBVHNodes();
+	// Range of the triangles of the given mesh of the model in SSceneMeshes::m_model.meshAttributes.m_indices.
+	BVHTree::SRange getModelMeshTriRange(size_t meshIdx) const;
 
 private:
 
@@ -214,6 +307,12 @@ private:
 
 	SSceneMeshes			m_sceneMeshes;
 	BVHTree					m_bvhTree; // Only used for SSceneMeshes::m_model for now.
+	std::vector< BVHTree::WideBVHNode<BVH_WIDTH> > m_bvhWideNodes; // m_bvhTree collapsed for the raytracing shader.
+	BVHTree::SWideBVHLayout	m_bvhWideLayout; // Where each mesh tree is in m_bvhWideNodes.
+	std::vector<SQuantizedWideBVHNode> m_bvhQuantizedWideNodes; // m_bvhWideNodes with quantized child bounds.
+	std::vector<BVHTree::PrecomputedTriangle> m_bvhTriangles; // Triangles of the leaves of m_bvhTree, in m_triIndices order.
+	std::vector<int32_t>	m_bvhMeshMaterialIds; // Material of each mesh of m_bvhTree, for the closest hits of the bounces.
+	std::vector<bool>		m_isModelMeshSpawned; // See setModelMeshesSpawned.
 
 	SVkVertices				m_vertices;
 
@@ -259,6 +358,18 @@ private:
 			vk::Buffer positions;
 			vk::Buffer normals;
 			vk::Buffer bvhAabbNodes;
+			vk::Buffer bvhTriIndices;
+			vk::Buffer bvhWideNodes;
+			vk::Buffer bvhQuantizedWideNodes;
+			vk::Buffer bvhTriangles;
+			vk::Buffer bvhMeshMaterialIds;
+
+			// -- Wavefront buffers
+			vk::Buffer wavefrontPaths;
+			vk::Buffer wavefrontQueueCounters;
+			vk::Buffer wavefrontExtensionQueues;
+			vk::Buffer wavefrontHitQueue;
+			vk::Buffer wavefrontShadowQueue;
 
 		} m_buffers;
 
@@ -278,6 +389,7 @@ private:
 			uint32_t    m_isTransparency = false;
 			uint32_t    m_isReflection = false;
 			uint32_t    m_isColorByRayBounces = false;
+			uint32_t    m_isQuantizedBVH = false;
 
 			// Padding to be 16 bytes aligned
 		} ubo;
@@ -22,12 +22,30 @@ This code is licensed under the MIT license (MIT) (http://opensource.org/license
 #include <tinygltfloader/tiny_gltf_loader.h>
 
 #include "Utilities.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 typedef unsigned char Byte;
 
 /////////////////////////////////////////////////////////////////////////////////
 /////							BVHTree										/////
-int BVHTree::numHeaderAabbNodes = 0;
+float BVHTree::Aabb::surfaceArea() const
+{
+	if (!isValid())
+		return 0.0f;
+
+	glm::vec3 extent = m_max - m_min;
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
 
 void BVHTree::BVHNode::setAabb(const Triangle* tri, size_t numTris)
 {
@@ -47,192 +65,3436 @@ void BVHTree::BVHNode::setAabb(const Triangle* tri, size_t numTris)
 		maxVtx = glm::max(tri[triIdx].m_pos[2], maxVtx);
 	}
 
-	m_minAABB = glm::vec4(minVtx, 0.0f);
-	m_maxAABB = glm::vec4(maxVtx, 0.0f);
+	m_minAABB = minVtx;
+	m_maxAABB = maxVtx;
+}
+
+void BVHTree::BVHNode::setNumMeshes(size_t numMeshes)
+{
+	m_left = int32_t(numMeshes);
+}
+
+void BVHTree::BVHNode::setRootNode(size_t aabbIdx, size_t numNodes)
+{
+	m_left = int32_t(aabbIdx);
+	m_right = int32_t(numNodes);
 }
 
-void BVHTree::BVHNode::setRootNode(size_t aabbIdx)
+void BVHTree::BVHNode::setTopLevelRootNode(size_t aabbIdx)
 {
-	m_minAABB.w = aabbIdx;
-	m_maxAABB.w = 0;
+	m_right = int32_t(aabbIdx);
 }
 
 void BVHTree::BVHNode::setLeftChild(size_t aabbIdx)
 {
-	m_minAABB.w = aabbIdx;
+	m_left = int32_t(aabbIdx);
 }
 
 void BVHTree::BVHNode::setRightChild(size_t aabbIdx)
 {
-	m_maxAABB.w = aabbIdx;
+	m_right = int32_t(aabbIdx);
+}
+
+void BVHTree::BVHNode::setAsLeaf(size_t firstTriIdx, size_t numTris)
+{
+	m_left = int32_t(firstTriIdx);
+	m_right = -int32_t(numTris);
+}
+
+BVHTree::BVHNode::BVHNode(const glm::vec3& bound0, const glm::vec3& bound1)
+: m_minAABB(glm::min(bound0, bound1))
+, m_left(0)
+, m_maxAABB(glm::max(bound0, bound1))
+, m_right(0)
+{
+}
+
+template <typename ChunkFunc>
+void BVHTree::_runChunks(size_t numChunks, const ChunkFunc& func)
+{
+	if (numChunks > 1 && m_buildThreadPool != nullptr)
+	{
+		m_buildThreadPool->parallelFor(numChunks, func);
+		return;
+	}
+
+	for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++)
+	{
+		func(chunkIdx);
+	}
+}
+
+template <typename SubtreeBuilderA, typename SubtreeBuilderB>
+void BVHTree::_buildChildNodes(size_t parentIdx, size_t numTris, const SubtreeBuilderA& buildSubtreeA, const SubtreeBuilderB& buildSubtreeB,
+	std::vector<BVHTree::BVHNode>& outNodes)
+{
+	if (m_buildThreadPool == nullptr || numTris < m_buildParams.m_parallelBuildMinTris)
+	{
+		size_t bvhNodeIdxL = buildSubtreeA(outNodes);
+		outNodes[parentIdx].setLeftChild(bvhNodeIdxL);
+
+		size_t bvhNodeIdxR = buildSubtreeB(outNodes);
+		outNodes[parentIdx].setRightChild(bvhNodeIdxR);
+		return;
+	}
+
+	// Build the left subtree on another thread while we build the right one, each into its own node buffer.
+	// The buffers are then appended in the same order as the sequential build so that the layout stays identical.
+	std::vector<BVHTree::BVHNode> nodesA;
+	std::vector<BVHTree::BVHNode> nodesB;
+	{
+		ThreadPool::TaskGroup taskGroup(*m_buildThreadPool);
+		taskGroup.run([&]() { buildSubtreeA(nodesA); });
+		buildSubtreeB(nodesB);
+		taskGroup.wait();
+	}
+
+	size_t bvhNodeIdxL = _appendNodes(nodesA, outNodes);
+	outNodes[parentIdx].setLeftChild(bvhNodeIdxL);
+
+	size_t bvhNodeIdxR = _appendNodes(nodesB, outNodes);
+	outNodes[parentIdx].setRightChild(bvhNodeIdxR);
 }
 
-void BVHTree::BVHNode::setNumLeafChildren(size_t numChildren)
+void* BVHTree::ScratchArena::_alloc(size_t numBytes)
 {
-	m_minAABB.w = numChildren;
-	m_maxAABB.w = numChildren;
+	const size_t alignment = 16;
+	const size_t minBlockSize = 64 * 1024;
+
+	numBytes = (numBytes + alignment - 1) & ~(alignment - 1);
+	if (m_curBlockIdx < m_blocks.size() && m_curOffset + numBytes <= m_blockSizes[m_curBlockIdx])
+	{
+		void* mem = m_blocks[m_curBlockIdx].get() + m_curOffset;
+		m_curOffset += numBytes;
+		return mem;
+	}
+
+	// Move on to the next block, which is unused and can be replaced if it is too small.
+	const size_t nextBlockIdx = (m_curBlockIdx < m_blocks.size() && m_curOffset > 0) ? m_curBlockIdx + 1 : m_curBlockIdx;
+	if (nextBlockIdx == m_blocks.size())
+	{
+		m_blocks.push_back(std::unique_ptr<char[]>());
+		m_blockSizes.push_back(0);
+	}
+	if (m_blockSizes[nextBlockIdx] < numBytes)
+	{
+		const size_t prevBlockSize = (nextBlockIdx > 0) ? m_blockSizes[nextBlockIdx - 1] : 0;
+		m_blockSizes[nextBlockIdx] = glm::max(glm::max(numBytes, minBlockSize), 2 * prevBlockSize);
+		m_blocks[nextBlockIdx].reset(new char[m_blockSizes[nextBlockIdx]]);
+	}
+
+	m_curBlockIdx = nextBlockIdx;
+	m_curOffset = numBytes;
+	return m_blocks[m_curBlockIdx].get();
 }
 
-void BVHTree::BVHNode::setAsLeafTri(const glm::ivec3& triIndices)
+BVHTree::ScratchArena& BVHTree::_getScratchArena()
 {
-	m_minAABB.x = triIndices[0];
-	m_minAABB.y = triIndices[1];
-	m_minAABB.z = triIndices[2];
-	m_minAABB.w = 0;
+	const int workerIdx = (m_buildThreadPool != nullptr) ? m_buildThreadPool->getCurrentWorkerIdx() : -1;
+	return m_scratchArenas[workerIdx + 1];
 }
 
-BVHTree::BVHNode::BVHNode(const glm::vec4& bound0, const glm::vec4& bound1)
+BVHTree::Aabb BVHTree::_computeAabb(const std::vector<Triangle>& tris, const BuildRef* refs, size_t numRefs) const
 {
-	m_minAABB = glm::min(bound0, bound1);
-	m_maxAABB = glm::max(bound0, bound1);
+	Aabb aabb;
+	for (size_t refIdx = 0; refIdx < numRefs; refIdx++)
+	{
+		const Triangle& tri = tris[refs[refIdx].m_triIdx];
+		aabb.grow(tri.m_pos[0]);
+		aabb.grow(tri.m_pos[1]);
+		aabb.grow(tri.m_pos[2]);
+	}
+	return aabb;
 }
 
-size_t BVHTree::_buildBVHTree(int depth, int maxLeafSize, const std::vector<Triangle>& tris, std::vector<BVHTree::BVHNode>& outNodes)
+size_t BVHTree::_buildBVHTree(int depth, int maxLeafSize, const std::vector<Triangle>& tris, BuildRef* refs, size_t numRefs,
+	std::vector<BVHTree::BVHNode>& outNodes)
 {
-	if (tris.empty())
+	if (numRefs == 0)
 		return 0;
 
+	if (depth == 0 || numRefs <= size_t(maxLeafSize))
+	{
+		return _buildLeafNode(tris, refs, numRefs, outNodes);
+	}
+
+	// 1) Find dimension of largest extent
+	const Aabb trisAabb = _computeAabb(tris, refs, numRefs);
+
+	int newBvhNodeIdx = outNodes.size();
+
+	outNodes.push_back(BVHNode());
+	BVHNode& newBvhNode = outNodes.back();
+	newBvhNode.m_minAABB = trisAabb.m_min;
+	newBvhNode.m_maxAABB = trisAabb.m_max;
+
+	glm::vec3 trisExtent = trisAabb.m_max - trisAabb.m_min;
+
+	DIM largestDim = DIM::DIM_X;
+	if (trisExtent[DIM::DIM_Y] > trisExtent[largestDim]) { largestDim = DIM_Y; }
+	if (trisExtent[DIM::DIM_Z] > trisExtent[largestDim]) { largestDim = DIM_Z; }
+
+	// 2) Split in halves around the median of the triangles' biggest extent along that dimension.
+	const size_t numRefsA = numRefs / 2;
+	std::nth_element(refs, refs + numRefsA, refs + numRefs, [&tris, largestDim](const BuildRef& lhs, const BuildRef& rhs) {
+		const Triangle& triL = tris[lhs.m_triIdx];
+		const Triangle& triR = tris[rhs.m_triIdx];
+		return glm::max(glm::max(triL.m_pos[0][largestDim], triL.m_pos[1][largestDim]), triL.m_pos[2][largestDim]) <
+			glm::max(glm::max(triR.m_pos[0][largestDim], triR.m_pos[1][largestDim]), triR.m_pos[2][largestDim]);
+	});
+
+	_buildChildNodes(newBvhNodeIdx, numRefs,
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _buildBVHTree(depth - 1, maxLeafSize, tris, refs, numRefsA, childNodes); },
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _buildBVHTree(depth - 1, maxLeafSize, tris, refs + numRefsA, numRefs - numRefsA, childNodes); },
+		outNodes);
+
+	return newBvhNodeIdx;
+}
+
+size_t BVHTree::_buildLeafNode(const std::vector<Triangle>& tris, const BuildRef* refs, size_t numRefs, std::vector<BVHTree::BVHNode>& outNodes)
+{
+	const Aabb trisAabb = _computeAabb(tris, refs, numRefs);
+
 	int newBvhNodeIdx = outNodes.size();
 
+	// The leaf temporarily points to the triangle of its first reference, see _buildMeshBVHTree.
 	outNodes.push_back(BVHNode());
 	BVHNode& newBvhNode = outNodes.back();
-	newBvhNode.setAabb(tris.data(), tris.size());
+	newBvhNode.m_minAABB = trisAabb.m_min;
+	newBvhNode.m_maxAABB = trisAabb.m_max;
+	newBvhNode.setAsLeaf(refs[0].m_triIdx, numRefs);
+
+	return newBvhNodeIdx;
+}
 
-	if (depth == 0 || tris.size() <= maxLeafSize)
+size_t BVHTree::_buildBVHTreeBinnedSAH(int depth, const SBuildParams& params, const std::vector<Triangle>& tris, BuildRef* refs, size_t numRefs,
+	std::vector<BVHTree::BVHNode>& outNodes)
+{
+	if (numRefs == 0)
+		return 0;
+
+	if (depth == 0 || numRefs == 1)
+	{
+		return _buildLeafNode(tris, refs, numRefs, outNodes);
+	}
+
+	Aabb trisAabb;
+	size_t numRefsA = 0;
 	{
-		newBvhNode.setNumLeafChildren(tris.size());
-		for (int i = 0; i < tris.size(); i++)
+		// Scratch memory is only needed to find the split, so it is released before recursing.
+		ScratchArena& arena = _getScratchArena();
+		ScratchArena::Scope arenaScope(arena);
+
+		// Big nodes are split into chunks which are bounded and binned concurrently, then reduced.
+		const size_t chunkSize = (m_buildThreadPool != nullptr) ? glm::max<size_t>(m_buildParams.m_parallelBuildMinTris, 1) : numRefs;
+		const size_t numChunks = (numRefs + chunkSize - 1) / chunkSize;
+		const int numBins = glm::max(params.m_numBins, 2);
+
+		// 1) Compute the bounds of the triangles and of their centroids.
+		Aabb* chunkTrisAabbs = arena.alloc<Aabb>(numChunks);
+		Aabb* chunkCentroidsAabbs = arena.alloc<Aabb>(numChunks);
+		_runChunks(numChunks, [&](size_t chunkIdx) {
+			const size_t chunkEnd = glm::min(numRefs, (chunkIdx + 1) * chunkSize);
+			for (size_t refIdx = chunkIdx * chunkSize; refIdx < chunkEnd; refIdx++)
+			{
+				const Triangle& tri = tris[refs[refIdx].m_triIdx];
+				chunkTrisAabbs[chunkIdx].grow(tri.m_pos[0]);
+				chunkTrisAabbs[chunkIdx].grow(tri.m_pos[1]);
+				chunkTrisAabbs[chunkIdx].grow(tri.m_pos[2]);
+
+				chunkCentroidsAabbs[chunkIdx].grow(refs[refIdx].m_centroid);
+			}
+		});
+
+		Aabb centroidsAabb;
+		for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++)
+		{
+			trisAabb.grow(chunkTrisAabbs[chunkIdx]);
+			centroidsAabb.grow(chunkCentroidsAabbs[chunkIdx]);
+		}
+
+		// 2) Bin the centroids along each dimension and evaluate the SAH at every bin boundary.
+		struct SahBin
+		{
+			SahBin() : m_numTris(0) {}
+
+			Aabb	m_aabb;
+			int		m_numTris;
+		};
+
+		SahBin* chunkBins = arena.alloc<SahBin>(numChunks * 3 * numBins);
+		_runChunks(numChunks, [&](size_t chunkIdx) {
+			const size_t chunkEnd = glm::min(numRefs, (chunkIdx + 1) * chunkSize);
+			for (int dim = DIM_X; dim <= DIM_Z; dim++)
+			{
+				const float centroidsExtent = centroidsAabb.m_max[dim] - centroidsAabb.m_min[dim];
+				if (centroidsExtent <= 0.0f)
+					continue;
+
+				const float binScale = numBins / centroidsExtent;
+				SahBin* bins = &chunkBins[(chunkIdx * 3 + dim) * numBins];
+				for (size_t refIdx = chunkIdx * chunkSize; refIdx < chunkEnd; refIdx++)
+				{
+					const Triangle& tri = tris[refs[refIdx].m_triIdx];
+					int binIdx = glm::min(numBins - 1, int((refs[refIdx].m_centroid[dim] - centroidsAabb.m_min[dim]) * binScale));
+					bins[binIdx].m_numTris++;
+					bins[binIdx].m_aabb.grow(tri.m_pos[0]);
+					bins[binIdx].m_aabb.grow(tri.m_pos[1]);
+					bins[binIdx].m_aabb.grow(tri.m_pos[2]);
+				}
+			}
+		});
+
+		SahBin* bins = arena.alloc<SahBin>(numBins);
+		float* rightAreas = arena.alloc<float>(numBins - 1);
+		int* rightNumTris = arena.alloc<int>(numBins - 1);
+
+		float bestCost = FLT_MAX;
+		int bestDim = -1;
+		int bestSplit = -1;
+		for (int dim = DIM_X; dim <= DIM_Z; dim++)
+		{
+			const float centroidsExtent = centroidsAabb.m_max[dim] - centroidsAabb.m_min[dim];
+			if (centroidsExtent <= 0.0f)
+				continue;
+
+			std::fill(bins, bins + numBins, SahBin());
+			for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++)
+			{
+				const SahBin* chunkDimBins = &chunkBins[(chunkIdx * 3 + dim) * numBins];
+				for (int binIdx = 0; binIdx < numBins; binIdx++)
+				{
+					bins[binIdx].m_numTris += chunkDimBins[binIdx].m_numTris;
+					bins[binIdx].m_aabb.grow(chunkDimBins[binIdx].m_aabb);
+				}
+			}
+
+			// Sweep from the right to gather the area and count of the triangles on the right side of each bin boundary.
+			Aabb rightAabb;
+			int rightCount = 0;
+			for (int binIdx = numBins - 1; binIdx > 0; binIdx--)
+			{
+				rightAabb.grow(bins[binIdx].m_aabb);
+				rightCount += bins[binIdx].m_numTris;
+				rightAreas[binIdx - 1] = rightAabb.surfaceArea();
+				rightNumTris[binIdx - 1] = rightCount;
+			}
+
+			// Sweep from the left and evaluate the cost of splitting at each bin boundary.
+			Aabb leftAabb;
+			int leftCount = 0;
+			for (int binIdx = 0; binIdx < numBins - 1; binIdx++)
+			{
+				leftAabb.grow(bins[binIdx].m_aabb);
+				leftCount += bins[binIdx].m_numTris;
+				if (leftCount == 0 || rightNumTris[binIdx] == 0)
+					continue;
+
+				float cost = leftCount * leftAabb.surfaceArea() + rightNumTris[binIdx] * rightAreas[binIdx];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestDim = dim;
+					bestSplit = binIdx;
+				}
+			}
+		}
+
+		const float parentArea = trisAabb.surfaceArea();
+		if (bestDim == -1 || parentArea <= 0.0f)
 		{
-			outNodes.push_back(BVHNode());
-			BVHNode& bvhLeafNode = outNodes.back();
-			bvhLeafNode.setAsLeafTri(tris[i].m_indices);
+			// All the centroids are coincident, there is nothing the SAH can do for us.
+			if (numRefs <= size_t(params.m_maxLeafSize))
+				return _buildLeafNode(tris, refs, numRefs, outNodes);
+			return _buildBVHTree(depth, params.m_maxLeafSize, tris, refs, numRefs, outNodes);
 		}
-		return newBvhNodeIdx;
+
+		// 3) Only split when it is expected to be cheaper than intersecting all the triangles, unless the leaf would be too big.
+		const float leafCost = params.m_intersectionCost * numRefs;
+		const float splitCost = params.m_traversalCost + params.m_intersectionCost * bestCost / parentArea;
+		if (numRefs <= size_t(params.m_maxLeafSize) && leafCost <= splitCost)
+		{
+			return _buildLeafNode(tris, refs, numRefs, outNodes);
+		}
+
+		// 4) Partition the references in place, the bins on the left of the best boundary go first.
+		const float bestBinMin = centroidsAabb.m_min[bestDim];
+		const float bestBinScale = numBins / (centroidsAabb.m_max[bestDim] - bestBinMin);
+		BuildRef* refsB = std::partition(refs, refs + numRefs, [=](const BuildRef& ref) {
+			return glm::min(numBins - 1, int((ref.m_centroid[bestDim] - bestBinMin) * bestBinScale)) <= bestSplit;
+		});
+		numRefsA = refsB - refs;
 	}
 
-	// 1) Find dimension of largest extent
-	glm::vec3 trisMin = tris[0].m_pos[0];
-	glm::vec3 trisMax = tris[0].m_pos[0];
+	int newBvhNodeIdx = outNodes.size();
 
-	for (int triIdx = 0; triIdx < tris.size(); triIdx++)
-	{
-		for (int posIdx = 0; posIdx < 3; posIdx++)
+	outNodes.push_back(BVHNode());
+	BVHNode& newBvhNode = outNodes.back();
+	newBvhNode.m_minAABB = trisAabb.m_min;
+	newBvhNode.m_maxAABB = trisAabb.m_max;
+
+	_buildChildNodes(newBvhNodeIdx, numRefs,
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _buildBVHTreeBinnedSAH(depth - 1, params, tris, refs, numRefsA, childNodes); },
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _buildBVHTreeBinnedSAH(depth - 1, params, tris, refs + numRefsA, numRefs - numRefsA, childNodes); },
+		outNodes);
+
+	return newBvhNodeIdx;
+}
+
+static inline int countLeadingZeros64(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long bitIdx;
+	return _BitScanReverse64(&bitIdx, x) ? 63 - int(bitIdx) : 64;
+#else
+	return (x != 0) ? __builtin_clzll(x) : 64;
+#endif
+}
+
+// Inserts two zeros between each of the 10 low bits of v.
+static inline uint64_t expandBits10(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// Inserts two zeros between each of the 21 low bits of v.
+static inline uint64_t expandBits21(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+// Length of the longest common prefix of the keys at sorted positions i and j, -1 if j is out of range.
+// Duplicated keys are disambiguated by their position.
+static inline int lbvhDelta(const uint64_t* mortonCodes, int numCodes, int i, int j)
+{
+	if (j < 0 || j >= numCodes)
+		return -1;
+	if (mortonCodes[i] == mortonCodes[j])
+		return 64 + countLeadingZeros64(uint64_t(uint32_t(i ^ j))) - 32;
+	return countLeadingZeros64(mortonCodes[i] ^ mortonCodes[j]);
+}
+
+size_t BVHTree::_buildLBVH(int depth, int maxLeafSize, const std::vector<Triangle>& tris, BuildRef* refs, size_t numRefs,
+	std::vector<BVHTree::BVHNode>& outNodes)
+{
+	if (numRefs == 0)
+		return 0;
+
+	// The radix tree is referenced by the whole emission, so the scratch memory is held until we are done.
+	ScratchArena& arena = _getScratchArena();
+	ScratchArena::Scope arenaScope(arena);
+
+	const int numTris = int(numRefs);
+	const size_t chunkSize = (m_buildThreadPool != nullptr) ? glm::max<size_t>(m_buildParams.m_parallelBuildMinTris, 1) : numTris;
+	const size_t numChunks = (numTris + chunkSize - 1) / chunkSize;
+
+	// 1) Compute the bounds of the centroids, which the Morton codes are quantized against.
+	Aabb* chunkCentroidsAabbs = arena.alloc<Aabb>(numChunks);
+	_runChunks(numChunks, [&](size_t chunkIdx) {
+		const size_t chunkEnd = glm::min<size_t>(numTris, (chunkIdx + 1) * chunkSize);
+		for (size_t refIdx = chunkIdx * chunkSize; refIdx < chunkEnd; refIdx++)
 		{
-			trisMin = glm::min(trisMin, tris[triIdx].m_pos[posIdx]);
-			trisMax = glm::max(trisMax, tris[triIdx].m_pos[posIdx]);
+			chunkCentroidsAabbs[chunkIdx].grow(refs[refIdx].m_centroid);
 		}
+	});
+
+	Aabb centroidsAabb;
+	for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++)
+	{
+		centroidsAabb.grow(chunkCentroidsAabbs[chunkIdx]);
 	}
 
-	glm::vec3 trisExtent = trisMax - trisMin;
-	trisExtent = glm::abs(trisExtent);
+	// 2) Compute the Morton code of each centroid.
+	const bool useWideCodes = m_buildParams.m_mortonCodeBits > 30;
+	const float gridSize = useWideCodes ? float((1 << 21) - 1) : float((1 << 10) - 1);
+	const glm::vec3 centroidsExtent = centroidsAabb.m_max - centroidsAabb.m_min;
+	const glm::vec3 gridScale(
+		centroidsExtent.x > 0.0f ? gridSize / centroidsExtent.x : 0.0f,
+		centroidsExtent.y > 0.0f ? gridSize / centroidsExtent.y : 0.0f,
+		centroidsExtent.z > 0.0f ? gridSize / centroidsExtent.z : 0.0f);
+
+	uint64_t* mortonCodes = arena.alloc<uint64_t>(numTris);
+	_runChunks(numChunks, [&](size_t chunkIdx) {
+		const size_t chunkEnd = glm::min<size_t>(numTris, (chunkIdx + 1) * chunkSize);
+		for (size_t refIdx = chunkIdx * chunkSize; refIdx < chunkEnd; refIdx++)
+		{
+			glm::vec3 gridPos = glm::clamp((refs[refIdx].m_centroid - centroidsAabb.m_min) * gridScale, glm::vec3(0.0f), glm::vec3(gridSize));
 
-	DIM largestDim = DIM::DIM_X;
-	if (trisExtent[DIM::DIM_Y] > trisExtent[largestDim]) { largestDim = DIM_Y; }
-	if (trisExtent[DIM::DIM_Z] > trisExtent[largestDim]) { largestDim = DIM_Z; }
+			if (useWideCodes)
+				mortonCodes[refIdx] = (expandBits21(uint64_t(gridPos.x)) << 2) | (expandBits21(uint64_t(gridPos.y)) << 1) | expandBits21(uint64_t(gridPos.z));
+			else
+				mortonCodes[refIdx] = (expandBits10(uint32_t(gridPos.x)) << 2) | (expandBits10(uint32_t(gridPos.y)) << 1) | expandBits10(uint32_t(gridPos.z));
+		}
+	});
+
+	// 3) Sort the triangles along the Morton curve.
+	_sortMortonCodes(mortonCodes, refs, numRefs, useWideCodes ? 63 : 30);
+
+	if (numTris == 1)
+		return _buildLeafNode(tris, refs, 1, outNodes);
+
+	// 4) Find the range and split position of every internal node of the radix tree, all independently.
+	LBVHNode* lbvhNodes = arena.alloc<LBVHNode>(numTris - 1);
+	_runChunks(numChunks, [&](size_t chunkIdx) {
+		const int chunkEnd = glm::min<int>(numTris - 1, int((chunkIdx + 1) * chunkSize));
+		for (int i = int(chunkIdx * chunkSize); i < chunkEnd; i++)
+		{
+			// Direction of the range covered by node i.
+			const int d = (lbvhDelta(mortonCodes, numTris, i, i + 1) - lbvhDelta(mortonCodes, numTris, i, i - 1)) >= 0 ? 1 : -1;
+
+			// Upper bound of the length of the range, then exact length by binary search.
+			const int deltaMin = lbvhDelta(mortonCodes, numTris, i, i - d);
+			int lengthMax = 2;
+			while (lbvhDelta(mortonCodes, numTris, i, i + lengthMax * d) > deltaMin)
+			{
+				lengthMax *= 2;
+			}
+
+			int length = 0;
+			for (int t = lengthMax / 2; t >= 1; t /= 2)
+			{
+				if (lbvhDelta(mortonCodes, numTris, i, i + (length + t) * d) > deltaMin)
+					length += t;
+			}
+			const int j = i + length * d;
 
-	std::vector<TriDimExtent> dimExtents; dimExtents.resize(tris.size());
-	for (int triIdx = 0; triIdx < tris.size(); triIdx++)
+			// Split position, i.e. the last key sharing more than deltaNode bits with key i.
+			const int deltaNode = lbvhDelta(mortonCodes, numTris, i, j);
+			int split = 0;
+			for (int div = 2, t = length; t > 1; div *= 2)
+			{
+				t = (length + div - 1) / div;
+				if (lbvhDelta(mortonCodes, numTris, i, i + (split + t) * d) > deltaNode)
+					split += t;
+			}
+			const int gamma = i + split * d + glm::min(d, 0);
+
+			LBVHNode& node = lbvhNodes[i];
+			node.m_first = glm::min(i, j);
+			node.m_last = glm::max(i, j);
+			node.m_child[0] = gamma;
+			node.m_child[1] = gamma + 1;
+			node.m_isLeafChild[0] = (node.m_first == gamma);
+			node.m_isLeafChild[1] = (node.m_last == gamma + 1);
+		}
+	});
+
+	// 5) Emit our nodes, optionally rebuilding the top of the tree over a cut of treelets using the SAH.
+	if (m_buildParams.m_lbvhRefineTreelets <= 1)
+		return _emitLBVHSubtree(lbvhNodes, 0, false, depth, maxLeafSize, tris, refs, outNodes);
+
+	std::vector<LBVHTreelet> treelets;
+	{
+		LBVHTreelet rootTreelet;
+		rootTreelet.m_nodeIdx = 0;
+		rootTreelet.m_isLeaf = false;
+		rootTreelet.m_first = 0;
+		rootTreelet.m_last = numTris - 1;
+		treelets.push_back(rootTreelet);
+	}
+
+	// Keep splitting the biggest treelet until we have enough of them.
+	while (int(treelets.size()) < m_buildParams.m_lbvhRefineTreelets)
 	{
-		dimExtents[triIdx].set(largestDim, triIdx, tris[triIdx]);
+		int biggestIdx = -1;
+		for (int treeletIdx = 0; treeletIdx < int(treelets.size()); treeletIdx++)
+		{
+			const LBVHTreelet& treelet = treelets[treeletIdx];
+			if (treelet.m_isLeaf || (treelet.m_last - treelet.m_first) < maxLeafSize)
+				continue;
+			if (biggestIdx == -1 || (treelet.m_last - treelet.m_first) > (treelets[biggestIdx].m_last - treelets[biggestIdx].m_first))
+				biggestIdx = treeletIdx;
+		}
+		if (biggestIdx == -1)
+			break;
+
+		const LBVHNode& node = lbvhNodes[treelets[biggestIdx].m_nodeIdx];
+		LBVHTreelet children[2];
+		for (int childIdx = 0; childIdx < 2; childIdx++)
+		{
+			children[childIdx].m_nodeIdx = node.m_child[childIdx];
+			children[childIdx].m_isLeaf = node.m_isLeafChild[childIdx];
+			children[childIdx].m_first = node.m_isLeafChild[childIdx] ? node.m_child[childIdx] : lbvhNodes[node.m_child[childIdx]].m_first;
+			children[childIdx].m_last = node.m_isLeafChild[childIdx] ? node.m_child[childIdx] : lbvhNodes[node.m_child[childIdx]].m_last;
+		}
+		treelets[biggestIdx] = children[0];
+		treelets.push_back(children[1]);
 	}
-	std::sort(dimExtents.begin(), dimExtents.end(), TriDimExtent::SortTris);
 
-	size_t numTris = tris.size();
-	size_t triIdx = 0;
+	_runChunks(treelets.size(), [&](size_t treeletIdx) {
+		LBVHTreelet& treelet = treelets[treeletIdx];
+		treelet.m_aabb = _computeAabb(tris, refs + treelet.m_first, treelet.m_last - treelet.m_first + 1);
+	});
+
+	return _emitLBVHTreelets(lbvhNodes, treelets, 0, treelets.size(), depth, maxLeafSize, tris, refs, outNodes);
+}
+
+void BVHTree::_sortMortonCodes(uint64_t* mortonCodes, BuildRef* refs, size_t numRefs, int numBits)
+{
+	// LSD radix sort, 8 bits per pass. Each chunk histograms its keys, then scatters them to the offsets
+	// given by the prefix sum over (digit, chunk), which keeps every pass stable.
+	ScratchArena& arena = _getScratchArena();
+	ScratchArena::Scope arenaScope(arena);
+
+	const int numBuckets = 256;
+	const size_t numKeys = numRefs;
+	const size_t chunkSize = (m_buildThreadPool != nullptr) ? glm::max<size_t>(m_buildParams.m_parallelBuildMinTris, 1) : numKeys;
+	const size_t numChunks = (numKeys + chunkSize - 1) / chunkSize;
+
+	uint64_t* keys[2] = { mortonCodes, arena.alloc<uint64_t>(numKeys) };
+	BuildRef* values[2] = { refs, arena.alloc<BuildRef>(numKeys) };
+	size_t* chunkOffsets = arena.alloc<size_t>(numChunks * numBuckets);
+
+	int srcIdx = 0;
+	for (int shift = 0; shift < numBits; shift += 8)
+	{
+		_runChunks(numChunks, [&](size_t chunkIdx) {
+			size_t* offsets = &chunkOffsets[chunkIdx * numBuckets];
+			std::fill(offsets, offsets + numBuckets, 0);
+
+			const size_t chunkEnd = glm::min(numKeys, (chunkIdx + 1) * chunkSize);
+			for (size_t keyIdx = chunkIdx * chunkSize; keyIdx < chunkEnd; keyIdx++)
+			{
+				offsets[(keys[srcIdx][keyIdx] >> shift) & 0xFF]++;
+			}
+		});
+
+		size_t offset = 0;
+		for (int bucketIdx = 0; bucketIdx < numBuckets; bucketIdx++)
+		{
+			for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++)
+			{
+				size_t count = chunkOffsets[chunkIdx * numBuckets + bucketIdx];
+				chunkOffsets[chunkIdx * numBuckets + bucketIdx] = offset;
+				offset += count;
+			}
+		}
+
+		_runChunks(numChunks, [&](size_t chunkIdx) {
+			size_t* offsets = &chunkOffsets[chunkIdx * numBuckets];
+
+			const size_t chunkEnd = glm::min(numKeys, (chunkIdx + 1) * chunkSize);
+			for (size_t keyIdx = chunkIdx * chunkSize; keyIdx < chunkEnd; keyIdx++)
+			{
+				size_t dstIdx = offsets[(keys[srcIdx][keyIdx] >> shift) & 0xFF]++;
+				keys[1 - srcIdx][dstIdx] = keys[srcIdx][keyIdx];
+				values[1 - srcIdx][dstIdx] = values[srcIdx][keyIdx];
+			}
+		});
+
+		srcIdx = 1 - srcIdx;
+	}
 
-	std::vector<Triangle> sortedTrisA; sortedTrisA.resize(numTris / 2);
-	for (; triIdx < numTris / 2; triIdx++)
+	// Odd number of passes, the sorted keys are in the scratch buffers.
+	if (srcIdx == 1)
 	{
-		sortedTrisA[triIdx] = tris[dimExtents[triIdx].m_triIdx];
+		std::copy(keys[1], keys[1] + numKeys, mortonCodes);
+		std::copy(values[1], values[1] + numKeys, refs);
 	}
-	std::vector<Triangle> sortedTrisB; sortedTrisB.reserve(numTris - numTris / 2);
-	for (; triIdx < numTris; triIdx++)
+}
+
+size_t BVHTree::_emitLBVHSubtree(const LBVHNode* lbvhNodes, int lbvhNodeIdx, bool isLeaf, int depth, int maxLeafSize,
+	const std::vector<Triangle>& tris, const BuildRef* sortedRefs, std::vector<BVHTree::BVHNode>& outNodes)
+{
+	const int first = isLeaf ? lbvhNodeIdx : lbvhNodes[lbvhNodeIdx].m_first;
+	const int last = isLeaf ? lbvhNodeIdx : lbvhNodes[lbvhNodeIdx].m_last;
+	const size_t numTris = last - first + 1;
+	if (isLeaf || depth == 0 || numTris <= size_t(maxLeafSize))
 	{
-		sortedTrisB.push_back(tris[dimExtents[triIdx].m_triIdx]);
+		return _buildLeafNode(tris, sortedRefs + first, numTris, outNodes);
 	}
 
-	int bvhNodeIdxL = _buildBVHTree(depth - 1, maxLeafSize, sortedTrisA, outNodes);
-	outNodes[newBvhNodeIdx].setLeftChild(numHeaderAabbNodes + bvhNodeIdxL);
+	int newBvhNodeIdx = outNodes.size();
+	outNodes.push_back(BVHNode());
 
-	int bvhNodeIdxR = _buildBVHTree(depth - 1, maxLeafSize, sortedTrisB, outNodes);
-	outNodes[newBvhNodeIdx].setRightChild(numHeaderAabbNodes + bvhNodeIdxR);
+	const LBVHNode& node = lbvhNodes[lbvhNodeIdx];
+	_buildChildNodes(newBvhNodeIdx, numTris,
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _emitLBVHSubtree(lbvhNodes, node.m_child[0], node.m_isLeafChild[0], depth - 1, maxLeafSize, tris, sortedRefs, childNodes); },
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _emitLBVHSubtree(lbvhNodes, node.m_child[1], node.m_isLeafChild[1], depth - 1, maxLeafSize, tris, sortedRefs, childNodes); },
+		outNodes);
 
+	_setAabbFromChildren(newBvhNodeIdx, outNodes);
 	return newBvhNodeIdx;
 }
 
-void BVHTree::buildBVHTree(const std::vector<vkMeshLoader::MeshEntry>& meshEntries)
+size_t BVHTree::_emitLBVHTreelets(const LBVHNode* lbvhNodes, std::vector<LBVHTreelet>& treelets, size_t first, size_t last, int depth, int maxLeafSize,
+	const std::vector<Triangle>& tris, const BuildRef* sortedRefs, std::vector<BVHTree::BVHNode>& outNodes)
 {
-	const size_t numMeshes = meshEntries.size();
-	m_aabbNodes.resize(numMeshes + 1);
-	m_aabbNodes[0].setNumLeafChildren(numMeshes);
+	if (last - first == 1)
+	{
+		const LBVHTreelet& treelet = treelets[first];
+		return _emitLBVHSubtree(lbvhNodes, treelet.m_nodeIdx, treelet.m_isLeaf, depth, maxLeafSize, tris, sortedRefs, outNodes);
+	}
 
-	std::vector< std::vector<Triangle> > sceneTris;
-	sceneTris.resize(numMeshes);
-	for (int meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	// There are only a few treelets, so evaluate the SAH at every split position along each axis.
+	size_t numTris = 0;
+	for (size_t treeletIdx = first; treeletIdx < last; treeletIdx++)
 	{
-		const vkMeshLoader::MeshEntry& meshEntry = meshEntries[meshIdx];
-		const int indicesCount = meshEntry.Indices.size();
-		sceneTris[meshIdx].resize(indicesCount / 3);
+		numTris += treelets[treeletIdx].m_last - treelets[treeletIdx].m_first + 1;
+	}
+
+	// The scratch costs are released before recursing.
+	size_t bestSplit = first + (last - first) / 2;
+	{
+		ScratchArena& arena = _getScratchArena();
+		ScratchArena::Scope arenaScope(arena);
+		float* rightCosts = arena.alloc<float>(last - first);
 
-		for (int iCount = 0, iTriIdx = 0; iCount < indicesCount; iCount += 3, iTriIdx++)
+		float bestCost = FLT_MAX;
+		int bestDim = DIM_X;
+		for (int dim = DIM_X; dim <= DIM_Z; dim++)
 		{
-			glm::ivec3 triIdx(
-				meshEntry.Indices[iCount]		+ meshEntry.vertexBase,
-				meshEntry.Indices[iCount + 1]	+ meshEntry.vertexBase,
-				meshEntry.Indices[iCount + 2]	+ meshEntry.vertexBase);
+			std::sort(treelets.begin() + first, treelets.begin() + last, [dim](const LBVHTreelet& lhs, const LBVHTreelet& rhs) {
+				return (lhs.m_aabb.m_min[dim] + lhs.m_aabb.m_max[dim]) < (rhs.m_aabb.m_min[dim] + rhs.m_aabb.m_max[dim]);
+			});
 
-			sceneTris[meshIdx][iTriIdx].set(
-				meshEntry.Vertices[triIdx[0] - meshEntry.vertexBase].m_pos,
-				meshEntry.Vertices[triIdx[1] - meshEntry.vertexBase].m_pos,
-				meshEntry.Vertices[triIdx[2] - meshEntry.vertexBase].m_pos);
+			Aabb rightAabb;
+			size_t rightNumTris = 0;
+			for (size_t treeletIdx = last - 1; treeletIdx > first; treeletIdx--)
+			{
+				rightAabb.grow(treelets[treeletIdx].m_aabb);
+				rightNumTris += treelets[treeletIdx].m_last - treelets[treeletIdx].m_first + 1;
+				rightCosts[treeletIdx - first] = rightNumTris * rightAabb.surfaceArea();
+			}
 
-			sceneTris[meshIdx][iTriIdx].m_indices = triIdx;
-		}
+			Aabb leftAabb;
+			size_t leftNumTris = 0;
+			for (size_t treeletIdx = first; treeletIdx < last - 1; treeletIdx++)
+			{
+				leftAabb.grow(treelets[treeletIdx].m_aabb);
+				leftNumTris += treelets[treeletIdx].m_last - treelets[treeletIdx].m_first + 1;
 
-		int treeMaxDepth = 5;
-		int maxLeafSize = 12;
+				float cost = leftNumTris * leftAabb.surfaceArea() + rightCosts[treeletIdx + 1 - first];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestDim = dim;
+					bestSplit = treeletIdx + 1;
+				}
+			}
+		}
 
-		numHeaderAabbNodes = m_aabbNodes.size();
-		std::vector<BVHTree::BVHNode> newNodes;
-		_buildBVHTree(treeMaxDepth, maxLeafSize, sceneTris[meshIdx], newNodes);
-		
-		m_aabbNodes[meshIdx + 1].setRootNode( m_aabbNodes.size() );
-		m_aabbNodes.insert( m_aabbNodes.end(), newNodes.begin(), newNodes.end() );
+		if (bestDim != DIM_Z)
+		{
+			std::sort(treelets.begin() + first, treelets.begin() + last, [bestDim](const LBVHTreelet& lhs, const LBVHTreelet& rhs) {
+				return (lhs.m_aabb.m_min[bestDim] + lhs.m_aabb.m_max[bestDim]) < (rhs.m_aabb.m_min[bestDim] + rhs.m_aabb.m_max[bestDim]);
+			});
+		}
 	}
 
+	int newBvhNodeIdx = outNodes.size();
+	outNodes.push_back(BVHNode());
+
+	_buildChildNodes(newBvhNodeIdx, numTris,
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _emitLBVHTreelets(lbvhNodes, treelets, first, bestSplit, depth - 1, maxLeafSize, tris, sortedRefs, childNodes); },
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _emitLBVHTreelets(lbvhNodes, treelets, bestSplit, last, depth - 1, maxLeafSize, tris, sortedRefs, childNodes); },
+		outNodes);
+
+	_setAabbFromChildren(newBvhNodeIdx, outNodes);
+	return newBvhNodeIdx;
+}
+
+void BVHTree::_setAabbFromChildren(size_t nodeIdx, std::vector<BVHTree::BVHNode>& nodes)
+{
+	BVHNode& node = nodes[nodeIdx];
+	const BVHNode& childL = nodes[node.getLeftChild()];
+	const BVHNode& childR = nodes[node.getRightChild()];
+
+	node.m_minAABB = glm::min(childL.m_minAABB, childR.m_minAABB);
+	node.m_maxAABB = glm::max(childL.m_maxAABB, childR.m_maxAABB);
+}
+
+size_t BVHTree::_appendNodes(std::vector<BVHTree::BVHNode>& nodes, std::vector<BVHTree::BVHNode>& outNodes)
+{
+	const size_t offset = outNodes.size();
+	_offsetNodeLinks(nodes, offset, 0);
+	outNodes.insert(outNodes.end(), nodes.begin(), nodes.end());
+	return offset;
+}
+
+struct BVHTree::SBVHBuildState
+{
+	SBVHBuildState(const std::vector<Triangle>& tris, const SBuildParams& params) : m_tris(tris), m_params(params), m_rootArea(0.0f) {}
+
+	const std::vector<Triangle>&	m_tris;
+	const SBuildParams&				m_params;
+	float							m_rootArea;
+
+	// The leaves reserve a range of this array for their triangles, they are packed in node order once the tree is built.
+	std::vector<uint32_t>			m_leafTris;
+	std::atomic<size_t>				m_numLeafTris;
+};
+
+// Bounds of the part of the triangle within [slabMin, slabMax] along dim, clipped to the bounds of its reference.
+static BVHTree::Aabb clipTriangleToSlab(const BVHTree::Triangle& tri, int dim, float slabMin, float slabMax, const BVHTree::Aabb& refAabb)
+{
+	BVHTree::Aabb aabb;
+	for (int vertexIdx = 0; vertexIdx < 3; vertexIdx++)
 	{
-		const int numMeshes = m_aabbNodes[0].m_minAABB.w;
-		int numTris = 0;
-		for (int iMeshIdx = 0; iMeshIdx < numMeshes; iMeshIdx++)
-		{
-			int iRootNode = m_aabbNodes[iMeshIdx + 1].m_minAABB.w;
-			numTris = visit(iRootNode, m_aabbNodes);
-		}
+		const glm::vec3& v0 = tri.m_pos[vertexIdx];
+		const glm::vec3& v1 = tri.m_pos[(vertexIdx + 1) % 3];
+		const float p0 = v0[dim];
+		const float p1 = v1[dim];
+
+		if (p0 >= slabMin && p0 <= slabMax)
+			aabb.grow(v0);
+
+		// Points where the edge crosses the slab planes.
+		if ((p0 < slabMin && p1 > slabMin) || (p0 > slabMin && p1 < slabMin))
+			aabb.grow(glm::mix(v0, v1, (slabMin - p0) / (p1 - p0)));
+		if ((p0 < slabMax && p1 > slabMax) || (p0 > slabMax && p1 < slabMax))
+			aabb.grow(glm::mix(v0, v1, (slabMax - p0) / (p1 - p0)));
 	}
+
+	aabb.m_min = glm::max(aabb.m_min, refAabb.m_min);
+	aabb.m_max = glm::min(aabb.m_max, refAabb.m_max);
+	aabb.m_min[dim] = glm::max(aabb.m_min[dim], slabMin);
+	aabb.m_max[dim] = glm::min(aabb.m_max[dim], slabMax);
+	return aabb;
+}
+
+static inline bool isEmptyAabb(const BVHTree::Aabb& aabb)
+{
+	return aabb.m_min.x > aabb.m_max.x || aabb.m_min.y > aabb.m_max.y || aabb.m_min.z > aabb.m_max.z;
+}
+
+// _layoutNodes emits the children of a mesh tree in pairs right after its root. With 32-byte nodes, placing the root at an
+// odd index makes every pair start on a 64-byte boundary, so fetching both children touches a single cache line.
+static inline size_t getAlignedMeshRootIdx(size_t nodeIdx)
+{
+	return nodeIdx | 1;
 }
 
-int BVHTree::visit(int iCurNode, std::vector<BVHTree::BVHNode>& nodes)
+void BVHTree::_buildMeshSBVH(const SBuildParams& params, const std::vector<Triangle>& tris, std::vector<BVHTree::BVHNode>& outNodes,
+	std::vector<glm::ivec3>& outTriIndices)
 {
-	int numTris = 0;
+	const size_t numTris = tris.size();
+	const int maxNumSplits = int(glm::max(params.m_spatialSplitBudget, 0.0f) * numTris);
 
-	BVHTree::BVHNode& node = nodes[iCurNode];
-	if (node.m_minAABB.w == node.m_maxAABB.w)
+	SBVHBuildState state(tris, params);
+	state.m_leafTris.resize(numTris + maxNumSplits);
+	state.m_numLeafTris = 0;
+
+	std::vector<SpatialBuildRef> refs; refs.resize(numTris);
+	Aabb meshAabb;
+	for (size_t triIdx = 0; triIdx < numTris; triIdx++)
 	{
-		int numNodes = node.m_minAABB.w;
-		for (int i = 0; i < numNodes; i++)
-		{
-			numTris++;
-			BVHTree::BVHNode& leafNode = nodes[iCurNode + 1 + i];
+		refs[triIdx].m_triIdx = uint32_t(triIdx);
+		refs[triIdx].m_aabb.grow(tris[triIdx].m_pos[0]);
+		refs[triIdx].m_aabb.grow(tris[triIdx].m_pos[1]);
+		refs[triIdx].m_aabb.grow(tris[triIdx].m_pos[2]);
+		meshAabb.grow(refs[triIdx].m_aabb);
+	}
+	state.m_rootArea = meshAabb.surfaceArea();
+
+	_buildSBVHNode(glm::clamp(params.m_maxDepth, 0, BVH_MAX_MESH_DEPTH), state, refs, maxNumSplits, outNodes);
 
+	// Pack the triangles of the leaves in node order, so that the layout doesn't depend on the order in which
+	// the build threads reserved their ranges.
+	outTriIndices.clear();
+	outTriIndices.reserve(state.m_numLeafTris);
+	for (size_t nodeIdx = 0; nodeIdx < outNodes.size(); nodeIdx++)
+	{
+		BVHNode& node = outNodes[nodeIdx];
+		if (!node.isLeaf())
+			continue;
+
+		const size_t firstTriIdx = outTriIndices.size();
+		for (size_t leafTriIdx = node.getFirstTri(); leafTriIdx < node.getFirstTri() + node.getNumTris(); leafTriIdx++)
+		{
+			outTriIndices.push_back(tris[state.m_leafTris[leafTriIdx]].m_indices);
 		}
+		node.setAsLeaf(firstTriIdx, node.getNumTris());
 	}
-	else
+}
+
+size_t BVHTree::_buildSBVHLeafNode(SBVHBuildState& state, const std::vector<SpatialBuildRef>& refs, std::vector<BVHTree::BVHNode>& outNodes)
+{
+	Aabb refsAabb;
+	const size_t firstLeafTriIdx = state.m_numLeafTris.fetch_add(refs.size());
+	for (size_t refIdx = 0; refIdx < refs.size(); refIdx++)
 	{
-		numTris += visit(node.m_minAABB.w, nodes);
-		numTris += visit(node.m_maxAABB.w, nodes);
+		refsAabb.grow(refs[refIdx].m_aabb);
+		state.m_leafTris[firstLeafTriIdx + refIdx] = refs[refIdx].m_triIdx;
 	}
 
-	return numTris;
+	int newBvhNodeIdx = outNodes.size();
+
+	// The leaf is bounded by the clipped references only, the parts of its triangles outside of it belong to other leaves.
+	outNodes.push_back(BVHNode());
+	BVHNode& newBvhNode = outNodes.back();
+	newBvhNode.m_minAABB = refsAabb.m_min;
+	newBvhNode.m_maxAABB = refsAabb.m_max;
+	newBvhNode.setAsLeaf(firstLeafTriIdx, refs.size());
+
+	return newBvhNodeIdx;
+}
+
+size_t BVHTree::_buildSBVHNode(int depth, SBVHBuildState& state, std::vector<SpatialBuildRef>& refs, int numSplitsLeft,
+	std::vector<BVHTree::BVHNode>& outNodes)
+{
+	const size_t numRefs = refs.size();
+	if (numRefs == 0)
+		return 0;
+
+	if (depth == 0 || numRefs == 1)
+	{
+		return _buildSBVHLeafNode(state, refs, outNodes);
+	}
+
+	const std::vector<Triangle>& tris = state.m_tris;
+	const SBuildParams& params = state.m_params;
+
+	std::vector<SpatialBuildRef> refsA;
+	std::vector<SpatialBuildRef> refsB;
+	Aabb refsAabb;
+	{
+		ScratchArena& arena = _getScratchArena();
+		ScratchArena::Scope arenaScope(arena);
+
+		const size_t chunkSize = (m_buildThreadPool != nullptr) ? glm::max<size_t>(m_buildParams.m_parallelBuildMinTris, 1) : numRefs;
+		const size_t numChunks = (numRefs + chunkSize - 1) / chunkSize;
+		const int numBins = glm::max(params.m_numBins, 2);
+
+		// 1) Compute the bounds of the references and of their centroids.
+		Aabb* chunkRefsAabbs = arena.alloc<Aabb>(numChunks);
+		Aabb* chunkCentroidsAabbs = arena.alloc<Aabb>(numChunks);
+		_runChunks(numChunks, [&](size_t chunkIdx) {
+			const size_t chunkEnd = glm::min(numRefs, (chunkIdx + 1) * chunkSize);
+			for (size_t refIdx = chunkIdx * chunkSize; refIdx < chunkEnd; refIdx++)
+			{
+				chunkRefsAabbs[chunkIdx].grow(refs[refIdx].m_aabb);
+				chunkCentroidsAabbs[chunkIdx].grow((refs[refIdx].m_aabb.m_min + refs[refIdx].m_aabb.m_max) * 0.5f);
+			}
+		});
+
+		Aabb centroidsAabb;
+		for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++)
+		{
+			refsAabb.grow(chunkRefsAabbs[chunkIdx]);
+			centroidsAabb.grow(chunkCentroidsAabbs[chunkIdx]);
+		}
+
+		struct SahBin
+		{
+			SahBin() : m_numEntries(0), m_numExits(0) {}
+
+			Aabb	m_aabb;
+			int		m_numEntries;	// Number of references starting in the bin, which is the reference count for object bins.
+			int		m_numExits;		// Number of references ending in the bin (spatial bins only).
+		};
+
+		// Sweeps the bins of one dimension and keeps the cheapest boundary, along with the bounds and counts of its sides.
+		float* rightAreas = arena.alloc<float>(numBins - 1);
+		int* rightNumRefs = arena.alloc<int>(numBins - 1);
+		struct SplitCandidate
+		{
+			SplitCandidate() : m_cost(FLT_MAX), m_dim(-1), m_split(-1), m_numRefsA(0), m_numRefsB(0) {}
+
+			float	m_cost;
+			int		m_dim;
+			int		m_split;
+			Aabb	m_aabbA;
+			Aabb	m_aabbB;
+			int		m_numRefsA;
+			int		m_numRefsB;
+		};
+		auto sweepBins = [&](const SahBin* bins, int dim, SplitCandidate& bestSplit) {
+			Aabb rightAabb;
+			int rightCount = 0;
+			for (int binIdx = numBins - 1; binIdx > 0; binIdx--)
+			{
+				rightAabb.grow(bins[binIdx].m_aabb);
+				rightCount += bins[binIdx].m_numExits;
+				rightAreas[binIdx - 1] = rightAabb.surfaceArea();
+				rightNumRefs[binIdx - 1] = rightCount;
+			}
+
+			Aabb leftAabb;
+			int leftCount = 0;
+			for (int binIdx = 0; binIdx < numBins - 1; binIdx++)
+			{
+				leftAabb.grow(bins[binIdx].m_aabb);
+				leftCount += bins[binIdx].m_numEntries;
+				if (leftCount == 0 || rightNumRefs[binIdx] == 0)
+					continue;
+
+				float cost = leftCount * leftAabb.surfaceArea() + rightNumRefs[binIdx] * rightAreas[binIdx];
+				if (cost < bestSplit.m_cost)
+				{
+					bestSplit.m_cost = cost;
+					bestSplit.m_dim = dim;
+					bestSplit.m_split = binIdx;
+					bestSplit.m_aabbA = leftAabb;
+					bestSplit.m_numRefsA = leftCount;
+					bestSplit.m_numRefsB = rightNumRefs[binIdx];
+				}
+			}
+
+			if (bestSplit.m_dim == dim)
+			{
+				bestSplit.m_aabbB = Aabb();
+				for (int binIdx = bestSplit.m_split + 1; binIdx < numBins; binIdx++)
+				{
+					bestSplit.m_aabbB.grow(bins[binIdx].m_aabb);
+				}
+			}
+		};
+
+		// 2) Bin the centroids of the references along each dimension, as the binned SAH builder does (object split).
+		SahBin* chunkBins = arena.alloc<SahBin>(numChunks * 3 * numBins);
+		_runChunks(numChunks, [&](size_t chunkIdx) {
+			const size_t chunkEnd = glm::min(numRefs, (chunkIdx + 1) * chunkSize);
+			for (int dim = DIM_X; dim <= DIM_Z; dim++)
+			{
+				const float centroidsExtent = centroidsAabb.m_max[dim] - centroidsAabb.m_min[dim];
+				if (centroidsExtent <= 0.0f)
+					continue;
+
+				const float binScale = numBins / centroidsExtent;
+				SahBin* bins = &chunkBins[(chunkIdx * 3 + dim) * numBins];
+				for (size_t refIdx = chunkIdx * chunkSize; refIdx < chunkEnd; refIdx++)
+				{
+					const Aabb& refAabb = refs[refIdx].m_aabb;
+					const float centroid = (refAabb.m_min[dim] + refAabb.m_max[dim]) * 0.5f;
+					int binIdx = glm::min(numBins - 1, int((centroid - centroidsAabb.m_min[dim]) * binScale));
+					bins[binIdx].m_numEntries++;
+					bins[binIdx].m_numExits++;
+					bins[binIdx].m_aabb.grow(refAabb);
+				}
+			}
+		});
+
+		SahBin* bins = arena.alloc<SahBin>(numBins);
+		SplitCandidate objectSplit;
+		for (int dim = DIM_X; dim <= DIM_Z; dim++)
+		{
+			if (centroidsAabb.m_max[dim] - centroidsAabb.m_min[dim] <= 0.0f)
+				continue;
+
+			std::fill(bins, bins + numBins, SahBin());
+			for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++)
+			{
+				const SahBin* chunkDimBins = &chunkBins[(chunkIdx * 3 + dim) * numBins];
+				for (int binIdx = 0; binIdx < numBins; binIdx++)
+				{
+					bins[binIdx].m_numEntries += chunkDimBins[binIdx].m_numEntries;
+					bins[binIdx].m_numExits += chunkDimBins[binIdx].m_numExits;
+					bins[binIdx].m_aabb.grow(chunkDimBins[binIdx].m_aabb);
+				}
+			}
+			sweepBins(bins, dim, objectSplit);
+		}
+
+		// 3) Large overlapping references keep the children of the object split from separating, in which case the
+		// references are also clipped into spatial bins spanning the node: a reference enters the bin of its minimum,
+		// exits the one of its maximum and contributes the part of its triangle within each bin in between.
+		SplitCandidate spatialSplit;
+		Aabb overlapAabb;
+		if (objectSplit.m_dim != -1)
+		{
+			overlapAabb.m_min = glm::max(objectSplit.m_aabbA.m_min, objectSplit.m_aabbB.m_min);
+			overlapAabb.m_max = glm::min(objectSplit.m_aabbA.m_max, objectSplit.m_aabbB.m_max);
+		}
+		const bool isOverlapping = (objectSplit.m_dim == -1) || (!isEmptyAabb(overlapAabb) && overlapAabb.surfaceArea() > params.m_spatialSplitAlpha * state.m_rootArea);
+		if (isOverlapping && numSplitsLeft > 0)
+		{
+			std::fill(chunkBins, chunkBins + numChunks * 3 * numBins, SahBin());
+			_runChunks(numChunks, [&](size_t chunkIdx) {
+				const size_t chunkEnd = glm::min(numRefs, (chunkIdx + 1) * chunkSize);
+				for (int dim = DIM_X; dim <= DIM_Z; dim++)
+				{
+					const float refsExtent = refsAabb.m_max[dim] - refsAabb.m_min[dim];
+					if (refsExtent <= 0.0f)
+						continue;
+
+					const float binWidth = refsExtent / numBins;
+					const float binScale = numBins / refsExtent;
+					SahBin* bins = &chunkBins[(chunkIdx * 3 + dim) * numBins];
+					for (size_t refIdx = chunkIdx * chunkSize; refIdx < chunkEnd; refIdx++)
+					{
+						const SpatialBuildRef& ref = refs[refIdx];
+						const int firstBinIdx = glm::clamp(int((ref.m_aabb.m_min[dim] - refsAabb.m_min[dim]) * binScale), 0, numBins - 1);
+						const int lastBinIdx = glm::clamp(int((ref.m_aabb.m_max[dim] - refsAabb.m_min[dim]) * binScale), firstBinIdx, numBins - 1);
+						bins[firstBinIdx].m_numEntries++;
+						bins[lastBinIdx].m_numExits++;
+
+						if (firstBinIdx == lastBinIdx)
+						{
+							bins[firstBinIdx].m_aabb.grow(ref.m_aabb);
+							continue;
+						}
+
+						const Triangle& tri = tris[ref.m_triIdx];
+						for (int binIdx = firstBinIdx; binIdx <= lastBinIdx; binIdx++)
+						{
+							const float binMin = (binIdx == 0) ? -FLT_MAX : refsAabb.m_min[dim] + binIdx * binWidth;
+							const float binMax = (binIdx == numBins - 1) ? FLT_MAX : refsAabb.m_min[dim] + (binIdx + 1) * binWidth;
+							const Aabb clippedAabb = clipTriangleToSlab(tri, dim, binMin, binMax, ref.m_aabb);
+							if (!isEmptyAabb(clippedAabb))
+								bins[binIdx].m_aabb.grow(clippedAabb);
+						}
+					}
+				}
+			});
+
+			for (int dim = DIM_X; dim <= DIM_Z; dim++)
+			{
+				if (refsAabb.m_max[dim] - refsAabb.m_min[dim] <= 0.0f)
+					continue;
+
+				std::fill(bins, bins + numBins, SahBin());
+				for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++)
+				{
+					const SahBin* chunkDimBins = &chunkBins[(chunkIdx * 3 + dim) * numBins];
+					for (int binIdx = 0; binIdx < numBins; binIdx++)
+					{
+						bins[binIdx].m_numEntries += chunkDimBins[binIdx].m_numEntries;
+						bins[binIdx].m_numExits += chunkDimBins[binIdx].m_numExits;
+						bins[binIdx].m_aabb.grow(chunkDimBins[binIdx].m_aabb);
+					}
+				}
+				sweepBins(bins, dim, spatialSplit);
+			}
+		}
+
+		const float parentArea = refsAabb.surfaceArea();
+		const SplitCandidate& bestSplit = (spatialSplit.m_cost < objectSplit.m_cost) ? spatialSplit : objectSplit;
+		if (bestSplit.m_dim == -1 || parentArea <= 0.0f)
+		{
+			if (numRefs <= size_t(params.m_maxLeafSize))
+				return _buildSBVHLeafNode(state, refs, outNodes);
+
+			// Nothing can be separated, split the references in halves along the largest extent instead.
+			const glm::vec3 refsExtent = refsAabb.m_max - refsAabb.m_min;
+			DIM largestDim = DIM_X;
+			if (refsExtent[DIM_Y] > refsExtent[largestDim]) { largestDim = DIM_Y; }
+			if (refsExtent[DIM_Z] > refsExtent[largestDim]) { largestDim = DIM_Z; }
+
+			std::nth_element(refs.begin(), refs.begin() + numRefs / 2, refs.end(), [largestDim](const SpatialBuildRef& lhs, const SpatialBuildRef& rhs) {
+				return lhs.m_aabb.m_min[largestDim] + lhs.m_aabb.m_max[largestDim] < rhs.m_aabb.m_min[largestDim] + rhs.m_aabb.m_max[largestDim];
+			});
+			refsA.assign(refs.begin(), refs.begin() + numRefs / 2);
+			refsB.assign(refs.begin() + numRefs / 2, refs.end());
+		}
+		else
+		{
+			// 4) Only split when it is expected to be cheaper than intersecting all the triangles, unless the leaf would be too big.
+			const float leafCost = params.m_intersectionCost * numRefs;
+			const float splitCost = params.m_traversalCost + params.m_intersectionCost * bestSplit.m_cost / parentArea;
+			if (numRefs <= size_t(params.m_maxLeafSize) && leafCost <= splitCost)
+			{
+				return _buildSBVHLeafNode(state, refs, outNodes);
+			}
+
+			refsA.reserve(bestSplit.m_numRefsA);
+			refsB.reserve(bestSplit.m_numRefsB);
+			const int bestDim = bestSplit.m_dim;
+			if (&bestSplit == &spatialSplit)
+			{
+				// 5) Distribute the references on each side of the split plane. Those straddling it are split in two,
+				// unless moving them entirely to one side is cheaper (reference unsplitting) or the budget is exhausted.
+				const float splitPos = refsAabb.m_min[bestDim] + (bestSplit.m_split + 1) * (refsAabb.m_max[bestDim] - refsAabb.m_min[bestDim]) / numBins;
+				const float areaA = bestSplit.m_aabbA.surfaceArea();
+				const float areaB = bestSplit.m_aabbB.surfaceArea();
+				const float numRefsA = float(bestSplit.m_numRefsA);
+				const float numRefsB = float(bestSplit.m_numRefsB);
+				for (size_t refIdx = 0; refIdx < numRefs; refIdx++)
+				{
+					const SpatialBuildRef& ref = refs[refIdx];
+					if (ref.m_aabb.m_max[bestDim] <= splitPos)
+					{
+						refsA.push_back(ref);
+						continue;
+					}
+					if (ref.m_aabb.m_min[bestDim] >= splitPos)
+					{
+						refsB.push_back(ref);
+						continue;
+					}
+
+					SpatialBuildRef refA = ref;
+					SpatialBuildRef refB = ref;
+					refA.m_aabb = clipTriangleToSlab(tris[ref.m_triIdx], bestDim, -FLT_MAX, splitPos, ref.m_aabb);
+					refB.m_aabb = clipTriangleToSlab(tris[ref.m_triIdx], bestDim, splitPos, FLT_MAX, ref.m_aabb);
+					if (isEmptyAabb(refA.m_aabb) || isEmptyAabb(refB.m_aabb))
+					{
+						// The triangle itself doesn't cross the plane within the bounds of the reference.
+						if (isEmptyAabb(refB.m_aabb))
+							refsA.push_back(refA);
+						else
+							refsB.push_back(refB);
+						continue;
+					}
+
+					Aabb unsplitAabbA = bestSplit.m_aabbA; unsplitAabbA.grow(ref.m_aabb);
+					Aabb unsplitAabbB = bestSplit.m_aabbB; unsplitAabbB.grow(ref.m_aabb);
+					const float splitRefCost = areaA * numRefsA + areaB * numRefsB;
+					const float unsplitCostA = unsplitAabbA.surfaceArea() * numRefsA + areaB * (numRefsB - 1.0f);
+					const float unsplitCostB = areaA * (numRefsA - 1.0f) + unsplitAabbB.surfaceArea() * numRefsB;
+					if (splitRefCost < glm::min(unsplitCostA, unsplitCostB) && numSplitsLeft > 0)
+					{
+						numSplitsLeft--;
+						refsA.push_back(refA);
+						refsB.push_back(refB);
+					}
+					else if (unsplitCostA <= unsplitCostB)
+					{
+						refsA.push_back(ref);
+					}
+					else
+					{
+						refsB.push_back(ref);
+					}
+				}
+			}
+
+			if (refsA.empty() || refsB.empty())
+			{
+				// Unsplitting moved every reference to the same side, fall back to the object split.
+				refsA.clear();
+				refsB.clear();
+			}
+
+			if (refsA.empty() && objectSplit.m_dim != -1)
+			{
+				const int objectDim = objectSplit.m_dim;
+				const float binMin = centroidsAabb.m_min[objectDim];
+				const float binScale = numBins / (centroidsAabb.m_max[objectDim] - binMin);
+				for (size_t refIdx = 0; refIdx < numRefs; refIdx++)
+				{
+					const float centroid = (refs[refIdx].m_aabb.m_min[objectDim] + refs[refIdx].m_aabb.m_max[objectDim]) * 0.5f;
+					if (glm::min(numBins - 1, int((centroid - binMin) * binScale)) <= objectSplit.m_split)
+						refsA.push_back(refs[refIdx]);
+					else
+						refsB.push_back(refs[refIdx]);
+				}
+			}
+
+			if (refsA.empty() || refsB.empty())
+			{
+				refsA.clear();
+				refsB.clear();
+				if (numRefs <= size_t(params.m_maxLeafSize))
+					return _buildSBVHLeafNode(state, refs, outNodes);
+				refsA.assign(refs.begin(), refs.begin() + numRefs / 2);
+				refsB.assign(refs.begin() + numRefs / 2, refs.end());
+			}
+		}
+	}
+
+	// The references of the node aren't needed anymore, release them before going down.
+	std::vector<SpatialBuildRef>().swap(refs);
+
+	// What is left of the budget is shared between the children according to their number of references, rather
+	// than drawn from a global counter, so that the tree doesn't depend on the order in which the threads build it.
+	const int numSplitsLeftA = int(int64_t(numSplitsLeft) * int64_t(refsA.size()) / int64_t(refsA.size() + refsB.size()));
+	const int numSplitsLeftB = numSplitsLeft - numSplitsLeftA;
+
+	int newBvhNodeIdx = outNodes.size();
+
+	outNodes.push_back(BVHNode());
+	BVHNode& newBvhNode = outNodes.back();
+	newBvhNode.m_minAABB = refsAabb.m_min;
+	newBvhNode.m_maxAABB = refsAabb.m_max;
+
+	_buildChildNodes(newBvhNodeIdx, numRefs,
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _buildSBVHNode(depth - 1, state, refsA, numSplitsLeftA, childNodes); },
+		[&](std::vector<BVHTree::BVHNode>& childNodes) { return _buildSBVHNode(depth - 1, state, refsB, numSplitsLeftB, childNodes); },
+		outNodes);
+
+	return newBvhNodeIdx;
+}
+
+void BVHTree::_extractMeshTriangles(const vkMeshLoader::MeshEntry& meshEntry, std::vector<Triangle>& outTris)
+{
+	const int indicesCount = meshEntry.Indices.size();
+	outTris.resize(indicesCount / 3);
+
+	for (int iCount = 0, iTriIdx = 0; iCount < indicesCount; iCount += 3, iTriIdx++)
+	{
+		glm::ivec3 triIdx(
+			meshEntry.Indices[iCount]		+ meshEntry.vertexBase,
+			meshEntry.Indices[iCount + 1]	+ meshEntry.vertexBase,
+			meshEntry.Indices[iCount + 2]	+ meshEntry.vertexBase);
+
+		outTris[iTriIdx].set(
+			meshEntry.Vertices[triIdx[0] - meshEntry.vertexBase].m_pos,
+			meshEntry.Vertices[triIdx[1] - meshEntry.vertexBase].m_pos,
+			meshEntry.Vertices[triIdx[2] - meshEntry.vertexBase].m_pos);
+
+		outTris[iTriIdx].m_indices = triIdx;
+	}
+}
+
+void BVHTree::_buildMeshBVHTree(const SBuildParams& params, const std::vector<Triangle>& tris, std::vector<BVHTree::BVHNode>& outNodes,
+	std::vector<glm::ivec3>& outTriIndices)
+{
+	if (params.m_strategy == BUILD_SBVH)
+	{
+		_buildMeshSBVH(params, tris, outNodes, outTriIndices);
+		return;
+	}
+
+	// The builders partition this single array of references in place rather than copying the triangles around.
+	const size_t numTris = tris.size();
+	std::vector<BuildRef> refs; refs.resize(numTris);
+
+	const size_t chunkSize = (m_buildThreadPool != nullptr) ? glm::max<size_t>(m_buildParams.m_parallelBuildMinTris, 1) : numTris;
+	const size_t numChunks = (numTris + chunkSize - 1) / chunkSize;
+	_runChunks(numChunks, [&](size_t chunkIdx) {
+		const size_t chunkEnd = glm::min(numTris, (chunkIdx + 1) * chunkSize);
+		for (size_t triIdx = chunkIdx * chunkSize; triIdx < chunkEnd; triIdx++)
+		{
+			refs[triIdx].m_centroid = (tris[triIdx].m_pos[0] + tris[triIdx].m_pos[1] + tris[triIdx].m_pos[2]) / 3.0f;
+			refs[triIdx].m_triIdx = uint32_t(triIdx);
+		}
+	});
+
+	const int maxDepth = glm::clamp(params.m_maxDepth, 0, BVH_MAX_MESH_DEPTH);
+	switch (params.m_strategy)
+	{
+	case BUILD_BINNED_SAH:
+		_buildBVHTreeBinnedSAH(maxDepth, params, tris, refs.data(), numTris, outNodes);
+		break;
+	case BUILD_LBVH:
+		_buildLBVH(maxDepth, params.m_maxLeafSize, tris, refs.data(), numTris, outNodes);
+		break;
+	case BUILD_MEDIAN_SPLIT:
+	default:
+		_buildBVHTree(maxDepth, params.m_maxLeafSize, tris, refs.data(), numTris, outNodes);
+		break;
+	}
+
+	// Every leaf covers a contiguous range of the partitioned references, so these directly give the packed triangle
+	// array. The leaves only know the triangle of their first reference, which is remapped to its position.
+	ScratchArena& arena = _getScratchArena();
+	ScratchArena::Scope arenaScope(arena);
+	uint32_t* refPositions = arena.alloc<uint32_t>(numTris);
+
+	outTriIndices.resize(numTris);
+	for (size_t refIdx = 0; refIdx < numTris; refIdx++)
+	{
+		refPositions[refs[refIdx].m_triIdx] = uint32_t(refIdx);
+		outTriIndices[refIdx] = tris[refs[refIdx].m_triIdx].m_indices;
+	}
+
+	for (size_t nodeIdx = 0; nodeIdx < outNodes.size(); nodeIdx++)
+	{
+		BVHNode& node = outNodes[nodeIdx];
+		if (node.isLeaf())
+			node.setAsLeaf(refPositions[node.getFirstTri()], node.getNumTris());
+	}
+}
+
+void BVHTree::_offsetNodeLinks(std::vector<BVHTree::BVHNode>& nodes, size_t nodeOffset, size_t triOffset)
+{
+	for (size_t nodeIdx = 0; nodeIdx < nodes.size(); nodeIdx++)
+	{
+		BVHNode& node = nodes[nodeIdx];
+		if (node.isLeaf())
+		{
+			node.setAsLeaf(triOffset + node.getFirstTri(), node.getNumTris());
+		}
+		else
+		{
+			node.setLeftChild(nodeOffset + node.getLeftChild());
+			node.setRightChild(nodeOffset + node.getRightChild());
+		}
+	}
+}
+
+size_t BVHTree::_buildTopLevelTree(int depth, BuildRef* meshRefs, size_t numMeshRefs)
+{
+	if (numMeshRefs == 1)
+		return meshRefs[0].m_triIdx + 1;
+
+	Aabb meshesAabb;
+	for (size_t refIdx = 0; refIdx < numMeshRefs; refIdx++)
+	{
+		const BVHNode& meshEntry = m_aabbNodes[meshRefs[refIdx].m_triIdx + 1];
+		meshesAabb.grow(meshEntry.m_minAABB);
+		meshesAabb.grow(meshEntry.m_maxAABB);
+	}
+
+	// There are usually few meshes, so evaluate the SAH at every split position along each axis. The median split always
+	// fits in the depth left, the others only if neither child gets more entries than its subtree can hold.
+	const size_t maxChildRefs = (depth > 1) ? (size_t(1) << (depth - 1)) : 1;
+	size_t bestSplit = numMeshRefs / 2;
+	{
+		ScratchArena& arena = _getScratchArena();
+		ScratchArena::Scope arenaScope(arena);
+		float* rightCosts = arena.alloc<float>(numMeshRefs);
+
+		float bestCost = FLT_MAX;
+		int bestDim = DIM_X;
+		for (int dim = DIM_X; dim <= DIM_Z; dim++)
+		{
+			std::sort(meshRefs, meshRefs + numMeshRefs, [dim](const BuildRef& lhs, const BuildRef& rhs) {
+				return (lhs.m_centroid[dim] < rhs.m_centroid[dim]) || (lhs.m_centroid[dim] == rhs.m_centroid[dim] && lhs.m_triIdx < rhs.m_triIdx);
+			});
+
+			Aabb rightAabb;
+			for (size_t refIdx = numMeshRefs - 1; refIdx > 0; refIdx--)
+			{
+				const BVHNode& meshEntry = m_aabbNodes[meshRefs[refIdx].m_triIdx + 1];
+				rightAabb.grow(meshEntry.m_minAABB);
+				rightAabb.grow(meshEntry.m_maxAABB);
+				rightCosts[refIdx] = (numMeshRefs - refIdx) * rightAabb.surfaceArea();
+			}
+
+			Aabb leftAabb;
+			for (size_t refIdx = 0; refIdx < numMeshRefs - 1; refIdx++)
+			{
+				const BVHNode& meshEntry = m_aabbNodes[meshRefs[refIdx].m_triIdx + 1];
+				leftAabb.grow(meshEntry.m_minAABB);
+				leftAabb.grow(meshEntry.m_maxAABB);
+				if (refIdx + 1 > maxChildRefs || numMeshRefs - refIdx - 1 > maxChildRefs)
+					continue;
+
+				float cost = (refIdx + 1) * leftAabb.surfaceArea() + rightCosts[refIdx + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestDim = dim;
+					bestSplit = refIdx + 1;
+				}
+			}
+		}
+
+		if (bestDim != DIM_Z)
+		{
+			std::sort(meshRefs, meshRefs + numMeshRefs, [bestDim](const BuildRef& lhs, const BuildRef& rhs) {
+				return (lhs.m_centroid[bestDim] < rhs.m_centroid[bestDim]) || (lhs.m_centroid[bestDim] == rhs.m_centroid[bestDim] && lhs.m_triIdx < rhs.m_triIdx);
+			});
+		}
+	}
+
+	int newBvhNodeIdx = m_aabbNodes.size();
+
+	m_aabbNodes.push_back(BVHNode());
+	m_aabbNodes[newBvhNodeIdx].m_minAABB = meshesAabb.m_min;
+	m_aabbNodes[newBvhNodeIdx].m_maxAABB = meshesAabb.m_max;
+
+	size_t bvhNodeIdxL = _buildTopLevelTree(depth - 1, meshRefs, bestSplit);
+	m_aabbNodes[newBvhNodeIdx].setLeftChild(bvhNodeIdxL);
+
+	size_t bvhNodeIdxR = _buildTopLevelTree(depth - 1, meshRefs + bestSplit, numMeshRefs - bestSplit);
+	m_aabbNodes[newBvhNodeIdx].setRightChild(bvhNodeIdxR);
+
+	return newBvhNodeIdx;
+}
+
+void BVHTree::buildBVHTree(const std::vector<vkMeshLoader::MeshEntry>& meshEntries)
+{
+	const size_t numMeshes = meshEntries.size();
+
+	std::vector<size_t> meshSizes; meshSizes.resize(numMeshes);
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		meshSizes[meshIdx] = meshEntries[meshIdx].Indices.size() / 3;
+	}
+	_setMeshVertexRanges(meshEntries);
+
+	_buildBVHTrees(meshSizes, [&](size_t meshIdx, std::vector<Triangle>& outTris) {
+		_extractMeshTriangles(meshEntries[meshIdx], outTris);
+	}, false);
+
+	if (m_buildParams.m_optimizeAfterBuild)
+		optimizeBVHTree();
+}
+
+bool BVHTree::buildBVHTree(const std::vector<vkMeshLoader::MeshEntry>& meshEntries, const std::string& cacheFilename)
+{
+	const uint64_t cacheKey = _computeCacheKey(meshEntries);
+	if (_loadCache(cacheFilename, cacheKey, meshEntries))
+		return true;
+
+	buildBVHTree(meshEntries);
+	if (!_saveCache(cacheFilename, cacheKey))
+		printf("BVH cache: failed to write %s\n", cacheFilename.c_str());
+	return false;
+}
+
+void BVHTree::_setMeshVertexRanges(const std::vector<vkMeshLoader::MeshEntry>& meshEntries)
+{
+	m_meshVertexRanges.resize(meshEntries.size());
+	for (size_t meshIdx = 0; meshIdx < meshEntries.size(); meshIdx++)
+	{
+		m_meshVertexRanges[meshIdx].m_first = meshEntries[meshIdx].vertexBase;
+		m_meshVertexRanges[meshIdx].m_count = meshEntries[meshIdx].Vertices.size();
+	}
+}
+
+// Must be bumped whenever the layout of the file, the node encoding or the output of a builder changes.
+static const uint32_t BVH_CACHE_VERSION = 7;
+static const char BVH_CACHE_MAGIC[8] = { 'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E' };
+
+// Followed by the nodes, the triangle indices and the depth and leaf size limits of each mesh (SBVHCacheMeshParams).
+struct SBVHCacheHeader
+{
+	char		m_magic[8];
+	uint32_t	m_version;
+	uint32_t	m_nodeSize;		// sizeof(BVHTree::BVHNode), in case the file was written by a build with another node layout.
+	uint64_t	m_key;			// See BVHTree::_computeCacheKey.
+	uint64_t	m_numMeshes;
+	uint64_t	m_numNodes;
+	uint64_t	m_numTriIndices;
+};
+
+struct SBVHCacheMeshParams
+{
+	int32_t		m_maxDepth;
+	int32_t		m_maxLeafSize;
+};
+
+// 64-bit FNV-1a.
+class BVHCacheHasher
+{
+public:
+	BVHCacheHasher() : m_hash(14695981039346656037ull) {}
+
+	void add(const void* data, size_t numBytes)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t byteIdx = 0; byteIdx < numBytes; byteIdx++)
+		{
+			m_hash = (m_hash ^ bytes[byteIdx]) * 1099511628211ull;
+		}
+	}
+
+	template <typename T>
+	void add(const T& value) { add(&value, sizeof(T)); }
+
+	uint64_t getHash() const { return m_hash; }
+
+private:
+	uint64_t m_hash;
+};
+
+uint64_t BVHTree::_computeCacheKey(const std::vector<vkMeshLoader::MeshEntry>& meshEntries) const
+{
+	BVHCacheHasher hasher;
+
+	// Build parameters are hashed one by one since the struct has padding. The thread count doesn't change the trees and
+	// the refit threshold isn't used by the build. The trees given by a treelet time budget vary from one run to the next,
+	// the budget is hashed so that they at least don't replace the ones optimized without it.
+	const SBuildParams& params = m_buildParams;
+	hasher.add(int32_t(params.m_strategy));
+	hasher.add(int32_t(params.m_maxDepth));
+	hasher.add(int32_t(params.m_maxLeafSize));
+	hasher.add(int32_t(params.m_numBins));
+	hasher.add(params.m_traversalCost);
+	hasher.add(params.m_intersectionCost);
+	hasher.add(uint64_t(params.m_parallelBuildMinTris));
+	hasher.add(int32_t(params.m_mortonCodeBits));
+	hasher.add(int32_t(params.m_lbvhRefineTreelets));
+	hasher.add(params.m_spatialSplitAlpha);
+	hasher.add(params.m_spatialSplitBudget);
+	hasher.add(int32_t(params.m_treeletSize));
+	hasher.add(int32_t(params.m_treeletPasses));
+	hasher.add(params.m_treeletTimeBudgetMs);
+	hasher.add(uint8_t(params.m_optimizeAfterBuild));
+	hasher.add(uint8_t(params.m_autoTune));
+	hasher.add(int32_t(params.m_autoTuneMaxDepth));
+	hasher.add(int32_t(params.m_layoutTopLevels));
+
+	hasher.add(uint64_t(meshEntries.size()));
+	for (size_t meshIdx = 0; meshIdx < meshEntries.size(); meshIdx++)
+	{
+		const vkMeshLoader::MeshEntry& meshEntry = meshEntries[meshIdx];
+		hasher.add(uint32_t(meshEntry.vertexBase));
+		hasher.add(uint64_t(meshEntry.Vertices.size()));
+		for (size_t vertexIdx = 0; vertexIdx < meshEntry.Vertices.size(); vertexIdx++)
+		{
+			hasher.add(meshEntry.Vertices[vertexIdx].m_pos);
+		}
+		hasher.add(uint64_t(meshEntry.Indices.size()));
+		if (!meshEntry.Indices.empty())
+			hasher.add(meshEntry.Indices.data(), meshEntry.Indices.size() * sizeof(unsigned int));
+	}
+	return hasher.getHash();
+}
+
+bool BVHTree::_loadCache(const std::string& cacheFilename, uint64_t cacheKey, const std::vector<vkMeshLoader::MeshEntry>& meshEntries)
+{
+	auto loadStart = std::chrono::high_resolution_clock::now();
+
+	MappedFile file;
+	if (!file.open(cacheFilename))
+		return false;
+
+	if (file.getSize() < sizeof(SBVHCacheHeader))
+	{
+		printf("BVH cache: %s is truncated, rebuilding\n", cacheFilename.c_str());
+		return false;
+	}
+
+	SBVHCacheHeader header;
+	std::memcpy(&header, file.getData(), sizeof(header));
+	if (std::memcmp(header.m_magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC)) != 0 || header.m_version != BVH_CACHE_VERSION ||
+		header.m_nodeSize != sizeof(BVHNode))
+	{
+		printf("BVH cache: %s was written by another version, rebuilding\n", cacheFilename.c_str());
+		return false;
+	}
+	if (header.m_key != cacheKey || header.m_numMeshes != meshEntries.size())
+	{
+		printf("BVH cache: %s doesn't match the model or the build parameters, rebuilding\n", cacheFilename.c_str());
+		return false;
+	}
+
+	const size_t nodesOffset = sizeof(SBVHCacheHeader);
+	const size_t triIndicesOffset = nodesOffset + size_t(header.m_numNodes) * sizeof(BVHNode);
+	const size_t meshParamsOffset = triIndicesOffset + size_t(header.m_numTriIndices) * sizeof(glm::ivec3);
+	const size_t fileSize = meshParamsOffset + size_t(header.m_numMeshes) * sizeof(SBVHCacheMeshParams);
+	if (file.getSize() != fileSize || header.m_numNodes < header.m_numMeshes + 1)
+	{
+		printf("BVH cache: %s is truncated, rebuilding\n", cacheFilename.c_str());
+		return false;
+	}
+
+	const size_t numMeshes = meshEntries.size();
+	const BVHNode* nodes = reinterpret_cast<const BVHNode*>(file.getData() + nodesOffset);
+	const glm::ivec3* triIndices = reinterpret_cast<const glm::ivec3*>(file.getData() + triIndicesOffset);
+	m_aabbNodes.assign(nodes, nodes + header.m_numNodes);
+	m_triIndices.assign(triIndices, triIndices + header.m_numTriIndices);
+	m_freeNodeRanges.clear();
+	m_freeTriRanges.clear();
+
+	_setMeshVertexRanges(meshEntries);
+	m_meshNumTris.resize(numMeshes);
+	m_meshBuildParams.assign(numMeshes, m_buildParams);
+	m_meshBuiltSAHCosts.resize(numMeshes);
+	float sahCost = 0.0f;
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		SBVHCacheMeshParams meshParams;
+		std::memcpy(&meshParams, file.getData() + meshParamsOffset + meshIdx * sizeof(SBVHCacheMeshParams), sizeof(meshParams));
+		m_meshBuildParams[meshIdx].m_maxDepth = meshParams.m_maxDepth;
+		m_meshBuildParams[meshIdx].m_maxLeafSize = meshParams.m_maxLeafSize;
+		m_meshNumTris[meshIdx] = meshEntries[meshIdx].Indices.size() / 3;
+		m_meshBuiltSAHCosts[meshIdx] = _computeMeshSAHCost(meshIdx);
+		sahCost += m_meshBuiltSAHCosts[meshIdx];
+	}
+
+	auto loadEnd = std::chrono::high_resolution_clock::now();
+	const double loadTimeInMs = std::chrono::duration<double, std::milli>(loadEnd - loadStart).count();
+	printf("BVH loaded from %s in %.2f ms: %d nodes, SAH cost: %f\n", cacheFilename.c_str(), loadTimeInMs, int(m_aabbNodes.size()), sahCost);
+	return true;
+}
+
+bool BVHTree::_saveCache(const std::string& cacheFilename, uint64_t cacheKey) const
+{
+	const size_t numMeshes = m_meshBuildParams.size();
+
+	SBVHCacheHeader header;
+	std::memcpy(header.m_magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC));
+	header.m_version = BVH_CACHE_VERSION;
+	header.m_nodeSize = sizeof(BVHNode);
+	header.m_key = cacheKey;
+	header.m_numMeshes = numMeshes;
+	header.m_numNodes = m_aabbNodes.size();
+	header.m_numTriIndices = m_triIndices.size();
+
+	std::vector<SBVHCacheMeshParams> meshParams(numMeshes);
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		meshParams[meshIdx].m_maxDepth = m_meshBuildParams[meshIdx].m_maxDepth;
+		meshParams[meshIdx].m_maxLeafSize = m_meshBuildParams[meshIdx].m_maxLeafSize;
+	}
+
+	// Written next to the cache file then renamed over it, so that an interrupted write never leaves a valid-looking file.
+	const std::string tmpFilename = cacheFilename + ".tmp";
+	FILE* file = fopen(tmpFilename.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+	success = success && fwrite(m_aabbNodes.data(), sizeof(BVHNode), m_aabbNodes.size(), file) == m_aabbNodes.size();
+	success = success && fwrite(m_triIndices.data(), sizeof(glm::ivec3), m_triIndices.size(), file) == m_triIndices.size();
+	success = success && fwrite(meshParams.data(), sizeof(SBVHCacheMeshParams), numMeshes, file) == numMeshes;
+	success = (fclose(file) == 0) && success;
+
+	// rename() doesn't replace an existing file on Windows.
+	remove(cacheFilename.c_str());
+	if (!success || rename(tmpFilename.c_str(), cacheFilename.c_str()) != 0)
+	{
+		remove(tmpFilename.c_str());
+		return false;
+	}
+	return true;
+}
+
+void BVHTree::rebuildBVHTree(const std::vector<glm::vec4>& positions)
+{
+	// The triangles are gathered back from the leaves of the current trees.
+	std::vector<BVHNode> prevNodes;
+	prevNodes.swap(m_aabbNodes);
+	std::vector<glm::ivec3> prevTriIndices;
+	prevTriIndices.swap(m_triIndices);
+	std::vector<size_t> meshSizes;
+	meshSizes.swap(m_meshNumTris);
+
+	_buildBVHTrees(meshSizes, [&](size_t meshIdx, std::vector<Triangle>& outTris) {
+		const SRange nodeRange = _getMeshNodeRange(prevNodes, meshIdx);
+		const size_t lastNodeIdx = nodeRange.m_first + nodeRange.m_count;
+		for (size_t nodeIdx = nodeRange.m_first; nodeIdx < lastNodeIdx; nodeIdx++)
+		{
+			const BVHNode& node = prevNodes[nodeIdx];
+			if (!node.isLeaf())
+				continue;
+
+			for (size_t triIdx = node.getFirstTri(); triIdx < node.getFirstTri() + node.getNumTris(); triIdx++)
+			{
+				const glm::ivec3& triIndices = prevTriIndices[triIdx];
+
+				Triangle tri;
+				tri.set(glm::vec3(positions[triIndices[0]]), glm::vec3(positions[triIndices[1]]), glm::vec3(positions[triIndices[2]]));
+				tri.m_indices = triIndices;
+				outTris.push_back(tri);
+			}
+		}
+
+		// Triangles split by BUILD_SBVH are referenced by several leaves.
+		if (outTris.size() > meshSizes[meshIdx])
+		{
+			std::sort(outTris.begin(), outTris.end(), [](const Triangle& lhs, const Triangle& rhs) {
+				return std::lexicographical_compare(&lhs.m_indices[0], &lhs.m_indices[0] + 3, &rhs.m_indices[0], &rhs.m_indices[0] + 3);
+			});
+			outTris.erase(std::unique(outTris.begin(), outTris.end(), [](const Triangle& lhs, const Triangle& rhs) {
+				return lhs.m_indices == rhs.m_indices;
+			}), outTris.end());
+		}
+	}, true);
+}
+
+void BVHTree::_buildBVHTrees(const std::vector<size_t>& meshSizes, const std::function<void(size_t, std::vector<Triangle>&)>& extractMeshTriangles,
+	bool isRebuild)
+{
+	auto buildStart = std::chrono::high_resolution_clock::now();
+
+	const size_t numMeshes = meshSizes.size();
+
+	// Dispatch the biggest meshes first so that a large mesh doesn't end up alone on one thread at the end of the build.
+	std::vector<size_t> meshOrder; meshOrder.resize(numMeshes);
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		meshOrder[meshIdx] = meshIdx;
+	}
+	std::stable_sort(meshOrder.begin(), meshOrder.end(), [&meshSizes](size_t lhs, size_t rhs) {
+		return meshSizes[lhs] > meshSizes[rhs];
+	});
+
+	// Each mesh tree is built into its own node array with child links relative to the start of that array.
+	// Big meshes are further split into tasks by the recursive build itself, see _buildChildNodes.
+	std::vector< std::vector<BVHTree::BVHNode> > meshNodes;
+	std::vector< std::vector<glm::ivec3> > meshTriIndices;
+	meshNodes.resize(numMeshes);
+	meshTriIndices.resize(numMeshes);
+	m_meshNumTris.resize(numMeshes);
+
+	// Rebuilds keep the depth and leaf size each mesh was tuned with, tuning again would take several builds.
+	const bool reuseTunedParams = isRebuild && m_buildParams.m_autoTune && m_meshBuildParams.size() == numMeshes;
+	const bool tuneParams = m_buildParams.m_autoTune && !reuseTunedParams;
+	std::vector<SBuildParams> meshBuildParams(numMeshes, m_buildParams);
+	for (size_t meshIdx = 0; reuseTunedParams && meshIdx < numMeshes; meshIdx++)
+	{
+		meshBuildParams[meshIdx].m_maxDepth = m_meshBuildParams[meshIdx].m_maxDepth;
+		meshBuildParams[meshIdx].m_maxLeafSize = m_meshBuildParams[meshIdx].m_maxLeafSize;
+	}
+	m_meshBuildParams.swap(meshBuildParams);
+	std::vector<float> meshTunedCosts(numMeshes, 0.0f);
+	std::vector<float> meshInitialCosts(numMeshes, 0.0f);
+	{
+		ThreadPool threadPool(m_buildParams.m_numThreads);
+		m_buildThreadPool = &threadPool;
+		m_scratchArenas.resize(threadPool.getNumThreads() + 1);
+
+		threadPool.parallelFor(numMeshes, [&](size_t orderIdx) {
+			const size_t meshIdx = meshOrder[orderIdx];
+
+			std::vector<Triangle> meshTris;
+			extractMeshTriangles(meshIdx, meshTris);
+			m_meshNumTris[meshIdx] = meshTris.size();
+			if (tuneParams && !meshTris.empty())
+				meshTunedCosts[meshIdx] = _autoTuneMeshBuildParams(meshTris, m_meshBuildParams[meshIdx], meshInitialCosts[meshIdx]);
+			_buildMeshBVHTree(m_meshBuildParams[meshIdx], meshTris, meshNodes[meshIdx], meshTriIndices[meshIdx]);
+
+			SRange nodeRange;
+			nodeRange.m_first = 0;
+			nodeRange.m_count = meshNodes[meshIdx].size();
+			_layoutNodes(meshNodes[meshIdx], nodeRange);
+		});
+
+		m_buildThreadPool = nullptr;
+	}
+
+	m_aabbNodes.clear();
+	m_aabbNodes.resize(numMeshes + 1, BVHNode(glm::vec3(0.0f), glm::vec3(0.0f)));
+	m_freeNodeRanges.clear();
+	m_freeTriRanges.clear();
+	m_aabbNodes[0].setNumMeshes(numMeshes);
+
+	// Stitch the trees together in mesh order, so that the final layout doesn't depend on the number of threads.
+	size_t numNodes = m_aabbNodes.size();
+	size_t numTris = 0;
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		numNodes += meshNodes[meshIdx].size() + 1;
+		numTris += meshTriIndices[meshIdx].size();
+	}
+	m_aabbNodes.reserve(numNodes);
+	m_triIndices.clear();
+	m_triIndices.reserve(numTris);
+
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		const size_t meshRootIdx = meshNodes[meshIdx].size() > 1 ? getAlignedMeshRootIdx(m_aabbNodes.size()) : m_aabbNodes.size();
+		m_aabbNodes.resize(meshRootIdx, BVHNode(glm::vec3(0.0f), glm::vec3(0.0f)));
+		_offsetNodeLinks(meshNodes[meshIdx], meshRootIdx, m_triIndices.size());
+
+		m_aabbNodes[meshIdx + 1].setRootNode(meshNodes[meshIdx].empty() ? 0 : meshRootIdx, meshNodes[meshIdx].size());
+		m_aabbNodes.insert(m_aabbNodes.end(), meshNodes[meshIdx].begin(), meshNodes[meshIdx].end());
+		m_triIndices.insert(m_triIndices.end(), meshTriIndices[meshIdx].begin(), meshTriIndices[meshIdx].end());
+	}
+
+	// Mesh entries get the bounds of their tree so that the top-level tree can point straight at them.
+	std::vector<BuildRef> meshRefs; meshRefs.reserve(numMeshes);
+	Aabb sceneAabb;
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		if (meshNodes[meshIdx].empty())
+			continue;
+
+		BVHNode& meshEntry = m_aabbNodes[meshIdx + 1];
+		const BVHNode& meshRoot = m_aabbNodes[meshEntry.getRootNode()];
+		meshEntry.m_minAABB = meshRoot.m_minAABB;
+		meshEntry.m_maxAABB = meshRoot.m_maxAABB;
+
+		BuildRef meshRef;
+		meshRef.m_centroid = (meshRoot.m_minAABB + meshRoot.m_maxAABB) * 0.5f;
+		meshRef.m_triIdx = uint32_t(meshIdx);
+		meshRefs.push_back(meshRef);
+
+		sceneAabb.grow(meshRoot.m_minAABB);
+		sceneAabb.grow(meshRoot.m_maxAABB);
+	}
+
+	if (!meshRefs.empty())
+	{
+		const size_t topLevelRootIdx = _buildTopLevelTree(BVH_MAX_TOP_LEVEL_DEPTH, meshRefs.data(), meshRefs.size());
+		m_aabbNodes[0].m_minAABB = sceneAabb.m_min;
+		m_aabbNodes[0].m_maxAABB = sceneAabb.m_max;
+		m_aabbNodes[0].setTopLevelRootNode(topLevelRootIdx);
+	}
+	else
+	{
+		m_aabbNodes[0].setTopLevelRootNode(0);
+	}
+
+	auto buildEnd = std::chrono::high_resolution_clock::now();
+	const double buildTimeInMs = std::chrono::duration<double, std::milli>(buildEnd - buildStart).count();
+
+	// Reference costs used to detect when refitting degraded the trees too much.
+	float sahCost = 0.0f;
+	m_meshBuiltSAHCosts.resize(numMeshes);
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		m_meshBuiltSAHCosts[meshIdx] = _computeMeshSAHCost(meshIdx);
+		sahCost += m_meshBuiltSAHCosts[meshIdx];
+	}
+
+	const char* strategyNames[] = { "median split", "binned SAH", "LBVH", "SBVH" };
+	printf("BVH built using %s in %.2f ms: %d nodes, SAH cost: %f\n",
+		strategyNames[m_buildParams.m_strategy], buildTimeInMs, int(m_aabbNodes.size()), sahCost);
+
+	size_t numDistinctTris = 0;
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		numDistinctTris += m_meshNumTris[meshIdx];
+	}
+	if (m_triIndices.size() > numDistinctTris)
+	{
+		printf("BVH spatial splits: %zu triangle references for %zu triangles (+%.1f%%)\n",
+			m_triIndices.size(), numDistinctTris, 100.0f * (m_triIndices.size() - numDistinctTris) / numDistinctTris);
+	}
+
+	// The previous layout appended one full node per triangle after each leaf.
+	const size_t nodesSize = m_aabbNodes.size() * sizeof(BVHNode);
+	const size_t triIndicesSize = m_triIndices.size() * sizeof(glm::ivec3);
+	const size_t prevLayoutSize = (m_aabbNodes.size() + m_triIndices.size()) * sizeof(BVHNode);
+	printf("BVH memory: %.1f KB (nodes %.1f KB + triangle indices %.1f KB), %.1f KB saved over one node per triangle\n",
+		(nodesSize + triIndicesSize) / 1024.0f, nodesSize / 1024.0f, triIndicesSize / 1024.0f, (prevLayoutSize - nodesSize - triIndicesSize) / 1024.0f);
+
+	if (isRebuild)
+		return;
+
+	for (size_t meshIdx = 0; tuneParams && meshIdx < numMeshes; meshIdx++)
+	{
+		if (m_meshNumTris[meshIdx] == 0)
+			continue;
+
+		printf("BVH auto-tuning, mesh %zu (%zu triangles): max depth %d, max leaf size %d, SAH cost %f (%f with max depth %d, max leaf size %d)\n",
+			meshIdx, m_meshNumTris[meshIdx], m_meshBuildParams[meshIdx].m_maxDepth, m_meshBuildParams[meshIdx].m_maxLeafSize,
+			meshTunedCosts[meshIdx], meshInitialCosts[meshIdx], m_buildParams.m_maxDepth, m_buildParams.m_maxLeafSize);
+	}
+	printStats(computeStats());
+}
+
+float BVHTree::_autoTuneMeshBuildParams(const std::vector<Triangle>& tris, SBuildParams& ioParams, float& outInitialCost)
+{
+	std::vector<BVHNode> nodes;
+	std::vector<glm::ivec3> triIndices;
+	auto evaluate = [&](int maxDepth, int maxLeafSize) {
+		SBuildParams params = ioParams;
+		params.m_maxDepth = maxDepth;
+		params.m_maxLeafSize = maxLeafSize;
+
+		nodes.clear();
+		triIndices.clear();
+		_buildMeshBVHTree(params, tris, nodes, triIndices);
+
+		Aabb rootAabb;
+		rootAabb.grow(nodes[0].m_minAABB);
+		rootAabb.grow(nodes[0].m_maxAABB);
+		const float rootArea = rootAabb.surfaceArea();
+		return (rootArea > 0.0f) ? _computeSAHCost(nodes, 0, rootArea) : 0.0f;
+	};
+
+	outInitialCost = evaluate(ioParams.m_maxDepth, ioParams.m_maxLeafSize);
+
+	// For each leaf size, try the shallowest tree which can reach it with balanced splits, the deepest one allowed, and
+	// one in between. Ties go to the candidates tried first, which are the smaller trees.
+	const int maxDepth = glm::clamp(ioParams.m_autoTuneMaxDepth, 1, BVH_MAX_MESH_DEPTH);
+	const int leafSizes[] = { 1, 2, 4, 8, 16 };
+	float bestCost = outInitialCost;
+	int bestDepth = ioParams.m_maxDepth;
+	int bestLeafSize = ioParams.m_maxLeafSize;
+	for (size_t leafSizeIdx = 0; leafSizeIdx < sizeof(leafSizes) / sizeof(leafSizes[0]); leafSizeIdx++)
+	{
+		const int leafSize = leafSizes[leafSizeIdx];
+		const size_t numLeaves = (tris.size() + leafSize - 1) / leafSize;
+		int minDepth = 1;
+		while (minDepth < maxDepth && (size_t(1) << minDepth) < numLeaves)
+		{
+			minDepth++;
+		}
+
+		const int depths[] = { minDepth, (minDepth + maxDepth) / 2, maxDepth };
+		for (int depthIdx = 0; depthIdx < 3; depthIdx++)
+		{
+			if (depthIdx > 0 && depths[depthIdx] == depths[depthIdx - 1])
+				continue;
+
+			const float cost = evaluate(depths[depthIdx], leafSize);
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestDepth = depths[depthIdx];
+				bestLeafSize = leafSize;
+			}
+		}
+	}
+
+	ioParams.m_maxDepth = bestDepth;
+	ioParams.m_maxLeafSize = bestLeafSize;
+	return bestCost;
+}
+
+BVHTree::SRange BVHTree::_getMeshNodeRange(const std::vector<BVHTree::BVHNode>& nodes, size_t meshIdx) const
+{
+	// Each mesh tree is stored contiguously from its root.
+	const BVHNode& meshEntry = nodes[meshIdx + 1];
+
+	SRange range;
+	range.m_first = meshEntry.getRootNode();
+	range.m_count = meshEntry.getNumMeshNodes();
+	return range;
+}
+
+BVHTree::SRange BVHTree::_getMeshTriRange(size_t meshIdx) const
+{
+	const SRange nodeRange = _getMeshNodeRange(m_aabbNodes, meshIdx);
+
+	size_t firstTriIdx = m_triIndices.size();
+	size_t lastTriIdx = 0;
+	for (size_t nodeIdx = nodeRange.m_first; nodeIdx < nodeRange.m_first + nodeRange.m_count; nodeIdx++)
+	{
+		const BVHNode& node = m_aabbNodes[nodeIdx];
+		if (!node.isLeaf())
+			continue;
+
+		firstTriIdx = std::min(firstTriIdx, node.getFirstTri());
+		lastTriIdx = std::max(lastTriIdx, node.getFirstTri() + node.getNumTris());
+	}
+
+	SRange range;
+	range.m_first = (firstTriIdx < lastTriIdx) ? firstTriIdx : 0;
+	range.m_count = (firstTriIdx < lastTriIdx) ? lastTriIdx - firstTriIdx : 0;
+	return range;
+}
+
+static inline BVHTree::PrecomputedTriangle precomputeTriangle(const std::vector<glm::vec4>& positions, const glm::ivec3& triIndices)
+{
+	const glm::vec3 v0(positions[triIndices.x]);
+
+	BVHTree::PrecomputedTriangle tri;
+	tri.m_v0 = glm::vec4(v0, 0.0f);
+	tri.m_edge1 = glm::vec4(glm::vec3(positions[triIndices.y]) - v0, 0.0f);
+	tri.m_edge2 = glm::vec4(glm::vec3(positions[triIndices.z]) - v0, 0.0f);
+	return tri;
+}
+
+void BVHTree::buildTriangleSoup(const std::vector<glm::vec4>& positions, std::vector<PrecomputedTriangle>& outTris) const
+{
+	outTris.resize(m_triIndices.size());
+	for (size_t triIdx = 0; triIdx < m_triIndices.size(); triIdx++)
+	{
+		outTris[triIdx] = precomputeTriangle(positions, m_triIndices[triIdx]);
+	}
+}
+
+void BVHTree::buildMeshMaterialIds(const std::vector<glm::ivec4>& sceneIndices, std::vector<int32_t>& outMaterialIds) const
+{
+	// The meshes own disjoint vertex ranges, and all the triangles of a mesh share its material.
+	std::vector<int32_t> vertexMeshIdxs;
+	for (size_t meshIdx = 0; meshIdx < m_meshVertexRanges.size(); meshIdx++)
+	{
+		const SRange& vertexRange = m_meshVertexRanges[meshIdx];
+		if (vertexMeshIdxs.size() < vertexRange.m_first + vertexRange.m_count)
+			vertexMeshIdxs.resize(vertexRange.m_first + vertexRange.m_count, -1);
+		for (size_t vertexIdx = vertexRange.m_first; vertexIdx < vertexRange.m_first + vertexRange.m_count; vertexIdx++)
+		{
+			vertexMeshIdxs[vertexIdx] = int32_t(meshIdx);
+		}
+	}
+
+	outMaterialIds.assign(m_meshVertexRanges.size(), 0);
+	for (size_t triIdx = 0; triIdx < sceneIndices.size(); triIdx++)
+	{
+		const size_t vertexIdx = size_t(sceneIndices[triIdx].x);
+		if (vertexIdx < vertexMeshIdxs.size() && vertexMeshIdxs[vertexIdx] >= 0)
+			outMaterialIds[vertexMeshIdxs[vertexIdx]] = sceneIndices[triIdx].w;
+	}
+}
+
+void BVHTree::refitTriangleSoup(const std::vector<glm::vec4>& positions, const std::vector<size_t>& meshIdxs, std::vector<PrecomputedTriangle>& ioTris,
+	std::vector<SRange>& outDirtyTriRanges) const
+{
+	for (size_t i = 0; i < meshIdxs.size(); i++)
+	{
+		const SRange triRange = _getMeshTriRange(meshIdxs[i]);
+		if (triRange.m_count == 0)
+			continue;
+
+		for (size_t triIdx = triRange.m_first; triIdx < triRange.m_first + triRange.m_count; triIdx++)
+		{
+			ioTris[triIdx] = precomputeTriangle(positions, m_triIndices[triIdx]);
+		}
+		outDirtyTriRanges.push_back(triRange);
+	}
+}
+
+bool BVHTree::refit(const std::vector<glm::vec4>& positions, const std::vector<size_t>& meshIdxs, std::vector<SRange>& outDirtyNodeRanges)
+{
+	if (m_aabbNodes.empty())
+		return false;
+
+	if (m_scratchArenas.empty())
+		m_scratchArenas.resize(1);
+
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	const size_t firstDirtyRangeIdx = outDirtyNodeRanges.size();
+
+	float builtSAHCost = 0.0f;
+	float refitSAHCost = 0.0f;
+	for (size_t i = 0; i < meshIdxs.size(); i++)
+	{
+		const size_t meshIdx = meshIdxs[i];
+		const SRange nodeRange = _getMeshNodeRange(m_aabbNodes, meshIdx);
+		if (nodeRange.m_count == 0)
+			continue;
+
+		_refitMeshNodes(positions, nodeRange);
+
+		BVHNode& meshEntry = m_aabbNodes[meshIdx + 1];
+		const BVHNode& meshRoot = m_aabbNodes[nodeRange.m_first];
+		meshEntry.m_minAABB = meshRoot.m_minAABB;
+		meshEntry.m_maxAABB = meshRoot.m_maxAABB;
+
+		SRange meshEntryRange;
+		meshEntryRange.m_first = meshIdx + 1;
+		meshEntryRange.m_count = 1;
+		outDirtyNodeRanges.push_back(nodeRange);
+		outDirtyNodeRanges.push_back(meshEntryRange);
+
+		builtSAHCost += m_meshBuiltSAHCosts[meshIdx];
+		refitSAHCost += _computeMeshSAHCost(meshIdx);
+	}
+
+	const size_t topLevelRootIdx = m_aabbNodes[0].getTopLevelRootNode();
+	if (topLevelRootIdx > numMeshes)
+		_refitTopLevelTree(topLevelRootIdx, outDirtyNodeRanges);
+
+	if (topLevelRootIdx > 0)
+	{
+		const BVHNode& topLevelRoot = m_aabbNodes[topLevelRootIdx];
+		m_aabbNodes[0].m_minAABB = topLevelRoot.m_minAABB;
+		m_aabbNodes[0].m_maxAABB = topLevelRoot.m_maxAABB;
+
+		SRange headerRange;
+		headerRange.m_first = 0;
+		headerRange.m_count = 1;
+		outDirtyNodeRanges.push_back(headerRange);
+	}
+
+	// Merge the overlapping and adjacent ranges to keep the number of copies down.
+	_mergeRanges(outDirtyNodeRanges, firstDirtyRangeIdx);
+
+	return (builtSAHCost > 0.0f) && (refitSAHCost > builtSAHCost * m_buildParams.m_refitRebuildThreshold);
+}
+
+void BVHTree::_refitMeshNodes(const std::vector<glm::vec4>& positions, const SRange& nodeRange)
+{
+	// Children are always stored after their parent, so the nodes can be visited children first in reverse order.
+	for (size_t nodeIdx = nodeRange.m_first + nodeRange.m_count; nodeIdx-- > nodeRange.m_first; )
+	{
+		BVHNode& node = m_aabbNodes[nodeIdx];
+		if (!node.isLeaf())
+		{
+			_setAabbFromChildren(nodeIdx, m_aabbNodes);
+			continue;
+		}
+
+		Aabb trisAabb;
+		for (size_t triIdx = node.getFirstTri(); triIdx < node.getFirstTri() + node.getNumTris(); triIdx++)
+		{
+			const glm::ivec3& triIndices = m_triIndices[triIdx];
+			trisAabb.grow(glm::vec3(positions[triIndices.x]));
+			trisAabb.grow(glm::vec3(positions[triIndices.y]));
+			trisAabb.grow(glm::vec3(positions[triIndices.z]));
+		}
+		node.m_minAABB = trisAabb.m_min;
+		node.m_maxAABB = trisAabb.m_max;
+	}
+}
+
+void BVHTree::_mergeRanges(std::vector<SRange>& ioRanges, size_t firstRangeIdx)
+{
+	std::sort(ioRanges.begin() + firstRangeIdx, ioRanges.end(), [](const SRange& lhs, const SRange& rhs) {
+		return lhs.m_first < rhs.m_first;
+	});
+
+	size_t lastRangeIdx = firstRangeIdx;
+	for (size_t rangeIdx = firstRangeIdx + 1; rangeIdx < ioRanges.size(); rangeIdx++)
+	{
+		SRange& lastRange = ioRanges[lastRangeIdx];
+		const SRange& range = ioRanges[rangeIdx];
+		if (range.m_first <= lastRange.m_first + lastRange.m_count)
+			lastRange.m_count = glm::max(lastRange.m_count, range.m_first + range.m_count - lastRange.m_first);
+		else
+			ioRanges[++lastRangeIdx] = range;
+	}
+	if (lastRangeIdx < ioRanges.size())
+		ioRanges.resize(lastRangeIdx + 1);
+}
+
+void BVHTree::_refitTopLevelTree(size_t nodeIdx, std::vector<SRange>& outDirtyNodeRanges)
+{
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	if (nodeIdx <= numMeshes)
+		return;
+
+	const BVHNode& node = m_aabbNodes[nodeIdx];
+	_refitTopLevelTree(node.getLeftChild(), outDirtyNodeRanges);
+	_refitTopLevelTree(node.getRightChild(), outDirtyNodeRanges);
+	_setAabbFromChildren(nodeIdx, m_aabbNodes);
+
+	SRange nodeRange;
+	nodeRange.m_first = nodeIdx;
+	nodeRange.m_count = 1;
+	outDirtyNodeRanges.push_back(nodeRange);
+}
+
+static void addFreeRange(std::vector<BVHTree::SRange>& ioFreeRanges, size_t first, size_t count)
+{
+	if (count == 0)
+		return;
+
+	BVHTree::SRange freeRange;
+	freeRange.m_first = first;
+	freeRange.m_count = count;
+	ioFreeRanges.push_back(freeRange);
+}
+
+// Takes count elements from the smallest free range large enough to hold them, or from the end of the array (of size
+// ioSize) otherwise. Best fit keeps the single nodes freed in the top-level tree from eating into the bigger ranges freed
+// by mesh trees. Mesh trees with children are placed at an odd index (see getAlignedMeshRootIdx); the slot skipped to get
+// there stays free. Returns the index of the first element.
+static size_t allocFromFreeRanges(std::vector<BVHTree::SRange>& ioFreeRanges, size_t count, size_t& ioSize, bool isAligned = false)
+{
+	int bestRangeIdx = -1;
+	for (size_t rangeIdx = 0; rangeIdx < ioFreeRanges.size(); rangeIdx++)
+	{
+		const BVHTree::SRange& freeRange = ioFreeRanges[rangeIdx];
+		const size_t padding = isAligned ? getAlignedMeshRootIdx(freeRange.m_first) - freeRange.m_first : 0;
+		if (freeRange.m_count >= count + padding && (bestRangeIdx == -1 || freeRange.m_count < ioFreeRanges[bestRangeIdx].m_count))
+			bestRangeIdx = int(rangeIdx);
+	}
+
+	if (bestRangeIdx == -1)
+	{
+		const size_t first = isAligned ? getAlignedMeshRootIdx(ioSize) : ioSize;
+		addFreeRange(ioFreeRanges, ioSize, first - ioSize);
+		ioSize = first + count;
+		return first;
+	}
+
+	BVHTree::SRange& freeRange = ioFreeRanges[bestRangeIdx];
+	const size_t rangeFirst = freeRange.m_first;
+	const size_t first = isAligned ? getAlignedMeshRootIdx(rangeFirst) : rangeFirst;
+	freeRange.m_first = first + count;
+	freeRange.m_count -= first + count - rangeFirst;
+	if (freeRange.m_count == 0)
+		ioFreeRanges.erase(ioFreeRanges.begin() + bestRangeIdx);
+	addFreeRange(ioFreeRanges, rangeFirst, first - rangeFirst);
+	return first;
+}
+
+bool BVHTree::_findTopLevelPath(size_t nodeIdx, size_t meshEntryIdx, std::vector<size_t>& ioPath) const
+{
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	if (nodeIdx <= numMeshes)
+		return false;
+
+	ioPath.push_back(nodeIdx);
+	const BVHNode& node = m_aabbNodes[nodeIdx];
+	if (node.getLeftChild() == meshEntryIdx || node.getRightChild() == meshEntryIdx ||
+		_findTopLevelPath(node.getLeftChild(), meshEntryIdx, ioPath) || _findTopLevelPath(node.getRightChild(), meshEntryIdx, ioPath))
+		return true;
+
+	ioPath.pop_back();
+	return false;
+}
+
+void BVHTree::_insertTopLevelEntry(size_t meshEntryIdx, std::vector<SRange>& outDirtyNodeRanges)
+{
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	const size_t topLevelRootIdx = m_aabbNodes[0].getTopLevelRootNode();
+	if (topLevelRootIdx == 0)
+	{
+		m_aabbNodes[0].setTopLevelRootNode(meshEntryIdx);
+		return;
+	}
+
+	Aabb entryAabb;
+	entryAabb.grow(m_aabbNodes[meshEntryIdx].m_minAABB);
+	entryAabb.grow(m_aabbNodes[meshEntryIdx].m_maxAABB);
+
+	// Greedy descent: the entry becomes the sibling of the node where pairing them costs less than the lowest cost any
+	// child could still reach, i.e. the surface area of the entry plus the growth of the nodes above the child.
+	std::vector<size_t> path;
+	size_t siblingIdx = topLevelRootIdx;
+	float inheritedCost = 0.0f;
+	while (siblingIdx > numMeshes)
+	{
+		const BVHNode& node = m_aabbNodes[siblingIdx];
+		Aabb nodeAabb;
+		nodeAabb.grow(node.m_minAABB);
+		nodeAabb.grow(node.m_maxAABB);
+		Aabb pairAabb = nodeAabb;
+		pairAabb.grow(entryAabb);
+
+		const float pairCost = pairAabb.surfaceArea() + inheritedCost;
+		const float childInheritedCost = inheritedCost + pairAabb.surfaceArea() - nodeAabb.surfaceArea();
+
+		float childCosts[2];
+		const size_t childIdxs[2] = { node.getLeftChild(), node.getRightChild() };
+		for (int childIdx = 0; childIdx < 2; childIdx++)
+		{
+			const BVHNode& child = m_aabbNodes[childIdxs[childIdx]];
+			Aabb childAabb;
+			childAabb.grow(child.m_minAABB);
+			childAabb.grow(child.m_maxAABB);
+			Aabb childPairAabb = childAabb;
+			childPairAabb.grow(entryAabb);
+
+			// Pairing the entry with a mesh entry costs the new node, going further down costs at least the entry itself.
+			childCosts[childIdx] = childInheritedCost + ((childIdxs[childIdx] <= numMeshes) ? childPairAabb.surfaceArea() :
+				childPairAabb.surfaceArea() - childAabb.surfaceArea() + entryAabb.surfaceArea());
+		}
+
+		const int bestChildIdx = (childCosts[0] <= childCosts[1]) ? 0 : 1;
+		if (pairCost <= childCosts[bestChildIdx])
+			break;
+
+		path.push_back(siblingIdx);
+		inheritedCost = childInheritedCost;
+		siblingIdx = childIdxs[bestChildIdx];
+	}
+
+	size_t numNodes = m_aabbNodes.size();
+	const size_t newNodeIdx = allocFromFreeRanges(m_freeNodeRanges, 1, numNodes);
+	m_aabbNodes.resize(numNodes);
+
+	BVHNode& newNode = m_aabbNodes[newNodeIdx];
+	newNode = BVHNode();
+	newNode.setLeftChild(siblingIdx);
+	newNode.setRightChild(meshEntryIdx);
+	_setAabbFromChildren(newNodeIdx, m_aabbNodes);
+
+	SRange newNodeRange;
+	newNodeRange.m_first = newNodeIdx;
+	newNodeRange.m_count = 1;
+	outDirtyNodeRanges.push_back(newNodeRange);
+
+	if (path.empty())
+	{
+		m_aabbNodes[0].setTopLevelRootNode(newNodeIdx);
+		return;
+	}
+
+	BVHNode& parent = m_aabbNodes[path.back()];
+	if (parent.getLeftChild() == siblingIdx)
+		parent.setLeftChild(newNodeIdx);
+	else
+		parent.setRightChild(newNodeIdx);
+
+	for (size_t i = path.size(); i-- > 0; )
+	{
+		_setAabbFromChildren(path[i], m_aabbNodes);
+
+		SRange nodeRange;
+		nodeRange.m_first = path[i];
+		nodeRange.m_count = 1;
+		outDirtyNodeRanges.push_back(nodeRange);
+	}
+}
+
+void BVHTree::_rebalanceTopLevelTree(std::vector<SRange>& outDirtyNodeRanges)
+{
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	const size_t topLevelRootIdx = m_aabbNodes[0].getTopLevelRootNode();
+	if (topLevelRootIdx <= numMeshes)
+		return;
+
+	std::vector<size_t> nodeIdxs;
+	std::vector<BuildRef> meshRefs;
+	int maxDepth = 0;
+	std::vector<std::pair<size_t, int> > stack(1, std::make_pair(topLevelRootIdx, 0));
+	while (!stack.empty())
+	{
+		const size_t nodeIdx = stack.back().first;
+		const int depth = stack.back().second;
+		stack.pop_back();
+
+		const BVHNode& node = m_aabbNodes[nodeIdx];
+		if (nodeIdx <= numMeshes)
+		{
+			BuildRef meshRef;
+			meshRef.m_centroid = (node.m_minAABB + node.m_maxAABB) * 0.5f;
+			meshRef.m_triIdx = uint32_t(nodeIdx - 1);
+			meshRefs.push_back(meshRef);
+			maxDepth = glm::max(maxDepth, depth);
+			continue;
+		}
+
+		nodeIdxs.push_back(nodeIdx);
+		stack.push_back(std::make_pair(node.getLeftChild(), depth + 1));
+		stack.push_back(std::make_pair(node.getRightChild(), depth + 1));
+	}
+
+	// The tree is rebuilt once it is twice as deep as a rebuilt one can be, so that inserting meshes one after the other
+	// doesn't rebuild it every time. Both depths stay within BVH_MAX_TOP_LEVEL_DEPTH.
+	int balancedDepth = 0;
+	while ((size_t(1) << balancedDepth) < meshRefs.size())
+		balancedDepth++;
+	const int rebuildDepth = glm::min(balancedDepth + 2, BVH_MAX_TOP_LEVEL_DEPTH);
+	if (maxDepth <= glm::min(2 * rebuildDepth, BVH_MAX_TOP_LEVEL_DEPTH))
+		return;
+
+	// _buildTopLevelTree appends the new nodes, which then move to the slots of the old ones (as many, one per entry but one).
+	const size_t firstNewNodeIdx = m_aabbNodes.size();
+	size_t newRootIdx = _buildTopLevelTree(rebuildDepth, meshRefs.data(), meshRefs.size());
+	std::sort(nodeIdxs.begin(), nodeIdxs.end());
+	for (size_t i = 0; i < nodeIdxs.size(); i++)
+	{
+		BVHNode& node = m_aabbNodes[nodeIdxs[i]];
+		node = m_aabbNodes[firstNewNodeIdx + i];
+		if (node.getLeftChild() >= firstNewNodeIdx)
+			node.setLeftChild(nodeIdxs[node.getLeftChild() - firstNewNodeIdx]);
+		if (node.getRightChild() >= firstNewNodeIdx)
+			node.setRightChild(nodeIdxs[node.getRightChild() - firstNewNodeIdx]);
+
+		SRange nodeRange;
+		nodeRange.m_first = nodeIdxs[i];
+		nodeRange.m_count = 1;
+		outDirtyNodeRanges.push_back(nodeRange);
+	}
+	m_aabbNodes.resize(firstNewNodeIdx);
+
+	m_aabbNodes[0].setTopLevelRootNode(nodeIdxs[newRootIdx - firstNewNodeIdx]);
+}
+
+void BVHTree::_removeTopLevelEntry(size_t meshEntryIdx, std::vector<SRange>& outDirtyNodeRanges)
+{
+	const size_t topLevelRootIdx = m_aabbNodes[0].getTopLevelRootNode();
+	if (topLevelRootIdx == meshEntryIdx)
+	{
+		m_aabbNodes[0].setTopLevelRootNode(0);
+		return;
+	}
+
+	std::vector<size_t> path;
+	if (!_findTopLevelPath(topLevelRootIdx, meshEntryIdx, path))
+		return;
+
+	// The parent of the entry is replaced by the sibling of the entry.
+	const size_t parentIdx = path.back();
+	path.pop_back();
+	const BVHNode& parent = m_aabbNodes[parentIdx];
+	const size_t siblingIdx = (parent.getLeftChild() == meshEntryIdx) ? parent.getRightChild() : parent.getLeftChild();
+	addFreeRange(m_freeNodeRanges, parentIdx, 1);
+	_mergeRanges(m_freeNodeRanges, 0);
+
+	if (path.empty())
+	{
+		m_aabbNodes[0].setTopLevelRootNode(siblingIdx);
+		return;
+	}
+
+	BVHNode& grandParent = m_aabbNodes[path.back()];
+	if (grandParent.getLeftChild() == parentIdx)
+		grandParent.setLeftChild(siblingIdx);
+	else
+		grandParent.setRightChild(siblingIdx);
+
+	for (size_t i = path.size(); i-- > 0; )
+	{
+		_setAabbFromChildren(path[i], m_aabbNodes);
+
+		SRange nodeRange;
+		nodeRange.m_first = path[i];
+		nodeRange.m_count = 1;
+		outDirtyNodeRanges.push_back(nodeRange);
+	}
+}
+
+bool BVHTree::insertMesh(size_t meshIdx, const std::vector<glm::vec4>& positions, const std::vector<glm::ivec3>& triIndices,
+	std::vector<SRange>& outDirtyNodeRanges, std::vector<SRange>& outDirtyTriRanges)
+{
+	if (m_aabbNodes.empty() || _getMeshNodeRange(m_aabbNodes, meshIdx).m_count > 0)
+		return false;
+
+	if (m_scratchArenas.empty())
+		m_scratchArenas.resize(1);
+
+	const size_t firstDirtyNodeRangeIdx = outDirtyNodeRanges.size();
+	const size_t firstDirtyTriRangeIdx = outDirtyTriRanges.size();
+
+	SRange& vertexRange = m_meshVertexRanges[meshIdx];
+	std::vector<Triangle> meshTris(triIndices.size());
+	size_t firstVertexIdx = triIndices.empty() ? 0 : size_t(triIndices[0].x);
+	size_t lastVertexIdx = firstVertexIdx;
+	for (size_t triIdx = 0; triIdx < triIndices.size(); triIdx++)
+	{
+		const glm::ivec3& indices = triIndices[triIdx];
+		meshTris[triIdx].set(glm::vec3(positions[indices.x]), glm::vec3(positions[indices.y]), glm::vec3(positions[indices.z]));
+		meshTris[triIdx].m_indices = indices;
+		for (int vertexIdx = 0; vertexIdx < 3; vertexIdx++)
+		{
+			firstVertexIdx = glm::min(firstVertexIdx, size_t(indices[vertexIdx]));
+			lastVertexIdx = glm::max(lastVertexIdx, size_t(indices[vertexIdx]));
+		}
+	}
+	vertexRange.m_first = firstVertexIdx;
+	vertexRange.m_count = triIndices.empty() ? 0 : lastVertexIdx - firstVertexIdx + 1;
+	m_meshNumTris[meshIdx] = meshTris.size();
+	if (meshTris.empty())
+		return true;
+
+	SBuildParams& meshParams = m_meshBuildParams[meshIdx];
+	meshParams = m_buildParams;
+	float initialCost = 0.0f;
+	if (m_buildParams.m_autoTune)
+		_autoTuneMeshBuildParams(meshTris, meshParams, initialCost);
+
+	std::vector<BVHNode> meshNodes;
+	std::vector<glm::ivec3> meshTriIndices;
+	_buildMeshBVHTree(meshParams, meshTris, meshNodes, meshTriIndices);
+
+	SRange layoutRange;
+	layoutRange.m_first = 0;
+	layoutRange.m_count = meshNodes.size();
+	_layoutNodes(meshNodes, layoutRange);
+
+	// Place the tree and its triangle indices, reusing the space freed by removed meshes when possible.
+	SRange nodeRange;
+	size_t numNodes = m_aabbNodes.size();
+	nodeRange.m_first = allocFromFreeRanges(m_freeNodeRanges, meshNodes.size(), numNodes, meshNodes.size() > 1);
+	nodeRange.m_count = meshNodes.size();
+	m_aabbNodes.resize(numNodes);
+
+	SRange triRange;
+	size_t numTris = m_triIndices.size();
+	triRange.m_first = allocFromFreeRanges(m_freeTriRanges, meshTriIndices.size(), numTris);
+	triRange.m_count = meshTriIndices.size();
+	m_triIndices.resize(numTris);
+
+	_offsetNodeLinks(meshNodes, nodeRange.m_first, triRange.m_first);
+	std::copy(meshNodes.begin(), meshNodes.end(), m_aabbNodes.begin() + nodeRange.m_first);
+	std::copy(meshTriIndices.begin(), meshTriIndices.end(), m_triIndices.begin() + triRange.m_first);
+
+	BVHNode& meshEntry = m_aabbNodes[meshIdx + 1];
+	const BVHNode& meshRoot = m_aabbNodes[nodeRange.m_first];
+	meshEntry.setRootNode(nodeRange.m_first, nodeRange.m_count);
+	meshEntry.m_minAABB = meshRoot.m_minAABB;
+	meshEntry.m_maxAABB = meshRoot.m_maxAABB;
+
+	SRange meshEntryRange;
+	meshEntryRange.m_first = meshIdx + 1;
+	meshEntryRange.m_count = 1;
+	outDirtyNodeRanges.push_back(nodeRange);
+	outDirtyNodeRanges.push_back(meshEntryRange);
+	outDirtyTriRanges.push_back(triRange);
+
+	_insertTopLevelEntry(meshIdx + 1, outDirtyNodeRanges);
+	_rebalanceTopLevelTree(outDirtyNodeRanges);
+
+	const size_t topLevelRootIdx = m_aabbNodes[0].getTopLevelRootNode();
+	const BVHNode& topLevelRoot = m_aabbNodes[topLevelRootIdx];
+	m_aabbNodes[0].m_minAABB = topLevelRoot.m_minAABB;
+	m_aabbNodes[0].m_maxAABB = topLevelRoot.m_maxAABB;
+
+	SRange headerRange;
+	headerRange.m_first = 0;
+	headerRange.m_count = 1;
+	outDirtyNodeRanges.push_back(headerRange);
+
+	m_meshBuiltSAHCosts[meshIdx] = _computeMeshSAHCost(meshIdx);
+
+	_mergeRanges(outDirtyNodeRanges, firstDirtyNodeRangeIdx);
+	_mergeRanges(outDirtyTriRanges, firstDirtyTriRangeIdx);
+	return true;
+}
+
+void BVHTree::removeMesh(size_t meshIdx, std::vector<SRange>& outDirtyNodeRanges)
+{
+	const SRange nodeRange = _getMeshNodeRange(m_aabbNodes, meshIdx);
+	if (m_aabbNodes.empty() || nodeRange.m_count == 0)
+		return;
+
+	const size_t firstDirtyNodeRangeIdx = outDirtyNodeRanges.size();
+
+	_removeTopLevelEntry(meshIdx + 1, outDirtyNodeRanges);
+
+	// The freed nodes are left as is on the GPU, nothing points to them anymore.
+	const SRange triRange = _getMeshTriRange(meshIdx);
+	addFreeRange(m_freeNodeRanges, nodeRange.m_first, nodeRange.m_count);
+	addFreeRange(m_freeTriRanges, triRange.m_first, triRange.m_count);
+	_mergeRanges(m_freeNodeRanges, 0);
+	_mergeRanges(m_freeTriRanges, 0);
+
+	BVHNode& meshEntry = m_aabbNodes[meshIdx + 1];
+	meshEntry = BVHNode(glm::vec3(0.0f), glm::vec3(0.0f));
+
+	SRange meshEntryRange;
+	meshEntryRange.m_first = meshIdx + 1;
+	meshEntryRange.m_count = 1;
+	outDirtyNodeRanges.push_back(meshEntryRange);
+
+	const size_t topLevelRootIdx = m_aabbNodes[0].getTopLevelRootNode();
+	if (topLevelRootIdx > 0)
+	{
+		const BVHNode& topLevelRoot = m_aabbNodes[topLevelRootIdx];
+		m_aabbNodes[0].m_minAABB = topLevelRoot.m_minAABB;
+		m_aabbNodes[0].m_maxAABB = topLevelRoot.m_maxAABB;
+	}
+	else
+	{
+		m_aabbNodes[0].m_minAABB = glm::vec3(0.0f);
+		m_aabbNodes[0].m_maxAABB = glm::vec3(0.0f);
+	}
+
+	SRange headerRange;
+	headerRange.m_first = 0;
+	headerRange.m_count = 1;
+	outDirtyNodeRanges.push_back(headerRange);
+
+	m_meshNumTris[meshIdx] = 0;
+	m_meshBuiltSAHCosts[meshIdx] = 0.0f;
+
+	_mergeRanges(outDirtyNodeRanges, firstDirtyNodeRangeIdx);
+}
+
+static inline int countSetBits(int x)
+{
+	int numBits = 0;
+	for (; x != 0; x &= x - 1)
+	{
+		numBits++;
+	}
+	return numBits;
+}
+
+// Treelet being restructured: its leaves (subtrees of the tree) and the optimal topology over every subset of them.
+struct STreelet
+{
+	static const int MAX_LEAVES = 8;
+
+	int				m_numLeaves;
+	size_t			m_leaves[MAX_LEAVES];
+	size_t			m_internalNodes[MAX_LEAVES - 1];	// Node slots reused by the new topology, [0] := root of the treelet.
+	BVHTree::Aabb	m_subsetAabbs[1 << MAX_LEAVES];
+	float			m_subsetCosts[1 << MAX_LEAVES];
+	int				m_subsetHeights[1 << MAX_LEAVES];	// Height of the optimal topology of the subset, including the subtrees below its leaves.
+	uint8_t			m_subsetSplits[1 << MAX_LEAVES];	// Leaves of the subset which go to the left child.
+};
+
+// Emits the optimal topology of the subset into the given node and returns the index of that node.
+static size_t emitTreeletNode(const STreelet& treelet, int subset, size_t nodeIdx, int& numInternalNodes,
+	std::vector<BVHTree::BVHNode>& nodes, std::vector<float>& nodeCosts, std::vector<int>& nodeHeights)
+{
+	const int subsets[2] = { treelet.m_subsetSplits[subset], subset & ~treelet.m_subsetSplits[subset] };
+	size_t childIdxs[2];
+	for (int childIdx = 0; childIdx < 2; childIdx++)
+	{
+		const int childSubset = subsets[childIdx];
+		if ((childSubset & (childSubset - 1)) == 0)
+		{
+			// Single leaf of the treelet.
+			int leafIdx = 0;
+			while ((childSubset >> leafIdx) != 1) { leafIdx++; }
+			childIdxs[childIdx] = treelet.m_leaves[leafIdx];
+		}
+		else
+		{
+			childIdxs[childIdx] = emitTreeletNode(treelet, childSubset, treelet.m_internalNodes[numInternalNodes++], numInternalNodes, nodes,
+				nodeCosts, nodeHeights);
+		}
+	}
+
+	BVHTree::BVHNode& node = nodes[nodeIdx];
+	node.m_minAABB = treelet.m_subsetAabbs[subset].m_min;
+	node.m_maxAABB = treelet.m_subsetAabbs[subset].m_max;
+	node.setLeftChild(childIdxs[0]);
+	node.setRightChild(childIdxs[1]);
+	nodeCosts[nodeIdx] = treelet.m_subsetCosts[subset];
+	nodeHeights[nodeIdx] = treelet.m_subsetHeights[subset];
+	return nodeIdx;
+}
+
+void BVHTree::optimizeBVHTree()
+{
+	if (m_aabbNodes.empty())
+		return;
+
+	if (m_scratchArenas.empty())
+		m_scratchArenas.resize(1);
+
+	auto optimizeStart = std::chrono::high_resolution_clock::now();
+	const TimePoint deadline = optimizeStart + std::chrono::microseconds(int64_t(m_buildParams.m_treeletTimeBudgetMs * 1000.0f));
+	const TimePoint* deadlinePtr = (m_buildParams.m_treeletTimeBudgetMs > 0.0f) ? &deadline : nullptr;
+
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	const float prevSahCost = computeSAHCost();
+
+	std::vector<size_t> taskRoots;
+	std::vector<size_t> taskNumRestructured;
+	std::vector<uint8_t> isTaskRoot;
+	std::vector<size_t> subtreeNumTris;
+	std::vector<int> nodeDepths;
+	std::vector<size_t> stack;
+	std::vector<float> nodeCosts(m_aabbNodes.size(), 0.0f);
+	std::vector<int> nodeHeights(m_aabbNodes.size(), 0);
+	size_t numRestructured = 0;
+	int numPasses = 0;
+
+	ThreadPool threadPool(m_buildParams.m_numThreads);
+	while (numPasses < m_buildParams.m_treeletPasses && (deadlinePtr == nullptr || std::chrono::high_resolution_clock::now() < deadline))
+	{
+		numPasses++;
+
+		// 1) Subtrees with few enough triangles are optimized as independent tasks, then the nodes above them on this thread.
+		// The split only depends on the triangle counts of the subtrees, so that the result doesn't depend on the number of threads.
+		taskRoots.clear();
+		isTaskRoot.assign(m_aabbNodes.size(), 0);
+		subtreeNumTris.assign(m_aabbNodes.size(), 0);
+		nodeDepths.assign(m_aabbNodes.size(), 0);
+		for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+		{
+			const SRange nodeRange = _getMeshNodeRange(m_aabbNodes, meshIdx);
+			if (nodeRange.m_count == 0)
+				continue;
+
+			for (size_t nodeIdx = nodeRange.m_first; nodeIdx < nodeRange.m_first + nodeRange.m_count; nodeIdx++)
+			{
+				const BVHNode& node = m_aabbNodes[nodeIdx];
+				if (!node.isLeaf())
+					nodeDepths[node.getLeftChild()] = nodeDepths[node.getRightChild()] = nodeDepths[nodeIdx] + 1;
+			}
+
+			for (size_t nodeIdx = nodeRange.m_first + nodeRange.m_count; nodeIdx-- > nodeRange.m_first; )
+			{
+				const BVHNode& node = m_aabbNodes[nodeIdx];
+				subtreeNumTris[nodeIdx] = node.isLeaf() ? node.getNumTris() :
+					subtreeNumTris[node.getLeftChild()] + subtreeNumTris[node.getRightChild()];
+			}
+
+			stack.push_back(nodeRange.m_first);
+			while (!stack.empty())
+			{
+				const size_t nodeIdx = stack.back();
+				stack.pop_back();
+
+				const BVHNode& node = m_aabbNodes[nodeIdx];
+				if (node.isLeaf() || subtreeNumTris[nodeIdx] <= m_buildParams.m_parallelBuildMinTris)
+				{
+					taskRoots.push_back(nodeIdx);
+					isTaskRoot[nodeIdx] = 1;
+					continue;
+				}
+				stack.push_back(node.getRightChild());
+				stack.push_back(node.getLeftChild());
+			}
+		}
+
+		// 2) Optimize the treelets bottom-up.
+		taskNumRestructured.assign(taskRoots.size(), 0);
+		threadPool.parallelFor(taskRoots.size(), [&](size_t taskIdx) {
+			taskNumRestructured[taskIdx] = _optimizeTreelets(taskRoots[taskIdx], isTaskRoot, nodeDepths, nodeCosts, nodeHeights, deadlinePtr);
+		});
+
+		size_t passNumRestructured = 0;
+		for (size_t taskIdx = 0; taskIdx < taskRoots.size(); taskIdx++)
+		{
+			passNumRestructured += taskNumRestructured[taskIdx];
+		}
+
+		for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+		{
+			const SRange nodeRange = _getMeshNodeRange(m_aabbNodes, meshIdx);
+			if (nodeRange.m_count > 0 && !isTaskRoot[nodeRange.m_first])
+				passNumRestructured += _optimizeTreelets(nodeRange.m_first, isTaskRoot, nodeDepths, nodeCosts, nodeHeights, deadlinePtr);
+		}
+
+		// 3) Restructured treelets reuse their node slots in any order, while the next pass, refit() and the rebuild
+		// expect the children to be stored after their parent.
+		for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+		{
+			_layoutNodes(m_aabbNodes, _getMeshNodeRange(m_aabbNodes, meshIdx));
+		}
+
+		numRestructured += passNumRestructured;
+		if (passNumRestructured == 0)
+			break;
+	}
+
+	float sahCost = 0.0f;
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		m_meshBuiltSAHCosts[meshIdx] = _computeMeshSAHCost(meshIdx);
+		sahCost += m_meshBuiltSAHCosts[meshIdx];
+	}
+
+	auto optimizeEnd = std::chrono::high_resolution_clock::now();
+	printf("BVH treelet optimization in %.2f ms: %zu treelets restructured in %d passes, SAH cost: %f -> %f\n",
+		std::chrono::duration<double, std::milli>(optimizeEnd - optimizeStart).count(), numRestructured, numPasses, prevSahCost, sahCost);
+}
+
+size_t BVHTree::_optimizeTreelets(size_t rootIdx, const std::vector<uint8_t>& isTaskRoot, const std::vector<int>& nodeDepths,
+	std::vector<float>& nodeCosts, std::vector<int>& nodeHeights, const TimePoint* deadline)
+{
+	// Iterative post-order traversal, the low bit of each stack entry tells whether the children of the node were pushed.
+	size_t numRestructured = 0;
+	std::vector<size_t> stack;
+	stack.push_back(rootIdx << 1);
+	while (!stack.empty())
+	{
+		const size_t entry = stack.back();
+		const size_t nodeIdx = entry >> 1;
+		BVHNode& node = m_aabbNodes[nodeIdx];
+
+		Aabb aabb;
+		aabb.grow(node.m_minAABB);
+		aabb.grow(node.m_maxAABB);
+		if (node.isLeaf())
+		{
+			nodeCosts[nodeIdx] = m_buildParams.m_intersectionCost * node.getNumTris() * aabb.surfaceArea();
+			nodeHeights[nodeIdx] = 0;
+			stack.pop_back();
+			continue;
+		}
+
+		if ((entry & 1) == 0)
+		{
+			stack.back() |= 1;
+			const size_t childIdxs[2] = { node.getLeftChild(), node.getRightChild() };
+			for (int childIdx = 0; childIdx < 2; childIdx++)
+			{
+				if (!isTaskRoot[childIdxs[childIdx]])
+					stack.push_back(childIdxs[childIdx] << 1);
+			}
+			continue;
+		}
+		stack.pop_back();
+
+		if (deadline != nullptr && std::chrono::high_resolution_clock::now() >= *deadline)
+			break;
+
+		nodeCosts[nodeIdx] = m_buildParams.m_traversalCost * aabb.surfaceArea()
+			+ nodeCosts[node.getLeftChild()] + nodeCosts[node.getRightChild()];
+		nodeHeights[nodeIdx] = glm::max(nodeHeights[node.getLeftChild()], nodeHeights[node.getRightChild()]) + 1;
+		if (_restructureTreelet(nodeIdx, nodeDepths, nodeCosts, nodeHeights))
+			numRestructured++;
+	}
+	return numRestructured;
+}
+
+bool BVHTree::_restructureTreelet(size_t nodeIdx, const std::vector<int>& nodeDepths, std::vector<float>& nodeCosts, std::vector<int>& nodeHeights)
+{
+	STreelet treelet;
+	const int treeletSize = glm::clamp(m_buildParams.m_treeletSize, 3, int(STreelet::MAX_LEAVES));
+
+	// 1) Grow the treelet by repeatedly opening the leaf with the largest surface area, which has the most to gain.
+	const BVHNode& rootNode = m_aabbNodes[nodeIdx];
+	treelet.m_internalNodes[0] = nodeIdx;
+	treelet.m_leaves[0] = rootNode.getLeftChild();
+	treelet.m_leaves[1] = rootNode.getRightChild();
+	treelet.m_numLeaves = 2;
+	while (treelet.m_numLeaves < treeletSize)
+	{
+		int bestLeafIdx = -1;
+		float bestArea = -1.0f;
+		for (int leafIdx = 0; leafIdx < treelet.m_numLeaves; leafIdx++)
+		{
+			const BVHNode& leaf = m_aabbNodes[treelet.m_leaves[leafIdx]];
+			if (leaf.isLeaf())
+				continue;
+
+			Aabb leafAabb;
+			leafAabb.grow(leaf.m_minAABB);
+			leafAabb.grow(leaf.m_maxAABB);
+			if (leafAabb.surfaceArea() > bestArea)
+			{
+				bestArea = leafAabb.surfaceArea();
+				bestLeafIdx = leafIdx;
+			}
+		}
+		if (bestLeafIdx == -1)
+			break;
+
+		const BVHNode& openedNode = m_aabbNodes[treelet.m_leaves[bestLeafIdx]];
+		treelet.m_internalNodes[treelet.m_numLeaves - 1] = treelet.m_leaves[bestLeafIdx];
+		treelet.m_leaves[bestLeafIdx] = openedNode.getLeftChild();
+		treelet.m_leaves[treelet.m_numLeaves++] = openedNode.getRightChild();
+	}
+
+	if (treelet.m_numLeaves < 3)
+		return false;
+
+	// 2) Find the cheapest topology of every subset of leaves, by increasing size, from the cheapest split of the subset in two.
+	const int numSubsets = 1 << treelet.m_numLeaves;
+	for (int leafIdx = 0; leafIdx < treelet.m_numLeaves; leafIdx++)
+	{
+		const int subset = 1 << leafIdx;
+		const BVHNode& leaf = m_aabbNodes[treelet.m_leaves[leafIdx]];
+		treelet.m_subsetAabbs[subset] = Aabb();
+		treelet.m_subsetAabbs[subset].grow(leaf.m_minAABB);
+		treelet.m_subsetAabbs[subset].grow(leaf.m_maxAABB);
+		treelet.m_subsetCosts[subset] = nodeCosts[treelet.m_leaves[leafIdx]];
+		treelet.m_subsetHeights[subset] = nodeHeights[treelet.m_leaves[leafIdx]];
+	}
+
+	for (int subsetSize = 2; subsetSize <= treelet.m_numLeaves; subsetSize++)
+	{
+		for (int subset = 3; subset < numSubsets; subset++)
+		{
+			if (countSetBits(subset) != subsetSize)
+				continue;
+
+			const int lowestLeaf = subset & -subset;
+			treelet.m_subsetAabbs[subset] = treelet.m_subsetAabbs[subset & ~lowestLeaf];
+			treelet.m_subsetAabbs[subset].grow(treelet.m_subsetAabbs[lowestLeaf]);
+
+			// Only the partitions keeping the lowest leaf on the left are evaluated, the others are their mirror.
+			float bestCost = FLT_MAX;
+			int bestSplit = 0;
+			for (int split = (subset - 1) & subset; split != 0; split = (split - 1) & subset)
+			{
+				if ((split & lowestLeaf) == 0)
+					continue;
+
+				const float cost = treelet.m_subsetCosts[split] + treelet.m_subsetCosts[subset & ~split];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestSplit = split;
+				}
+			}
+
+			treelet.m_subsetCosts[subset] = m_buildParams.m_traversalCost * treelet.m_subsetAabbs[subset].surfaceArea() + bestCost;
+			treelet.m_subsetHeights[subset] = glm::max(treelet.m_subsetHeights[bestSplit], treelet.m_subsetHeights[subset & ~bestSplit]) + 1;
+			treelet.m_subsetSplits[subset] = uint8_t(bestSplit);
+		}
+	}
+
+	// 3) Only rewrite the treelet when it gets noticeably cheaper, rounding errors would otherwise shuffle equivalent topologies.
+	// A topology deeper than the traversal stacks allow is dropped rather than searched for the cheapest one that fits.
+	const int allLeaves = numSubsets - 1;
+	if (treelet.m_subsetCosts[allLeaves] >= nodeCosts[nodeIdx] * 0.9999f ||
+		nodeDepths[nodeIdx] + treelet.m_subsetHeights[allLeaves] > BVH_MAX_MESH_DEPTH)
+		return false;
+
+	int numInternalNodes = 1;
+	emitTreeletNode(treelet, allLeaves, nodeIdx, numInternalNodes, m_aabbNodes, nodeCosts, nodeHeights);
+	return true;
+}
+
+void BVHTree::_layoutNodes(std::vector<BVHTree::BVHNode>& nodes, const SRange& nodeRange)
+{
+	if (nodeRange.m_count == 0)
+		return;
+
+	ScratchArena& arena = _getScratchArena();
+	ScratchArena::Scope arenaScope(arena);
+	BVHNode* layoutNodes = arena.alloc<BVHNode>(nodeRange.m_count);
+	size_t* stack = arena.alloc<size_t>(nodeRange.m_count);
+
+	// The children of a node are emitted (and get their final index) together, as soon as their parent is visited.
+	size_t numNodes = 0;
+	auto emitChildren = [&](size_t newNodeIdx) {
+		BVHNode& node = layoutNodes[newNodeIdx];
+		const size_t newNodeIdxL = numNodes++;
+		const size_t newNodeIdxR = numNodes++;
+		layoutNodes[newNodeIdxL] = nodes[node.getLeftChild()];
+		layoutNodes[newNodeIdxR] = nodes[node.getRightChild()];
+		node.setLeftChild(nodeRange.m_first + newNodeIdxL);
+		node.setRightChild(nodeRange.m_first + newNodeIdxR);
+	};
+
+	// 1) Top levels, one level after the other.
+	layoutNodes[numNodes++] = nodes[nodeRange.m_first];
+	size_t levelBegin = 0;
+	size_t levelEnd = numNodes;
+	for (int level = 0; level < m_buildParams.m_layoutTopLevels && levelBegin < levelEnd; level++)
+	{
+		for (size_t newNodeIdx = levelBegin; newNodeIdx < levelEnd; newNodeIdx++)
+		{
+			if (!layoutNodes[newNodeIdx].isLeaf())
+				emitChildren(newNodeIdx);
+		}
+		levelBegin = levelEnd;
+		levelEnd = numNodes;
+	}
+
+	// 2) Subtrees below the last top level, the left subtree first.
+	size_t stackSize = 0;
+	for (size_t newNodeIdx = levelEnd; newNodeIdx-- > levelBegin; )
+	{
+		stack[stackSize++] = newNodeIdx;
+	}
+	while (stackSize > 0)
+	{
+		const size_t newNodeIdx = stack[--stackSize];
+		if (layoutNodes[newNodeIdx].isLeaf())
+			continue;
+
+		emitChildren(newNodeIdx);
+		stack[stackSize++] = numNodes - 1;
+		stack[stackSize++] = numNodes - 2;
+	}
+
+	std::copy(layoutNodes, layoutNodes + numNodes, nodes.begin() + nodeRange.m_first);
+}
+
+template <int N>
+void BVHTree::collapseToWideBVH(std::vector< WideBVHNode<N> >& outNodes) const
+{
+	outNodes.clear();
+	if (m_aabbNodes.empty())
+		return;
+
+	// Without any mesh, the root is emitted with empty slots only so that traversal always has a node to start from.
+	const size_t topLevelRootIdx = m_aabbNodes[0].getTopLevelRootNode();
+	_emitWideBVHNode<N>(topLevelRootIdx, nullptr, outNodes);
+}
+
+template <int N>
+void BVHTree::updateWideBVH(const std::vector<size_t>& meshIdxs, SWideBVHLayout& ioLayout, std::vector< WideBVHNode<N> >& ioNodes,
+	std::vector<SRange>& outDirtyNodeRanges) const
+{
+	if (m_aabbNodes.empty())
+		return;
+
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	const size_t firstDirtyNodeRangeIdx = outDirtyNodeRanges.size();
+
+	// Each wide node of the top-level tree opens at least one of its binary nodes, of which there are one less than the
+	// entries, so the room kept at the front is always enough (one node at least, for the root).
+	const size_t numTopLevelSlots = glm::max<size_t>(numMeshes, 2) - 1;
+	std::vector<size_t> collapsedMeshIdxs = meshIdxs;
+	if (ioLayout.m_meshNodeRanges.size() != numMeshes)
+	{
+		ioNodes.assign(numTopLevelSlots, WideBVHNode<N>());
+		ioLayout.m_meshNodeRanges.assign(numMeshes, SRange());
+		ioLayout.m_freeNodeRanges.clear();
+		collapsedMeshIdxs.resize(numMeshes);
+		for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+			collapsedMeshIdxs[meshIdx] = meshIdx;
+	}
+
+	std::vector< WideBVHNode<N> > meshNodes;
+	size_t numNodes = ioNodes.size();
+	for (size_t i = 0; i < collapsedMeshIdxs.size(); i++)
+	{
+		const size_t meshIdx = collapsedMeshIdxs[i];
+		meshNodes.clear();
+		if (_getMeshNodeRange(m_aabbNodes, meshIdx).m_count > 0)
+			_emitWideBVHNode<N>(m_aabbNodes[meshIdx + 1].getRootNode(), nullptr, meshNodes);
+
+		// A refitted tree usually collapses to as many nodes as before, and then stays where it is.
+		SRange& nodeRange = ioLayout.m_meshNodeRanges[meshIdx];
+		if (meshNodes.size() > nodeRange.m_count)
+		{
+			addFreeRange(ioLayout.m_freeNodeRanges, nodeRange.m_first, nodeRange.m_count);
+			_mergeRanges(ioLayout.m_freeNodeRanges, 0);
+			nodeRange.m_first = allocFromFreeRanges(ioLayout.m_freeNodeRanges, meshNodes.size(), numNodes);
+			ioNodes.resize(numNodes);
+		}
+		else
+		{
+			addFreeRange(ioLayout.m_freeNodeRanges, nodeRange.m_first + meshNodes.size(), nodeRange.m_count - meshNodes.size());
+			_mergeRanges(ioLayout.m_freeNodeRanges, 0);
+		}
+		nodeRange.m_count = meshNodes.size();
+		if (meshNodes.empty())
+			continue;
+
+		// The links between the nodes of a mesh are relative to the first one until they are placed.
+		for (size_t nodeIdx = 0; nodeIdx < meshNodes.size(); nodeIdx++)
+		{
+			WideBVHNode<N>& wideNode = meshNodes[nodeIdx];
+			for (int slotIdx = 0; slotIdx < N; slotIdx++)
+			{
+				if (wideNode.m_children[slotIdx] >= 0 && wideNode.m_counts[slotIdx] == 0)
+					wideNode.m_children[slotIdx] += int32_t(nodeRange.m_first);
+			}
+		}
+		std::copy(meshNodes.begin(), meshNodes.end(), ioNodes.begin() + nodeRange.m_first);
+		outDirtyNodeRanges.push_back(nodeRange);
+	}
+
+	// The top-level tree changes with any mesh and is small, it is always collapsed again.
+	meshNodes.clear();
+	_emitWideBVHNode<N>(m_aabbNodes[0].getTopLevelRootNode(), ioLayout.m_meshNodeRanges.data(), meshNodes);
+	assert(meshNodes.size() <= numTopLevelSlots);
+	std::copy(meshNodes.begin(), meshNodes.end(), ioNodes.begin());
+
+	SRange topLevelNodeRange;
+	topLevelNodeRange.m_first = 0;
+	topLevelNodeRange.m_count = meshNodes.size();
+	outDirtyNodeRanges.push_back(topLevelNodeRange);
+
+	_mergeRanges(outDirtyNodeRanges, firstDirtyNodeRangeIdx);
+}
+
+template <int N>
+size_t BVHTree::_emitWideBVHNode(size_t nodeIdx, const SRange* meshNodeRanges, std::vector< WideBVHNode<N> >& outNodes) const
+{
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+
+	// Greedily open the child with the biggest surface area until the node is full. Leaves and mesh entries are never
+	// opened, so that the collapsed mesh trees stay separate from the top-level tree.
+	size_t children[N];
+	size_t numChildren = 0;
+	if (nodeIdx > 0)
+		children[numChildren++] = nodeIdx;
+
+	while (numChildren < N)
+	{
+		int bestChildIdx = -1;
+		float bestArea = -1.0f;
+		for (size_t childIdx = 0; childIdx < numChildren; childIdx++)
+		{
+			const BVHNode& child = m_aabbNodes[children[childIdx]];
+			if (children[childIdx] <= numMeshes || child.isLeaf())
+				continue;
+
+			Aabb childAabb;
+			childAabb.grow(child.m_minAABB);
+			childAabb.grow(child.m_maxAABB);
+			if (childAabb.surfaceArea() > bestArea)
+			{
+				bestArea = childAabb.surfaceArea();
+				bestChildIdx = int(childIdx);
+			}
+		}
+
+		if (bestChildIdx == -1)
+			break;
+
+		const BVHNode& child = m_aabbNodes[children[bestChildIdx]];
+		children[bestChildIdx] = child.getLeftChild();
+		children[numChildren++] = child.getRightChild();
+	}
+
+	const size_t wideNodeIdx = outNodes.size();
+	outNodes.push_back(WideBVHNode<N>());
+	for (int slotIdx = 0; slotIdx < N; slotIdx++)
+	{
+		WideBVHNode<N>& wideNode = outNodes[wideNodeIdx];
+		wideNode.m_minX[slotIdx] = wideNode.m_minY[slotIdx] = wideNode.m_minZ[slotIdx] = FLT_MAX;
+		wideNode.m_maxX[slotIdx] = wideNode.m_maxY[slotIdx] = wideNode.m_maxZ[slotIdx] = -FLT_MAX;
+		wideNode.m_children[slotIdx] = -1;
+		wideNode.m_counts[slotIdx] = 0;
+	}
+
+	for (size_t childIdx = 0; childIdx < numChildren; childIdx++)
+	{
+		const BVHNode& child = m_aabbNodes[children[childIdx]];
+
+		int32_t childLink;
+		int32_t childCount;
+		if (children[childIdx] <= numMeshes)
+		{
+			childLink = (meshNodeRanges != nullptr) ? int32_t(meshNodeRanges[children[childIdx] - 1].m_first) :
+				int32_t(_emitWideBVHNode<N>(child.getLeftChild(), nullptr, outNodes));
+			childCount = -int32_t(children[childIdx]);
+		}
+		else if (child.isLeaf())
+		{
+			childLink = int32_t(child.getFirstTri());
+			childCount = int32_t(child.getNumTris());
+		}
+		else
+		{
+			childLink = int32_t(_emitWideBVHNode<N>(children[childIdx], meshNodeRanges, outNodes));
+			childCount = 0;
+		}
+
+		// The recursion above may have reallocated outNodes.
+		WideBVHNode<N>& wideNode = outNodes[wideNodeIdx];
+		wideNode.m_minX[childIdx] = child.m_minAABB.x;
+		wideNode.m_minY[childIdx] = child.m_minAABB.y;
+		wideNode.m_minZ[childIdx] = child.m_minAABB.z;
+		wideNode.m_maxX[childIdx] = child.m_maxAABB.x;
+		wideNode.m_maxY[childIdx] = child.m_maxAABB.y;
+		wideNode.m_maxZ[childIdx] = child.m_maxAABB.z;
+		wideNode.m_children[childIdx] = childLink;
+		wideNode.m_counts[childIdx] = childCount;
+	}
+
+	return wideNodeIdx;
+}
+
+template void BVHTree::collapseToWideBVH<2>(std::vector< WideBVHNode<2> >& outNodes) const;
+template void BVHTree::collapseToWideBVH<4>(std::vector< WideBVHNode<4> >& outNodes) const;
+template void BVHTree::collapseToWideBVH<8>(std::vector< WideBVHNode<8> >& outNodes) const;
+template void BVHTree::updateWideBVH<2>(const std::vector<size_t>& meshIdxs, SWideBVHLayout& ioLayout, std::vector< WideBVHNode<2> >& ioNodes,
+	std::vector<SRange>& outDirtyNodeRanges) const;
+template void BVHTree::updateWideBVH<4>(const std::vector<size_t>& meshIdxs, SWideBVHLayout& ioLayout, std::vector< WideBVHNode<4> >& ioNodes,
+	std::vector<SRange>& outDirtyNodeRanges) const;
+template void BVHTree::updateWideBVH<8>(const std::vector<size_t>& meshIdxs, SWideBVHLayout& ioLayout, std::vector< WideBVHNode<8> >& ioNodes,
+	std::vector<SRange>& outDirtyNodeRanges) const;
+
+template <int N, typename T>
+void BVHTree::quantizeWideBVH(const std::vector< WideBVHNode<N> >& wideNodes, std::vector< QuantizedWideBVHNode<N, T> >& outNodes)
+{
+	SRange nodeRange;
+	nodeRange.m_first = 0;
+	nodeRange.m_count = wideNodes.size();
+	quantizeWideBVH(wideNodes, std::vector<SRange>(1, nodeRange), outNodes);
+}
+
+template <int N, typename T>
+void BVHTree::quantizeWideBVH(const std::vector< WideBVHNode<N> >& wideNodes, const std::vector<SRange>& nodeRanges,
+	std::vector< QuantizedWideBVHNode<N, T> >& outNodes)
+{
+	const float maxSteps = float(std::numeric_limits<T>::max());
+
+	outNodes.resize(wideNodes.size());
+	for (size_t rangeIdx = 0; rangeIdx < nodeRanges.size(); rangeIdx++)
+	{
+		const SRange& nodeRange = nodeRanges[rangeIdx];
+		for (size_t nodeIdx = nodeRange.m_first; nodeIdx < nodeRange.m_first + nodeRange.m_count; nodeIdx++)
+		{
+			const WideBVHNode<N>& wideNode = wideNodes[nodeIdx];
+			QuantizedWideBVHNode<N, T>& quantizedNode = outNodes[nodeIdx];
+
+			const float* childMins[3] = { wideNode.m_minX, wideNode.m_minY, wideNode.m_minZ };
+			const float* childMaxs[3] = { wideNode.m_maxX, wideNode.m_maxY, wideNode.m_maxZ };
+			T* quantizedMins[3] = { quantizedNode.m_qMinX, quantizedNode.m_qMinY, quantizedNode.m_qMinZ };
+			T* quantizedMaxs[3] = { quantizedNode.m_qMaxX, quantizedNode.m_qMaxY, quantizedNode.m_qMaxZ };
+
+			for (int dim = 0; dim < 3; dim++)
+			{
+				float nodeMin = FLT_MAX;
+				float nodeMax = -FLT_MAX;
+				for (int slotIdx = 0; slotIdx < N; slotIdx++)
+				{
+					if (wideNode.m_children[slotIdx] < 0)
+						continue;
+
+					nodeMin = std::min(nodeMin, childMins[dim][slotIdx]);
+					nodeMax = std::max(nodeMax, childMaxs[dim][slotIdx]);
+				}
+				if (nodeMin > nodeMax)
+				{
+					nodeMin = nodeMax = 0.0f;
+				}
+
+				// Grow the step until the last one reaches the maximum despite the rounding of the decoding.
+				float scale = (nodeMax - nodeMin) / maxSteps;
+				float scaleIncrement = std::max(scale * FLT_EPSILON, FLT_MIN);
+				while (nodeMin + maxSteps * scale < nodeMax)
+				{
+					scale += scaleIncrement;
+					scaleIncrement *= 2.0f;
+				}
+				quantizedNode.m_origin[dim] = nodeMin;
+				quantizedNode.m_scale[dim] = scale;
+
+				for (int slotIdx = 0; slotIdx < N; slotIdx++)
+				{
+					// Unused slots get an inverted box on top of their -1 child index.
+					float qMin = maxSteps;
+					float qMax = 0.0f;
+					if (wideNode.m_children[slotIdx] >= 0 && scale > 0.0f)
+					{
+						// Round outward, and fix the (rare) cases where the decoding rounds back inward.
+						const float childMin = childMins[dim][slotIdx];
+						const float childMax = childMaxs[dim][slotIdx];
+						qMin = std::max(0.0f, std::floor((childMin - nodeMin) / scale));
+						while (qMin > 0.0f && nodeMin + qMin * scale > childMin)
+						{
+							qMin -= 1.0f;
+						}
+						qMax = std::min(maxSteps, std::ceil((childMax - nodeMin) / scale));
+						while (qMax < maxSteps && nodeMin + qMax * scale < childMax)
+						{
+							qMax += 1.0f;
+						}
+					}
+					else if (wideNode.m_children[slotIdx] >= 0)
+					{
+						// Flat node along this axis: every child decodes to the origin.
+						qMin = 0.0f;
+					}
+					quantizedMins[dim][slotIdx] = T(qMin);
+					quantizedMaxs[dim][slotIdx] = T(qMax);
+				}
+			}
+
+			for (int slotIdx = 0; slotIdx < N; slotIdx++)
+			{
+				quantizedNode.m_children[slotIdx] = wideNode.m_children[slotIdx];
+				quantizedNode.m_counts[slotIdx] = wideNode.m_counts[slotIdx];
+			}
+		}
+	}
+}
+
+template void BVHTree::quantizeWideBVH<2, uint8_t>(const std::vector< WideBVHNode<2> >& wideNodes, std::vector< QuantizedWideBVHNode<2, uint8_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<4, uint8_t>(const std::vector< WideBVHNode<4> >& wideNodes, std::vector< QuantizedWideBVHNode<4, uint8_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<8, uint8_t>(const std::vector< WideBVHNode<8> >& wideNodes, std::vector< QuantizedWideBVHNode<8, uint8_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<2, uint16_t>(const std::vector< WideBVHNode<2> >& wideNodes, std::vector< QuantizedWideBVHNode<2, uint16_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<4, uint16_t>(const std::vector< WideBVHNode<4> >& wideNodes, std::vector< QuantizedWideBVHNode<4, uint16_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<8, uint16_t>(const std::vector< WideBVHNode<8> >& wideNodes, std::vector< QuantizedWideBVHNode<8, uint16_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<2, uint8_t>(const std::vector< WideBVHNode<2> >& wideNodes, const std::vector<SRange>& nodeRanges,
+	std::vector< QuantizedWideBVHNode<2, uint8_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<4, uint8_t>(const std::vector< WideBVHNode<4> >& wideNodes, const std::vector<SRange>& nodeRanges,
+	std::vector< QuantizedWideBVHNode<4, uint8_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<8, uint8_t>(const std::vector< WideBVHNode<8> >& wideNodes, const std::vector<SRange>& nodeRanges,
+	std::vector< QuantizedWideBVHNode<8, uint8_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<2, uint16_t>(const std::vector< WideBVHNode<2> >& wideNodes, const std::vector<SRange>& nodeRanges,
+	std::vector< QuantizedWideBVHNode<2, uint16_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<4, uint16_t>(const std::vector< WideBVHNode<4> >& wideNodes, const std::vector<SRange>& nodeRanges,
+	std::vector< QuantizedWideBVHNode<4, uint16_t> >& outNodes);
+template void BVHTree::quantizeWideBVH<8, uint16_t>(const std::vector< WideBVHNode<8> >& wideNodes, const std::vector<SRange>& nodeRanges,
+	std::vector< QuantizedWideBVHNode<8, uint16_t> >& outNodes);
+
+float BVHTree::computeSAHCost() const
+{
+	if (m_aabbNodes.empty())
+		return 0.0f;
+
+	float sahCost = 0.0f;
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		sahCost += _computeMeshSAHCost(meshIdx);
+	}
+	return sahCost;
+}
+
+float BVHTree::_computeMeshSAHCost(size_t meshIdx) const
+{
+	const SRange nodeRange = _getMeshNodeRange(m_aabbNodes, meshIdx);
+	if (nodeRange.m_count == 0)
+		return 0.0f;
+
+	const BVHNode& rootNode = m_aabbNodes[nodeRange.m_first];
+	Aabb rootAabb;
+	rootAabb.grow(rootNode.m_minAABB);
+	rootAabb.grow(rootNode.m_maxAABB);
+
+	const float rootArea = rootAabb.surfaceArea();
+	return (rootArea > 0.0f) ? _computeSAHCost(m_aabbNodes, nodeRange.m_first, rootArea) : 0.0f;
+}
+
+float BVHTree::_computeSAHCost(const std::vector<BVHTree::BVHNode>& nodes, size_t nodeIdx, float rootArea) const
+{
+	const BVHNode& node = nodes[nodeIdx];
+
+	Aabb aabb;
+	aabb.grow(node.m_minAABB);
+	aabb.grow(node.m_maxAABB);
+	const float areaRatio = aabb.surfaceArea() / rootArea;
+
+	if (node.isLeaf())
+	{
+		return areaRatio * m_buildParams.m_intersectionCost * node.getNumTris();
+	}
+
+	return areaRatio * m_buildParams.m_traversalCost
+		+ _computeSAHCost(nodes, node.getLeftChild(), rootArea)
+		+ _computeSAHCost(nodes, node.getRightChild(), rootArea);
+}
+
+BVHTree::SStats BVHTree::computeStats() const
+{
+	SStats stats;
+	if (m_aabbNodes.empty())
+		return stats;
+
+	const size_t numMeshes = m_aabbNodes[0].getNumMeshes();
+	for (size_t meshIdx = 0; meshIdx < numMeshes; meshIdx++)
+	{
+		if (_getMeshNodeRange(m_aabbNodes, meshIdx).m_count > 0)
+			_accumulateStats(m_aabbNodes[meshIdx + 1].getRootNode(), stats);
+	}
+
+	stats.m_sahCost = computeSAHCost();
+	stats.m_memorySize = m_aabbNodes.size() * sizeof(BVHNode) + m_triIndices.size() * sizeof(glm::ivec3);
+	_finalizeStats(stats);
+	return stats;
+}
+
+BVHTree::SStats BVHTree::computeMeshStats(size_t meshIdx) const
+{
+	SStats stats;
+	const SRange nodeRange = _getMeshNodeRange(m_aabbNodes, meshIdx);
+	if (nodeRange.m_count == 0)
+		return stats;
+
+	_accumulateStats(nodeRange.m_first, stats);
+	stats.m_sahCost = _computeMeshSAHCost(meshIdx);
+	stats.m_memorySize = stats.m_numNodes * sizeof(BVHNode) + stats.m_numTriRefs * sizeof(glm::ivec3);
+	_finalizeStats(stats);
+	return stats;
+}
+
+void BVHTree::_accumulateStats(size_t rootIdx, SStats& stats) const
+{
+	std::vector< std::pair<size_t, int> > stack; // (node, depth)
+	stack.push_back(std::make_pair(rootIdx, 0));
+	while (!stack.empty())
+	{
+		const size_t nodeIdx = stack.back().first;
+		const int depth = stack.back().second;
+		stack.pop_back();
+
+		const BVHNode& node = m_aabbNodes[nodeIdx];
+		stats.m_numNodes++;
+		stats.m_maxDepth = glm::max(stats.m_maxDepth, depth);
+		if (node.isLeaf())
+		{
+			const size_t numTris = node.getNumTris();
+			stats.m_numLeaves++;
+			stats.m_numTriRefs += numTris;
+
+			if (stats.m_leafSizeHistogram.size() <= numTris)
+				stats.m_leafSizeHistogram.resize(numTris + 1, 0);
+			stats.m_leafSizeHistogram[numTris]++;
+			if (stats.m_leafDepthHistogram.size() <= size_t(depth))
+				stats.m_leafDepthHistogram.resize(depth + 1, 0);
+			stats.m_leafDepthHistogram[depth]++;
+			continue;
+		}
+
+		const BVHNode& childL = m_aabbNodes[node.getLeftChild()];
+		const BVHNode& childR = m_aabbNodes[node.getRightChild()];
+		Aabb nodeAabb;
+		nodeAabb.grow(node.m_minAABB);
+		nodeAabb.grow(node.m_maxAABB);
+		Aabb overlapAabb;
+		overlapAabb.m_min = glm::max(childL.m_minAABB, childR.m_minAABB);
+		overlapAabb.m_max = glm::min(childL.m_maxAABB, childR.m_maxAABB);
+		const bool isOverlapping = glm::all(glm::lessThanEqual(overlapAabb.m_min, overlapAabb.m_max));
+		if (isOverlapping && nodeAabb.surfaceArea() > 0.0f)
+			stats.m_avgChildOverlap += overlapAabb.surfaceArea() / nodeAabb.surfaceArea();
+
+		stack.push_back(std::make_pair(node.getRightChild(), depth + 1));
+		stack.push_back(std::make_pair(node.getLeftChild(), depth + 1));
+	}
+}
+
+void BVHTree::_finalizeStats(SStats& stats)
+{
+	size_t leafDepthSum = 0;
+	for (size_t depth = 0; depth < stats.m_leafDepthHistogram.size(); depth++)
+	{
+		leafDepthSum += depth * stats.m_leafDepthHistogram[depth];
+	}
+
+	const size_t numInteriorNodes = stats.m_numNodes - stats.m_numLeaves;
+	stats.m_avgLeafDepth = (stats.m_numLeaves > 0) ? float(leafDepthSum) / stats.m_numLeaves : 0.0f;
+	stats.m_avgLeafSize = (stats.m_numLeaves > 0) ? float(stats.m_numTriRefs) / stats.m_numLeaves : 0.0f;
+	stats.m_avgChildOverlap = (numInteriorNodes > 0) ? stats.m_avgChildOverlap / numInteriorNodes : 0.0f;
+}
+
+void BVHTree::printStats(const SStats& stats)
+{
+	printf("BVH stats: %zu nodes (%zu leaves), %zu triangle references, SAH cost %f, %.1f KB\n",
+		stats.m_numNodes, stats.m_numLeaves, stats.m_numTriRefs, stats.m_sahCost, stats.m_memorySize / 1024.0f);
+	printf("  leaf depth: max %d, average %.2f, histogram (depth:leaves)", stats.m_maxDepth, stats.m_avgLeafDepth);
+	for (size_t depth = 0; depth < stats.m_leafDepthHistogram.size(); depth++)
+	{
+		if (stats.m_leafDepthHistogram[depth] > 0)
+			printf(" %zu:%zu", depth, stats.m_leafDepthHistogram[depth]);
+	}
+
+	// Leaf sizes are bucketed by powers of two, median split trees can have a lot of different ones.
+	printf("\n  leaf size: average %.2f, histogram (triangles:leaves)", stats.m_avgLeafSize);
+	for (size_t bucketMin = 1; bucketMin < stats.m_leafSizeHistogram.size(); bucketMin *= 2)
+	{
+		const size_t bucketMax = glm::min(bucketMin * 2, stats.m_leafSizeHistogram.size());
+		size_t numLeaves = 0;
+		for (size_t numTris = bucketMin; numTris < bucketMax; numTris++)
+		{
+			numLeaves += stats.m_leafSizeHistogram[numTris];
+		}
+		if (numLeaves == 0)
+			continue;
+
+		if (bucketMax - bucketMin == 1)
+			printf(" %zu:%zu", bucketMin, numLeaves);
+		else
+			printf(" %zu-%zu:%zu", bucketMin, bucketMax - 1, numLeaves);
+	}
+	printf("\n  average child overlap: %.2f%% of the parent's surface area\n", 100.0f * stats.m_avgChildOverlap);
 }
 
 /////////////////////////////////////////////////////////////////////////////////
@@ -1,6 +1,7 @@
 ﻿#include "VulkanRaytracer.h"
 #include "Utilities.h"
 #include "VulkanDeferredRenderer.h"
+#include <vulkan/spirv.h>
 
 namespace
 {
@@ -67,6 +68,12 @@ void VulkanRaytracer::shutdownVulkan()
 	vkDestroyBuffer(m_device, m_compute.buffers.positions.buffer, nullptr);
 	vkDestroyBuffer(m_device, m_compute.buffers.normals.buffer, nullptr);
 
+	// BVH
+	vkDestroyBuffer(m_device, m_compute.buffers.bvhAabbNodes.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.buffers.bvhTriIndices.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.buffers.bvhTriangles.buffer, nullptr);
+	vkDestroyBuffer(m_device, m_compute.buffers.bvhMeshMaterialIds.buffer, nullptr);
+
 	// Uniform buffers
 	vkUtils::destroyUniformData(m_device, &m_compute.buffers.ubo);
 	vkUtils::destroyUniformData(m_device, &m_compute.buffers.materials);
@@ -74,6 +81,10 @@ void VulkanRaytracer::shutdownVulkan()
 	vkFreeMemory(m_device, m_compute.buffers.indices.memory, nullptr);
 	vkFreeMemory(m_device, m_compute.buffers.positions.memory, nullptr);
 	vkFreeMemory(m_device, m_compute.buffers.normals.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.buffers.bvhAabbNodes.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.buffers.bvhTriIndices.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.buffers.bvhTriangles.memory, nullptr);
+	vkFreeMemory(m_device, m_compute.buffers.bvhMeshMaterialIds.memory, nullptr);
 
 	vkDestroyFence(m_device, m_compute.fence, nullptr);
 	vkFreeCommandBuffers(m_device, m_cmdPool, 1, &m_compute.commandBuffer);
@@ -120,7 +131,7 @@ void VulkanRaytracer::setupDescriptorFramework()
 	std::vector<VkDescriptorPoolSize> poolSizes =
 	{
 		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1),
-		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3),
+		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7),
 		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
 		vkUtils::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1)
 	};
@@ -194,6 +205,30 @@ void VulkanRaytracer::setupDescriptorFramework()
 		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 		VK_SHADER_STAGE_COMPUTE_BIT,
 		5
+		),
+		// Binding 6: storage buffer for BVH nodes
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		6
+		),
+		// Binding 7: storage buffer for BVH triangle indices
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		7
+		),
+		// Binding 8: storage buffer for BVH triangles
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		8
+		),
+		// Binding 9: storage buffer for BVH mesh materials
+		vkUtils::initializers::descriptorSetLayoutBinding(
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_SHADER_STAGE_COMPUTE_BIT,
+		9
 		)
 	};
 
@@ -290,6 +325,34 @@ void VulkanRaytracer::setupDescriptors()
 		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 		5,
 		&m_compute.buffers.materials.descriptor
+		),
+		// Binding 6 : BVH nodes buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_compute,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		6,
+		&m_compute.buffers.bvhAabbNodes.descriptor
+		),
+		// Binding 7 : BVH triangle indices buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_compute,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		7,
+		&m_compute.buffers.bvhTriIndices.descriptor
+		),
+		// Binding 8 : BVH triangles buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_compute,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		8,
+		&m_compute.buffers.bvhTriangles.descriptor
+		),
+		// Binding 9 : BVH mesh materials buffer
+		vkUtils::initializers::writeDescriptorSet(
+		m_descriptorSets.m_compute,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		9,
+		&m_compute.buffers.bvhMeshMaterialIds.descriptor
 		)
 	};
 
@@ -386,8 +449,19 @@ void VulkanRaytracer::setupPipelines() {
 			m_pipelineLayouts.m_compute, 
 			0);
 
+	// The binary is compiled by the build (see CMakeLists.txt). One older than the BVH traversal lacks the BVH buffers
+	// (bindings 6 to 9) and would test every triangle instead.
+	const std::string computeShaderFileName = getAssetPath() + "shaders/raytracing/raytrace.comp.spv";
+	const uint32_t lastComputeBinding = 9;
+	std::vector<uint32_t> bindings;
+	if (!vkUtils::getShaderDecorations(computeShaderFileName.c_str(), SpvDecorationBinding, bindings) ||
+		std::find(bindings.begin(), bindings.end(), lastComputeBinding) == bindings.end())
+	{
+		vkUtils::exitFatal(computeShaderFileName + " is missing or was compiled from an older raytrace.comp, rebuild the Shaders target.", "Fatal error");
+	}
+
 	// Create shader modules from bytecodes
-	shaderStages[0] = loadShader(getAssetPath() + "shaders/raytracing/raytrace.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+	shaderStages[0] = loadShader(computeShaderFileName, VK_SHADER_STAGE_COMPUTE_BIT);
 	computePipelineCreateInfo.stage = shaderStages[0];
 
 	VK_CHECK_RESULT(vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &m_pipelines.m_compute));
@@ -591,6 +665,130 @@ void VulkanRaytracer::prepareResources() {
 
 	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
 	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+	// --  BVH AABBs
+	bufferSize = m_bvhTree.m_aabbNodes.size() * sizeof(BVHTree::BVHNode);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhTree.m_aabbNodes.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.buffers.bvhAabbNodes.buffer,
+		&m_compute.buffers.bvhAabbNodes.memory,
+		&m_compute.buffers.bvhAabbNodes.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyAabbNodesCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyAabbNodesCmd, stagingBuffer.buffer, m_compute.buffers.bvhAabbNodes.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyAabbNodesCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+	// --  BVH triangle indices
+	bufferSize = m_bvhTree.m_triIndices.size() * sizeof(glm::ivec3);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhTree.m_triIndices.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.buffers.bvhTriIndices.buffer,
+		&m_compute.buffers.bvhTriIndices.memory,
+		&m_compute.buffers.bvhTriIndices.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyTriIndicesCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyTriIndicesCmd, stagingBuffer.buffer, m_compute.buffers.bvhTriIndices.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyTriIndicesCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+	// --  BVH triangles
+	bufferSize = m_bvhTriangles.size() * sizeof(BVHTree::PrecomputedTriangle);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhTriangles.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.buffers.bvhTriangles.buffer,
+		&m_compute.buffers.bvhTriangles.memory,
+		&m_compute.buffers.bvhTriangles.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyTrianglesCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyTrianglesCmd, stagingBuffer.buffer, m_compute.buffers.bvhTriangles.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyTrianglesCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+
+	// --  BVH mesh materials
+	bufferSize = m_bvhMeshMaterialIds.size() * sizeof(int32_t);
+
+	createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		bufferSize,
+		m_bvhMeshMaterialIds.data(),
+		&stagingBuffer.buffer,
+		&stagingBuffer.memory,
+		&stagingBuffer.descriptor);
+
+	createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		bufferSize,
+		nullptr,
+		&m_compute.buffers.bvhMeshMaterialIds.buffer,
+		&m_compute.buffers.bvhMeshMaterialIds.memory,
+		&m_compute.buffers.bvhMeshMaterialIds.descriptor);
+
+	// Copy to staging buffer
+	VkCommandBuffer copyMeshMaterialIdsCmd = createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	copyRegion = {};
+	copyRegion.size = bufferSize;
+	vkCmdCopyBuffer(copyMeshMaterialIdsCmd, stagingBuffer.buffer, m_compute.buffers.bvhMeshMaterialIds.buffer, 1, &copyRegion);
+	flushCommandBuffer(copyMeshMaterialIdsCmd, m_compute.queue, true);
+
+	vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
+	vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
 }
 
 void VulkanRaytracer::loadMeshes()
@@ -599,7 +797,14 @@ void VulkanRaytracer::loadMeshes()
 	{
 		vkMeshLoader::MeshCreateInfo meshCreateInfo;
 
-		loadMesh(getAssetPath() + m_fileName, nullptr, &m_sceneAttributes, vertexLayout, &meshCreateInfo);
+		// Same tree as VulkanHybridRenderer, but the shader traverses its binary nodes directly.
+		m_bvhTree.m_buildParams.m_strategy = BVHTree::BUILD_SBVH;
+		m_bvhTree.m_buildParams.m_maxDepth = 32;
+		m_bvhTree.m_buildParams.m_optimizeAfterBuild = true;
+
+		loadMesh(getAssetPath() + m_fileName, nullptr, &m_sceneAttributes, vertexLayout, &meshCreateInfo, &m_bvhTree);
+		m_bvhTree.buildTriangleSoup(m_sceneAttributes.m_verticePositions, m_bvhTriangles);
+		m_bvhTree.buildMeshMaterialIds(m_sceneAttributes.m_indices, m_bvhMeshMaterialIds);
 		std::cout << "Number of vertices: " << m_sceneAttributes.m_verticePositions.size() << std::endl;
 		std::cout << "Number of triangles: " << m_sceneAttributes.m_indices.size()  << std::endl;
 	}
@@ -86,6 +86,10 @@ private:
 private:
 	SSceneAttributes		m_sceneAttributes;
 
+	BVHTree					m_bvhTree; // Traversed by data/shaders/raytracing/raytrace.comp instead of testing every triangle.
+	std::vector<BVHTree::PrecomputedTriangle> m_bvhTriangles; // Triangles of the leaves of m_bvhTree, in m_triIndices order.
+	std::vector<int32_t>	m_bvhMeshMaterialIds; // Material of each mesh of m_bvhTree.
+
 	SVkDescriptorSetLayouts	m_descriptorSetLayouts;
 	SVkDescriptorSets		m_descriptorSets;
 
@@ -110,6 +114,12 @@ private:
 			vk::Buffer positions;
 			vk::Buffer normals;
 
+			// -- BVH buffers
+			vk::Buffer bvhAabbNodes;
+			vk::Buffer bvhTriIndices;
+			vk::Buffer bvhTriangles;
+			vk::Buffer bvhMeshMaterialIds;
+
 		} buffers;
 
 		// -- Output storage image
@@ -276,8 +276,9 @@ void VulkanRenderer::loadMesh(std::string filename, vkMeshLoader::MeshBuffer * m
 {
 	VulkanMeshLoader *mesh = new VulkanMeshLoader();
 	mesh->LoadMesh(filename);
+	// Models rarely change between launches, so their trees are cached next to them.
 	if (tree)
-		tree->buildBVHTree( mesh->m_Entries );
+		tree->buildBVHTree( mesh->m_Entries, filename + ".bvhcache" );
 	
 	if (meshAttributes != nullptr) {
 		*meshAttributes = mesh->m_sceneAttributes;
@@ -311,6 +312,9 @@ VulkanRenderer::VulkanRenderer(const std::string& fileName)
 , m_enableTransparency(false)
 , m_enableReflection(false)
 , m_enableColorByRayBounces(false)
+, m_enableQuantizedBVH(false)
+, m_enableWavefront(false)
+, m_despawnMeshes(false)
 , m_addLight(0)
 , m_fileName(fileName)
 {
@@ -524,6 +528,15 @@ void VulkanRenderer::render(SRendererContext& context)
 	else if (context.m_enableColorByRayBounces != m_enableColorByRayBounces) {
 		toggleColorByRayBounces();
 	}
+	else if (context.m_enableQuantizedBVH != m_enableQuantizedBVH) {
+		toggleQuantizedBVH();
+	}
+	else if (context.m_enableWavefront != m_enableWavefront) {
+		toggleWavefront();
+	}
+	else if (context.m_despawnMeshes != m_despawnMeshes) {
+		toggleDespawnMeshes();
+	}
 	else if (context.m_addLight != m_addLight) {
 		addLight();
 	}
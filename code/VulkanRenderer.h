@@ -72,6 +72,9 @@ public:
 	virtual void toggleTransparency() { m_enableTransparency = !m_enableTransparency; }
 	virtual void toggleReflection() { m_enableReflection = !m_enableReflection; }
 	virtual void toggleColorByRayBounces() { m_enableColorByRayBounces = !m_enableColorByRayBounces; }
+	virtual void toggleQuantizedBVH() { m_enableQuantizedBVH = !m_enableQuantizedBVH; }
+	virtual void toggleWavefront() { m_enableWavefront = !m_enableWavefront; }
+	virtual void toggleDespawnMeshes() { m_despawnMeshes = !m_despawnMeshes; }
 	virtual void addLight() { m_addLight = m_addLight == 0 ? 1 : 0; }
 
 	// Prepare the frame for workload submission
@@ -218,6 +221,9 @@ protected:
 	bool m_enableTransparency;
 	bool m_enableReflection;
 	bool m_enableColorByRayBounces;
+	bool m_enableQuantizedBVH;
+	bool m_enableWavefront;
+	bool m_despawnMeshes;
 	uint32_t m_addLight;
 
 	// Last frame time, measured using a high performance timer (if available)
@@ -20,6 +20,7 @@ This code is licensed under the MIT license (MIT) (http://opensource.org/license
 
 #include <vector>
 #include "VulkanUtilities.h"
+#include <vulkan/spirv.h>
 
 void VulkanSwapChain::initSurface(GLFWwindow* window)
 {
@@ -497,6 +498,49 @@ VkShaderModule vkUtils::loadShader(const char *fileName, VkDevice device, VkShad
 	return shaderModule;
 }
 
+bool vkUtils::getShaderDecorations(const char *fileName, uint32_t decoration, std::vector<uint32_t>& values)
+{
+	values.clear();
+
+	std::vector<uint32_t> words;
+	FILE *fp = fopen(fileName, "rb");
+	if (fp)
+	{
+		fseek(fp, 0L, SEEK_END);
+		words.resize(ftell(fp) / sizeof(uint32_t));
+		fseek(fp, 0L, SEEK_SET);
+		if (fread(words.data(), sizeof(uint32_t), words.size(), fp) != words.size())
+		{
+			words.clear();
+		}
+		fclose(fp);
+	}
+
+	// Header: magic number, version, generator, bound and schema
+	const size_t headerSize = 5;
+	if (words.size() < headerSize || words[0] != SpvMagicNumber)
+	{
+		return false;
+	}
+
+	// OpDecorate: target id, decoration, then its literals
+	for (size_t wordIdx = headerSize; wordIdx < words.size();)
+	{
+		const uint32_t opcode = words[wordIdx] & SpvOpCodeMask;
+		const size_t wordCount = words[wordIdx] >> SpvWordCountShift;
+		if (wordCount == 0 || wordIdx + wordCount > words.size())
+		{
+			return false;
+		}
+		if (opcode == SpvOpDecorate && wordCount >= 4 && words[wordIdx + 2] == decoration)
+		{
+			values.push_back(words[wordIdx + 3]);
+		}
+		wordIdx += wordCount;
+	}
+	return true;
+}
+
 VkShaderModule vkUtils::loadShaderGLSL(const char *fileName, VkDevice device, VkShaderStageFlagBits stage)
 {
 	std::string shaderSrc = readTextFile(fileName);
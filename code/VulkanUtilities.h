@@ -127,6 +127,10 @@ namespace vkUtils
 
 	// Load a SPIR-V shader
 	VkShaderModule loadShader(const char *fileName, VkDevice device, VkShaderStageFlagBits stage);
+	// Load the literals of a decoration (e.g. SpvDecorationBinding or SpvDecorationSpecId) from the OpDecorate instructions of a
+	// SPIR-V shader, to check that the binary matches the interface its GLSL source has now
+	// Returns false if the file is not a SPIR-V module
+	bool getShaderDecorations(const char *fileName, uint32_t decoration, std::vector<uint32_t>& values);
 
 	// Load a GLSL shader
 	// Note : Only for testing purposes, support for directly feeding GLSL shaders into Vulkan
@@ -27,6 +27,9 @@ This code is licensed under the MIT license (MIT) (http://opensource.org/license
 #include <stdio.h>
 #include <vector>
 #include <map>
+#include <functional>
+#include <chrono>
+#include <memory>
 #ifdef _WIN32
 #include <windows.h>
 #include <fcntl.h>
@@ -49,6 +52,8 @@ This code is licensed under the MIT license (MIT) (http://opensource.org/license
 #include <glm/gtc/type_ptr.hpp>
 #include "GfxScene.h"
 
+class ThreadPool;
+
 namespace vkMeshLoader
 {
 	typedef unsigned char Byte;
@@ -166,6 +171,14 @@ namespace vkMeshLoader
 	};
 }
 
+// Depth limits of the trees, which the traversal stacks are sized for (BVH_STACK_SIZE in BVHTraversal.cpp and raytrace.comp):
+// a binary traversal holds at most one entry per level below the top-level root, plus the root or the sentinel entry.
+// The mesh trees are built and optimized no deeper than BVH_MAX_MESH_DEPTH whatever SBuildParams::m_maxDepth is, and the
+// mesh entries are no deeper than BVH_MAX_TOP_LEVEL_DEPTH in the top-level tree (the leaves of a mesh tree are below its entry).
+#define BVH_MAX_MESH_DEPTH 32
+#define BVH_MAX_TOP_LEVEL_DEPTH 30
+#define BVH_MAX_DEPTH (BVH_MAX_TOP_LEVEL_DEPTH + BVH_MAX_MESH_DEPTH)
+
 struct BVHTree
 {
 	enum DIM
@@ -175,6 +188,123 @@ struct BVHTree
 		DIM_Z
 	};
 
+	enum EBuildStrategy
+	{
+		BUILD_MEDIAN_SPLIT = 0,	// Split at the median of the triangles sorted along the largest extent.
+		BUILD_BINNED_SAH,		// Split at the cheapest bin boundary according to the Surface Area Heuristic.
+		BUILD_LBVH,				// Sort the triangles along a Morton curve and emit the implied radix tree (fast rebuilds).
+		BUILD_SBVH				// Binned SAH which can also split the triangles straddling a plane when it is cheaper (spatial splits).
+	};
+
+	// Parameters used to configure the construction of the BVH Trees.
+	struct SBuildParams
+	{
+		SBuildParams()
+		: m_strategy(BUILD_MEDIAN_SPLIT)
+		, m_maxDepth(5)
+		, m_maxLeafSize(12)
+		, m_numBins(16)
+		, m_traversalCost(1.0f)
+		, m_intersectionCost(1.0f)
+		, m_numThreads(0)
+		, m_parallelBuildMinTris(4096)
+		, m_mortonCodeBits(30)
+		, m_lbvhRefineTreelets(0)
+		, m_refitRebuildThreshold(1.5f)
+		, m_spatialSplitAlpha(1e-5f)
+		, m_spatialSplitBudget(0.3f)
+		, m_treeletSize(7)
+		, m_treeletPasses(3)
+		, m_treeletTimeBudgetMs(0.0f)
+		, m_optimizeAfterBuild(false)
+		, m_autoTune(false)
+		, m_autoTuneMaxDepth(32)
+		, m_layoutTopLevels(6)
+		{}
+
+		EBuildStrategy	m_strategy;
+		int				m_maxDepth;
+		int				m_maxLeafSize;
+
+		// Binned SAH only.
+		int				m_numBins;
+		float			m_traversalCost;	// Cost of visiting an interior node (one ray-aabb test for each child).
+		float			m_intersectionCost;	// Cost of one ray-triangle test.
+
+		unsigned int	m_numThreads;		// Number of build threads, 0 := one per hardware thread.
+		size_t			m_parallelBuildMinTris;	// Nodes with fewer triangles are built (and binned) on a single thread.
+
+		// LBVH only.
+		int				m_mortonCodeBits;		// 30 (10 bits per axis) or 63 (21 bits per axis).
+		int				m_lbvhRefineTreelets;	// Number of treelets the top of the tree is rebuilt over using a full SAH sweep, 0 := no refinement.
+
+		// Refit only.
+		float			m_refitRebuildThreshold;	// refit() asks for a rebuild once the SAH cost of the refitted meshes grows past this factor.
+
+		// SBVH only, on top of the binned SAH parameters.
+		float			m_spatialSplitAlpha;	// Spatial splits are only evaluated when the children of the best object split overlap by more than this fraction of the mesh's surface area.
+		float			m_spatialSplitBudget;	// Maximum number of duplicated triangle references, as a fraction of the number of triangles of the mesh.
+
+		// Treelet optimization only (see optimizeBVHTree).
+		int				m_treeletSize;			// Number of leaves of the treelets whose topology is optimized, from 3 to 8.
+		int				m_treeletPasses;		// Number of bottom-up passes over the trees.
+		float			m_treeletTimeBudgetMs;	// The optimization stops once it has run for this long, 0 := no limit (the default, the passes bound it and the trees are the same on every run).
+		bool			m_optimizeAfterBuild;	// buildBVHTree runs the optimization on the trees it built (not rebuildBVHTree).
+
+		// Auto-tuning only.
+		bool			m_autoTune;				// Builds each mesh with several depth and leaf size limits and keeps the cheapest tree (SAH cost).
+		int				m_autoTuneMaxDepth;		// Deepest tree the tuner may pick, at most BVH_MAX_MESH_DEPTH.
+
+		// Node layout (see _layoutNodes).
+		int				m_layoutTopLevels;		// Number of levels at the top of each mesh tree laid out breadth-first, 0 := depth-first only.
+	};
+
+	// Quality and size of the trees, see computeStats.
+	struct SStats
+	{
+		SStats() : m_sahCost(0.0f), m_numNodes(0), m_numLeaves(0), m_numTriRefs(0), m_maxDepth(0), m_avgLeafDepth(0.0f), m_avgLeafSize(0.0f),
+			m_avgChildOverlap(0.0f), m_memorySize(0) {}
+
+		float				m_sahCost;
+		size_t				m_numNodes;				// Interior nodes and leaves of the mesh trees.
+		size_t				m_numLeaves;
+		size_t				m_numTriRefs;			// Triangles referenced by the leaves, including the duplicates of split triangles.
+		int					m_maxDepth;				// The root of a mesh tree is at depth 0.
+		float				m_avgLeafDepth;
+		float				m_avgLeafSize;
+		float				m_avgChildOverlap;		// Surface area of the intersection of the children of an interior node relative to the node's.
+		size_t				m_memorySize;			// Size in bytes of the nodes and triangle indices.
+		std::vector<size_t>	m_leafSizeHistogram;	// [i] := number of leaves with i triangles.
+		std::vector<size_t>	m_leafDepthHistogram;	// [i] := number of leaves at depth i.
+	};
+
+	struct SRange
+	{
+		size_t m_first;
+		size_t m_count;
+	};
+
+	// Where updateWideBVH put the collapsed tree of each mesh. The nodes of the collapsed top-level tree come first, in room
+	// for as many as there are mesh entries, so that its root stays node 0.
+	struct SWideBVHLayout
+	{
+		std::vector<SRange> m_meshNodeRanges;	// Collapsed tree of each mesh, empty if the mesh is.
+		std::vector<SRange> m_freeNodeRanges;	// Sorted and merged, like BVHTree::m_freeNodeRanges.
+	};
+
+	struct Aabb
+	{
+		Aabb() : m_min(FLT_MAX), m_max(-FLT_MAX) {}
+
+		void grow(const glm::vec3& p) { m_min = glm::min(m_min, p); m_max = glm::max(m_max, p); }
+		void grow(const Aabb& aabb) { m_min = glm::min(m_min, aabb.m_min); m_max = glm::max(m_max, aabb.m_max); }
+		bool isValid() const { return m_min.x <= m_max.x; }
+		float surfaceArea() const;
+
+		glm::vec3 m_min;
+		glm::vec3 m_max;
+	};
+
 	struct Triangle
 	{
 	public:
@@ -196,50 +326,370 @@ struct BVHTree
 		glm::ivec3	m_indices;
 	};
 
-	struct TriDimExtent
+	// Reference to a triangle of the mesh being built. The builders only ever reorder (in place) these references,
+	// never the triangles themselves.
+	struct BuildRef
 	{
-		void set(DIM dim, size_t triIdx, const Triangle& tri)
-		{
-			m_triIdx = triIdx;
-			m_biggestExtent = glm::max(tri.m_pos[0][dim], tri.m_pos[1][dim]);
-			m_biggestExtent = glm::max(m_biggestExtent, tri.m_pos[2][dim]);
-		}
-
-		static bool SortTris(TriDimExtent& rhs, TriDimExtent& lhs)
-		{
-			return rhs.m_biggestExtent < lhs.m_biggestExtent;
-		}
-
+		glm::vec3	m_centroid;
+		uint32_t	m_triIdx;
+	};
 
-		size_t	m_triIdx;
-		float	m_biggestExtent;
+	// Reference to a triangle of the mesh being built with spatial splits, bounded by the part of the triangle which
+	// is left once it has been clipped by the split planes above it.
+	struct SpatialBuildRef
+	{
+		Aabb		m_aabb;
+		uint32_t	m_triIdx;
 	};
 
+	// The links are stored as integers next to the bounds, so that node and triangle indices are exact over the whole int32
+	// range (floats would only hold them up to 2^24) and the shaders read them without conversion (see BVHAabb in raytrace.comp).
 	struct BVHNode
 	{
-		BVHNode() {}
-		BVHNode(const glm::vec4& bound0, const glm::vec4& bound1);
+		BVHNode() : m_left(0), m_right(0) {}
+		BVHNode(const glm::vec3& bound0, const glm::vec3& bound1);
 
 		void setAabb(const Triangle* tri, size_t numTris);
 		
-		void setRootNode(size_t aabbIdx);
+		void setNumMeshes(size_t numMeshes);
+		void setRootNode(size_t aabbIdx, size_t numNodes);
+		void setTopLevelRootNode(size_t aabbIdx);
 		void setLeftChild(size_t aabbIdx);
 		void setRightChild(size_t aabbIdx);
-		void setNumLeafChildren(size_t numChildren);
-		void setAsLeafTri(const glm::ivec3& 	triIndices);
+		void setAsLeaf(size_t firstTriIdx, size_t numTris);
+
+		bool isLeaf() const { return m_right < 0; }
+		size_t getFirstTri() const { return size_t(m_left); }
+		size_t getNumTris() const { return size_t(-m_right); }
+		size_t getLeftChild() const { return size_t(m_left); }
+		size_t getRightChild() const { return size_t(m_right); }
+		size_t getNumMeshes() const { return size_t(m_left); }
+		size_t getRootNode() const { return size_t(m_left); }
+		size_t getNumMeshNodes() const { return size_t(m_right); }
+		size_t getTopLevelRootNode() const { return size_t(m_right); }
+
+		glm::vec3	m_minAABB;
+		int32_t		m_left;		// Left aabb child index, or index of the first triangle of a leaf in m_triIndices.
+		glm::vec3	m_maxAABB;
+		int32_t		m_right;	// Right aabb child index, or -(number of triangles) of a leaf.
+	};
 
-		glm::vec4 m_minAABB; // .w := left aabb child index.
-		glm::vec4 m_maxAABB; // .w := right aabb child index.
+	// Triangle referenced by a leaf, stored with the two edges leaving its first vertex so that Möller-Trumbore can run on it
+	// straight away (see buildTriangleSoup).
+	struct PrecomputedTriangle
+	{
+		glm::vec4 m_v0;		// .w is unused.
+		glm::vec4 m_edge1;	// v1 - v0.
+		glm::vec4 m_edge2;	// v2 - v0.
+	};
+
+	// Node of the tree collapsed to N children per node (see collapseToWideBVH). The bounds of the children are stored as
+	// SoA so that they can all be tested at once. Unused child slots have an empty box, which no ray can hit.
+	template <int N>
+	struct WideBVHNode
+	{
+		float	m_minX[N];
+		float	m_minY[N];
+		float	m_minZ[N];
+		float	m_maxX[N];
+		float	m_maxY[N];
+		float	m_maxZ[N];
+		int32_t	m_children[N];	// Index of the child node, of the first triangle of a leaf in m_triIndices, or of the root node of a mesh.
+		int32_t	m_counts[N];	// 0 := child node, > 0 := number of triangles of a leaf, < 0 := -(mesh index + 1).
+	};
+
+	// Wide node whose child bounds are quantized to T (uint8_t or uint16_t) relative to the bounds of the node itself, and
+	// rounded outward so that they still enclose the children. A child bound decodes to m_origin + q * m_scale on each axis.
+	// Unused child slots have a -1 child index.
+	template <int N, typename T>
+	struct QuantizedWideBVHNode
+	{
+		float	m_origin[3];	// Minimum corner of the node.
+		float	m_scale[3];		// Size of a quantization step along each axis.
+		T		m_qMinX[N];
+		T		m_qMinY[N];
+		T		m_qMinZ[N];
+		T		m_qMaxX[N];
+		T		m_qMaxY[N];
+		T		m_qMaxZ[N];
+		int32_t	m_children[N];	// Same as WideBVHNode.
+		int32_t	m_counts[N];
 	};
 
 	void buildBVHTree(const std::vector<vkMeshLoader::MeshEntry>& meshEntries);
+
+	// Same as buildBVHTree, but the trees are memory-mapped from the given cache file when it was written by the same version
+	// of the builders for the same vertex positions, indices and build parameters. Otherwise the trees are built and the cache
+	// file is (re)written. Returns true when the trees were loaded from the cache.
+	bool buildBVHTree(const std::vector<vkMeshLoader::MeshEntry>& meshEntries, const std::string& cacheFilename);
+
+	// Optional pass run after the build for static scenes, which restructures each treelet (small subtree) of the mesh trees
+	// bottom-up into the topology minimizing its SAH cost (see Karras and Aila, "Fast Parallel Construction of High-Quality
+	// Bounding Volume Hierarchies", 2013). Independent subtrees are optimized in parallel, m_treeletPasses times, and if
+	// m_treeletTimeBudgetMs is set the pass stops where it is once it is spent, which still leaves valid trees.
+	void optimizeBVHTree();
+
+	// Collapses the binary trees into a N-wide tree (N := 2, 4 or 8) whose root is outNodes[0]. Each mesh tree is collapsed
+	// separately and referenced from the leaves of the collapsed top-level tree, which keeps track of the mesh being traversed.
+	template <int N>
+	void collapseToWideBVH(std::vector< WideBVHNode<N> >& outNodes) const;
+
+	// Same as collapseToWideBVH, but only the top-level tree and the trees of the given (refitted, inserted or removed) meshes
+	// are collapsed again, the others are left where ioLayout says they are. A tree goes back in its own range when it still
+	// fits, and in a freed range or at the end of ioNodes otherwise. Every tree is collapsed when ioLayout doesn't match the
+	// number of meshes (e.g. it is empty, or the trees were rebuilt). The modified node ranges are appended (sorted and merged)
+	// to outDirtyNodeRanges.
+	template <int N>
+	void updateWideBVH(const std::vector<size_t>& meshIdxs, SWideBVHLayout& ioLayout, std::vector< WideBVHNode<N> >& ioNodes,
+		std::vector<SRange>& outDirtyNodeRanges) const;
+
+	// Quantizes the child bounds of a collapsed tree, outNodes[i] is wideNodes[i] with its links unchanged.
+	template <int N, typename T>
+	static void quantizeWideBVH(const std::vector< WideBVHNode<N> >& wideNodes, std::vector< QuantizedWideBVHNode<N, T> >& outNodes);
+	// Same, only for the nodes in the given ranges (see updateWideBVH). outNodes is resized to match wideNodes.
+	template <int N, typename T>
+	static void quantizeWideBVH(const std::vector< WideBVHNode<N> >& wideNodes, const std::vector<SRange>& nodeRanges,
+		std::vector< QuantizedWideBVHNode<N, T> >& outNodes);
+
+	// Rebuilds every tree from scratch with the current triangle set but the given (moved) vertex positions.
+	void rebuildBVHTree(const std::vector<glm::vec4>& positions);
+
+	// Recomputes the bounds of the given meshes bottom-up from the moved vertex positions, then the bounds of the top-level
+	// tree, in O(n) without changing the topology. The modified node ranges are appended (sorted and merged) to outDirtyNodeRanges.
+	// Returns true when the trees degraded enough (see SBuildParams::m_refitRebuildThreshold) that a rebuild is worth it.
+	bool refit(const std::vector<glm::vec4>& positions, const std::vector<size_t>& meshIdxs, std::vector<SRange>& outDirtyNodeRanges);
+
+	// Builds the tree of an empty mesh (one which was removed, or didn't have any triangle) over the given triangles, whose
+	// vertex indices point into positions, and inserts its entry into the top-level tree next to the node found to increase
+	// the SAH cost of the top-level tree the least by a greedy descent from the root, rebuilding the top-level tree if that made it too deep. The tree reuses a freed range of nodes and triangle indices when one is large
+	// enough, otherwise m_aabbNodes and m_triIndices grow. The modified node and triangle index ranges are appended (sorted
+	// and merged) to outDirtyNodeRanges and outDirtyTriRanges. Returns false if the mesh isn't empty.
+	bool insertMesh(size_t meshIdx, const std::vector<glm::vec4>& positions, const std::vector<glm::ivec3>& triIndices,
+		std::vector<SRange>& outDirtyNodeRanges, std::vector<SRange>& outDirtyTriRanges);
+
+	// Removes the mesh entry from the top-level tree and frees the nodes and triangle indices of its tree, the mesh is empty
+	// until it is inserted again. Its vertex range is kept. The modified node ranges are appended to outDirtyNodeRanges.
+	void removeMesh(size_t meshIdx, std::vector<SRange>& outDirtyNodeRanges);
+
+	// Fills outTris[i] with the i-th triangle of m_triIndices (BVH order), so that the leaves can be tested without fetching
+	// the vertex indices and then each position; the indices are still needed to interpolate the normals of the closest hit.
+	// Must be called again once the trees are rebuilt.
+	void buildTriangleSoup(const std::vector<glm::vec4>& positions, std::vector<PrecomputedTriangle>& outTris) const;
+
+	// Updates the triangles of the given meshes from their moved vertex positions (see refit), the modified ranges of
+	// ioTris are appended to outDirtyTriRanges.
+	void refitTriangleSoup(const std::vector<glm::vec4>& positions, const std::vector<size_t>& meshIdxs, std::vector<PrecomputedTriangle>& ioTris,
+		std::vector<SRange>& outDirtyTriRanges) const;
+
+	// Range of vertices referenced by the given mesh in the scene position buffer.
+	const SRange& getMeshVertexRange(size_t meshIdx) const { return m_meshVertexRanges[meshIdx]; }
+
+	// Fills outMaterialIds[i] with the material of the i-th mesh, read from the fourth component of the scene triangles
+	// (SSceneAttributes::m_indices) which reference its vertex range, so that a BVH hit can be given its material from its
+	// mesh index. Meshes without any triangle get material 0.
+	void buildMeshMaterialIds(const std::vector<glm::ivec4>& sceneIndices, std::vector<int32_t>& outMaterialIds) const;
+
+	// Returns the SAH cost of the whole scene, i.e. the sum of the expected cost of tracing a ray through each mesh tree
+	// (normalized by the surface area of the mesh's root node), using the cost constants of m_buildParams.
+	float computeSAHCost() const;
+
+	// Statistics over all the mesh trees (the top-level tree and the mesh entries only count in m_memorySize), or over one of them.
+	SStats computeStats() const;
+	SStats computeMeshStats(size_t meshIdx) const;
+	static void printStats(const SStats& stats);
+
+	BVHTree() : m_buildThreadPool(nullptr) {}
+
+	SBuildParams m_buildParams;
+
+	// [0]					:= header, m_left := number of meshes, m_right := root of the top-level tree, bounds of the scene.
+	// [1, numMeshes]		:= mesh entries, m_left := root of the mesh tree, m_right := number of nodes of the mesh tree (0 for
+	//						   an empty or removed mesh), bounds of the mesh.
+	// [numMeshes + 1, ...)	:= mesh trees, each stored contiguously from its root, and the top-level tree whose nodes point either
+	//						   to each other or to mesh entries (child index <= numMeshes). A build stores the mesh trees in mesh
+	//						   order followed by the top-level tree, insertMesh and removeMesh then reuse and free node ranges.
 	std::vector<BVHNode> m_aabbNodes;
 
+	// Vertex indices of the triangles referenced by the leaves, packed in leaf order (each leaf owns a contiguous range).
+	// A triangle is referenced by several leaves when it was split by BUILD_SBVH.
+	std::vector<glm::ivec3> m_triIndices;
+
 private:
-	static int numHeaderAabbNodes;
-	size_t _buildBVHTree(int depth, int maxLeafSize, const std::vector<Triangle>& tris, std::vector<BVHTree::BVHNode>& outNodes);
+	// Linear allocator handing out the scratch memory of the builders. Allocations are released in LIFO order
+	// through Scope objects and the memory blocks are kept around, so that a warmed-up arena doesn't allocate anymore.
+	class ScratchArena
+	{
+	public:
+		ScratchArena() : m_curBlockIdx(0), m_curOffset(0) {}
+
+		// Returns count value-initialized objects, which must be trivially destructible.
+		template <typename T>
+		T* alloc(size_t count)
+		{
+			T* objs = static_cast<T*>(_alloc(count * sizeof(T)));
+			for (size_t i = 0; i < count; i++)
+			{
+				new (&objs[i]) T();
+			}
+			return objs;
+		}
+
+		// Releases everything allocated from the arena during its lifetime.
+		class Scope
+		{
+		public:
+			explicit Scope(ScratchArena& arena) : m_arena(arena), m_blockIdx(arena.m_curBlockIdx), m_offset(arena.m_curOffset) {}
+			~Scope() { m_arena.m_curBlockIdx = m_blockIdx; m_arena.m_curOffset = m_offset; }
+
+		private:
+			Scope(const Scope&);
+			Scope& operator=(const Scope&);
+
+			ScratchArena&	m_arena;
+			size_t			m_blockIdx;
+			size_t			m_offset;
+		};
+
+	private:
+		void* _alloc(size_t numBytes);
+
+		std::vector< std::unique_ptr<char[]> >	m_blocks;
+		std::vector<size_t>						m_blockSizes;
+		size_t									m_curBlockIdx;
+		size_t									m_curOffset;
+	};
+
+	// Returns the arena of the calling build thread.
+	ScratchArena& _getScratchArena();
+
+	// Builds the two children of outNodes[parentIdx], concurrently when they hold enough triangles (numTris).
+	// Subtree builders append a subtree to the given node array and return the index of its root node; they are
+	// template parameters rather than std::function so that building small nodes never allocates.
+	template <typename SubtreeBuilderA, typename SubtreeBuilderB>
+	void _buildChildNodes(size_t parentIdx, size_t numTris, const SubtreeBuilderA& buildSubtreeA, const SubtreeBuilderB& buildSubtreeB,
+		std::vector<BVHTree::BVHNode>& outNodes);
+	size_t _appendNodes(std::vector<BVHTree::BVHNode>& nodes, std::vector<BVHTree::BVHNode>& outNodes);
+	template <typename ChunkFunc>
+	void _runChunks(size_t numChunks, const ChunkFunc& func);
+
+	void _setMeshVertexRanges(const std::vector<vkMeshLoader::MeshEntry>& meshEntries);
+	void _extractMeshTriangles(const vkMeshLoader::MeshEntry& meshEntry, std::vector<Triangle>& outTris);
+	void _buildMeshBVHTree(const SBuildParams& params, const std::vector<Triangle>& tris, std::vector<BVHTree::BVHNode>& outNodes,
+		std::vector<glm::ivec3>& outTriIndices);
+	void _offsetNodeLinks(std::vector<BVHTree::BVHNode>& nodes, size_t nodeOffset, size_t triOffset);
+	void _buildBVHTrees(const std::vector<size_t>& meshSizes, const std::function<void(size_t, std::vector<Triangle>&)>& extractMeshTriangles,
+		bool isRebuild);
+	// Builds the mesh with a few depth and leaf size limits and keeps the ones giving the lowest SAH cost in ioParams.
+	// Returns the SAH cost of the selected tree, and the one of the tree built with the initial limits in outInitialCost.
+	float _autoTuneMeshBuildParams(const std::vector<Triangle>& tris, SBuildParams& ioParams, float& outInitialCost);
+	// Hash of everything the trees depend on, which must match the one stored in a cache file for it to be loaded.
+	uint64_t _computeCacheKey(const std::vector<vkMeshLoader::MeshEntry>& meshEntries) const;
+	bool _loadCache(const std::string& cacheFilename, uint64_t cacheKey, const std::vector<vkMeshLoader::MeshEntry>& meshEntries);
+	bool _saveCache(const std::string& cacheFilename, uint64_t cacheKey) const;
+	SRange _getMeshNodeRange(const std::vector<BVHTree::BVHNode>& nodes, size_t meshIdx) const;
+	// Sorts the ranges from firstRangeIdx on and merges the overlapping and adjacent ones.
+	static void _mergeRanges(std::vector<SRange>& ioRanges, size_t firstRangeIdx);
+	// Range of m_triIndices referenced by the leaves of the mesh tree, which are packed in a contiguous range per mesh.
+	SRange _getMeshTriRange(size_t meshIdx) const;
+	void _refitMeshNodes(const std::vector<glm::vec4>& positions, const SRange& nodeRange);
+
+	// Restructures the treelets of the subtree in post-order, without going down the other task roots it contains, and
+	// updates the SAH cost and the height of its nodes. nodeDepths holds the depth of the nodes in their mesh tree, a treelet
+	// is only restructured if its leaves stay within BVH_MAX_MESH_DEPTH. Returns the number of treelets whose topology changed.
+	typedef std::chrono::high_resolution_clock::time_point TimePoint;
+	size_t _optimizeTreelets(size_t rootIdx, const std::vector<uint8_t>& isTaskRoot, const std::vector<int>& nodeDepths,
+		std::vector<float>& nodeCosts, std::vector<int>& nodeHeights, const TimePoint* deadline);
+	bool _restructureTreelet(size_t nodeIdx, const std::vector<int>& nodeDepths, std::vector<float>& nodeCosts, std::vector<int>& nodeHeights);
+	// Lays the nodes of the subtree rooted at nodeRange.m_first, which fills the range, back out so that the two children of
+	// a node are always next to each other (the traversal fetches both at once): the top m_layoutTopLevels levels are packed
+	// breadth-first, since every ray goes through them, and the subtrees below them depth-first, so that the nodes of a path
+	// are close together. Children are stored after their parent either way.
+	void _layoutNodes(std::vector<BVHTree::BVHNode>& nodes, const SRange& nodeRange);
+
+	// Builds the top-level tree over the given mesh entries (BuildRef::m_triIdx := mesh index) with a full SAH sweep
+	// and returns the index of its root, which is the mesh entry itself if there is only one. The entries end up at most
+	// depth levels below the root: the splits leaving more entries on one side than the levels left can hold are skipped.
+	size_t _buildTopLevelTree(int depth, BuildRef* meshRefs, size_t numMeshRefs);
+	// Recomputes the bounds of the top-level tree below nodeIdx in post-order, its nodes may be stored in any order once
+	// meshes were inserted. The refitted nodes are appended to outDirtyNodeRanges.
+	void _refitTopLevelTree(size_t nodeIdx, std::vector<SRange>& outDirtyNodeRanges);
+	// Appends the top-level nodes from nodeIdx down to (and excluding) the given mesh entry to ioPath. Returns false if the
+	// entry isn't below nodeIdx.
+	bool _findTopLevelPath(size_t nodeIdx, size_t meshEntryIdx, std::vector<size_t>& ioPath) const;
+	void _insertTopLevelEntry(size_t meshEntryIdx, std::vector<SRange>& outDirtyNodeRanges);
+	void _removeTopLevelEntry(size_t meshEntryIdx, std::vector<SRange>& outDirtyNodeRanges);
+	// The greedy insertions don't rotate anything, so the top-level tree gets deeper as meshes are removed and inserted
+	// again. Rebuilds it with the SAH sweep into the slots of its nodes once it is much deeper than a balanced tree, which
+	// also keeps it within BVH_MAX_TOP_LEVEL_DEPTH. The rewritten nodes are appended to outDirtyNodeRanges.
+	void _rebalanceTopLevelTree(std::vector<SRange>& outDirtyNodeRanges);
+
+	// The builders below partition the given range of references in place.
+	size_t _buildBVHTree(int depth, int maxLeafSize, const std::vector<Triangle>& tris, BuildRef* refs, size_t numRefs,
+		std::vector<BVHTree::BVHNode>& outNodes);
+	size_t _buildBVHTreeBinnedSAH(int depth, const SBuildParams& params, const std::vector<Triangle>& tris, BuildRef* refs, size_t numRefs,
+		std::vector<BVHTree::BVHNode>& outNodes);
+	size_t _buildLeafNode(const std::vector<Triangle>& tris, const BuildRef* refs, size_t numRefs, std::vector<BVHTree::BVHNode>& outNodes);
+	Aabb _computeAabb(const std::vector<Triangle>& tris, const BuildRef* refs, size_t numRefs) const;
+
+	// Internal node of the radix tree implied by the sorted Morton codes (see Karras, "Maximizing Parallelism in the
+	// Construction of BVHs, Octrees, and k-d Trees", 2012). Child references are either internal nodes or sorted triangles.
+	struct LBVHNode
+	{
+		int		m_first;			// Range of sorted triangles covered by the node.
+		int		m_last;
+		int		m_child[2];
+		bool	m_isLeafChild[2];
+	};
+
+	// Subtree of the radix tree used as a primitive when refining the top of the tree.
+	struct LBVHTreelet
+	{
+		int		m_nodeIdx;
+		bool	m_isLeaf;
+		int		m_first;
+		int		m_last;
+		Aabb	m_aabb;
+	};
 
-	int visit(int iCurNode, std::vector<BVHTree::BVHNode>& nodes);
+	size_t _buildLBVH(int depth, int maxLeafSize, const std::vector<Triangle>& tris, BuildRef* refs, size_t numRefs,
+		std::vector<BVHTree::BVHNode>& outNodes);
+	void _sortMortonCodes(uint64_t* mortonCodes, BuildRef* refs, size_t numRefs, int numBits);
+	size_t _emitLBVHSubtree(const LBVHNode* lbvhNodes, int lbvhNodeIdx, bool isLeaf, int depth, int maxLeafSize,
+		const std::vector<Triangle>& tris, const BuildRef* sortedRefs, std::vector<BVHTree::BVHNode>& outNodes);
+	size_t _emitLBVHTreelets(const LBVHNode* lbvhNodes, std::vector<LBVHTreelet>& treelets, size_t first, size_t last, int depth, int maxLeafSize,
+		const std::vector<Triangle>& tris, const BuildRef* sortedRefs, std::vector<BVHTree::BVHNode>& outNodes);
+	void _setAabbFromChildren(size_t nodeIdx, std::vector<BVHTree::BVHNode>& nodes);
+
+	// State shared by the nodes of a mesh built with spatial splits (see Stich et al., "Spatial Splits in Bounding Volume
+	// Hierarchies", 2009). Unlike the other builders, every node gets its own arrays of references since splits add references.
+	struct SBVHBuildState;
+
+	void _buildMeshSBVH(const SBuildParams& params, const std::vector<Triangle>& tris, std::vector<BVHTree::BVHNode>& outNodes,
+		std::vector<glm::ivec3>& outTriIndices);
+	size_t _buildSBVHNode(int depth, SBVHBuildState& state, std::vector<SpatialBuildRef>& refs, int numSplitsLeft,
+		std::vector<BVHTree::BVHNode>& outNodes);
+	size_t _buildSBVHLeafNode(SBVHBuildState& state, const std::vector<SpatialBuildRef>& refs, std::vector<BVHTree::BVHNode>& outNodes);
+
+	// Appends the wide node collapsed from nodeIdx and its descendants to outNodes. The mesh entries reached from the top-level
+	// tree are collapsed in turn, unless meshNodeRanges is given: they then link to the first node of their range.
+	template <int N>
+	size_t _emitWideBVHNode(size_t nodeIdx, const SRange* meshNodeRanges, std::vector< WideBVHNode<N> >& outNodes) const;
+
+	float _computeSAHCost(const std::vector<BVHTree::BVHNode>& nodes, size_t nodeIdx, float rootArea) const;
+	float _computeMeshSAHCost(size_t meshIdx) const;
+	// Adds the nodes of the tree to the counters and histograms of the stats, m_avgChildOverlap is summed up.
+	void _accumulateStats(size_t rootIdx, SStats& stats) const;
+	static void _finalizeStats(SStats& stats);
+
+	ThreadPool* m_buildThreadPool; // Only set while building.
+	std::vector<ScratchArena> m_scratchArenas; // [0] := calling thread, [1 + i] := i-th build thread.
+
+	std::vector<SRange> m_meshVertexRanges;
+	std::vector<float> m_meshBuiltSAHCosts; // SAH cost of each mesh tree right after it was built.
+	std::vector<size_t> m_meshNumTris; // Number of distinct triangles of each mesh, its leaves may reference more with BUILD_SBVH.
+	std::vector<SBuildParams> m_meshBuildParams; // Parameters each mesh tree was built with, the depth and leaf size may have been tuned.
+	std::vector<SRange> m_freeNodeRanges; // Ranges of m_aabbNodes freed by removeMesh, sorted and merged.
+	std::vector<SRange> m_freeTriRanges; // Same for m_triIndices.
 };
 
 // Simple mesh class for getting all the necessary stuff from models loaded via ASSIMP
@@ -247,6 +697,8 @@ class VulkanMeshLoader
 {
 private:
 	friend class VulkanRenderer;
+	friend class BVHBenchmark;
+	friend class CpuRaytracer;
 
 public:
 